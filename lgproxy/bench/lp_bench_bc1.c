@@ -0,0 +1,298 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Block Compression Benchmark
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+/*  Measures BC1 encode and decode throughput on a synthetic desktop frame,
+    and the quality of the result in regions with different content: flat
+    window backgrounds, gradients, text, and a noisy photo-like area.
+
+    Usage: lp_bench_bc1 [iterations] [width] [height]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lp_bcn.h"
+
+#define LP_BENCH_DEF_ITER   50
+#define LP_BENCH_DEF_WIDTH  1920
+#define LP_BENCH_DEF_HEIGHT 1080
+
+typedef struct {
+    const char *    name;
+    uint32_t        x, y, w, h;
+} LPBenchRegion;
+
+static double lpBenchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void lpBenchFill(uint8_t * px, uint8_t b, uint8_t g, uint8_t r)
+{
+    px[0] = b;
+    px[1] = g;
+    px[2] = r;
+    px[3] = 0xFF;
+}
+
+/**
+ * @brief Draw a synthetic desktop into a BGRA frame
+ * 
+ * @param buf       Frame, width * height * 4 bytes
+ * @param width     Frame width
+ * @param height    Frame height
+ * @param r         Regions drawn: flat, gradient, text, photo
+ */
+static void lpBenchDraw(uint8_t * buf, uint32_t width, uint32_t height,
+                        LPBenchRegion * r)
+{
+    uint32_t hw = width / 2, hh = height / 2;
+    r[0] = (LPBenchRegion) { "flat",     0,  0,  hw, hh };
+    r[1] = (LPBenchRegion) { "gradient", hw, 0,  hw, hh };
+    r[2] = (LPBenchRegion) { "text",     0,  hh, hw, hh };
+    r[3] = (LPBenchRegion) { "photo",    hw, hh, hw, hh };
+
+    unsigned int seed = 1;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint8_t * px = buf + ((size_t) y * width + x) * 4;
+            if (y < hh && x < hw)
+            {
+                // Window with a title bar and a border
+                if (y < 32)
+                    lpBenchFill(px, 0x50, 0x30, 0x20);
+                else if (x % 400 < 2 || y % 300 < 2)
+                    lpBenchFill(px, 0x80, 0x80, 0x80);
+                else
+                    lpBenchFill(px, 0xF0, 0xF0, 0xF0);
+            }
+            else if (y < hh)
+            {
+                lpBenchFill(px, (x - hw) * 255 / hw, y * 255 / hh, 
+                            (x + y) * 127 / (hw + hh));
+            }
+            else if (x < hw)
+            {
+                // Dark glyph-like strokes on a light background
+                uint32_t cx = x % 9, cy = (y - hh) % 18;
+                bool ink = cy < 12 && ((cx == 1 || cx == 5) 
+                           || (cy == 0 || cy == 6 || cy == 11)) 
+                           && ((x / 9 * 7 + y / 18 * 3) % 5 != 0);
+                if (ink)
+                    lpBenchFill(px, 0x20, 0x20, 0x20);
+                else
+                    lpBenchFill(px, 0xFF, 0xFF, 0xFF);
+            }
+            else
+            {
+                // Smooth shapes with sensor noise on top
+                double fx = (double) (x - hw) / hw, fy = (double) (y - hh) / hh;
+                int n = (int) (rand_r(&seed) % 32) - 16;
+                int b = 128 + 100 * sin(fx * 7.0) * cos(fy * 5.0) + n;
+                int g = 110 + 90 * sin(fx * 3.0 + fy * 4.0) + n;
+                int c = 90 + 80 * cos(fx * 11.0 - fy * 2.0) + n;
+                lpBenchFill(px, b < 0 ? 0 : b > 255 ? 255 : b, 
+                            g < 0 ? 0 : g > 255 ? 255 : g,
+                            c < 0 ? 0 : c > 255 ? 255 : c);
+            }
+        }
+    }
+}
+
+/**
+ * @brief PSNR of the colour channels of a region
+ * 
+ * @return PSNR in dB, INFINITY if the region is identical
+ */
+static double lpBenchPSNR(const uint8_t * a, const uint8_t * b, 
+                          uint32_t width, const LPBenchRegion * r)
+{
+    double se = 0;
+    for (uint32_t y = r->y; y < r->y + r->h; y++)
+    {
+        for (uint32_t x = r->x; x < r->x + r->w; x++)
+        {
+            size_t i = ((size_t) y * width + x) * 4;
+            for (int c = 0; c < 3; c++)
+            {
+                double d = (double) a[i + c] - b[i + c];
+                se += d * d;
+            }
+        }
+    }
+    double mse = se / ((double) r->w * r->h * 3);
+    return mse == 0 ? INFINITY : 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+static int lpBenchEncode(const uint8_t * src, uint8_t * dst, uint32_t width,
+                         uint32_t height, int threads, long iter, 
+                         double * ns)
+{
+    LPBlockCoder e;
+    int ret = lpBC1EncoderInit(&e, width, height, threads);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    lpBC1Encode(&e, dst, src, (size_t) width * 4);
+
+    double start = lpBenchNow();
+    for (long i = 0; i < iter; i++)
+    {
+        lpBC1Encode(&e, dst, src, (size_t) width * 4);
+    }
+    *ns = (lpBenchNow() - start) / iter;
+    lpBC1CoderDestroy(&e);
+    return 0;
+}
+
+/**
+ * @brief Time in place decoding, as the sink does it. Decoding in place
+ * destroys the blocks, so they are restored from a copy before each frame;
+ * the time taken by the copy is not counted.
+ */
+static int lpBenchDecode(uint8_t * out, uint8_t * blocks, 
+                         const uint8_t * saved, size_t bcSize, uint32_t width,
+                         uint32_t height, int threads, long iter, double * ns)
+{
+    LPBlockCoder d;
+    int ret = lpBC1DecoderInit(&d, width, height, threads);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    double total = 0;
+    for (long i = 0; i < iter; i++)
+    {
+        memcpy(blocks, saved, bcSize);
+        double start = lpBenchNow();
+        lpBC1Decode(&d, out, blocks);
+        total += lpBenchNow() - start;
+    }
+    *ns = total / iter;
+    lpBC1CoderDestroy(&d);
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    long iter       = argc > 1 ? strtol(argv[1], NULL, 10) : LP_BENCH_DEF_ITER;
+    long width      = argc > 2 ? strtol(argv[2], NULL, 10) : LP_BENCH_DEF_WIDTH;
+    long height     = argc > 3 ? strtol(argv[3], NULL, 10) 
+                                : LP_BENCH_DEF_HEIGHT;
+    if (iter <= 0 || width < 8 || height < 8 || width > 16384 
+        || height > 16384 || width % 8 || height % 8)
+    {
+        fprintf(stderr, "Usage: %s [iterations] [width] [height]\n"
+                "Width and height must be multiples of 8\n", argv[0]);
+        return EINVAL;
+    }
+
+    size_t size     = (size_t) width * height * 4;
+    size_t bcSize   = lpBC1Size(width, height);
+    uint8_t * src   = malloc(size);
+    uint8_t * out   = malloc(size);
+    if (!src || !out)
+    {
+        free(src);
+        free(out);
+        return ENOMEM;
+    }
+
+    LPBenchRegion regions[4];
+    lpBenchDraw(src, width, height, regions);
+
+    // Encode into the end of the output buffer, as the sink does
+    uint8_t * blocks = out + size - bcSize;
+    long cpus   = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > LP_BCN_THREADS_MAX ? LP_BCN_THREADS_MAX : cpus;
+    double mp   = width * height / 1e6;
+
+    int ret = 0;
+    printf("%ldx%ld, %ld iterations, %.1f:1 compression\n\n", width, height,
+           iter, (double) size / bcSize);
+    printf("%-16s %10s %10s\n", "operation", "ms/frame", "MP/s");
+    for (int t = 1; t <= threads; t = t < threads && t * 2 > threads ? 
+                                      threads : t * 2)
+    {
+        double ns;
+        ret = lpBenchEncode(src, blocks, width, height, t, iter, &ns);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Encoder setup failed: %s\n", strerror(-ret));
+            goto free_bufs;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "encode (%d thr)", t);
+        printf("%-16s %10.3f %10.1f\n", name, ns / 1e6, mp / (ns / 1e9));
+    }
+
+    uint8_t * saved = malloc(bcSize);
+    if (!saved)
+    {
+        ret = -ENOMEM;
+        goto free_bufs;
+    }
+    memcpy(saved, blocks, bcSize);
+    for (int t = 1; t <= threads; t = t < threads && t * 2 > threads ? 
+                                      threads : t * 2)
+    {
+        double ns;
+        ret = lpBenchDecode(out, blocks, saved, bcSize, width, height, t, 
+                            iter, &ns);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Decoder setup failed: %s\n", strerror(-ret));
+            free(saved);
+            goto free_bufs;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "decode (%d thr)", t);
+        printf("%-16s %10.3f %10.1f\n", name, ns / 1e6, mp / (ns / 1e9));
+    }
+    printf("\n");
+    free(saved);
+
+    printf("%-16s %10s\n", "region", "PSNR (dB)");
+    for (int i = 0; i < 4; i++)
+    {
+        printf("%-16s %10.2f\n", regions[i].name, 
+               lpBenchPSNR(src, out, width, &regions[i]));
+    }
+    LPBenchRegion all = { "overall", 0, 0, width, height };
+    printf("%-16s %10.2f\n", all.name, lpBenchPSNR(src, out, width, &all));
+
+free_bufs:
+    free(src);
+    free(out);
+    return ret < 0 ? -ret : 0;
+}
@@ -0,0 +1,146 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Encoding Benchmark
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+/*  Compares the cost of encoding and decoding a cursor position update using
+    the protobuf CursorData message and the fixed-layout binary record.
+
+    Usage: lp_bench_cursor [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trf.h"
+#include "trf_msg.h"
+#include "lp_msg.h"
+#include "lp_msg.pb-c.h"
+
+#define LP_BENCH_BUF_SIZE   4096
+#define LP_BENCH_DEF_ITER   1000000
+
+static double lpBenchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int lpBenchProtobuf(void * buf, long iter, ssize_t * size)
+{
+    LpMsg__MessageWrapper wrapper   = LP_MSG__MESSAGE_WRAPPER__INIT;
+    LpMsg__CursorData curData       = LP_MSG__CURSOR_DATA__INIT;
+    LpMsg__MessageWrapper * out     = NULL;
+    wrapper.cursor_data             = &curData;
+    wrapper.wdata_case              = LP_MSG__MESSAGE_WRAPPER__WDATA_CURSOR_DATA;
+
+    for (long i = 0; i < iter; i++)
+    {
+        curData.x       = i & 0xfff;
+        curData.y       = (i >> 12) & 0xfff;
+        curData.flags   = 1;
+        *size = trfMsgPackProtobuf((ProtobufCMessage *) &wrapper, 
+                                   LP_BENCH_BUF_SIZE, buf);
+        if (*size < 0)
+        {
+            return *size;
+        }
+
+        int ret = trfMsgUnpackProtobuf((ProtobufCMessage **) &out,
+                        (const ProtobufCMessageDescriptor *) 
+                        &lp_msg__message_wrapper__descriptor, 
+                        trfMsgGetPackedLength(buf), trfMsgGetPayload(buf));
+        if (ret < 0 || out->cursor_data->x != curData.x)
+        {
+            return -EINVAL;
+        }
+        lp_msg__message_wrapper__free_unpacked(out, NULL);
+    }
+    return 0;
+}
+
+static int lpBenchBinary(void * buf, long iter, ssize_t * size)
+{
+    LPBinCursorPos out;
+    for (long i = 0; i < iter; i++)
+    {
+        *size = lpPackCursorPos(buf, LP_BENCH_BUF_SIZE, i & 0xfff, 
+                                (i >> 12) & 0xfff, 1, i);
+        if (*size < 0)
+        {
+            return *size;
+        }
+        
+        int ret = lpUnpackCursorPos(buf, LP_BENCH_BUF_SIZE, &out);
+        if (ret < 0 || out.x != (i & 0xfff))
+        {
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    long iter = argc > 1 ? strtol(argv[1], NULL, 10) : LP_BENCH_DEF_ITER;
+    if (iter <= 0)
+    {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return EINVAL;
+    }
+
+    void * buf = calloc(1, LP_BENCH_BUF_SIZE);
+    if (!buf)
+    {
+        return ENOMEM;
+    }
+
+    struct {
+        const char * name;
+        int (* fn)(void *, long, ssize_t *);
+    } tests[] = {
+        { "protobuf",   lpBenchProtobuf },
+        { "binary",     lpBenchBinary   },
+    };
+
+    int ret = 0;
+    printf("%-10s %10s %12s\n", "encoding", "bytes", "ns/update");
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        ssize_t size = 0;
+        double start = lpBenchNow();
+        ret = tests[i].fn(buf, iter, &size);
+        double end = lpBenchNow();
+        if (ret < 0)
+        {
+            fprintf(stderr, "%s: benchmark failed: %s\n", tests[i].name,
+                    strerror(-ret));
+            break;
+        }
+        printf("%-10s %10zd %12.1f\n", tests[i].name, size, 
+               (end - start) / iter);
+    }
+
+    free(buf);
+    return ret < 0 ? -ret : 0;
+}
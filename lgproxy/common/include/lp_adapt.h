@@ -0,0 +1,240 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Bandwidth Adaptation
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_ADAPT_H
+#define _LP_ADAPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+
+/*  The source times every frame write from being posted to its completion,
+    and fits transfer time = rtt + bytes / throughput to these samples. Every
+    LP_ADAPT_DECIDE_MS, the predicted frame time is compared against the
+    target, and the frame rate cap is moved along a fixed ladder. Frames are
+    only sent on request from the sink, so the cap is enforced by delaying
+    the reply to a frame request. */
+
+/**
+ * @brief Interval between controller decisions, in milliseconds
+ */
+#define LP_ADAPT_DECIDE_MS 500
+
+/**
+ * @brief Time the predicted frame time must stay below the target before the
+ * frame rate cap is raised, in milliseconds
+ */
+#define LP_ADAPT_HOLD_MS 2000
+
+/**
+ * @brief The cap is only raised if the predicted frame time is below this
+ * percentage of the target
+ */
+#define LP_ADAPT_LOW_WATER 70
+
+/**
+ * @brief Percentage of the link time frames may use, leaving room for cursor
+ * and control traffic
+ */
+#define LP_ADAPT_BUSY 90
+
+/**
+ * @brief Weight of each new sample in the transfer time fit, as 1 / 2^n
+ */
+#define LP_ADAPT_EWMA_SHIFT 4
+
+/**
+ * @brief Frame rate caps the controller chooses from, in Hz. 0 is uncapped.
+ */
+#define LP_ADAPT_LADDER { 0, 144, 120, 90, 60, 45, 30, 20, 15, 10 }
+
+/**
+ * @brief Number of entries in LP_ADAPT_LADDER
+ */
+#define LP_ADAPT_LEVELS 10
+
+/**
+ * @brief Reasons for a controller decision
+ * 
+ */
+enum LPAdaptReason {
+    /**
+     * @brief Controller started
+     * 
+     */
+    LP_ADAPT_START,
+    /**
+     * @brief Predicted frame time is above the target
+     * 
+     */
+    LP_ADAPT_OVER_TARGET,
+    /**
+     * @brief The link cannot sustain the current frame rate cap
+     * 
+     */
+    LP_ADAPT_OVER_CAPACITY,
+    /**
+     * @brief Predicted frame time has stayed well below the target
+     * 
+     */
+    LP_ADAPT_HEADROOM,
+    /**
+     * @brief No change
+     * 
+     */
+    LP_ADAPT_HOLD,
+    LP_ADAPT_REASON_MAX
+};
+
+/**
+ * @brief Bandwidth-adaptive frame rate controller. Only the thread sending
+ * frames uses it.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Target frame time in nanoseconds
+     * 
+     */
+    uint64_t                target;
+    /**
+     * @brief Current index into LP_ADAPT_LADDER
+     * 
+     */
+    int                     level;
+    /**
+     * @brief Decayed sums for the transfer time fit: sample weight, bytes,
+     * time, bytes squared and bytes times time
+     * 
+     */
+    double                  s1, sx, sy, sxx, sxy;
+    /**
+     * @brief Estimated throughput in bytes per nanosecond
+     * 
+     */
+    double                  bw;
+    /**
+     * @brief Estimated fixed cost per write, in nanoseconds
+     * 
+     */
+    double                  rtt;
+    /**
+     * @brief Bytes and writes in the frame being sent
+     * 
+     */
+    uint64_t                bytes;
+    uint32_t                writes;
+    /**
+     * @brief Bytes and writes in the last frame
+     * 
+     */
+    uint64_t                frame_bytes;
+    uint32_t                frame_writes;
+    /**
+     * @brief Smoothed measured frame time in nanoseconds
+     * 
+     */
+    double                  frame_time;
+    /**
+     * @brief Frames sent since the last decision
+     * 
+     */
+    uint64_t                frames;
+    /**
+     * @brief Time of the last decision, in nanoseconds
+     * 
+     */
+    uint64_t                last_decision;
+    /**
+     * @brief Time the predicted frame time last exceeded the low water mark,
+     * in nanoseconds
+     * 
+     */
+    uint64_t                last_busy;
+    /**
+     * @brief Time the last frame was sent, in nanoseconds
+     * 
+     */
+    uint64_t                last_send;
+    /**
+     * @brief Decision log, NULL if decisions are not exported
+     * 
+     */
+    FILE *                  log;
+} LPAdapt;
+
+/**
+ * @brief Initialize the controller
+ * 
+ * @param a         Controller to initialize
+ * @param targetUs  Target frame time in microseconds
+ * @param logPath   File to append decisions to as CSV, may be NULL
+ * @return 0 on success, negative error code on failure
+ */
+int lpAdaptInit(LPAdapt * a, uint32_t targetUs, const char * logPath);
+
+/**
+ * @brief Close the decision log and log the final estimates
+ * 
+ * @param a         Controller
+ */
+void lpAdaptDestroy(LPAdapt * a);
+
+/**
+ * @brief Record a completed frame data write
+ * 
+ * @param a         Controller, may be NULL
+ * @param bytes     Size of the write in bytes
+ * @param time      Time from posting the write to its completion, in
+ *                  nanoseconds
+ */
+void lpAdaptSample(LPAdapt * a, size_t bytes, uint64_t time);
+
+/**
+ * @brief Record a completed frame, and update the frame rate cap if
+ * LP_ADAPT_DECIDE_MS has passed since the last decision
+ * 
+ * @param a         Controller, may be NULL
+ * @param time      Time from the first write being posted to the last one
+ *                  completing, in nanoseconds
+ */
+void lpAdaptFrameDone(LPAdapt * a, uint64_t time);
+
+/**
+ * @brief Wait until the next frame may be sent under the current cap
+ * 
+ * @param a         Controller, may be NULL
+ * @return Time spent waiting in nanoseconds
+ */
+uint64_t lpAdaptPace(LPAdapt * a);
+
+/**
+ * @brief Get the current frame rate cap
+ * 
+ * @param a         Controller
+ * @return Cap in Hz, 0 if uncapped
+ */
+uint32_t lpAdaptFpsCap(const LPAdapt * a);
+
+#endif
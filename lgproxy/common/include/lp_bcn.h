@@ -0,0 +1,243 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Block compression
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_BCN_H
+#define _LP_BCN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*  BC1 block compression
+
+    Frames can be sent as BC1 (DXT1), which stores each block of 4x4 pixels
+    in 8 bytes: two RGB565 endpoint colours and a 2-bit index per pixel
+    choosing between them and two colours in between. This is an eighth of
+    the size of a frame with four 8-bit channels.
+
+    The encoder picks the endpoints from the bounding box of the block's
+    colours, inset slightly towards its centre, and each pixel's index from
+    its projection onto the line between them. It is split into bands of
+    block rows, encoded in parallel by the calling thread and a set of
+    worker threads. The decoder is split the same way, and a frame can be
+    decompressed in place from its last lpBC1Size bytes, as the sink
+    receives it.
+
+    The channels are treated as ordered in memory, the first being stored in
+    the low bits of the endpoints, and the fourth channel is not stored. The
+    decoder writes the same order back, so any 32-bit format with 8-bit
+    channels can be compressed. Only frames with a width and height that are
+    multiples of 4 are supported. */
+
+/**
+ * @brief Maximum number of threads encoding or decoding a frame, including
+ * the calling thread
+ */
+#define LP_BCN_THREADS_MAX 4
+
+typedef struct LPBlockCoder LPBlockCoder;
+
+/**
+ * @brief Work for one band of block rows
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Owning coder
+     * 
+     */
+    LPBlockCoder *          c;
+    /**
+     * @brief First block row, and the block row after the last one
+     * 
+     */
+    uint32_t                y0;
+    uint32_t                y1;
+    /**
+     * @brief Worker thread, unused for the first band
+     * 
+     */
+    pthread_t               thread;
+} LPBlockBand;
+
+/**
+ * @brief BC1 frame encoder or decoder
+ * 
+ */
+struct LPBlockCoder {
+    /**
+     * @brief Frame size in pixels
+     * 
+     */
+    uint32_t                width;
+    uint32_t                height;
+    /**
+     * @brief Whether frames are decompressed rather than compressed
+     * 
+     */
+    bool                    decode;
+    /**
+     * @brief Bands, one per thread
+     * 
+     */
+    LPBlockBand             bands[LP_BCN_THREADS_MAX];
+    int                     threads;
+    /**
+     * @brief Frame being processed, valid between the start and end
+     * barriers. The pitch is only used when encoding.
+     * 
+     */
+    uint8_t *               dst;
+    const uint8_t *         src;
+    size_t                  src_pitch;
+    /**
+     * @brief Copy of the compressed frame when decompressing in place,
+     * lpBC1Size bytes, decoder only
+     * 
+     */
+    uint8_t *               blocks;
+    /**
+     * @brief Barriers at the start and end of each frame
+     * 
+     */
+    pthread_barrier_t       start;
+    pthread_barrier_t       end;
+    /**
+     * @brief Held while the worker threads are being created, so that they
+     * can be stopped if not all of them start
+     * 
+     */
+    pthread_mutex_t         lock;
+    /**
+     * @brief Set to stop the worker threads
+     * 
+     */
+    atomic_bool             stop;
+    bool                    started;
+};
+
+/**
+ * @brief Check whether frames of a format and size can be compressed
+ * 
+ * @param format    Pixel format
+ * @param width     Frame width in pixels
+ * @param height    Frame height in pixels
+ * @return true if the frame can be compressed
+ */
+bool lpBC1Supported(int format, uint32_t width, uint32_t height);
+
+/**
+ * @brief Size of a compressed frame
+ * 
+ * @param width     Frame width in pixels, a multiple of 4
+ * @param height    Frame height in pixels, a multiple of 4
+ * @return Size in bytes
+ */
+static inline size_t lpBC1Size(uint32_t width, uint32_t height)
+{
+    return (size_t) (width / 4) * (height / 4) * 8;
+}
+
+/**
+ * @brief Set up an encoder and start its worker threads
+ * 
+ * @param e         Encoder to set up
+ * @param width     Frame width in pixels, a multiple of 4
+ * @param height    Frame height in pixels, a multiple of 4
+ * @param threads   Number of threads, including the calling thread
+ * @return 0 on success, negative error code on failure
+ */
+int lpBC1EncoderInit(LPBlockCoder * c, uint32_t width, uint32_t height, 
+                     int threads);
+
+/**
+ * @brief Set up a decoder and start its worker threads
+ * 
+ * @param c         Decoder to set up
+ * @param width     Frame width in pixels, a multiple of 4
+ * @param height    Frame height in pixels, a multiple of 4
+ * @param threads   Number of threads, including the calling thread
+ * @return 0 on success, negative error code on failure
+ */
+int lpBC1DecoderInit(LPBlockCoder * c, uint32_t width, uint32_t height, 
+                     int threads);
+
+/**
+ * @brief Stop the worker threads and free the coder's buffers. Does nothing
+ * if the coder was not set up.
+ * 
+ * @param c         Encoder or decoder
+ */
+void lpBC1CoderDestroy(LPBlockCoder * c);
+
+/**
+ * @brief Compress a frame
+ * 
+ * @param c         Encoder
+ * @param dst       Output, lpBC1Size bytes with blocks in row-major order
+ * @param src       Frame with four 8-bit channels per pixel
+ * @param srcPitch  Size of a frame row in bytes
+ */
+void lpBC1Encode(LPBlockCoder * c, uint8_t * dst, const uint8_t * src, 
+                 size_t srcPitch);
+
+/**
+ * @brief Compress block rows of a frame on the calling thread
+ * 
+ * @param dst       Output for the whole frame
+ * @param src       Frame with four 8-bit channels per pixel
+ * @param srcPitch  Size of a frame row in bytes
+ * @param width     Frame width in pixels, a multiple of 4
+ * @param y0        First block row
+ * @param y1        Block row after the last one
+ */
+void lpBC1EncodeRows(uint8_t * dst, const uint8_t * src, size_t srcPitch, 
+                     uint32_t width, uint32_t y0, uint32_t y1);
+
+/**
+ * @brief Decompress a frame into tightly packed rows. The compressed frame
+ * may be the last lpBC1Size bytes of the output frame, in which case it is
+ * decompressed in place.
+ * 
+ * @param c         Decoder
+ * @param dst       Output frame, with the fourth channel set to 0xFF
+ * @param src       Compressed frame
+ */
+void lpBC1Decode(LPBlockCoder * c, uint8_t * dst, const uint8_t * src);
+
+/**
+ * @brief Decompress block rows of a frame on the calling thread. The
+ * compressed rows must not overlap the output.
+ * 
+ * @param dst       Output for the whole frame, tightly packed
+ * @param src       Compressed frame
+ * @param width     Frame width in pixels, a multiple of 4
+ * @param y0        First block row
+ * @param y1        Block row after the last one
+ */
+void lpBC1DecodeRows(uint8_t * dst, const uint8_t * src, uint32_t width, 
+                     uint32_t y0, uint32_t y1);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Frame Capture Pipeline
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_CAPTURE_H
+#define _LP_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "trf.h"
+#include "lp_types.h"
+#include "lp_ring.h"
+#include "lp_scale.h"
+
+/*  Capture pipeline
+
+    With a capture queue, frames are taken from LGMP by a capture thread and
+    sent by the network thread (the thread handling client requests). The
+    capture thread copies each frame into a staging buffer registered for
+    fabric transfers and releases the LGMP message immediately, so a slow
+    fabric completion never holds up LGMP consumption. Frame descriptors are
+    passed to the network thread through a single-producer, single-consumer
+    ring, one staging buffer per ring element.
+
+    On each frame request, the network thread skips to the newest captured
+    frame. If it falls behind so far that every staging buffer is in use, the
+    capture thread drops new frames instead of waiting. */
+
+/**
+ * @brief Maximum number of staging buffers
+ */
+#define LP_CAPTURE_DEPTH_MAX 8
+
+/**
+ * @brief Amount of frame data copied at a time while the guest is still
+ * writing the frame, in bytes
+ */
+#define LP_CAPTURE_COPY_CHUNK (1024 * 1024)
+
+/**
+ * @brief Interval between capture and network statistics reports, in
+ * milliseconds
+ */
+#define LP_CAPTURE_REPORT_MS 10000
+
+/**
+ * @brief Captured frame descriptor
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Staging buffer. This is fixed for each ring element.
+     * 
+     */
+    uint8_t *               data;
+    /**
+     * @brief Size of the frame data in bytes
+     * 
+     */
+    size_t                  size;
+    /**
+     * @brief LGMP frame serial
+     * 
+     */
+    uint32_t                serial;
+    /**
+     * @brief Time the frame was taken from LGMP, in nanoseconds
+     * 
+     */
+    uint64_t                time;
+} LPCaptureFrame;
+
+/**
+ * @brief Statistics for one side of the pipeline. Only the thread owning the
+ * side updates and reports them.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Number of frames copied or sent
+     * 
+     */
+    uint64_t                frames;
+    /**
+     * @brief Number of frames dropped because the queue was full (capture),
+     * or skipped because a newer frame was queued (network)
+     * 
+     */
+    uint64_t                skipped;
+    /**
+     * @brief Number of frames not copied because the client was not
+     * consuming them (capture only)
+     * 
+     */
+    uint64_t                throttled;
+    /**
+     * @brief Total time spent copying or sending frames, in nanoseconds
+     * 
+     */
+    uint64_t                busy;
+    /**
+     * @brief Longest time spent on one frame, in nanoseconds
+     * 
+     */
+    uint64_t                max;
+    /**
+     * @brief Total time from frames being taken from LGMP to their transfer
+     * completing, in nanoseconds (network only)
+     * 
+     */
+    uint64_t                latency;
+    /**
+     * @brief Time of the last report, in nanoseconds
+     * 
+     */
+    uint64_t                last_report;
+} LPCaptureStats;
+
+/**
+ * @brief Frame capture pipeline
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Captured frames, from the capture thread to the network thread
+     * 
+     */
+    LPRing                  ring;
+    /**
+     * @brief Staging buffers
+     * 
+     */
+    void *                  mem;
+    /**
+     * @brief Fabric registration of the staging buffers
+     * 
+     */
+    struct fid_mr *         mr;
+    /**
+     * @brief Size of the frame data in bytes
+     * 
+     */
+    size_t                  frame_size;
+    /**
+     * @brief Scaler applied while copying frames, NULL to copy them as they
+     * are
+     * 
+     */
+    LPScaler *              scaler;
+    /**
+     * @brief Context containing the LGMP client
+     * 
+     */
+    PLPContext              ctx;
+    /**
+     * @brief Capture thread
+     * 
+     */
+    pthread_t               thread;
+    /**
+     * @brief Whether the capture thread was started
+     * 
+     */
+    bool                    started;
+    /**
+     * @brief Set to stop the capture thread
+     * 
+     */
+    atomic_bool             stop;
+    /**
+     * @brief 0 while the capture thread is running normally, negative error
+     * code once it has failed
+     * 
+     */
+    atomic_int              status;
+    /**
+     * @brief Capture thread statistics
+     * 
+     */
+    LPCaptureStats          cap_stats;
+    /**
+     * @brief Network thread statistics
+     * 
+     */
+    LPCaptureStats          net_stats;
+} LPCapture;
+
+/**
+ * @brief Allocate and register the staging buffers and start the capture
+ * thread. From then on, only the capture thread may use the LGMP frame queue.
+ * 
+ * @param ctx           Context containing the LGMP client
+ * @param cc            Client context the frames will be sent on
+ * @param cap           Pipeline to initialize
+ * @param frameSize     Size of the frame data in bytes
+ * @param depth         Number of staging buffers, 2 to LP_CAPTURE_DEPTH_MAX.
+ *                      This is rounded up to a power of two.
+ * @param scaler        Scaler to apply while copying frames, NULL to copy
+ *                      them as they are. frameSize is the scaled size.
+ * @return 0 on success, negative error code on failure
+ */
+int lpCaptureStart(PLPContext ctx, PTRFContext cc, LPCapture * cap,
+                   size_t frameSize, uint32_t depth, LPScaler * scaler);
+
+/**
+ * @brief Stop the capture thread, log the pipeline statistics and free the
+ * staging buffers. Does nothing if the pipeline was not started.
+ * 
+ * @param cap           Pipeline to stop
+ */
+void lpCaptureStop(LPCapture * cap);
+
+/**
+ * @brief Network thread: get the newest captured frame, skipping any older
+ * ones. The frame must be returned with lpCaptureDone once it has been sent.
+ * 
+ * @param cap           Pipeline to use
+ * @param serial        Serial of the frame the sink already has
+ * @return Captured frame, NULL if no new frame is available
+ */
+LPCaptureFrame * lpCaptureNext(LPCapture * cap, uint64_t serial);
+
+/**
+ * @brief Network thread: return a frame to the capture thread once its
+ * transfer has completed
+ * 
+ * @param cap           Pipeline to use
+ * @param frame         Frame returned by lpCaptureNext
+ * @param sendTime      Time taken to send the frame, in nanoseconds
+ */
+void lpCaptureDone(LPCapture * cap, LPCaptureFrame * frame, uint64_t sendTime);
+
+/**
+ * @brief Get the fabric descriptor of the staging buffers
+ * 
+ * @param cap           Pipeline to use
+ * @return Descriptor to pass to fabric transfers
+ */
+static inline void * lpCaptureDesc(LPCapture * cap)
+{
+    return fi_mr_desc(cap->mr);
+}
+
+/**
+ * @brief Get the capture thread status
+ * 
+ * @param cap           Pipeline to use
+ * @return 0 while the capture thread is running normally, negative error code
+ * once it has failed
+ */
+static inline int lpCaptureStatus(LPCapture * cap)
+{
+    return atomic_load_explicit(&cap->status, memory_order_acquire);
+}
+
+#endif
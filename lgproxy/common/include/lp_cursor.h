@@ -0,0 +1,430 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Update Queue
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_CURSOR_H
+#define _LP_CURSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "lp_types.h"
+#include "lp_ring.h"
+
+#define LP_CURSOR_SHAPE_RING_LEN 8
+#define LP_CURSOR_CACHE_LEN 16
+
+/*  Cursor subchannel transfer parameters. The sink keeps LP_CURSOR_RECV_SLOTS
+    receives of LP_BIN_MAX_MSG_SIZE bytes posted and handles up to
+    LP_CURSOR_RECV_BATCH completions at a time. The source keeps up to
+    LP_CURSOR_SEND_BATCH shape fragments in flight, and
+    LP_CURSOR_SRC_RECV_SLOTS receives posted for requests from the sink. Posted
+    receives are cancelled when the sink's cursor thread exits, and their
+    completions drained for up to LP_CURSOR_DRAIN_MS. */
+#define LP_CURSOR_RECV_SLOTS 64
+#define LP_CURSOR_RECV_BATCH 16
+#define LP_CURSOR_SEND_BATCH 32
+#define LP_CURSOR_SRC_RECV_SLOTS 16
+#define LP_CURSOR_DRAIN_MS 100
+
+/**
+ * @brief Cursor shape update, always delivered in order.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Cursor header followed by the shape data, stored in the queue's
+     * shape buffer
+     * 
+     */
+    KVMFRCursor *           cursor;
+    /**
+     * @brief Total size of the cursor data, including the header
+     * 
+     */
+    uint32_t                size;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Update sequence number
+     * 
+     */
+    uint32_t                seq;
+    /**
+     * @brief Time the update was pushed, in nanoseconds
+     * 
+     */
+    uint64_t                time;
+} LPCursorShape;
+
+/**
+ * @brief Cursor shape data as sent to the sink
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Shape data, raw or encoded
+     * 
+     */
+    const void *            data;
+    /**
+     * @brief Size of the shape data. 0 if the sink already holds the shape.
+     * 
+     */
+    uint32_t                size;
+    /**
+     * @brief Shape data encoding (enum LPCursorCodec)
+     * 
+     */
+    uint8_t                 codec;
+} LPCursorShapeData;
+
+/**
+ * @brief Cursor position update. Only the latest one is retained.
+ * 
+ */
+typedef struct {
+    int16_t                 x;
+    int16_t                 y;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Update sequence number
+     * 
+     */
+    uint32_t                seq;
+    /**
+     * @brief Time the update was pushed, in nanoseconds
+     * 
+     */
+    uint64_t                time;
+} LPCursorPos;
+
+/**
+ * @brief Lock-free queue between the LGMP cursor reader and the fabric sender.
+ * 
+ * Shape updates are queued in order and are never dropped. Position-only
+ * updates overwrite each other, so the sender only ever sends the latest
+ * position, regardless of how many updates arrived while it was busy.
+ */
+struct LPCursorQueue {
+    /**
+     * @brief Pending shape updates (LPCursorShape)
+     * 
+     */
+    LPRing                  shapes;
+    /**
+     * @brief Preallocated storage for queued shapes, one MAX_POINTER_SIZE
+     * slot per shape ring element
+     * 
+     */
+    uint8_t *               shape_buf;
+    /**
+     * @brief Sequence lock protecting the position slot, odd while the
+     * producer is writing to it
+     * 
+     */
+    atomic_uint             pos_lock;
+    atomic_int              pos_x;
+    atomic_int              pos_y;
+    atomic_uint             pos_flags;
+    atomic_uint             pos_seq;
+    atomic_ullong           pos_time;
+    /**
+     * @brief Producer: sequence number of the last update pushed
+     * 
+     */
+    uint32_t                seq;
+    /**
+     * @brief Consumer: sequence number of the last update popped
+     * 
+     */
+    uint32_t                sent_seq;
+};
+
+typedef struct LPCursorQueue LPCursorQueue;
+
+/**
+ * @brief Initialize a cursor queue
+ * 
+ * @param q         Queue to initialize
+ * @return 0 on success, negative error code on failure
+ */
+int lpCursorQueueInit(LPCursorQueue * q);
+
+/**
+ * @brief Free a cursor queue, including any shape updates still queued
+ * 
+ * @param q         Queue to free
+ */
+void lpCursorQueueFree(LPCursorQueue * q);
+
+/**
+ * @brief Producer: get storage for the next shape update. The storage can be
+ * filled with any update; it is only consumed if a shape update is pushed.
+ * 
+ * @param q         Queue to use
+ * @return MAX_POINTER_SIZE bytes of storage, NULL if the shape ring is full
+ */
+KVMFRCursor * lpCursorQueueAcquireShape(LPCursorQueue * q);
+
+/**
+ * @brief Producer: push a cursor update. Position-only updates are copied;
+ * shape updates must be stored in the buffer returned by
+ * lpCursorQueueAcquireShape.
+ * 
+ * @param q         Queue to use
+ * @param cursor    Cursor data
+ * @param size      Size of the cursor data, including the header
+ * @param flags     LGMP cursor flags
+ * @return 0 on success, -EAGAIN if the shape ring is full, -EINVAL if a shape
+ * update is not stored in the queue's shape buffer
+ */
+int lpCursorQueuePush(LPCursorQueue * q, KVMFRCursor * cursor, uint32_t size,
+                      uint32_t flags);
+
+/**
+ * @brief Consumer: get the oldest pending shape update. out->cursor remains
+ * valid until lpCursorQueueReleaseShape is called.
+ * 
+ * @param q         Queue to use
+ * @param out       Shape update output
+ * @return true if a shape update was returned
+ */
+bool lpCursorQueuePopShape(LPCursorQueue * q, LPCursorShape * out);
+
+/**
+ * @brief Consumer: return the storage of the shape update returned by
+ * lpCursorQueuePopShape to the producer
+ * 
+ * @param q         Queue to use
+ */
+void lpCursorQueueReleaseShape(LPCursorQueue * q);
+
+/**
+ * @brief Consumer: get the latest position, if it is newer than any update
+ * popped so far. Should only be called once all shapes have been popped.
+ * 
+ * @param q         Queue to use
+ * @param out       Position output
+ * @return true if a new position was returned
+ */
+bool lpCursorQueuePopPos(LPCursorQueue * q, LPCursorPos * out);
+
+/**
+ * @brief Source side record of a cursor shape held by the sink.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Hash of the shape data
+     * 
+     */
+    uint64_t                hash;
+    /**
+     * @brief Shape header. Position fields are not used.
+     * 
+     */
+    KVMFRCursor             hdr;
+    /**
+     * @brief Size of the shape data, excluding the header
+     * 
+     */
+    uint32_t                size;
+    /**
+     * @brief Logical time of the last use, for LRU eviction
+     * 
+     */
+    uint64_t                last_used;
+    bool                    valid;
+} LPShapeCacheEntry;
+
+/**
+ * @brief Source side LRU cache of the shapes held by the sink. The sink
+ * mirrors it with an LPShapeStore; since the source picks the slot to evict,
+ * both sides stay in sync as long as messages are delivered in order.
+ * 
+ */
+typedef struct {
+    LPShapeCacheEntry       entries[LP_CURSOR_CACHE_LEN];
+    uint64_t                clock;
+} LPShapeCache;
+
+/**
+ * @brief Sink side copy of a cached cursor shape
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Cursor header followed by the shape data, ready to be copied into
+     * LGMP memory
+     * 
+     */
+    KVMFRCursor *           cursor;
+    /**
+     * @brief Size of the allocated buffer
+     * 
+     */
+    uint32_t                alloc;
+    /**
+     * @brief Size of the shape data, excluding the header. 0 if unused.
+     * 
+     */
+    uint32_t                size;
+} LPShapeStoreEntry;
+
+/**
+ * @brief Sink side cursor shape store, indexed by the slot the source chose.
+ * 
+ */
+struct LPShapeStore {
+    LPShapeStoreEntry       entries[LP_CURSOR_CACHE_LEN];
+};
+
+typedef struct LPShapeStore LPShapeStore;
+
+/**
+ * @brief Hash cursor shape data
+ * 
+ * @param data      Shape data
+ * @param len       Length of the shape data in bytes
+ * @return 64-bit hash
+ */
+uint64_t lpHashShape(const void * data, size_t len);
+
+/**
+ * @brief Look up a cursor shape in the cache. On a miss, the least recently
+ * used slot is reassigned to the shape, and the shape must be sent in full
+ * so the sink can store it.
+ * 
+ * @param cache     Cache to use
+ * @param cursor    Cursor header followed by the shape data
+ * @param size      Size of the shape data, excluding the header
+ * @param hit       Set to true if the sink already holds the shape
+ * @return Shape ID to send (slot + 1)
+ */
+uint32_t lpShapeCacheLookup(LPShapeCache * cache, const KVMFRCursor * cursor,
+                            uint32_t size, bool * hit);
+
+/**
+ * @brief Store a cursor shape received from the source
+ * 
+ * @param store     Store to use
+ * @param id        Shape ID received (slot + 1)
+ * @param cursor    Cursor header
+ * @param data      Shape data
+ * @param size      Size of the shape data in bytes
+ * @return 0 on success, negative error code on failure
+ */
+int lpShapeStorePut(LPShapeStore * store, uint32_t id, 
+                    const KVMFRCursor * cursor, const void * data, 
+                    uint32_t size);
+
+/**
+ * @brief Get a cursor shape previously stored
+ * 
+ * @param store     Store to use
+ * @param id        Shape ID received (slot + 1)
+ * @param size      Size of the shape data, excluding the header
+ * @return Cursor header followed by the shape data, NULL if the slot is empty
+ */
+KVMFRCursor * lpShapeStoreGet(LPShapeStore * store, uint32_t id, 
+                              uint32_t * size);
+
+/**
+ * @brief Free all shapes held in the store
+ * 
+ * @param store     Store to free
+ */
+void lpShapeStoreFree(LPShapeStore * store);
+
+/**
+ * @brief Cursor shape data encodings
+ * 
+ */
+enum LPCursorCodec {
+    /**
+     * @brief Raw shape data
+     * 
+     */
+    LP_CURSOR_CODEC_NONE    = 0,
+    /**
+     * @brief Run-length encoded, with a palette if the shape has at most
+     * LP_CURSOR_CODEC_PALETTE_LEN distinct pixel values
+     * 
+     */
+    LP_CURSOR_CODEC_RLE     = 1,
+    LP_CURSOR_CODEC_MAX
+};
+
+/*  Run-length encoded shape layout (little-endian):
+
+        uint32_t    raw_size        Size of the decoded shape data
+        uint8_t     elem_size       Element size, 1 or 4 bytes
+        uint8_t     palette_len     Number of palette entries, 0 if none
+        uint32_t    palette[]       Palette entries (elem_size 4 only)
+
+    followed by runs, each starting with a control byte. If bit 7 is set, the
+    next element is repeated, otherwise the next elements are copied. The low
+    7 bits hold the element count - 1; if they are all set, a uint16_t follows
+    and the count is 128 + its value. Elements are palette indices if there is
+    a palette, raw values otherwise. */
+#define LP_CURSOR_CODEC_PALETTE_LEN 255
+#define LP_CURSOR_CODEC_HDR_LEN     6
+
+/**
+ * @brief Run-length encode cursor shape data
+ * 
+ * @param type      Cursor image format (LG_RendererCursor)
+ * @param data      Shape data
+ * @param size      Size of the shape data
+ * @param out       Output buffer
+ * @param outLen    Size of the output buffer. To only use the encoding when it
+ *                  is smaller, pass a value lower than size.
+ * @return Encoded size on success, -ENOSPC if the encoded data does not fit
+ * in outLen bytes, other negative error code on failure
+ */
+ssize_t lpEncodeCursorShape(uint32_t type, const void * data, uint32_t size,
+                            void * out, size_t outLen);
+
+/**
+ * @brief Decode cursor shape data
+ * 
+ * @param codec     Shape data encoding (enum LPCursorCodec)
+ * @param data      Encoded data
+ * @param size      Size of the encoded data
+ * @param out       Output buffer
+ * @param outLen    Size of the output buffer
+ * @return Decoded size on success, negative error code on failure
+ */
+ssize_t lpDecodeCursorShape(uint8_t codec, const void * data, uint32_t size,
+                            void * out, size_t outLen);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Client Consumption Feedback
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_DEMAND_H
+#define _LP_DEMAND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*  Consumption feedback
+
+    The sink measures how fast the Looking Glass client consumes frames from
+    the LGMP frame queue and reports it to the source on the cursor
+    subchannel (LPBinConsumption). A report is sent as soon as the client
+    stops or resumes consuming, and otherwise only when the rate changes
+    noticeably or the last report is getting old.
+
+    The source turns each report into a demand level. While the client keeps
+    up, frames are captured as usual. If the queue stayed full for a whole
+    measurement window, the source captures at most slightly faster than the
+    client's rate, and if the client consumed nothing or there is no client
+    at all, capture is paused. The first frame consumed afterwards is
+    reported right away and resumes capture. */
+
+/**
+ * @brief Window over which the consumption rate is measured, in milliseconds
+ */
+#define LP_DEMAND_WINDOW_MS 100
+
+/**
+ * @brief Longest time between consumption reports, in milliseconds
+ */
+#define LP_DEMAND_REFRESH_MS 1000
+
+/**
+ * @brief Relative rate change that triggers a report, in percent
+ */
+#define LP_DEMAND_RATE_CHANGE 25
+
+/**
+ * @brief Capture rate while throttled, relative to the client's rate, in
+ * percent. Capturing slightly faster than the client keeps its queue fed.
+ */
+#define LP_DEMAND_HEADROOM 125
+
+/**
+ * @brief Demand levels, as seen by the source
+ * 
+ */
+enum LPDemandLevel {
+    /**
+     * @brief The client keeps up, frames are captured as they arrive
+     * 
+     */
+    LP_DEMAND_FULL,
+    /**
+     * @brief The client falls behind, frames are captured at its rate
+     * 
+     */
+    LP_DEMAND_THROTTLED,
+    /**
+     * @brief The client consumes nothing, or there is no client
+     * 
+     */
+    LP_DEMAND_PAUSED
+};
+
+/**
+ * @brief Consumption state reported by the sink
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Frames the client has not consumed yet
+     * 
+     */
+    uint16_t                pending;
+    /**
+     * @brief Length of the LGMP frame queue
+     * 
+     */
+    uint16_t                depth;
+    /**
+     * @brief Whether the frame queue has subscribers
+     * 
+     */
+    bool                    subs;
+    /**
+     * @brief Whether the frame queue stayed full for the whole measurement
+     * window
+     * 
+     */
+    bool                    backlog;
+    /**
+     * @brief Consumption rate in mHz
+     * 
+     */
+    uint32_t                rate;
+} LPDemandReport;
+
+/**
+ * @brief Sink side consumption meter. It is sampled by the LGMP maintenance
+ * thread, and its reports are sent by the cursor thread.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Start of the current measurement window, in nanoseconds
+     * 
+     */
+    uint64_t                window_start;
+    /**
+     * @brief Frames consumed at the start of the current window
+     * 
+     */
+    uint64_t                window_consumed;
+    /**
+     * @brief Whether the queue was seen below full in the current window
+     * 
+     */
+    bool                    drained;
+    /**
+     * @brief Rate measured over the last complete window, in mHz
+     * 
+     */
+    uint32_t                rate;
+    /**
+     * @brief Whether the queue stayed full for the last complete window
+     * 
+     */
+    bool                    backlog;
+    /**
+     * @brief Last published report
+     * 
+     */
+    LPDemandReport          last;
+    /**
+     * @brief Time the last report was published, in nanoseconds
+     * 
+     */
+    uint64_t                last_time;
+    /**
+     * @brief Last published report, packed into a single word
+     * 
+     */
+    _Atomic uint64_t        report;
+    /**
+     * @brief Incremented with every published report
+     * 
+     */
+    atomic_uint             seq;
+} LPDemandMeter;
+
+/**
+ * @brief Source side demand state, updated by the cursor thread and read by
+ * the capture thread
+ * 
+ */
+typedef struct LPDemand {
+    /**
+     * @brief Current level (enum LPDemandLevel)
+     * 
+     */
+    atomic_int              level;
+    /**
+     * @brief Shortest time between captured frames while throttled, in
+     * nanoseconds
+     * 
+     */
+    _Atomic uint64_t        interval;
+} LPDemand;
+
+/**
+ * @brief Sink: sample the consumption of the LGMP frame queue, publishing a
+ * report if it should be sent to the source
+ * 
+ * @param m         Meter to update
+ * @param consumed  Total number of frames consumed by the client, i.e. the
+ *                  number of posts minus the pending posts
+ * @param pending   Frames the client has not consumed yet
+ * @param depth     Length of the LGMP frame queue
+ * @param subs      Whether the frame queue has subscribers
+ */
+void lpDemandMeterSample(LPDemandMeter * m, uint64_t consumed, 
+                         uint32_t pending, uint32_t depth, bool subs);
+
+/**
+ * @brief Sink: get the latest report if one was published since the last
+ * call
+ * 
+ * @param m         Meter to use
+ * @param seq       Sequence number of the last report sent, updated
+ * @param out       Latest report
+ * @return true if a new report should be sent
+ */
+bool lpDemandMeterPoll(LPDemandMeter * m, unsigned int * seq, 
+                       LPDemandReport * out);
+
+/**
+ * @brief Source: initialize demand state to LP_DEMAND_FULL
+ * 
+ * @param d         Demand state to initialize
+ */
+void lpDemandInit(LPDemand * d);
+
+/**
+ * @brief Source: apply a consumption report from the sink
+ * 
+ * @param d         Demand state to update
+ * @param r         Report received
+ */
+void lpDemandUpdate(LPDemand * d, const LPDemandReport * r);
+
+/**
+ * @brief Source: check whether a frame would be captured now, without
+ * updating any state
+ * 
+ * @param d         Demand state, may be NULL
+ * @param last      Time of the last captured frame, in nanoseconds
+ * @param now       Current time, in nanoseconds
+ * @return true if a frame would be captured
+ */
+bool lpDemandReady(LPDemand * d, uint64_t last, uint64_t now);
+
+/**
+ * @brief Source: decide whether a frame should be captured now
+ * 
+ * @param d         Demand state, may be NULL
+ * @param last      Time of the last captured frame, in nanoseconds. Updated
+ *                  if the frame is admitted.
+ * @param now       Current time, in nanoseconds
+ * @return true if the frame should be captured
+ */
+bool lpDemandAdmit(LPDemand * d, uint64_t * last, uint64_t now);
+
+#endif
@@ -0,0 +1,322 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Mailbox
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_MAILBOX_H
+#define _LP_MAILBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "trf.h"
+#include "lp_types.h"
+#include "lp_cursor.h"
+#include "lp_msg.h"
+
+/*  Cursor mailbox
+
+    In mailbox mode, the sink registers an LPCursorMailbox for remote access
+    and sends its address and key to the source (LPBinCursorMailbox). The
+    source then writes cursor updates into it with RDMA writes, and the sink
+    picks them up by polling memory. No receives are posted and no messages
+    are decoded on the cursor path.
+
+    Every record ends with a check value computed over the rest of the
+    record, so that the sink can detect records that are still being written.
+    Shape data is written, and its completion awaited, before the shape
+    header, so a valid header implies valid data. The sink publishes the index
+    of the last shape it has consumed; the source reads it back before
+    reusing a slot.
+
+    All fields are little-endian.
+*/
+
+#define LP_MAILBOX_VERSION 2
+#define LP_MAILBOX_SHAPE_SLOTS 4
+#define LP_MAILBOX_SHAPE_SIZE (MAX_POINTER_SIZE - sizeof(KVMFRCursor))
+
+/**
+ * @brief Mailbox position slot
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Update sequence number
+     * 
+     */
+    uint32_t                seq;
+    int16_t                 x;
+    int16_t                 y;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Check value over the preceding fields
+     * 
+     */
+    uint32_t                check;
+} LPMailboxPos;
+
+/**
+ * @brief Mailbox shape slot header
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Shape index, starting from 1. Shape n is stored in slot
+     * (n - 1) % LP_MAILBOX_SHAPE_SLOTS.
+     * 
+     */
+    uint32_t                index;
+    /**
+     * @brief Update sequence number
+     * 
+     */
+    uint32_t                seq;
+    int16_t                 x;
+    int16_t                 y;
+    int8_t                  hx;
+    int8_t                  hy;
+    /**
+     * @brief Cursor image format (CursorType)
+     * 
+     */
+    uint8_t                 type;
+    /**
+     * @brief Shape data encoding (enum LPCursorCodec)
+     * 
+     */
+    uint8_t                 codec;
+    uint32_t                width;
+    uint32_t                height;
+    uint32_t                pitch;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Shape cache slot + 1, 0 if the shape is not cached
+     * 
+     */
+    uint32_t                shape_id;
+    /**
+     * @brief Size of the shape data in the slot, after encoding. 0 refers to a shape
+     * previously cached by the sink in slot shape_id - 1.
+     * 
+     */
+    uint32_t                total;
+    /**
+     * @brief Check value over the preceding fields
+     * 
+     */
+    uint32_t                check;
+} LPMailboxShapeHdr;
+
+_Static_assert(sizeof(LPMailboxPos) == 16, "LPMailboxPos layout changed");
+_Static_assert(sizeof(LPMailboxShapeHdr) == 44, 
+               "LPMailboxShapeHdr layout changed");
+
+/**
+ * @brief Mailbox shape slot
+ * 
+ */
+typedef struct {
+    _Alignas(64) LPMailboxShapeHdr  hdr;
+    _Alignas(64) uint8_t            data[LP_MAILBOX_SHAPE_SIZE];
+} LPMailboxShapeSlot;
+
+/**
+ * @brief Mailbox memory layout
+ * 
+ */
+typedef struct {
+    _Alignas(64) LPMailboxPos       pos;
+    /**
+     * @brief Written by the sink: index of the last shape consumed
+     * 
+     */
+    _Alignas(64) uint32_t           consumed;
+    LPMailboxShapeSlot              shapes[LP_MAILBOX_SHAPE_SLOTS];
+} LPCursorMailbox;
+
+/**
+ * @brief Sink side mailbox
+ * 
+ */
+typedef struct LPMailbox {
+    /**
+     * @brief Mailbox memory, registered for remote access
+     * 
+     */
+    LPCursorMailbox *       mem;
+    /**
+     * @brief Memory registration
+     * 
+     */
+    struct fid_mr *         mr;
+    /**
+     * @brief Index of the last shape consumed
+     * 
+     */
+    uint32_t                consumed;
+    /**
+     * @brief Whether the mailbox has been offered to the source
+     * 
+     */
+    bool                    offered;
+} LPMailbox;
+
+/**
+ * @brief Source side view of the sink's mailbox
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Remote address of the mailbox
+     * 
+     */
+    uint64_t                addr;
+    /**
+     * @brief Remote key of the mailbox
+     * 
+     */
+    uint64_t                key;
+    /**
+     * @brief Index of the last shape written
+     * 
+     */
+    uint32_t                written;
+    /**
+     * @brief Last known index of the last shape consumed by the sink
+     * 
+     */
+    uint32_t                consumed;
+    /**
+     * @brief Whether inject writes are used for position updates
+     * 
+     */
+    bool                    inject;
+    /**
+     * @brief Whether the mailbox is in use
+     * 
+     */
+    bool                    active;
+} LPMailboxRemote;
+
+/**
+ * @brief Sink: allocate and register a cursor mailbox
+ * 
+ * @param ctx       Subchannel context
+ * @param mb        Mailbox to initialize
+ * @return 0 on success, negative error code on failure
+ */
+int lpMailboxCreate(PTRFContext ctx, LPMailbox * mb);
+
+/**
+ * @brief Sink: deregister and free a cursor mailbox
+ * 
+ * @param mb        Mailbox to free
+ */
+void lpMailboxDestroy(LPMailbox * mb);
+
+/**
+ * @brief Sink: send the mailbox offer to the source
+ * 
+ * @param ctx       Subchannel context
+ * @param mem       Registered memory used to send the offer
+ * @param mb        Mailbox to offer
+ * @return 0 on success, negative error code on failure
+ */
+int lpMailboxOffer(PTRFContext ctx, struct TRFMem * mem, LPMailbox * mb);
+
+/**
+ * @brief Sink: read the position slot
+ * 
+ * @param mb        Mailbox to read
+ * @param out       Position, in host byte order
+ * @return true if the slot contains a complete record
+ */
+bool lpMailboxReadPos(LPMailbox * mb, LPMailboxPos * out);
+
+/**
+ * @brief Sink: read the header of the next shape, if it has arrived
+ * 
+ * @param mb        Mailbox to read
+ * @param out       Shape header, in host byte order
+ * @return Shape data on success, NULL if the next shape has not arrived
+ */
+const uint8_t * lpMailboxReadShape(LPMailbox * mb, LPMailboxShapeHdr * out);
+
+/**
+ * @brief Sink: release the shape returned by lpMailboxReadShape, allowing the
+ * source to reuse its slot
+ * 
+ * @param mb        Mailbox to use
+ */
+void lpMailboxReleaseShape(LPMailbox * mb);
+
+/**
+ * @brief Source: accept a mailbox offer from the sink
+ * 
+ * @param rm        Remote mailbox to initialize
+ * @param offer     Offer received
+ * @return 0 on success, negative error code if the offer is incompatible
+ */
+int lpMailboxAccept(LPMailboxRemote * rm, const LPBinCursorMailbox * offer);
+
+/**
+ * @brief Source: write a position update into the mailbox
+ * 
+ * @param ctx       Subchannel context
+ * @param mr        Registered memory containing ctrl
+ * @param ctrl      Registered scratch buffer of at least 64 bytes
+ * @param rm        Remote mailbox
+ * @param pos       Position update
+ * @return 0 on success, negative error code on failure
+ */
+int lpMailboxWritePos(PTRFContext ctx, struct TRFMem * mr, void * ctrl,
+                      LPMailboxRemote * rm, const LPCursorPos * pos);
+
+/**
+ * @brief Source: write a shape update into the mailbox, waiting for the sink
+ * to free a slot if necessary
+ * 
+ * @param ctx       Subchannel context
+ * @param mr        Registered memory containing data and ctrl
+ * @param data      Registered buffer of at least LP_MAILBOX_SHAPE_SIZE bytes
+ * @param ctrl      Registered scratch buffer of at least 64 bytes
+ * @param rm        Remote mailbox
+ * @param shape     Shape update
+ * @param shapeId   Shape cache slot + 1
+ * @param payload   Shape data to send, empty if the sink already holds it
+ * @return 0 on success, negative error code on failure
+ */
+int lpMailboxWriteShape(PTRFContext ctx, struct TRFMem * mr, void * data,
+                        void * ctrl, LPMailboxRemote * rm, 
+                        const LPCursorShape * shape, uint32_t shapeId,
+                        const LPCursorShapeData * payload);
+
+#endif
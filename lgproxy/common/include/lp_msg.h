@@ -25,13 +25,700 @@
 #define _LP_MSG_H
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <endian.h>
 
 #include "trf.h"
 #include "trf_ncp.h"
 #include "lp_msg.pb-c.h"
 #include "lp_types.h"
 
+/*  Binary messages
+
+    Small, frequent messages (e.g. cursor positions) bypass protobuf and use
+    fixed-layout little-endian records instead. Every record starts with an
+    LPBinHdr. The magic bytes, read as a libtrf length prefix in either byte
+    order, exceed the size of any message buffer, so a binary record can
+    never be mistaken for a packed protobuf message.
+*/
+
+#define LP_BIN_MAGIC            "LPB"
+#define LP_BIN_VERSION          2
+
+/*  Maximum size of a message on the cursor subchannel. The sink posts
+    receive slots of this size, so larger updates must be fragmented. */
+#define LP_BIN_MAX_MSG_SIZE     4096
+
+enum LPBinType {
+    LP_BIN_INVALID      = 0,
+    LP_BIN_CURSOR_POS   = 1,
+    LP_BIN_CURSOR_SHAPE = 2,
+    LP_BIN_CURSOR_MAILBOX = 3,
+    LP_BIN_CONSUMPTION  = 4,
+    LP_BIN_VIEWPORT     = 5,
+    LP_BIN_PROGRESSIVE  = 6,
+    LP_BIN_FOCUS        = 7,
+    LP_BIN_TILE_HASHES  = 8,
+    LP_BIN_COMPRESS     = 9,
+    LP_BIN_MAX
+};
+
+/**
+ * @brief Binary message header
+ * 
+ */
+typedef struct {
+    /**
+     * @brief LP_BIN_MAGIC, without the terminator
+     * 
+     */
+    uint8_t                 magic[3];
+    /**
+     * @brief Record layout version. Records with a different version are
+     * rejected.
+     * 
+     */
+    uint8_t                 version;
+    /**
+     * @brief Record type (enum LPBinType)
+     * 
+     */
+    uint16_t                type;
+    /**
+     * @brief Total record size, including the header
+     * 
+     */
+    uint16_t                size;
+} LPBinHdr;
+
+/**
+ * @brief Cursor position update
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    int16_t                 x;
+    int16_t                 y;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Update sequence number
+     * 
+     */
+    uint32_t                seq;
+} LPBinCursorPos;
+
+/**
+ * @brief Cursor shape update fragment, followed by up to hdr.size - 
+ * sizeof(LPBinCursorShape) bytes of shape data. Shapes are split into
+ * fragments so that they fit in the sink's fixed-size receive slots; every
+ * fragment repeats the cursor header.
+ * 
+ * A fragment with total = 0 refers to a shape previously cached by the sink
+ * in slot shape_id - 1.
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    int16_t                 x;
+    int16_t                 y;
+    int8_t                  hx;
+    int8_t                  hy;
+    /**
+     * @brief Cursor image format (CursorType)
+     * 
+     */
+    uint8_t                 type;
+    /**
+     * @brief Shape data encoding (enum LPCursorCodec)
+     * 
+     */
+    uint8_t                 codec;
+    uint32_t                width;
+    uint32_t                height;
+    uint32_t                pitch;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Shape cache slot + 1, 0 if the shape is not cached
+     * 
+     */
+    uint32_t                shape_id;
+    /**
+     * @brief Update sequence number, identical for all fragments of a shape
+     * 
+     */
+    uint32_t                seq;
+    /**
+     * @brief Total size of the shape data as sent, i.e. after encoding
+     * 
+     */
+    uint32_t                total;
+    /**
+     * @brief Offset of this fragment's data within the shape data
+     * 
+     */
+    uint32_t                offset;
+} LPBinCursorShape;
+
+/**
+ * @brief Cursor mailbox offer, sent by the sink to the source. Once received,
+ * the source writes cursor updates directly into the mailbox using RDMA
+ * writes instead of sending messages.
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Mailbox layout version (LP_MAILBOX_VERSION)
+     * 
+     */
+    uint32_t                version;
+    /**
+     * @brief Number of shape slots in the mailbox
+     * 
+     */
+    uint32_t                slots;
+    /**
+     * @brief Remote address of the mailbox
+     * 
+     */
+    uint64_t                addr;
+    /**
+     * @brief Remote key of the mailbox
+     * 
+     */
+    uint64_t                key;
+    /**
+     * @brief Size of the mailbox in bytes
+     * 
+     */
+    uint64_t                size;
+} LPBinCursorMailbox;
+
+/**
+ * @brief The frame queue has at least one subscriber
+ */
+#define LP_BIN_CONSUMPTION_SUBS 0x1
+
+/**
+ * @brief The frame queue stayed full for the whole measurement window
+ */
+#define LP_BIN_CONSUMPTION_BACKLOG 0x2
+
+/**
+ * @brief Looking Glass client consumption report, sent by the sink to the
+ * source on the cursor subchannel
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Frames posted to the LGMP frame queue that the client has not
+     * consumed yet
+     * 
+     */
+    uint16_t                pending;
+    /**
+     * @brief Length of the LGMP frame queue
+     * 
+     */
+    uint16_t                depth;
+    /**
+     * @brief LP_BIN_CONSUMPTION_* flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Rate at which the client consumes frames, in mHz
+     * 
+     */
+    uint32_t                rate;
+} LPBinConsumption;
+
+/**
+ * @brief Viewport requested by the sink, and echoed back by the source with
+ * the viewport it applies. An empty viewport in the reply means that the
+ * source sends whole frames.
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Left edge of the viewport, in pixels
+     * 
+     */
+    uint16_t                x;
+    /**
+     * @brief Top edge of the viewport, in pixels
+     * 
+     */
+    uint16_t                y;
+    /**
+     * @brief Width of the viewport, in pixels
+     * 
+     */
+    uint16_t                width;
+    /**
+     * @brief Height of the viewport, in pixels
+     * 
+     */
+    uint16_t                height;
+} LPBinViewport;
+
+/**
+ * @brief Progressive delivery request from the sink, and the source's reply.
+ * The reply carries the size of the previews the source sends, or zero if
+ * the source does not send previews.
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Width of the previews, in pixels
+     * 
+     */
+    uint16_t                width;
+    /**
+     * @brief Height of the previews, in pixels
+     * 
+     */
+    uint16_t                height;
+    /**
+     * @brief Reserved, must be 0
+     * 
+     */
+    uint32_t                reserved;
+} LPBinProgressive;
+
+/**
+ * @brief Focus band request from the sink, and the source's reply with the
+ * band height it accepts, or zero if it does not send bands
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Height of the bands, in rows
+     * 
+     */
+    uint32_t                rows;
+    /**
+     * @brief Reserved, must be 0
+     * 
+     */
+    uint32_t                reserved;
+} LPBinFocus;
+
+/**
+ * @brief Part of the tile hashes of the frame the sink still holds after
+ * reconnecting, followed by count little-endian 64-bit hashes. The source
+ * replies with count 0, and total set to the number of tiles it accepted
+ * hashes for, or 0 if it sends the first frame in full.
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Frame size, in pixels
+     * 
+     */
+    uint16_t                width;
+    uint16_t                height;
+    /**
+     * @brief Frame format (enum TRFTexFormat)
+     * 
+     */
+    uint16_t                format;
+    /**
+     * @brief Tile width and height, in pixels
+     * 
+     */
+    uint16_t                tile;
+    /**
+     * @brief Index of the first tile in this message, in row-major order
+     * 
+     */
+    uint16_t                first;
+    /**
+     * @brief Number of hashes in this message
+     * 
+     */
+    uint16_t                count;
+    /**
+     * @brief Number of tiles in the frame
+     * 
+     */
+    uint16_t                total;
+    /**
+     * @brief Reserved, must be 0
+     * 
+     */
+    uint16_t                reserved;
+} LPBinTileHashes;
+
+/**
+ * @brief Block compression formats for frame data
+ * 
+ */
+enum LPBlockFormat {
+    LP_BLOCK_NONE       = 0,
+    LP_BLOCK_BC1        = 1,
+};
+
+/**
+ * @brief Block compression request from the sink, and the source's reply with
+ * the format it will send frames in, or LP_BLOCK_NONE if it sends them
+ * uncompressed
+ * 
+ */
+typedef struct {
+    LPBinHdr                hdr;
+    /**
+     * @brief Compression format (enum LPBlockFormat)
+     * 
+     */
+    uint32_t                format;
+    /**
+     * @brief Reserved, must be 0
+     * 
+     */
+    uint32_t                reserved;
+} LPBinCompress;
+
+_Static_assert(sizeof(LPBinHdr) == 8, "LPBinHdr layout changed");
+_Static_assert(sizeof(LPBinCursorPos) == 20, "LPBinCursorPos layout changed");
+_Static_assert(sizeof(LPBinCursorShape) == 48, 
+               "LPBinCursorShape layout changed");
+_Static_assert(sizeof(LPBinCursorMailbox) == 40, 
+               "LPBinCursorMailbox layout changed");
+_Static_assert(sizeof(LPBinConsumption) == 20, 
+               "LPBinConsumption layout changed");
+_Static_assert(sizeof(LPBinViewport) == 16, "LPBinViewport layout changed");
+_Static_assert(sizeof(LPBinProgressive) == 16, 
+               "LPBinProgressive layout changed");
+_Static_assert(sizeof(LPBinFocus) == 16, "LPBinFocus layout changed");
+_Static_assert(sizeof(LPBinTileHashes) == 24, 
+               "LPBinTileHashes layout changed");
+_Static_assert(sizeof(LPBinCompress) == 16, "LPBinCompress layout changed");
+
+/*  Shape data carried by each fragment */
+#define LP_BIN_FRAG_DATA        (LP_BIN_MAX_MSG_SIZE - sizeof(LPBinCursorShape))
+
+/*  Tile hashes carried by each message */
+#define LP_BIN_TILE_HASHES_MAX  ((LP_BIN_MAX_MSG_SIZE \
+                                  - sizeof(LPBinTileHashes)) / sizeof(uint64_t))
+
+/**
+ * @brief Cursor update parsed in place from a packed CursorData message.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Cursor header
+     * 
+     */
+    KVMFRCursor             hdr;
+    /**
+     * @brief LGMP cursor flags
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Shape cache slot + 1, 0 if the shape is not cached
+     * 
+     */
+    uint32_t                shape_id;
+    /**
+     * @brief Shape data, pointing into the message buffer. NULL if the
+     * message contains no shape data.
+     * 
+     */
+    const uint8_t *         data;
+    /**
+     * @brief Shape data length
+     * 
+     */
+    uint32_t                data_len;
+    /**
+     * @brief Shape data encoding (enum LPCursorCodec). CursorData messages
+     * always carry raw shape data.
+     * 
+     */
+    uint8_t                 codec;
+} LPCursorDataView;
 
 int lpKeepAlive(PTRFContext ctx);
 
+/**
+ * @brief Parse a MessageWrapper containing CursorData without unpacking it.
+ * Header fields are decoded, while the shape data is left in the message
+ * buffer, so it can be copied directly to its destination.
+ * 
+ * @param buf       Message payload (without the libtrf length prefix)
+ * @param len       Payload length
+ * @param out       Parsed cursor update
+ * @return 0 on success, -ENOMSG if the message is valid but does not contain
+ * CursorData, -EBADMSG if the message is malformed
+ */
+int lpParseCursorData(const void * buf, size_t len, LPCursorDataView * out);
+
+/**
+ * @brief Get the type of a binary message
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @return Message type, LP_BIN_INVALID if buf does not contain a valid
+ * binary message (e.g. it contains a protobuf message instead)
+ */
+enum LPBinType lpBinMsgType(const void * buf, size_t len);
+
+/**
+ * @brief Pack a cursor position update
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param x         Cursor X position
+ * @param y         Cursor Y position
+ * @param flags     LGMP cursor flags
+ * @param seq       Update sequence number
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackCursorPos(void * buf, size_t len, int16_t x, int16_t y,
+                        uint32_t flags, uint32_t seq);
+
+/**
+ * @brief Unpack a cursor position update
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message, in host byte order
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackCursorPos(const void * buf, size_t len, LPBinCursorPos * out);
+
+/**
+ * @brief Pack a cursor shape fragment
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param cursor    Cursor header
+ * @param flags     LGMP cursor flags
+ * @param shapeId   Shape cache slot + 1, 0 if the shape is not cached
+ * @param seq       Update sequence number
+ * @param codec     Shape data encoding (enum LPCursorCodec)
+ * @param data      Shape data
+ * @param total     Total size of the shape data
+ * @param offset    Offset of the fragment within the shape data
+ * @param chunk     Size of the fragment
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackCursorShape(void * buf, size_t len, const KVMFRCursor * cursor,
+                          uint32_t flags, uint32_t shapeId, uint32_t seq,
+                          uint8_t codec, const void * data, uint32_t total, uint32_t offset,
+                          uint32_t chunk);
+
+/**
+ * @brief Unpack a cursor shape fragment
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked fragment header, in host byte order
+ * @param data      Fragment data, pointing into buf
+ * @return Size of the fragment data on success, negative error code on
+ * failure
+ */
+ssize_t lpUnpackCursorShape(const void * buf, size_t len, 
+                            LPBinCursorShape * out, const uint8_t ** data);
+
+/**
+ * @brief Pack a cursor mailbox offer
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param version   Mailbox layout version
+ * @param slots     Number of shape slots
+ * @param addr      Remote address of the mailbox
+ * @param key       Remote key of the mailbox
+ * @param size      Size of the mailbox
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackCursorMailbox(void * buf, size_t len, uint32_t version, 
+                            uint32_t slots, uint64_t addr, uint64_t key, 
+                            uint64_t size);
+
+/**
+ * @brief Unpack a cursor mailbox offer
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message, in host byte order
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackCursorMailbox(const void * buf, size_t len, 
+                          LPBinCursorMailbox * out);
+
+/**
+ * @brief Pack a consumption report
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param pending   Frames the client has not consumed yet
+ * @param depth     Length of the LGMP frame queue
+ * @param flags     LP_BIN_CONSUMPTION_* flags
+ * @param rate      Consumption rate in mHz
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackConsumption(void * buf, size_t len, uint16_t pending, 
+                          uint16_t depth, uint32_t flags, uint32_t rate);
+
+/**
+ * @brief Unpack a consumption report
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message, in host byte order
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackConsumption(const void * buf, size_t len, LPBinConsumption * out);
+
+/**
+ * @brief Pack a viewport request or reply
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param vp        Viewport
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackViewport(void * buf, size_t len, const LPViewport * vp);
+
+/**
+ * @brief Unpack a viewport request or reply
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Viewport
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackViewport(const void * buf, size_t len, LPViewport * out);
+
+/**
+ * @brief Pack a progressive delivery request or reply
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param width     Preview width, 0 in requests and rejections
+ * @param height    Preview height, 0 in requests and rejections
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackProgressive(void * buf, size_t len, uint16_t width, 
+                          uint16_t height);
+
+/**
+ * @brief Unpack a progressive delivery request or reply
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message, in host byte order
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackProgressive(const void * buf, size_t len, 
+                        LPBinProgressive * out);
+
+/**
+ * @brief Pack a focus band request or reply
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param rows      Band height, 0 in rejections
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackFocus(void * buf, size_t len, uint32_t rows);
+
+/**
+ * @brief Unpack a focus band request or reply
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message, in host byte order
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackFocus(const void * buf, size_t len, LPBinFocus * out);
+
+/**
+ * @brief Pack tile hashes, or a reply to them
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param info      Frame and tile fields of the message. hdr is ignored, and
+ *                  count gives the number of hashes to pack.
+ * @param hashes    Hashes of tiles first to first + count - 1, may be NULL
+ *                  if count is 0
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackTileHashes(void * buf, size_t len, const LPBinTileHashes * info,
+                         const uint64_t * hashes);
+
+/**
+ * @brief Unpack tile hashes, or a reply to them
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message header, in host byte order
+ * @param hashes    Little-endian hashes, pointing into buf
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackTileHashes(const void * buf, size_t len, LPBinTileHashes * out,
+                       const uint8_t ** hashes);
+
+/**
+ * @brief Pack a block compression request or reply
+ * 
+ * @param buf       Output buffer
+ * @param len       Size of the output buffer
+ * @param format    Compression format, LP_BLOCK_NONE in rejections
+ * @return Packed size on success, negative error code on failure
+ */
+ssize_t lpPackCompress(void * buf, size_t len, uint32_t format);
+
+/**
+ * @brief Unpack a block compression request or reply
+ * 
+ * @param buf       Received message
+ * @param len       Number of bytes available in buf
+ * @param out       Unpacked message, in host byte order
+ * @return 0 on success, negative error code on failure
+ */
+int lpUnpackCompress(const void * buf, size_t len, LPBinCompress * out);
+
+/**
+ * @brief Wait for outstanding send or RMA operations to complete
+ * 
+ * @param ctx       Context the operations were posted on
+ * @param pending   Number of operations outstanding
+ * @return 0 on success, negative error code on failure
+ */
+int lpWaitSends(PTRFContext ctx, size_t pending);
+
+/**
+ * @brief Send a small message, using an inject send if the provider supports
+ * it. Inject sends return as soon as the provider has copied the data and do
+ * not generate a completion.
+ * 
+ * @param ctx       Context to send the message on
+ * @param mem       Registered memory containing buf, used for regular sends
+ * @param buf       Message to send
+ * @param len       Message size
+ * @param inject    In: whether to attempt an inject send. Out: set to false
+ *                  if the provider does not support inject sends of this size.
+ * @return 0 on success, negative error code on failure
+ */
+ssize_t lpSendSmall(PTRFContext ctx, struct TRFMem * mem, void * buf, 
+                    size_t len, bool * inject);
+
 #endif
\ No newline at end of file
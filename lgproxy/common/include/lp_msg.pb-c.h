@@ -91,10 +91,14 @@ struct  LpMsg__CursorData
    * Flags from looking glass
    */
   uint32_t flags;
+  /**
+   * Shape cache slot + 1, 0 if the shape is not cached
+   */
+  uint32_t shape_id;
 };
 #define LP_MSG__CURSOR_DATA__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&lp_msg__cursor_data__descriptor) \
-    , 0, 0, 0, 0, 0, 0, 0, 0, {0,NULL}, 0, 0 }
+    , 0, 0, 0, 0, 0, 0, 0, 0, {0,NULL}, 0, 0, 0 }
 
 
 /**
@@ -0,0 +1,200 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Motion Predictor
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_PREDICT_H
+#define _LP_PREDICT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * @brief Maximum time a position is extrapolated past the last received
+ * position, in milliseconds. If no update arrives within this time, the
+ * cursor is assumed to have stopped and is returned to the last received
+ * position.
+ */
+#define LP_PREDICT_HORIZON_MS 20
+
+/**
+ * @brief Maximum distance in pixels, along each axis, between a predicted
+ * position and the last received position
+ */
+#define LP_PREDICT_MAX_OVERSHOOT 24
+
+/**
+ * @brief Weight of the newest velocity sample in the velocity estimate, in
+ * the range (0, 1]
+ */
+#define LP_PREDICT_SMOOTHING 0.5
+
+/**
+ * @brief Cursor prediction error statistics. The error is measured when a
+ * position is received, as the distance between it and the last predicted
+ * position posted to LGMP.
+ */
+typedef struct {
+    /**
+     * @brief Number of positions received
+     * 
+     */
+    uint64_t    samples;
+    /**
+     * @brief Number of predicted positions posted
+     * 
+     */
+    uint64_t    predicted;
+    /**
+     * @brief Number of error measurements
+     * 
+     */
+    uint64_t    err_count;
+    /**
+     * @brief Sum of the prediction errors, in pixels
+     * 
+     */
+    double      err_sum;
+    /**
+     * @brief Sum of the squared prediction errors
+     * 
+     */
+    double      err_sq_sum;
+    /**
+     * @brief Largest prediction error, in pixels
+     * 
+     */
+    double      err_max;
+} LPPredictStats;
+
+/**
+ * @brief Cursor motion predictor state
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Interval between predicted positions in nanoseconds
+     * 
+     */
+    uint64_t        interval;
+    /**
+     * @brief Arrival time of the last received position in nanoseconds
+     * 
+     */
+    uint64_t        last_time;
+    /**
+     * @brief Time the last position was posted in nanoseconds
+     * 
+     */
+    uint64_t        post_time;
+    /**
+     * @brief Last received position
+     * 
+     */
+    int16_t         x, y;
+    /**
+     * @brief Last posted position
+     * 
+     */
+    int16_t         px, py;
+    /**
+     * @brief Estimated velocity in pixels per millisecond
+     * 
+     */
+    double          vx, vy;
+    /**
+     * @brief Whether a position has been received since the last reset
+     * 
+     */
+    bool            valid;
+    /**
+     * @brief Whether the last posted position was a prediction
+     * 
+     */
+    bool            posted_prediction;
+    /**
+     * @brief Prediction error statistics
+     * 
+     */
+    LPPredictStats  stats;
+} LPCursorPredictor;
+
+/**
+ * @brief Initialize a cursor motion predictor
+ * 
+ * @param p         Predictor to initialize
+ * @param rate      Rate at which predicted positions are posted, in Hz
+ * @return 0 on success, negative error code on failure
+ */
+int lpPredictInit(LPCursorPredictor * p, int rate);
+
+/**
+ * @brief Discard the motion history, e.g. when the cursor is hidden. The
+ * statistics are kept.
+ * 
+ * @param p         Predictor
+ */
+void lpPredictReset(LPCursorPredictor * p);
+
+/**
+ * @brief Record a position received from the source. The predictor snaps to
+ * this position; the caller should post it to LGMP as-is.
+ * 
+ * @param p         Predictor
+ * @param x         Received x coordinate
+ * @param y         Received y coordinate
+ * @param now       Arrival time in nanoseconds
+ */
+void lpPredictSample(LPCursorPredictor * p, int16_t x, int16_t y, 
+                     uint64_t now);
+
+/**
+ * @brief Get the predicted position to post, if one is due
+ * 
+ * @param p         Predictor
+ * @param now       Current time in nanoseconds
+ * @param x         Predicted x coordinate
+ * @param y         Predicted y coordinate
+ * @return true if a position should be posted, false if the position posted
+ * last is still current or no prediction is due yet
+ */
+bool lpPredictPosition(LPCursorPredictor * p, uint64_t now, int16_t * x, 
+                       int16_t * y);
+
+/**
+ * @brief Get the time the next predicted position is due
+ * 
+ * @param p         Predictor
+ * @return Time in nanoseconds, or UINT64_MAX if the cursor is at rest and no
+ * prediction is pending
+ */
+uint64_t lpPredictNextTime(LPCursorPredictor * p);
+
+/**
+ * @brief Log the prediction error statistics
+ * 
+ * @param p         Predictor
+ */
+void lpPredictLogStats(LPCursorPredictor * p);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Tile hash resync
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_RESYNC_H
+#define _LP_RESYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*  Delta resync after a reconnect
+
+    The sink's frame slots are in a shared memory file that outlives the
+    sink process, so after the sink is restarted, e.g. after a network
+    outage, they usually still hold the last frame it received. The sink
+    splits that frame into square tiles and sends a 64-bit hash of each to
+    the source. The source hashes the tiles of the first frame it sends in
+    the same way, and only writes the tiles whose hashes differ, on top of a
+    copy of the old frame in the sink's new frame slot.
+
+    The tile size is chosen from the frame size alone, so that both sides
+    derive the same grid, and the hashes of a frame fit in a few messages. */
+
+/**
+ * @brief Smallest tile width and height, in pixels
+ */
+#define LP_RESYNC_TILE_MIN 64
+
+/**
+ * @brief Maximum number of tiles in a frame. Tiles are made larger until
+ * the frame fits.
+ */
+#define LP_RESYNC_TILES_MAX 1024
+
+/**
+ * @brief Division of a frame into tiles. Tiles in the last column and row
+ * are cut short by the frame's edges.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Frame size, in pixels
+     * 
+     */
+    uint32_t                width;
+    uint32_t                height;
+    /**
+     * @brief Tile width and height, in pixels
+     * 
+     */
+    uint32_t                tile;
+    /**
+     * @brief Number of tile columns and rows
+     * 
+     */
+    uint32_t                cols;
+    uint32_t                rows;
+    /**
+     * @brief Total number of tiles
+     * 
+     */
+    uint32_t                count;
+} LPTileGrid;
+
+/**
+ * @brief Divide a frame into tiles
+ * 
+ * @param g         Grid to set up
+ * @param width     Frame width, in pixels
+ * @param height    Frame height, in pixels
+ * @return 0 on success, negative error code on failure
+ */
+int lpTileGridInit(LPTileGrid * g, uint32_t width, uint32_t height);
+
+/**
+ * @brief Hash the pixels of a tile
+ * 
+ * @param g         Tile grid
+ * @param src       Frame data
+ * @param pitch     Size of a frame row in bytes
+ * @param bpp       Size of a pixel in bytes
+ * @param index     Tile index, in row-major order
+ * @return 64-bit hash
+ */
+uint64_t lpHashTile(const LPTileGrid * g, const uint8_t * src, size_t pitch,
+                    size_t bpp, uint32_t index);
+
+/**
+ * @brief Hash every tile of a frame
+ * 
+ * @param g         Tile grid
+ * @param src       Frame data
+ * @param pitch     Size of a frame row in bytes
+ * @param bpp       Size of a pixel in bytes
+ * @param out       Hashes, g->count entries
+ */
+void lpHashTiles(const LPTileGrid * g, const uint8_t * src, size_t pitch,
+                 size_t bpp, uint64_t * out);
+
+/**
+ * @brief Hash a whole frame, to detect frames identical to the last one sent.
+ * The data is consumed in 64-byte stripes by eight independent lanes, using
+ * SSE2 where available, so that the hash runs at close to memory bandwidth.
+ * The result is the same with and without SSE2.
+ * 
+ * @param data      Frame data
+ * @param len       Size of the frame data in bytes
+ * @return 64-bit hash
+ */
+uint64_t lpHashFrame(const void * data, size_t len);
+
+#endif
@@ -55,21 +55,84 @@ int lpInitLgmpClient(PLPContext ctx);
 int lpClientInitSession(PLPContext ctx);
 
 /**
- * @brief Get Frame from shared memory
+ * @brief Lease on a frame in the LGMP frame queue.
+ * 
+ * While a lease is held, the LGMP message is not marked as done, so the
+ * Looking Glass host will not reuse the frame buffer. A lease must be held
+ * until every fabric operation reading from the frame has completed.
+ * 
+ * The LGMP client API only exposes the message at the client's queue
+ * position, and the next message only becomes visible once the current one
+ * is done, so a client holds at most one lease at a time and leases are
+ * released in the order they were taken.
+ */
+typedef struct {
+    /**
+     * @brief Frame header
+     * 
+     */
+    KVMFRFrame *            frame;
+    /**
+     * @brief Frame data
+     * 
+     */
+    FrameBuffer *           fb;
+    /**
+     * @brief Time the lease was taken, in nanoseconds
+     * 
+     */
+    uint64_t                time;
+    /**
+     * @brief Whether the lease is held
+     * 
+     */
+    bool                    held;
+} LPFrameLease;
+
+/**
+ * @brief Lease the next frame from shared memory
+ * 
+ * @param ctx           Context to use
+ * @param lease         Lease to fill in, must not be held
+ * @return 0 on success, -EAGAIN if no frame is available, -EBUSY if the
+ * lease is already held, other negative error code on error
+ */
+int lpLeaseFrame(PLPContext ctx, LPFrameLease * lease);
+
+/**
+ * @brief Release a frame lease, allowing the Looking Glass host to reuse the
+ * frame buffer. Releasing a lease that is not held does nothing.
+ * 
+ * @param ctx           Context to use
+ * @param lease         Lease to release
+ * @return 0 on success, negative error code on error
+ */
+int lpReleaseFrame(PLPContext ctx, LPFrameLease * lease);
+
+/**
+ * @brief Subscribe to the frame queue again, so that the Looking Glass host
+ * treats this as a new client and posts its current frame. Used to catch up
+ * after frames were dropped without being sent.
  * 
  * @param ctx           Context to use
- * @param out           Frame retrieved from LookingGlass
  * @return 0 on success, negative error code on error
  */
-int lpGetFrame(PLPContext ctx, KVMFRFrame **out, FrameBuffer **fb);
+int lpResubscribeFrames(PLPContext ctx);
 
 /**
- * @brief Get the Cursor object
+ * @brief Get the Cursor object, copying it from LGMP message memory into
+ * caller-provided storage. Position-only updates copy just the header.
  * 
  * @param ctx       Context to use
- * @param out       Cursor from Looking Glass Host if there is no change in cursor postion it out will be set to NULL
- * @return 0 on success, negative error code on failure
+ * @param out       Output buffer
+ * @param maxSize   Size of the output buffer
+ * @param size      Number of bytes copied, including the header
+ * @param flags     LGMP cursor flags
+ * @return 1 if an update was copied, 0 if there is no change in cursor
+ * position, -ENOBUFS if the update does not fit in out (the update is left in
+ * the queue and returned again on the next call), other negative error code
+ * on failure
  */
-int lpgetCursor(PLPContext ctx, KVMFRCursor **out, uint32_t *size, 
-                uint32_t *flags);
+int lpgetCursor(PLPContext ctx, KVMFRCursor * out, uint32_t maxSize,
+                uint32_t * size, uint32_t * flags);
 #endif
\ No newline at end of file
@@ -0,0 +1,220 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Lock-free Ring Buffer
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_RING_H
+#define _LP_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+/**
+ * @brief Single-producer, single-consumer ring buffer of fixed size elements.
+ * 
+ * Exactly one thread may call the producer functions (lpRingAcquire,
+ * lpRingCommit, lpRingPush) and exactly one other thread may call the consumer
+ * functions (lpRingFront, lpRingRelease, lpRingPop). No locks are taken.
+ */
+typedef struct {
+    /**
+     * @brief Element storage, count * elem_size bytes
+     * 
+     */
+    uint8_t *               data;
+    /**
+     * @brief Size of each element in bytes
+     * 
+     */
+    size_t                  elem_size;
+    /**
+     * @brief Number of elements - 1. The element count is a power of two.
+     * 
+     */
+    uint32_t                mask;
+    /**
+     * @brief Whether the element storage is owned by the ring
+     * 
+     */
+    bool                    owned;
+    /**
+     * @brief Index of the next element to be written by the producer
+     * 
+     */
+    _Alignas(64) atomic_uint head;
+    /**
+     * @brief Index of the next element to be read by the consumer
+     * 
+     */
+    _Alignas(64) atomic_uint tail;
+} LPRing;
+
+/**
+ * @brief Initialize a ring buffer, allocating storage for its elements
+ * 
+ * @param ring          Ring to initialize
+ * @param elem_size     Size of each element in bytes
+ * @param count         Number of elements, must be a power of two
+ * @return 0 on success, negative error code on failure
+ */
+int lpRingInit(LPRing * ring, size_t elem_size, uint32_t count);
+
+/**
+ * @brief Initialize a ring buffer on top of caller-provided storage, e.g. a
+ * buffer registered for fabric transfers.
+ * 
+ * @param ring          Ring to initialize
+ * @param buf           Storage of at least elem_size * count bytes
+ * @param elem_size     Size of each element in bytes
+ * @param count         Number of elements, must be a power of two
+ * @return 0 on success, negative error code on failure
+ */
+int lpRingInitBuf(LPRing * ring, void * buf, size_t elem_size, uint32_t count);
+
+/**
+ * @brief Free ring buffer storage, if it is owned by the ring
+ * 
+ * @param ring          Ring to free
+ */
+void lpRingFree(LPRing * ring);
+
+/**
+ * @brief Number of elements currently in the ring
+ * 
+ * @param ring          Ring to use
+ * @return Element count
+ */
+static inline uint32_t lpRingCount(LPRing * ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire)
+           - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/**
+ * @brief Get the element at a given index, regardless of its state
+ * 
+ * @param ring          Ring to use
+ * @param idx           Element index (wraps around)
+ * @return Pointer to the element storage
+ */
+static inline void * lpRingElem(LPRing * ring, uint32_t idx)
+{
+    return ring->data + (size_t) (idx & ring->mask) * ring->elem_size;
+}
+
+/**
+ * @brief Producer: get the next free element to be filled in place
+ * 
+ * @param ring          Ring to use
+ * @return Pointer to the free element, NULL if the ring is full
+ */
+static inline void * lpRingAcquire(LPRing * ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail > ring->mask)
+    {
+        return NULL;
+    }
+    return lpRingElem(ring, head);
+}
+
+/**
+ * @brief Producer: publish the element returned by lpRingAcquire
+ * 
+ * @param ring          Ring to use
+ */
+static inline void lpRingCommit(LPRing * ring)
+{
+    atomic_fetch_add_explicit(&ring->head, 1, memory_order_release);
+}
+
+/**
+ * @brief Consumer: get the oldest element without removing it
+ * 
+ * @param ring          Ring to use
+ * @return Pointer to the element, NULL if the ring is empty
+ */
+static inline void * lpRingFront(LPRing * ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+    {
+        return NULL;
+    }
+    return lpRingElem(ring, tail);
+}
+
+/**
+ * @brief Consumer: remove the element returned by lpRingFront, returning its
+ * storage to the producer
+ * 
+ * @param ring          Ring to use
+ */
+static inline void lpRingRelease(LPRing * ring)
+{
+    atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+}
+
+/**
+ * @brief Producer: copy an element into the ring
+ * 
+ * @param ring          Ring to use
+ * @param elem          Element to copy
+ * @return true on success, false if the ring is full
+ */
+static inline bool lpRingPush(LPRing * ring, const void * elem)
+{
+    void * slot = lpRingAcquire(ring);
+    if (!slot)
+    {
+        return false;
+    }
+    memcpy(slot, elem, ring->elem_size);
+    lpRingCommit(ring);
+    return true;
+}
+
+/**
+ * @brief Consumer: copy the oldest element out of the ring and remove it
+ * 
+ * @param ring          Ring to use
+ * @param out           Element output
+ * @return true on success, false if the ring is empty
+ */
+static inline bool lpRingPop(LPRing * ring, void * out)
+{
+    void * slot = lpRingFront(ring);
+    if (!slot)
+    {
+        return false;
+    }
+    memcpy(out, slot, ring->elem_size);
+    lpRingRelease(ring);
+    return true;
+}
+
+#endif
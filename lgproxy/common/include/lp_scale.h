@@ -0,0 +1,308 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Frame Downscaling
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_SCALE_H
+#define _LP_SCALE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "trf.h"
+#include "common/framebuffer.h"
+
+/*  Frame downscaling
+
+    The source can advertise a smaller display to the sink and downscale each
+    frame into it while copying it out of shared memory in the capture
+    thread. The destination frame is split into bands of rows, which are
+    scaled in parallel by the capture thread and a set of worker threads.
+    Each band only waits for the source rows it reads, so scaling overlaps
+    with the guest writing the frame.
+
+    Only 32-bit formats with 8-bit channels are supported, since every
+    channel is filtered independently. */
+
+/**
+ * @brief Maximum number of threads scaling a frame, including the capture
+ * thread
+ */
+#define LP_SCALE_THREADS_MAX 4
+
+/**
+ * @brief Largest integer factor supported by the box filter
+ */
+#define LP_SCALE_BOX_MAX 8
+
+/**
+ * @brief Fractional bits of the bilinear filter weights
+ */
+#define LP_SCALE_FRAC_BITS 8
+
+/**
+ * @brief Scaling filters
+ * 
+ */
+enum LPScaleFilter {
+    /**
+     * @brief Average of each block of factor x factor pixels. Only integer
+     * factors are supported.
+     * 
+     */
+    LP_SCALE_BOX,
+    /**
+     * @brief Interpolation between the four nearest pixels. Any size is
+     * supported, but detail is lost when shrinking by more than half.
+     * 
+     */
+    LP_SCALE_BILINEAR,
+    LP_SCALE_FILTER_MAX
+};
+
+/**
+ * @brief Requested output size, as given on the command line
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Integer factor to shrink by, or 0 if a size is given
+     * 
+     */
+    uint32_t                factor;
+    /**
+     * @brief Output width and height in pixels, if no factor is given
+     * 
+     */
+    uint32_t                width;
+    uint32_t                height;
+    /**
+     * @brief Filter (enum LPScaleFilter)
+     * 
+     */
+    int                     filter;
+} LPScaleOpts;
+
+typedef struct LPScaler LPScaler;
+
+/**
+ * @brief Work for one band of destination rows
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Owning scaler
+     * 
+     */
+    LPScaler *              s;
+    /**
+     * @brief First destination row, and the row after the last one
+     * 
+     */
+    uint32_t                y0;
+    uint32_t                y1;
+    /**
+     * @brief Vertically filtered row, bilinear filter only
+     * 
+     */
+    uint16_t *              tmp;
+    /**
+     * @brief Worker thread, unused for the first band
+     * 
+     */
+    pthread_t               thread;
+    /**
+     * @brief Whether the band was scaled successfully
+     * 
+     */
+    bool                    ok;
+} LPScaleBand;
+
+/**
+ * @brief Frame scaler
+ * 
+ */
+struct LPScaler {
+    /**
+     * @brief Source size in pixels
+     * 
+     */
+    uint32_t                src_w;
+    uint32_t                src_h;
+    /**
+     * @brief Destination size in pixels
+     * 
+     */
+    uint32_t                dst_w;
+    uint32_t                dst_h;
+    /**
+     * @brief Filter (enum LPScaleFilter)
+     * 
+     */
+    int                     filter;
+    /**
+     * @brief Box filter factor
+     * 
+     */
+    uint32_t                factor;
+    /**
+     * @brief Bilinear filter: left source column and weight of the right one
+     * for each destination column, and the same for rows
+     * 
+     */
+    uint32_t *              x_idx;
+    uint16_t *              x_wt;
+    uint32_t *              y_idx;
+    uint16_t *              y_wt;
+    /**
+     * @brief Bands, one per thread
+     * 
+     */
+    LPScaleBand             bands[LP_SCALE_THREADS_MAX];
+    int                     threads;
+    /**
+     * @brief Frame being scaled, valid between the start and end barriers.
+     * fb is NULL if the source frame is already complete.
+     * 
+     */
+    uint8_t *               dst;
+    const uint8_t *         src;
+    FrameBuffer *           fb;
+    size_t                  src_pitch;
+    /**
+     * @brief Barriers at the start and end of each frame
+     * 
+     */
+    pthread_barrier_t       start;
+    pthread_barrier_t       end;
+    /**
+     * @brief Held while the worker threads are being created, so that they
+     * can be stopped if not all of them start
+     * 
+     */
+    pthread_mutex_t         lock;
+    /**
+     * @brief Set to stop the worker threads
+     * 
+     */
+    atomic_bool             stop;
+    bool                    started;
+};
+
+/**
+ * @brief Parse a scaling factor (e.g. 2) or output size (e.g. 1920x1080)
+ * 
+ * @param data      String to parse
+ * @param out       Options to fill in. The filter is left unchanged.
+ * @return 0 on success, -EINVAL if the string is invalid
+ */
+int lpParseScale(const char * data, LPScaleOpts * out);
+
+/**
+ * @brief Parse a filter name, box or bilinear
+ * 
+ * @param data      String to parse
+ * @return Filter (enum LPScaleFilter), or -EINVAL if the name is unknown
+ */
+int lpParseScaleFilter(const char * data);
+
+/**
+ * @brief Work out the output size for a display
+ * 
+ * @param opts      Requested output size
+ * @param width     Source width, replaced by the output width
+ * @param height    Source height, replaced by the output height
+ * @return 0 on success, -EINVAL if the output size is not supported with the
+ * filter, or would be larger than the source
+ */
+int lpScaleSize(const LPScaleOpts * opts, uint32_t * width, 
+                uint32_t * height);
+
+/**
+ * @brief Check whether frames of a format can be scaled
+ * 
+ * @param format    Pixel format
+ * @return true if the format is supported
+ */
+bool lpScaleFormatSupported(int format);
+
+/**
+ * @brief Set up a scaler and start its worker threads
+ * 
+ * @param s         Scaler to set up
+ * @param opts      Requested output size
+ * @param srcW      Source width in pixels
+ * @param srcH      Source height in pixels
+ * @param threads   Number of threads, including the calling thread
+ * @return 0 on success, negative error code on failure
+ */
+int lpScalerInit(LPScaler * s, const LPScaleOpts * opts, uint32_t srcW, 
+                 uint32_t srcH, int threads);
+
+/**
+ * @brief Stop the worker threads and free the scaler's resources. Does
+ * nothing if the scaler was not set up.
+ * 
+ * @param s         Scaler
+ */
+void lpScalerDestroy(LPScaler * s);
+
+/**
+ * @brief Scale a frame as the guest writes it
+ * 
+ * @param s         Scaler
+ * @param dst       Destination buffer, with tightly packed rows
+ * @param fb        LGMP frame buffer
+ * @param srcPitch  Size of a source row in bytes
+ * @return true on success, false if the guest did not finish writing the
+ * frame in time
+ */
+bool lpScaleFrame(LPScaler * s, uint8_t * dst, FrameBuffer * fb, 
+                  size_t srcPitch);
+
+/**
+ * @brief Scale a complete frame
+ * 
+ * @param s         Scaler
+ * @param dst       Destination buffer, with tightly packed rows
+ * @param src       Source frame
+ * @param srcPitch  Size of a source row in bytes
+ */
+void lpScaleBuffer(LPScaler * s, uint8_t * dst, const uint8_t * src, 
+                   size_t srcPitch);
+
+/**
+ * @brief Expand a half resolution preview to full resolution in place, with
+ * a bilinear filter. The preview must be at the start of the buffer with
+ * tightly packed rows, and is half the width and height of the frame,
+ * rounded down.
+ * 
+ * @param buf       Frame buffer containing the preview
+ * @param width     Frame width in pixels, at least 2
+ * @param height    Frame height in pixels, at least 2
+ * @return 0 on success, negative error code on failure
+ */
+int lpUpscalePreview(uint8_t * buf, uint32_t width, uint32_t height);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Transfer Priority Scheduling
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#ifndef _LP_SCHED_H
+#define _LP_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*  Frame and cursor traffic share the same link. Frames are written in
+    chunks of at most LPUserOpts.frame_chunk bytes, one chunk at a time; a
+    chunk may be split into several writes in flight together. While the
+    cursor thread has an update in flight, no new frame write is posted.
+    A cursor update therefore waits for at most one frame chunk. */
+
+/**
+ * @brief Default frame chunk size in bytes
+ */
+#define LP_SCHED_DEFAULT_CHUNK (1024 * 1024)
+
+/**
+ * @brief Maximum number of writes a frame chunk is split into
+ */
+#define LP_SCHED_FRAME_WINDOW 16
+
+/**
+ * @brief Smallest write a frame chunk is split into, in bytes
+ */
+#define LP_SCHED_MIN_WRITE (64 * 1024)
+
+/**
+ * @brief Longest time a frame chunk is held back for cursor traffic, in
+ * microseconds. This bounds frame starvation if the cursor thread stalls.
+ */
+#define LP_SCHED_MAX_DEFER_US 2000
+
+/**
+ * @brief Interval between queueing delay reports, in milliseconds
+ */
+#define LP_SCHED_REPORT_MS 10000
+
+/**
+ * @brief Traffic classes, in order of priority
+ * 
+ */
+enum LPSchedClass {
+    /**
+     * @brief Cursor updates and subchannel control messages. The queueing
+     * delay is the time from the cursor update being read from LGMP to it
+     * being posted.
+     * 
+     */
+    LP_SCHED_CURSOR,
+    /**
+     * @brief Frame data. The queueing delay is the time the frame was held
+     * back for higher priority traffic.
+     * 
+     */
+    LP_SCHED_FRAME,
+    /**
+     * @brief Whole frames compared with the last one sent. The queueing
+     * delay is the time spent hashing the frame before it is sent or
+     * skipped.
+     * 
+     */
+    LP_SCHED_HASH,
+    LP_SCHED_CLASS_MAX
+};
+
+/**
+ * @brief Queueing delay statistics for one traffic class. Only the thread
+ * sending the class updates and reports them.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Number of transfers
+     * 
+     */
+    uint64_t                count;
+    /**
+     * @brief Sum of the queueing delays in nanoseconds
+     * 
+     */
+    uint64_t                total;
+    /**
+     * @brief Largest queueing delay in nanoseconds
+     * 
+     */
+    uint64_t                max;
+    /**
+     * @brief Time of the last report in nanoseconds
+     * 
+     */
+    uint64_t                last_report;
+} LPSchedStats;
+
+/**
+ * @brief Priority gate shared by the frame and cursor threads
+ * 
+ */
+struct LPSched {
+    /**
+     * @brief Number of cursor transfers in flight
+     * 
+     */
+    _Alignas(64) atomic_uint urgent;
+    /**
+     * @brief Queueing delay statistics, indexed by enum LPSchedClass
+     * 
+     */
+    _Alignas(64) LPSchedStats stats[LP_SCHED_CLASS_MAX];
+};
+
+typedef struct LPSched LPSched;
+
+/**
+ * @brief Initialize a priority gate
+ * 
+ * @param s         Gate to initialize
+ */
+void lpSchedInit(LPSched * s);
+
+/**
+ * @brief Cursor thread: mark the start of a high priority transfer
+ * 
+ * @param s         Gate
+ */
+static inline void lpSchedUrgentBegin(LPSched * s)
+{
+    atomic_fetch_add_explicit(&s->urgent, 1, memory_order_release);
+}
+
+/**
+ * @brief Cursor thread: mark the end of a high priority transfer
+ * 
+ * @param s         Gate
+ */
+static inline void lpSchedUrgentEnd(LPSched * s)
+{
+    atomic_fetch_sub_explicit(&s->urgent, 1, memory_order_release);
+}
+
+/**
+ * @brief Frame thread: check whether a high priority transfer is in flight
+ * 
+ * @param s         Gate
+ * @return true if frame chunks should be held back
+ */
+static inline bool lpSchedUrgent(LPSched * s)
+{
+    return atomic_load_explicit(&s->urgent, memory_order_acquire) != 0;
+}
+
+/**
+ * @brief Frame thread: wait until no high priority transfer is in flight,
+ * for at most LP_SCHED_MAX_DEFER_US
+ * 
+ * @param s         Gate
+ * @return Time spent waiting in nanoseconds
+ */
+uint64_t lpSchedWait(LPSched * s);
+
+/**
+ * @brief Record the queueing delay of a transfer
+ * 
+ * @param s         Gate
+ * @param cls       Traffic class (enum LPSchedClass)
+ * @param delay     Queueing delay in nanoseconds
+ */
+void lpSchedRecord(LPSched * s, int cls, uint64_t delay);
+
+/**
+ * @brief Log and reset the queueing delay statistics of a traffic class if
+ * LP_SCHED_REPORT_MS has passed since the last report
+ * 
+ * @param s         Gate
+ * @param cls       Traffic class (enum LPSchedClass)
+ * @param force     Report regardless of the interval
+ */
+void lpSchedReport(LPSched * s, int cls, bool force);
+
+#endif
@@ -36,9 +36,77 @@
 #include <unistd.h>
 #include "trf.h"
 #include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "lp_demand.h"
+#include "lp_scale.h"
+#include "lp_resync.h"
 
 #define POINTER_SHAPE_BUFFERS 3
+#define LP_FRAME_SLOTS_DEFAULT 3
+#define LP_FRAME_SLOTS_MAX 8
 #define MAX_POINTER_SIZE (sizeof(KVMFRCursor) + (512 * 512 * 4))
+#define LP_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define LP_LGMP_MAINT_INTERVAL_US 1000
+#define LP_LGMP_SUB_TIMEOUT_MS 1000
+#define LP_OFFER_TIMEOUT_MS 5000
+#define LP_VIEWPORT_BATCH_MAX 16
+
+/**
+ * @brief Set in the counter of a frame request to ask for a quarter
+ * resolution preview of the next frame, instead of the frame itself. Only
+ * used once progressive delivery has been agreed on.
+ */
+#define LP_FRAME_CNTR_PREVIEW (1ULL << 63)
+
+/**
+ * @brief Set in the counter of a frame request to ask for only the band of
+ * rows given with LP_FRAME_CNTR_BAND of the next frame. Only used once focus
+ * bands have been agreed on.
+ */
+#define LP_FRAME_CNTR_FOCUS (1ULL << 62)
+
+/**
+ * @brief Set in the counter of a frame request to ask for the rows outside
+ * the band given with LP_FRAME_CNTR_BAND of the frame the last focus band
+ * was sent from
+ */
+#define LP_FRAME_CNTR_REST (1ULL << 61)
+
+/**
+ * @brief Set in the counter of the first frame request after the source has
+ * accepted tile hashes, to ask for only the tiles that differ from them
+ */
+#define LP_FRAME_CNTR_DELTA (1ULL << 60)
+
+/**
+ * @brief Set in the counter of a frame request for a whole frame while the
+ * sink still holds the last frame it received in full. The source may then
+ * skip a frame identical to the last one it sent, and acknowledge the
+ * request without advancing its own frame counter.
+ */
+#define LP_FRAME_CNTR_SAME (1ULL << 59)
+
+/**
+ * @brief Bits of a frame request counter holding the frame serial. The other
+ * bits carry the LP_FRAME_CNTR_* flags and band.
+ */
+#define LP_FRAME_CNTR_SERIAL_MASK 0xFFFFFFFFULL
+
+/**
+ * @brief Maximum number of rows in a focus band, and maximum first row
+ */
+#define LP_FOCUS_ROWS_MAX 0x0FFF
+#define LP_FOCUS_Y_MAX 0x7FFF
+
+/**
+ * @brief Encode a band of rows in a frame request counter
+ */
+#define LP_FRAME_CNTR_BAND(y, rows) \
+    ((((uint64_t) (y) & LP_FOCUS_Y_MAX) << 32) \
+     | (((uint64_t) (rows) & LP_FOCUS_ROWS_MAX) << 47))
+#define LP_FRAME_CNTR_BAND_Y(cntr)      (((cntr) >> 32) & LP_FOCUS_Y_MAX)
+#define LP_FRAME_CNTR_BAND_ROWS(cntr)   (((cntr) >> 47) & LP_FOCUS_ROWS_MAX)
 
 
 enum T_STATE {
@@ -54,6 +122,62 @@ enum LP_STATE {
     LP_STATE_RESTART
 };
 
+/**
+ * @brief Frame slot ownership on the sink. Only the receive thread moves a
+ * slot out of LP_FRAME_SLOT_FREE, and only the LGMP maintenance thread moves
+ * it back.
+ * 
+ */
+enum LP_FRAME_SLOT_STATE {
+    /**
+     * @brief No client can be reading the slot, it may be received into
+     */
+    LP_FRAME_SLOT_FREE,
+    /**
+     * @brief A frame is being received into the slot
+     */
+    LP_FRAME_SLOT_RECV,
+    /**
+     * @brief The slot holds a complete frame which clients may be reading
+     */
+    LP_FRAME_SLOT_POSTED
+};
+
+/**
+ * @brief Negotiation state of an option the sink requests from the source
+ * before the first frame, such as a viewport
+ * 
+ */
+enum LP_OFFER_STATE {
+    /**
+     * @brief The option has not been requested
+     */
+    LP_OFFER_NONE,
+    /**
+     * @brief The option was requested, and the source has not replied yet
+     */
+    LP_OFFER_PENDING,
+    /**
+     * @brief The source applies the option
+     */
+    LP_OFFER_ACTIVE,
+    /**
+     * @brief The source does not apply the option
+     */
+    LP_OFFER_REJECTED
+};
+
+/**
+ * @brief Part of the display to send, in pixels
+ * 
+ */
+typedef struct {
+    uint16_t                x;
+    uint16_t                y;
+    uint16_t                width;
+    uint16_t                height;
+} LPViewport;
+
 typedef enum LG_RendererCursor
 {
     LG_CURSOR_COLOR,
@@ -94,10 +218,106 @@ typedef struct {
      */
     enum T_STATE            thread_flags;
     /**
-     * @brief LGMP memory for frame data
+     * @brief LGMP memory for frame data, frame_slots of which are allocated
+     * 
+     */
+    PLGMPMemory             frame_memory[LP_FRAME_SLOTS_MAX];
+    /**
+     * @brief Number of frame slots in use
+     * 
+     */
+    unsigned int            frame_slots;
+    /**
+     * @brief Slots of the last LGMP_Q_FRAME_LEN frame queue posts, oldest
+     * first starting at frame_post_head. The last lgmpHostQueuePending()
+     * entries are still held by clients and must not be written to.
+     * 
+     */
+    unsigned int            frame_posted[LGMP_Q_FRAME_LEN];
+    /**
+     * @brief Index of the oldest entry in frame_posted
+     * 
+     */
+    unsigned int            frame_post_head;
+    /**
+     * @brief Number of valid entries in frame_posted
      * 
      */
-    PLGMPMemory             frame_memory[LGMP_Q_FRAME_LEN];
+    unsigned int            frame_post_count;
+    /**
+     * @brief Time of the last frame queue post, in nanoseconds
+     * 
+     */
+    uint64_t                frame_post_time;
+    /**
+     * @brief Total number of frame queue posts
+     * 
+     */
+    uint64_t                frame_post_total;
+    /**
+     * @brief Client consumption, sampled by the LGMP maintenance thread and
+     * reported to the source by the cursor thread
+     * 
+     */
+    LPDemandMeter           demand;
+    /**
+     * @brief Ownership of each frame slot, see enum LP_FRAME_SLOT_STATE
+     * 
+     */
+    atomic_int              frame_state[LP_FRAME_SLOTS_MAX];
+    /**
+     * @brief Last slot a frame was completely received into, -1 if none
+     * 
+     */
+    atomic_int              frame_last;
+    /**
+     * @brief Incremented each time the LGMP host is reinitialized
+     * 
+     */
+    atomic_uint             lgmp_gen;
+    /**
+     * @brief LGMP generation the header of the current frame slot was
+     * written in
+     * 
+     */
+    unsigned int            frame_gen;
+    /**
+     * @brief Number of frames reposted for new subscribers
+     * 
+     */
+    uint64_t                repost_new;
+    /**
+     * @brief Number of frames reposted for idle subscribers
+     * 
+     */
+    uint64_t                repost_idle;
+    /**
+     * @brief Whether the frame queue has subscribers, as last seen by the
+     * LGMP maintenance thread
+     * 
+     */
+    atomic_bool             has_subs;
+    /**
+     * @brief Serializes LGMP host processing and frame queue posts between
+     * the receive thread and the LGMP maintenance thread
+     * 
+     */
+    pthread_mutex_t         lgmp_lock;
+    /**
+     * @brief LGMP maintenance thread
+     * 
+     */
+    pthread_t               lgmp_thread;
+    /**
+     * @brief Whether the LGMP maintenance thread has been started
+     * 
+     */
+    bool                    lgmp_started;
+    /**
+     * @brief Display the frame slots are sized for
+     * 
+     */
+    PTRFDisplay             display;
     /**
      * @brief LGMP memory for pointer data
      * 
@@ -109,7 +329,7 @@ typedef struct {
      */
     PLGMPMemory             cursor_shape[POINTER_SHAPE_BUFFERS];
     /**
-     * @brief Frame index
+     * @brief Frame slot currently being written, owned by the receive thread
      * 
      */
     unsigned int            frame_index;
@@ -138,6 +358,73 @@ typedef struct {
      * 
      */
     pthread_t               cursor_thread;
+    /**
+     * @brief Cursor shapes cached on request of the source. Kept across
+     * cursor thread restarts, since the source is not aware of them.
+     * 
+     */
+    struct LPShapeStore *   shape_store;
+    /**
+     * @brief Cursor mailbox, if enabled. Created with the subchannel and kept
+     * across cursor thread restarts, since the source keeps writing to it.
+     * 
+     */
+    struct LPMailbox *      mailbox;
+    /**
+     * @brief Viewport applied by the source, valid once viewport_state is
+     * LP_OFFER_ACTIVE
+     * 
+     */
+    LPViewport              viewport;
+    /**
+     * @brief Viewport negotiation state (enum LP_OFFER_STATE)
+     * 
+     */
+    atomic_int              viewport_state;
+    /**
+     * @brief Progressive delivery negotiation state (enum LP_OFFER_STATE)
+     * 
+     */
+    atomic_int              progressive_state;
+    /**
+     * @brief Height of the focus bands agreed on with the source, valid once
+     * focus_state is LP_OFFER_ACTIVE
+     * 
+     */
+    uint32_t                focus_rows;
+    /**
+     * @brief Focus band negotiation state (enum LP_OFFER_STATE)
+     * 
+     */
+    atomic_int              focus_state;
+    /**
+     * @brief Last cursor row posted to Looking Glass, -1 if none has been.
+     * Focus bands are centred on it.
+     * 
+     */
+    atomic_int              cursor_y;
+    /**
+     * @brief Frame slot still holding the last frame of a previous session,
+     * -1 if there is none
+     * 
+     */
+    int                     resync_slot;
+    /**
+     * @brief Tile grid and hashes of the frame in resync_slot
+     * 
+     */
+    LPTileGrid              resync_grid;
+    uint64_t *              resync_hashes;
+    /**
+     * @brief Tile hash negotiation state (enum LP_OFFER_STATE)
+     * 
+     */
+    atomic_int              resync_state;
+    /**
+     * @brief Block compression negotiation state (enum LP_OFFER_STATE)
+     * 
+     */
+    atomic_int              compress_state;
 } LPClient;
 
 typedef struct {
@@ -176,6 +463,80 @@ typedef struct {
      * 
      */
     enum T_STATE            thread_flags;
+    /**
+     * @brief Queue between the cursor reader and the cursor sender
+     * 
+     */
+    struct LPCursorQueue *  cursor_q;
+    /**
+     * @brief Priority gate between frame and cursor transfers
+     * 
+     */
+    struct LPSched *        sched;
+    /**
+     * @brief Client consumption reported by the sink
+     * 
+     */
+    struct LPDemand *       demand;
+    /**
+     * @brief Thread reading cursor updates from LGMP
+     * 
+     */
+    pthread_t               cursor_reader;
+    /**
+     * @brief Display requested by the sink, set before the subchannel is
+     * opened
+     * 
+     */
+    PTRFDisplay             display;
+    /**
+     * @brief Viewport requested by the sink, valid once viewport_state is
+     * LP_OFFER_ACTIVE
+     * 
+     */
+    LPViewport              viewport;
+    /**
+     * @brief Viewport state (enum LP_OFFER_STATE). A viewport is only
+     * accepted before the first frame request, after which the state is
+     * either LP_OFFER_ACTIVE or LP_OFFER_REJECTED.
+     * 
+     */
+    atomic_int              viewport_state;
+    /**
+     * @brief Progressive delivery state (enum LP_OFFER_STATE), latched at
+     * the first frame request like viewport_state
+     * 
+     */
+    atomic_int              progressive_state;
+    /**
+     * @brief Focus band state (enum LP_OFFER_STATE), latched at the first
+     * frame request like viewport_state
+     * 
+     */
+    atomic_int              focus_state;
+    /**
+     * @brief Tile grid of the sink's old frame, the tile hashes received so
+     * far, a bitmap of the tiles they cover and the number of tiles covered.
+     * Only written by the subchannel thread until resync_state leaves
+     * LP_OFFER_NONE.
+     * 
+     */
+    LPTileGrid              resync_grid;
+    uint64_t *              resync_hashes;
+    uint64_t *              resync_filled;
+    uint32_t                resync_received;
+    /**
+     * @brief Tile hash state (enum LP_OFFER_STATE), latched at the first
+     * frame request like viewport_state
+     * 
+     */
+    atomic_int              resync_state;
+    /**
+     * @brief Block compression state (enum LP_OFFER_STATE), latched at the
+     * first frame request like viewport_state
+     * 
+     */
+    atomic_int              compress_state;
 } LPHost;
 
 typedef struct {
@@ -190,6 +551,77 @@ typedef struct {
      * false.
      */
     bool delete_exit;
+    /**
+     * @brief Number of threads used to prefault the shared memory mapping at
+     * startup. If this is 0 (default), pages are faulted in on first access.
+     * If this is 1, the mapping is populated by the kernel using MAP_POPULATE.
+     */
+    int prefault_threads;
+    /**
+     * @brief Offer an RDMA mailbox for cursor updates to the source (sink
+     * only). If this is false (default), cursor updates are sent as messages.
+     */
+    bool cursor_mailbox;
+    /**
+     * @brief Rate in Hz at which predicted cursor positions are posted
+     * between updates from the source (sink only). If this is 0 (default),
+     * only received positions are posted.
+     */
+    int cursor_predict;
+    /**
+     * @brief Maximum size of each frame data write in bytes (source only).
+     * Cursor updates are sent between chunks. If this is 0, frames are sent
+     * in a single write.
+     */
+    size_t frame_chunk;
+    /**
+     * @brief Number of LGMP frame slots to rotate through (sink only). A
+     * frame is received into a slot no client is reading while the previous
+     * frame is displayed. Defaults to LP_FRAME_SLOTS_DEFAULT.
+     */
+    int frame_slots;
+    /**
+     * @brief Number of staging buffers between the capture and network
+     * threads (source only). If this is 0 (default), frames are sent directly
+     * from shared memory by the thread handling client requests.
+     */
+    int capture_depth;
+    /**
+     * @brief Target frame transfer time in microseconds (source only). If
+     * this is not 0, the frame rate is capped to keep transfers under it.
+     */
+    uint32_t adapt_target;
+    /**
+     * @brief File to append frame rate controller decisions to as CSV
+     * (source only). If this is NULL (default), decisions are only logged.
+     */
+    char * adapt_log;
+    /**
+     * @brief Part of the display to receive (sink only). If the width is 0
+     * (default), whole frames are received.
+     */
+    LPViewport viewport;
+    /**
+     * @brief Ask the source for a quarter resolution preview of each frame
+     * before the frame itself (sink only)
+     */
+    bool progressive;
+    /**
+     * @brief Height of the band of rows around the cursor to receive before
+     * the rest of each frame (sink only). If this is 0 (default), frames are
+     * received in one piece.
+     */
+    uint32_t focus_rows;
+    /**
+     * @brief Ask the source for BC1 compressed frames, decompressed before
+     * they are posted to Looking Glass (sink only)
+     */
+    bool compress;
+    /**
+     * @brief Output size of frames sent to the sink (source only). If both
+     * the factor and width are 0 (default), frames are sent at full size.
+     */
+    LPScaleOpts scale;
 }LPUserOpts;
 
 typedef enum {
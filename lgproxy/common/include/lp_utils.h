@@ -28,9 +28,24 @@
 #include <stdio.h>
 #include "lp_types.h"
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <pthread.h>
 #include <math.h>
 #include "lp_msg.pb-c.h"
 
+/**
+ * @brief Get the current monotonic time in nanoseconds
+ * 
+ * @return Time in nanoseconds
+ */
+static inline uint64_t lpGetTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
  * @brief Poll for a message, decoding it if the message has been received.
  * 
@@ -51,6 +66,25 @@ uint64_t lpParseMemString(char * data);
 
 int64_t lpParsePollString(char * data);
 
+/**
+ * @brief Parse a viewport given as WIDTHxHEIGHT+X+Y, e.g. 1920x1080+1920+0
+ * 
+ * @param data          String containing the viewport
+ * @param out           Parsed viewport
+ * @return 0 on success, -EINVAL if the string is invalid
+ */
+int lpParseViewport(const char * data, LPViewport * out);
+
+/**
+ * @brief Clip a viewport to a display
+ * 
+ * @param vp            Viewport to clip
+ * @param width         Display width in pixels
+ * @param height        Display height in pixels
+ * @return true if any part of the viewport is on the display
+ */
+bool lpClipViewport(LPViewport * vp, uint32_t width, uint32_t height);
+
 /**
  * @brief Check if the SHM File needs to be truncated 
  * 
@@ -59,6 +93,44 @@ int64_t lpParsePollString(char * data);
  */
 bool lpShouldTruncate(PLPContext ctx);
 
+/**
+ * @brief Get the huge page size backing the shared memory file
+ * 
+ * @param path      Path to shm file
+ * @return Huge page size in bytes if the file resides on hugetlbfs, 0 if it
+ * does not, negative error code on failure
+ */
+ssize_t lpShmHugePageSize(const char * path);
+
+/**
+ * @brief Map the shared memory file, applying huge page and prefaulting hints
+ * where they are supported.
+ * 
+ * @param ctx       Context to use. The mapping size is taken from ram_size.
+ * @param fd        File descriptor of the opened shared memory file
+ * @return 0 on success, negative error code on failure
+ */
+int lpMapShm(PLPContext ctx, int fd);
+
+/**
+ * @brief Fault in all pages of a memory region without modifying its contents
+ * 
+ * @param addr      Start of the region, must be page aligned
+ * @param len       Length of the region in bytes
+ * @param threads   Number of threads to split the work across
+ * @return 0 on success, negative error code on failure
+ */
+int lpPrefaultMem(void * addr, size_t len, int threads);
+
+/**
+ * @brief Number of threads a frame processing pool should use. Half of the
+ * online CPUs are used, leaving the rest to the fabric and capture threads,
+ * and small machines use a single thread.
+ * 
+ * @return Number of threads, at least 1
+ */
+int lpWorkerThreads(void);
+
 /**
  * @brief Set Looking Glass Proxy logging level
  * 
@@ -153,9 +225,10 @@ int lpSetDefaultOpts(PLPContext ctx);
  * @brief Calculate the size needed for shared memory file
  * 
  * @param display   Display metadata from Libtrf
+ * @param slots     Number of frame slots
  * @return size of the display needed
  */
-int lpCalcFrameSizeNeeded(PTRFDisplay display);
+int lpCalcFrameSizeNeeded(PTRFDisplay display, int slots);
 
 /**
  * @brief Send disconnect message to clients
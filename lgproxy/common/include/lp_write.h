@@ -41,6 +41,10 @@
 #include "common/framebuffer.h"
 #include "lp_utils.h"
 #include "lp_msg.pb-c.h"
+#include "lp_msg.h"
+#include "lp_cursor.h"
+#include "lp_mailbox.h"
+#include "lp_predict.h"
 
 LGMP_STATUS lpKeepLGMPSessionAlive(PLPContext ctx, PTRFDisplay display);
 
@@ -55,7 +59,8 @@ LGMP_STATUS lpKeepLGMPSessionAlive(PLPContext ctx, PTRFDisplay display);
 int lpInitHost(PLPContext ctx, PTRFDisplay display, bool initShm);
 
 /**
- * @brief       Signal that a frame is done writing to the LGMP client
+ * @brief       Signal that a frame is done writing to the LGMP client, and
+ *              hand its slot over to the LGMP maintenance thread
  * 
  * @param ctx   Client context to use.
  * @param disp  Display data to write.
@@ -64,13 +69,105 @@ int lpInitHost(PLPContext ctx, PTRFDisplay display, bool initShm);
 int lpSignalFrameDone(PLPContext ctx, PTRFDisplay disp);
 
 /**
- * @brief Write data to shared memory
+ * @brief       Signal that the source found the frame identical to the last
+ *              one it sent. The slot claimed with lpRequestFrame, which must
+ *              not have been posted, is released and the last complete
+ *              frame is posted again instead.
+ * 
+ * @param ctx   Client context to use.
+ * @param disp  Display data being received.
+ * @return      0 on success, negative error code on failure
+ */
+int lpSignalFrameUnchanged(PLPContext ctx, PTRFDisplay disp);
+
+/**
+ * @brief       Signal that only a band of full-width rows of a frame has
+ *              been written. The band is marked as the frame's only damage,
+ *              so Looking Glass clients keep the rest of the previous frame,
+ *              and the slot is posted and handed over. The slot must have
+ *              been requested without posting it, and is never posted again
+ *              in place of an unchanged frame.
+ * 
+ * @param ctx   Client context to use.
+ * @param disp  Display data written.
+ * @param y     First row of the band.
+ * @param rows  Number of rows in the band.
+ * @return      0 on success, negative error code on failure
+ */
+int lpSignalFrameBand(PLPContext ctx, PTRFDisplay disp, uint32_t y, 
+                      uint32_t rows);
+
+/**
+ * @brief Look for a complete frame left in the frame slots by a previous
+ * session with the same display, and hash its tiles so that the source only
+ * has to send the tiles that changed since. Must be called after lpInitHost,
+ * before any frame is requested.
+ * 
+ * @param ctx       Context to use
+ * @param disp      Display that will be received
+ * @return 0 if a frame was found, -ENOENT if there is none, negative error
+ * code on failure
+ */
+int lpFindResyncBase(PLPContext ctx, PTRFDisplay disp);
+
+/**
+ * @brief Copy the frame found by lpFindResyncBase into the frame slot being
+ * received into, so that only changed tiles need to be written on top
+ * 
+ * @param ctx       Context to use
+ * @param disp      Display data being received
+ * @return 0 on success, negative error code on failure
+ */
+int lpRestoreResyncBase(PLPContext ctx, PTRFDisplay disp);
+
+/**
+ * @brief Post a frame slot to the LGMP frame queue, recording the post so that
+ * the slot is not written to while a client may still be reading it. Once the
+ * LGMP maintenance thread is running, lgmp_lock must be held.
+ * 
+ * @param ctx       Context to use
+ * @param slot      Frame slot index
+ * @return LGMP status
+ */
+LGMP_STATUS lpPostFrameSlot(PLPContext ctx, unsigned int slot);
+
+/**
+ * @brief Claim a free frame slot and write the frame header, ready for the
+ * frame data to be received, and optionally post it to the LGMP frame queue
  * 
  * @param ctx               PLPContext to use
  * @param display           Display data to write
+ * @param post              Post the slot now. Otherwise, it must be posted
+ *                          with lpPostFrame or lpSignalFrameBand, or released
+ *                          with lpSignalFrameUnchanged once the source
+ *                          replies.
+ * @return 0 on success, negative error code on failure
+ */
+int lpRequestFrame(PLPContext ctx, PTRFDisplay disp, bool post);
+
+/**
+ * @brief Post the slot claimed with lpRequestFrame to the LGMP frame queue,
+ * waiting for the queue to have room. A failed post is only logged, as the
+ * slot is still reclaimed once handed over.
+ * 
+ * @param ctx               PLPContext to use
+ * @return 0 on success, -EAGAIN if the context is stopping
+ */
+int lpPostFrame(PLPContext ctx);
+
+/**
+ * @brief Post a cursor update to Looking Glass. The header and shape data are
+ * copied directly into the next LGMP cursor buffer.
+ * 
+ * @param ctx        Context to use
+ * @param cur        Cursor header
+ * @param shape      Shape data, may be NULL if shapeSize is 0
+ * @param shapeSize  Size of the shape data, 0 for position-only updates
+ * @param flags      LGMP cursor flags
  * @return 0 on success, negative error code on failure
  */
-int lpRequestFrame(PLPContext ctx, PTRFDisplay disp);
+int lpUpdateCursor(PLPContext ctx, const KVMFRCursor * cur, 
+                   const void * shape, uint32_t shapeSize, uint32_t flags);
 
 /**
  * @brief Update host cursor position on the client
@@ -115,6 +212,24 @@ void lpShutdown(PLPContext ctx);
  */
 int lpReinitCursorThread(PLPContext ctx);
 
+/**
+ * @brief Start the LGMP maintenance thread. From then on, it owns LGMP host
+ * processing, reinitialization and the cursor thread's lifecycle, and frees
+ * frame slots once no client can still be reading them.
+ * 
+ * @param ctx       Context to use
+ * @return 0 on success, negative error code on failure
+ */
+int lpStartLGMPThread(PLPContext ctx);
+
+/**
+ * @brief Stop the LGMP maintenance thread. This also sets the state to
+ * LP_STATE_STOP. Does nothing if the thread was not started.
+ * 
+ * @param ctx       Context to use
+ */
+void lpStopLGMPThread(PLPContext ctx);
+
 /**
  * @brief Handle Cursor Data
  * 
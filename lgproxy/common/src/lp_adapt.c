@@ -0,0 +1,288 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Bandwidth Adaptation
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_adapt.h"
+#include "lp_log.h"
+#include "lp_utils.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static const uint32_t lpAdaptLadder[LP_ADAPT_LEVELS] = LP_ADAPT_LADDER;
+
+static const char * lpAdaptReasonName[LP_ADAPT_REASON_MAX] = {
+    "start",
+    "over target",
+    "over capacity",
+    "headroom",
+    "hold"
+};
+
+/**
+ * @brief Predict the time to send the last frame from the current estimates
+ * 
+ * @param a         Controller
+ * @return Predicted frame time in nanoseconds
+ */
+static double lpAdaptPredict(const LPAdapt * a)
+{
+    if (a->bw <= 0)
+    {
+        return a->frame_time;
+    }
+    return a->frame_writes * a->rtt + a->frame_bytes / a->bw;
+}
+
+/**
+ * @brief Log a change of the cap, and append every decision to the decision
+ * log
+ * 
+ * @param a         Controller
+ * @param now       Current time in nanoseconds
+ * @param from      Previous ladder index
+ * @param reason    Reason for the decision (enum LPAdaptReason)
+ * @param pred      Predicted frame time in nanoseconds
+ * @param fps       Frame rate measured since the last decision
+ */
+static void lpAdaptRecord(LPAdapt * a, uint64_t now, int from, int reason, 
+                          double pred, double fps)
+{
+    if (reason != LP_ADAPT_HOLD)
+    {
+        lp__log_info("Frame rate cap %u -> %u Hz (%s): predicted frame time "
+                     "%.2f ms, target %.2f ms, %.0f Mbit/s, rtt %.1f us",
+                     lpAdaptLadder[from], lpAdaptLadder[a->level],
+                     lpAdaptReasonName[reason], pred / 1000000.0, 
+                     a->target / 1000000.0, a->bw * 8000.0, a->rtt / 1000.0);
+    }
+    if (a->log)
+    {
+        fprintf(a->log, "%lu,%s,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%lu,%.1f\n", 
+                now, lpAdaptReasonName[reason], lpAdaptLadder[from], 
+                lpAdaptLadder[a->level], pred / 1000.0, a->frame_time / 1000.0,
+                a->target / 1000.0, a->bw * 8000.0, a->rtt / 1000.0, 
+                a->frame_bytes, fps);
+        fflush(a->log);
+    }
+}
+
+int lpAdaptInit(LPAdapt * a, uint32_t targetUs, const char * logPath)
+{
+    if (!a || !targetUs)
+    {
+        return -EINVAL;
+    }
+
+    memset(a, 0, sizeof(*a));
+    a->target = targetUs * 1000ULL;
+    if (logPath)
+    {
+        a->log = fopen(logPath, "a");
+        if (!a->log)
+        {
+            int ret = -errno;
+            lp__log_error("Unable to open %s: %s", logPath, strerror(-ret));
+            return ret;
+        }
+        fseek(a->log, 0, SEEK_END);
+        if (ftell(a->log) == 0)
+        {
+            fputs("time_ns,reason,from_hz,to_hz,predicted_us,measured_us,"
+                  "target_us,mbps,rtt_us,frame_bytes,fps\n", a->log);
+        }
+    }
+
+    uint64_t now = lpGetTimeNs();
+    a->last_decision    = now;
+    a->last_busy        = now;
+    lpAdaptRecord(a, now, 0, LP_ADAPT_START, 0, 0);
+    return 0;
+}
+
+void lpAdaptDestroy(LPAdapt * a)
+{
+    if (!a)
+    {
+        return;
+    }
+    lp__log_info("Frame rate cap %u Hz at disconnect: %.0f Mbit/s, rtt %.1f "
+                 "us, frame time %.2f ms", lpAdaptLadder[a->level], 
+                 a->bw * 8000.0, a->rtt / 1000.0, a->frame_time / 1000000.0);
+    if (a->log)
+    {
+        fclose(a->log);
+        a->log = NULL;
+    }
+}
+
+void lpAdaptSample(LPAdapt * a, size_t bytes, uint64_t time)
+{
+    if (!a || !bytes || !time)
+    {
+        return;
+    }
+
+    a->bytes += bytes;
+    a->writes++;
+
+    // Least squares fit of time = rtt + bytes / bw, with older samples
+    // decaying away
+    const double d = 1.0 - 1.0 / (1 << LP_ADAPT_EWMA_SHIFT);
+    double x = bytes;
+    double y = time;
+    a->s1   = a->s1  * d + 1;
+    a->sx   = a->sx  * d + x;
+    a->sy   = a->sy  * d + y;
+    a->sxx  = a->sxx * d + x * x;
+    a->sxy  = a->sxy * d + x * y;
+
+    double var = a->s1 * a->sxx - a->sx * a->sx;
+    if (var > 1e-3 * a->s1 * a->sxx)
+    {
+        double slope = (a->s1 * a->sxy - a->sx * a->sy) / var;
+        double icpt  = (a->sy - slope * a->sx) / a->s1;
+        if (slope > 0 && icpt >= 0)
+        {
+            a->bw  = 1.0 / slope;
+            a->rtt = icpt;
+            return;
+        }
+    }
+
+    // All writes are about the same size, so the fixed cost cannot be told
+    // apart from the throughput. Keep the last estimate of the fixed cost.
+    double mx = a->sx / a->s1;
+    double my = a->sy / a->s1;
+    if (a->rtt >= my)
+    {
+        a->rtt = 0;
+    }
+    a->bw = mx / (my - a->rtt);
+}
+
+void lpAdaptFrameDone(LPAdapt * a, uint64_t time)
+{
+    if (!a)
+    {
+        return;
+    }
+
+    a->frame_bytes  = a->bytes;
+    a->frame_writes = a->writes;
+    a->bytes        = 0;
+    a->writes       = 0;
+    a->frame_time   = a->frame_time ? 
+                      a->frame_time + ((double) time - a->frame_time) 
+                                      / (1 << LP_ADAPT_EWMA_SHIFT) 
+                      : time;
+    a->frames++;
+
+    uint64_t now = lpGetTimeNs();
+    if (now - a->last_decision < LP_ADAPT_DECIDE_MS * 1000000ULL)
+    {
+        return;
+    }
+
+    double pred = lpAdaptPredict(a);
+    double fps  = a->frames * 1e9 / (now - a->last_decision);
+    a->frames        = 0;
+    a->last_decision = now;
+
+    // Highest cap the link sustains while leaving room for other traffic.
+    // Uncapped is only allowed if every cap on the ladder is sustainable.
+    double maxRate = pred > 0 ? LP_ADAPT_BUSY * 1e7 / pred : 0;
+    int fit = LP_ADAPT_LEVELS - 1;
+    for (int i = 1; i < LP_ADAPT_LEVELS; i++)
+    {
+        if (lpAdaptLadder[i] <= maxRate)
+        {
+            fit = i == 1 ? 0 : i;
+            break;
+        }
+    }
+
+    int from    = a->level;
+    int reason  = LP_ADAPT_HOLD;
+    if (pred >= a->target * (LP_ADAPT_LOW_WATER / 100.0))
+    {
+        a->last_busy = now;
+    }
+
+    if (pred > a->target)
+    {
+        if (a->level < LP_ADAPT_LEVELS - 1)
+        {
+            a->level++;
+            reason = LP_ADAPT_OVER_TARGET;
+        }
+    }
+    else if (fit > a->level)
+    {
+        a->level = fit;
+        reason   = LP_ADAPT_OVER_CAPACITY;
+    }
+    else if (fit < a->level 
+             && now - a->last_busy >= LP_ADAPT_HOLD_MS * 1000000ULL)
+    {
+        // Raise the cap one step at a time, waiting for the estimates to
+        // settle in between
+        a->level--;
+        a->last_busy = now;
+        reason       = LP_ADAPT_HEADROOM;
+    }
+    lpAdaptRecord(a, now, from, reason, pred, fps);
+}
+
+uint64_t lpAdaptPace(LPAdapt * a)
+{
+    if (!a)
+    {
+        return 0;
+    }
+
+    uint64_t start = lpGetTimeNs();
+    uint32_t cap = lpAdaptLadder[a->level];
+    if (cap && a->last_send)
+    {
+        uint64_t next = a->last_send + 1000000000ULL / cap;
+        if (start < next)
+        {
+            struct timespec req = {
+                .tv_sec     = (next - start) / 1000000000ULL,
+                .tv_nsec    = (next - start) % 1000000000ULL
+            };
+            struct timespec rem;
+            while (nanosleep(&req, &rem) < 0 && errno == EINTR)
+            {
+                req = rem;
+            }
+        }
+    }
+    a->last_send = lpGetTimeNs();
+    return a->last_send - start;
+}
+
+uint32_t lpAdaptFpsCap(const LPAdapt * a)
+{
+    return lpAdaptLadder[a->level];
+}
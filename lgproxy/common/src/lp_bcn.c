@@ -0,0 +1,605 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Block compression
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_bcn.h"
+#include "lp_log.h"
+#include "trf_def.h"
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool lpBC1Supported(int format, uint32_t width, uint32_t height)
+{
+    switch (format)
+    {
+        case TRF_TEX_BGRA_8888:
+        case TRF_TEX_RGBA_8888:
+        case TRF_TEX_BGR_32:
+            break;
+        default:
+            return false;
+    }
+    return width && height && width % 4 == 0 && height % 4 == 0;
+}
+
+/**
+ * @brief Quantize a colour to RGB565, with the first channel in the low bits
+ * 
+ * @param c         Channels
+ * @return Packed colour
+ */
+static inline uint16_t lpPack565(const uint8_t * c)
+{
+    return (uint16_t) ((((c[2] * 31 + 127) / 255) << 11)
+                       | (((c[1] * 63 + 127) / 255) << 5)
+                       | ((c[0] * 31 + 127) / 255));
+}
+
+/**
+ * @brief Spread the low 16 bits of a mask to the even bits of a word
+ * 
+ * @param x         Mask
+ * @return Spread mask
+ */
+static inline uint32_t lpSpreadBits(uint32_t x)
+{
+    x &= 0xFFFF;
+    x = (x | x << 8) & 0x00FF00FF;
+    x = (x | x << 4) & 0x0F0F0F0F;
+    x = (x | x << 2) & 0x33333333;
+    x = (x | x << 1) & 0x55555555;
+    return x;
+}
+
+/**
+ * @brief Write a block
+ * 
+ * @param out       Output
+ * @param c0        First endpoint, the larger one in four colour mode
+ * @param c1        Second endpoint
+ * @param idx       2-bit pixel indices, the first pixel in the low bits
+ */
+static inline void lpStoreBlock(uint8_t * out, uint16_t c0, uint16_t c1, 
+                                uint32_t idx)
+{
+    c0  = htole16(c0);
+    c1  = htole16(c1);
+    idx = htole32(idx);
+    memcpy(out, &c0, sizeof(c0));
+    memcpy(out + 2, &c1, sizeof(c1));
+    memcpy(out + 4, &idx, sizeof(idx));
+}
+
+/*  Pixel indices are chosen by projecting each pixel onto the line from the
+    low endpoint (index 1) to the high endpoint (index 0), and rounding to
+    the nearest of the four colours on it. With d six times the projection
+    relative to the low endpoint and r the projection of the high endpoint,
+    the level l (0 to 3) crosses r, 3r and 5r. Index bit 1 is set for levels
+    1 and 2, and bit 0 for levels 0 and 1. */
+
+#ifdef __SSE2__
+static void lpBC1Block(uint8_t * out, const uint8_t * src, size_t pitch)
+{
+    const __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rows[4];
+    for (int y = 0; y < 4; y++)
+    {
+        rows[y] = _mm_and_si128(
+                    _mm_loadu_si128((const __m128i *) (src + y * pitch)), 
+                    mask);
+    }
+
+    // Bounding box of the block's colours, in every pixel lane
+    __m128i mn = _mm_min_epu8(_mm_min_epu8(rows[0], rows[1]), 
+                              _mm_min_epu8(rows[2], rows[3]));
+    __m128i mx = _mm_max_epu8(_mm_max_epu8(rows[0], rows[1]), 
+                              _mm_max_epu8(rows[2], rows[3]));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    // Inset by 1/16 of the range, which lowers the error for most blocks
+    __m128i inset = _mm_and_si128(_mm_srli_epi16(_mm_subs_epu8(mx, mn), 4),
+                                  _mm_set1_epi8(0x0F));
+    mn = _mm_adds_epu8(mn, inset);
+    mx = _mm_subs_epu8(mx, inset);
+
+    uint32_t mnv = _mm_cvtsi128_si32(mn), mxv = _mm_cvtsi128_si32(mx);
+    uint8_t lo[4], hi[4];
+    memcpy(lo, &mnv, sizeof(lo));
+    memcpy(hi, &mxv, sizeof(hi));
+    uint16_t c0 = lpPack565(hi);
+    uint16_t c1 = lpPack565(lo);
+    if (c0 == c1)
+    {
+        lpStoreBlock(out, c0, c1, 0);
+        return;
+    }
+
+    __m128i dir = _mm_unpacklo_epi8(_mm_subs_epu8(mx, mn), zero);
+    int32_t dmin = 0, r = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        dmin    += lo[c] * (hi[c] - lo[c]);
+        r       += (hi[c] - lo[c]) * (hi[c] - lo[c]);
+    }
+    const __m128i base  = _mm_set1_epi32(6 * dmin);
+    const __m128i t1    = _mm_set1_epi32(r);
+    const __m128i t3    = _mm_set1_epi32(3 * r);
+    const __m128i t5    = _mm_set1_epi32(5 * r);
+
+    uint32_t b0 = 0, b1 = 0;
+    for (int y = 0; y < 4; y++)
+    {
+        __m128 l = _mm_castsi128_ps(
+                    _mm_madd_epi16(_mm_unpacklo_epi8(rows[y], zero), dir));
+        __m128 h = _mm_castsi128_ps(
+                    _mm_madd_epi16(_mm_unpackhi_epi8(rows[y], zero), dir));
+        __m128i dot = _mm_add_epi32(
+            _mm_castps_si128(_mm_shuffle_ps(l, h, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(l, h, _MM_SHUFFLE(3, 1, 3, 1))));
+        __m128i d = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(dot, 2), 
+                                                _mm_slli_epi32(dot, 1)), 
+                                  base);
+        __m128i ge1 = _mm_cmpgt_epi32(d, t1);
+        __m128i ge2 = _mm_cmpgt_epi32(d, t3);
+        __m128i ge3 = _mm_cmpgt_epi32(d, t5);
+        b1 |= (uint32_t) _mm_movemask_ps(
+                _mm_castsi128_ps(_mm_xor_si128(ge1, ge3))) << (4 * y);
+        b0 |= (uint32_t) (_mm_movemask_ps(_mm_castsi128_ps(ge2)) ^ 0xF) 
+              << (4 * y);
+    }
+    lpStoreBlock(out, c0, c1, lpSpreadBits(b0) | lpSpreadBits(b1) << 1);
+}
+#else
+static void lpBC1Block(uint8_t * out, const uint8_t * src, size_t pitch)
+{
+    uint8_t lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            const uint8_t * p = src + y * pitch + x * 4;
+            for (int c = 0; c < 3; c++)
+            {
+                lo[c] = p[c] < lo[c] ? p[c] : lo[c];
+                hi[c] = p[c] > hi[c] ? p[c] : hi[c];
+            }
+        }
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        uint8_t inset = (hi[c] - lo[c]) >> 4;
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+
+    uint16_t c0 = lpPack565(hi);
+    uint16_t c1 = lpPack565(lo);
+    if (c0 == c1)
+    {
+        lpStoreBlock(out, c0, c1, 0);
+        return;
+    }
+
+    int32_t dir[3], dmin = 0, r = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        dir[c]  = hi[c] - lo[c];
+        dmin    += lo[c] * dir[c];
+        r       += dir[c] * dir[c];
+    }
+    uint32_t idx = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        const uint8_t * p = src + (i / 4) * pitch + (i % 4) * 4;
+        int32_t d = 6 * (p[0] * dir[0] + p[1] * dir[1] + p[2] * dir[2] 
+                         - dmin);
+        bool ge1 = d > r, ge2 = d > 3 * r, ge3 = d > 5 * r;
+        idx |= (uint32_t) ((ge1 ^ ge3) << 1 | !ge2) << (2 * i);
+    }
+    lpStoreBlock(out, c0, c1, idx);
+}
+#endif
+
+void lpBC1EncodeRows(uint8_t * dst, const uint8_t * src, size_t srcPitch, 
+                     uint32_t width, uint32_t y0, uint32_t y1)
+{
+    uint32_t bw = width / 4;
+    for (uint32_t by = y0; by < y1; by++)
+    {
+        const uint8_t * row = src + (size_t) by * 4 * srcPitch;
+        uint8_t * out       = dst + (size_t) by * bw * 8;
+        for (uint32_t bx = 0; bx < bw; bx++)
+        {
+            lpBC1Block(out + bx * 8, row + bx * 16, srcPitch);
+        }
+    }
+}
+
+/**
+ * @brief Expand an RGB565 colour to four 8-bit channels
+ * 
+ * @param out       Channels
+ * @param c         Packed colour
+ */
+static inline void lpUnpack565(uint8_t * out, uint16_t c)
+{
+    uint8_t b = c & 31, g = (c >> 5) & 63, r = c >> 11;
+    out[0] = (b << 3) | (b >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (r << 3) | (r >> 2);
+    out[3] = 0xFF;
+}
+
+/**
+ * @brief Read a block
+ * 
+ * @param blk       Block
+ * @param c0        First endpoint
+ * @param c1        Second endpoint
+ * @param idx       2-bit pixel indices, the first pixel in the low bits
+ */
+static inline void lpLoadBlock(const uint8_t * blk, uint16_t * c0, 
+                               uint16_t * c1, uint32_t * idx)
+{
+    memcpy(c0, blk, sizeof(*c0));
+    memcpy(c1, blk + 2, sizeof(*c1));
+    memcpy(idx, blk + 4, sizeof(*idx));
+    *c0  = le16toh(*c0);
+    *c1  = le16toh(*c1);
+    *idx = le32toh(*idx);
+}
+
+#ifdef __SSE2__
+static void lpBC1DecodeBlock(uint8_t * out, size_t pitch, 
+                             const uint8_t * blk)
+{
+    uint16_t c0, c1;
+    uint32_t idx, e0, e1;
+    lpLoadBlock(blk, &c0, &c1, &idx);
+    uint8_t ch[4];
+    lpUnpack565(ch, c0);
+    memcpy(&e0, ch, sizeof(e0));
+    lpUnpack565(ch, c1);
+    memcpy(&e1, ch, sizeof(e1));
+
+    // Palette in 16-bit lanes; x / 3 is exact as (x * 0x5556) >> 16 for the
+    // sums of up to three channels
+    const __m128i zero  = _mm_setzero_si128();
+    __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(e0), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(e1), zero);
+    __m128i ab = _mm_add_epi16(a, b);
+    __m128i p2, p3;
+    if (c0 > c1)
+    {
+        const __m128i third = _mm_set1_epi16(0x5556);
+        p2 = _mm_mulhi_epu16(_mm_add_epi16(ab, a), third);
+        p3 = _mm_mulhi_epu16(_mm_add_epi16(ab, b), third);
+    }
+    else
+    {
+        p2 = _mm_srli_epi16(ab, 1);
+        p3 = zero;
+    }
+    __m128i pal = _mm_or_si128(
+                    _mm_packus_epi16(_mm_unpacklo_epi64(a, b), 
+                                     _mm_unpacklo_epi64(p2, p3)),
+                    _mm_set1_epi32((int) 0xFF000000));
+    const __m128i pal0  = _mm_shuffle_epi32(pal, _MM_SHUFFLE(0, 0, 0, 0));
+    const __m128i pal1  = _mm_shuffle_epi32(pal, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128i pal2  = _mm_shuffle_epi32(pal, _MM_SHUFFLE(2, 2, 2, 2));
+    const __m128i pal3  = _mm_shuffle_epi32(pal, _MM_SHUFFLE(3, 3, 3, 3));
+
+    // Each pixel lane tests its own two index bits of the current row
+    const __m128i bit0  = _mm_set_epi32(1 << 6, 1 << 4, 1 << 2, 1);
+    const __m128i bit1  = _mm_slli_epi32(bit0, 1);
+    __m128i v = _mm_set1_epi32((int) idx);
+    for (int y = 0; y < 4; y++, v = _mm_srli_epi32(v, 8))
+    {
+        __m128i m0  = _mm_cmpeq_epi32(_mm_and_si128(v, bit0), bit0);
+        __m128i m1  = _mm_cmpeq_epi32(_mm_and_si128(v, bit1), bit1);
+        __m128i s01 = _mm_or_si128(_mm_and_si128(m0, pal1), 
+                                   _mm_andnot_si128(m0, pal0));
+        __m128i s23 = _mm_or_si128(_mm_and_si128(m0, pal3), 
+                                   _mm_andnot_si128(m0, pal2));
+        _mm_storeu_si128((__m128i *) (out + y * pitch), 
+                         _mm_or_si128(_mm_and_si128(m1, s23), 
+                                      _mm_andnot_si128(m1, s01)));
+    }
+}
+#else
+static void lpBC1DecodeBlock(uint8_t * out, size_t pitch, 
+                             const uint8_t * blk)
+{
+    uint16_t c0, c1;
+    uint32_t idx;
+    lpLoadBlock(blk, &c0, &c1, &idx);
+
+    uint8_t pal[4][4];
+    lpUnpack565(pal[0], c0);
+    lpUnpack565(pal[1], c1);
+    for (int c = 0; c < 3; c++)
+    {
+        if (c0 > c1)
+        {
+            pal[2][c] = (2 * pal[0][c] + pal[1][c]) / 3;
+            pal[3][c] = (pal[0][c] + 2 * pal[1][c]) / 3;
+        }
+        else
+        {
+            pal[2][c] = (pal[0][c] + pal[1][c]) / 2;
+            pal[3][c] = 0;
+        }
+    }
+    pal[2][3] = 0xFF;
+    pal[3][3] = 0xFF;
+
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++, idx >>= 2)
+        {
+            memcpy(out + y * pitch + x * 4, pal[idx & 3], 4);
+        }
+    }
+}
+#endif
+
+void lpBC1DecodeRows(uint8_t * dst, const uint8_t * src, uint32_t width, 
+                     uint32_t y0, uint32_t y1)
+{
+    uint32_t bw     = width / 4;
+    size_t pitch    = (size_t) width * 4;
+    for (uint32_t by = y0; by < y1; by++)
+    {
+        const uint8_t * row = src + (size_t) by * bw * 8;
+        uint8_t * out       = dst + (size_t) by * 4 * pitch;
+        for (uint32_t bx = 0; bx < bw; bx++)
+        {
+            lpBC1DecodeBlock(out + bx * 16, pitch, row + bx * 8);
+        }
+    }
+}
+
+/**
+ * @brief Run the calling thread's share of a frame
+ * 
+ * @param c         Coder, with the frame set
+ * @param b         Band to process
+ */
+static void lpBC1CodeBand(LPBlockCoder * c, LPBlockBand * b)
+{
+    if (c->decode)
+    {
+        lpBC1DecodeRows(c->dst, c->src, c->width, b->y0, b->y1);
+    }
+    else
+    {
+        lpBC1EncodeRows(c->dst, c->src, c->src_pitch, c->width, b->y0, 
+                        b->y1);
+    }
+}
+
+static void * lpBC1Worker(void * arg)
+{
+    LPBlockBand * b     = (LPBlockBand *) arg;
+    LPBlockCoder * c    = b->c;
+
+    // Wait for the other workers to be created
+    pthread_mutex_lock(&c->lock);
+    pthread_mutex_unlock(&c->lock);
+    if (atomic_load_explicit(&c->stop, memory_order_acquire))
+    {
+        return NULL;
+    }
+    while (1)
+    {
+        pthread_barrier_wait(&c->start);
+        if (atomic_load_explicit(&c->stop, memory_order_acquire))
+        {
+            break;
+        }
+        lpBC1CodeBand(c, b);
+        pthread_barrier_wait(&c->end);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Set up a coder and start its worker threads
+ * 
+ * @param c         Coder to set up
+ * @param width     Frame width in pixels, a multiple of 4
+ * @param height    Frame height in pixels, a multiple of 4
+ * @param threads   Number of threads, including the calling thread
+ * @param decode    Whether the coder decompresses frames
+ * @return 0 on success, negative error code on failure
+ */
+static int lpBC1CoderInit(LPBlockCoder * c, uint32_t width, uint32_t height,
+                          int threads, bool decode)
+{
+    if (!c || !width || !height || width % 4 || height % 4 || threads < 1)
+    {
+        return -EINVAL;
+    }
+
+    memset(c, 0, sizeof(*c));
+    uint32_t rows   = height / 4;
+    c->width        = width;
+    c->height       = height;
+    c->decode       = decode;
+    c->threads      = threads > LP_BCN_THREADS_MAX ? 
+                      LP_BCN_THREADS_MAX : threads;
+    if ((uint32_t) c->threads > rows)
+    {
+        c->threads = rows;
+    }
+    for (int i = 0; i < c->threads; i++)
+    {
+        LPBlockBand * b = &c->bands[i];
+        b->c    = c;
+        b->y0   = (uint64_t) rows * i / c->threads;
+        b->y1   = (uint64_t) rows * (i + 1) / c->threads;
+    }
+
+    if (decode)
+    {
+        c->blocks = malloc(lpBC1Size(width, height));
+        if (!c->blocks)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    atomic_init(&c->stop, false);
+    if (c->threads > 1)
+    {
+        pthread_barrier_init(&c->start, NULL, c->threads);
+        pthread_barrier_init(&c->end, NULL, c->threads);
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_mutex_lock(&c->lock);
+        int i;
+        int ret = 0;
+        for (i = 1; i < c->threads; i++)
+        {
+            ret = pthread_create(&c->bands[i].thread, NULL, lpBC1Worker, 
+                                 &c->bands[i]);
+            if (ret)
+            {
+                lp__log_error("Unable to start compression thread: %s", 
+                              strerror(ret));
+                break;
+            }
+        }
+        if (i < c->threads)
+        {
+            // The workers that did start exit before reaching the barriers
+            atomic_store_explicit(&c->stop, true, memory_order_release);
+            pthread_mutex_unlock(&c->lock);
+            for (int j = 1; j < i; j++)
+            {
+                pthread_join(c->bands[j].thread, NULL);
+            }
+            pthread_barrier_destroy(&c->start);
+            pthread_barrier_destroy(&c->end);
+            pthread_mutex_destroy(&c->lock);
+            free(c->blocks);
+            c->blocks = NULL;
+            return -ret;
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    c->started = true;
+    lp__log_info("%s %ux%u frames %s BC1 with %d threads", 
+                 decode ? "Decompressing" : "Compressing", width, height, 
+                 decode ? "from" : "to", c->threads);
+    return 0;
+}
+
+int lpBC1EncoderInit(LPBlockCoder * c, uint32_t width, uint32_t height, 
+                     int threads)
+{
+    return lpBC1CoderInit(c, width, height, threads, false);
+}
+
+int lpBC1DecoderInit(LPBlockCoder * c, uint32_t width, uint32_t height, 
+                     int threads)
+{
+    return lpBC1CoderInit(c, width, height, threads, true);
+}
+
+void lpBC1CoderDestroy(LPBlockCoder * c)
+{
+    if (!c || !c->started)
+    {
+        return;
+    }
+
+    if (c->threads > 1)
+    {
+        atomic_store_explicit(&c->stop, true, memory_order_release);
+        pthread_barrier_wait(&c->start);
+        for (int i = 1; i < c->threads; i++)
+        {
+            pthread_join(c->bands[i].thread, NULL);
+        }
+        pthread_barrier_destroy(&c->start);
+        pthread_barrier_destroy(&c->end);
+        pthread_mutex_destroy(&c->lock);
+    }
+    free(c->blocks);
+    c->blocks   = NULL;
+    c->started  = false;
+}
+
+/**
+ * @brief Process a frame on the calling thread and the worker threads
+ * 
+ * @param c         Coder, with the frame set
+ */
+static void lpBC1Code(LPBlockCoder * c)
+{
+    if (c->threads > 1)
+    {
+        pthread_barrier_wait(&c->start);
+    }
+    lpBC1CodeBand(c, &c->bands[0]);
+    if (c->threads > 1)
+    {
+        pthread_barrier_wait(&c->end);
+    }
+}
+
+void lpBC1Encode(LPBlockCoder * c, uint8_t * dst, const uint8_t * src, 
+                 size_t srcPitch)
+{
+    c->dst          = dst;
+    c->src          = src;
+    c->src_pitch    = srcPitch;
+    lpBC1Code(c);
+}
+
+void lpBC1Decode(LPBlockCoder * c, uint8_t * dst, const uint8_t * src)
+{
+    // When decompressing in place, the bands further down the frame
+    // overwrite the blocks of the ones above it, so the blocks are copied
+    // out first
+    size_t size = (size_t) c->width * c->height * 4;
+    if (src >= dst && src < dst + size)
+    {
+        memcpy(c->blocks, src, lpBC1Size(c->width, c->height));
+        src = c->blocks;
+    }
+    c->dst          = dst;
+    c->src          = src;
+    c->src_pitch    = 0;
+    lpBC1Code(c);
+}
@@ -0,0 +1,310 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Frame Capture Pipeline
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_capture.h"
+#include "lp_retrieve.h"
+#include "lp_log.h"
+#include "lp_utils.h"
+#include "common/framebuffer.h"
+
+static void lpCaptureRecord(LPCaptureStats * st, uint64_t busy)
+{
+    st->frames++;
+    st->busy += busy;
+    if (busy > st->max)
+    {
+        st->max = busy;
+    }
+}
+
+static void lpCaptureReport(const char * name, LPCaptureStats * st, 
+                            bool force)
+{
+    uint64_t now = lpGetTimeNs();
+    if (!force && now - st->last_report < LP_CAPTURE_REPORT_MS * 1000000ULL)
+    {
+        return;
+    }
+
+    if (st->frames && force)
+    {
+        lp__log_info("%s: %lu frames, %lu skipped, mean %.2f ms, max %.2f ms",
+                     name, st->frames, st->skipped, 
+                     st->busy / 1000000.0 / st->frames, st->max / 1000000.0);
+    }
+    else if (st->frames)
+    {
+        lp__log_debug("%s: %lu frames, %lu skipped, mean %.2f ms, "
+                      "max %.2f ms", name, st->frames, st->skipped, 
+                      st->busy / 1000000.0 / st->frames, st->max / 1000000.0);
+    }
+    if (st->throttled)
+    {
+        lp__log_debug("%s: %lu frames throttled", name, st->throttled);
+    }
+    if (st->frames && st->latency)
+    {
+        lp__log_debug("%s: mean capture to send latency %.2f ms", name,
+                      st->latency / 1000000.0 / st->frames);
+    }
+    *st = (LPCaptureStats) { .last_report = now };
+}
+
+/**
+ * @brief Copy a frame into a staging buffer as the guest writes it
+ * 
+ * @param dst       Staging buffer
+ * @param fb        LGMP frame buffer
+ * @param size      Size of the frame data in bytes
+ * @return true on success, false if the guest did not finish writing the
+ * frame in time
+ */
+static bool lpCaptureCopy(uint8_t * dst, FrameBuffer * fb, size_t size)
+{
+    const uint8_t * src = framebuffer_get_data(fb);
+    for (size_t off = 0; off < size; off += LP_CAPTURE_COPY_CHUNK)
+    {
+        size_t n = size - off < LP_CAPTURE_COPY_CHUNK ? 
+                   size - off : LP_CAPTURE_COPY_CHUNK;
+        if (!framebuffer_wait(fb, off + n))
+        {
+            return false;
+        }
+        memcpy(dst + off, src + off, n);
+    }
+    return true;
+}
+
+static void * lpCaptureThread(void * arg)
+{
+    LPCapture * cap = (LPCapture *) arg;
+    PLPContext ctx = cap->ctx;
+    LPCaptureStats * st = &cap->cap_stats;
+    LPDemand * demand = ctx->lp_host.demand;
+    LPFrameLease lease = {0};
+    uint64_t lastCopy = 0;
+    bool missed = false;
+    int ret = 0;
+
+    lp__log_trace("Started capture thread");
+    while (!atomic_load_explicit(&cap->stop, memory_order_acquire))
+    {
+        ret = lpLeaseFrame(ctx, &lease);
+        if (ret == -EAGAIN)
+        {
+            ret = 0;
+            // Once frames may be copied again, catch up on the last frame
+            // that was throttled, in case the guest does not send another one
+            if (missed && lpDemandReady(demand, lastCopy, lpGetTimeNs()))
+            {
+                missed = false;
+                ret = lpResubscribeFrames(ctx);
+                if (ret < 0)
+                {
+                    break;
+                }
+            }
+            continue;
+        }
+        if (ret < 0)
+        {
+            lp__log_error("Unable to get frame from LGMP: %d", ret);
+            break;
+        }
+
+        LPCaptureFrame * f = NULL;
+        if (!lpDemandAdmit(demand, &lastCopy, lease.time))
+        {
+            // The client is not keeping up, the frame would only be replaced
+            st->throttled++;
+            missed = true;
+        }
+        else if (!(f = lpRingAcquire(&cap->ring)))
+        {
+            // Every staging buffer is queued or being sent
+            st->skipped++;
+        }
+        else
+        {
+            uint64_t start = lpGetTimeNs();
+            bool copied = cap->scaler ? 
+                lpScaleFrame(cap->scaler, f->data, lease.fb, 
+                             lease.frame->pitch) :
+                lpCaptureCopy(f->data, lease.fb, cap->frame_size);
+            if (copied)
+            {
+                f->size     = cap->frame_size;
+                f->serial   = lease.frame->frameSerial;
+                f->time     = lease.time;
+                lpRingCommit(&cap->ring);
+                lpCaptureRecord(st, lpGetTimeNs() - start);
+                missed = false;
+            }
+            else
+            {
+                lp__log_debug("Timed out waiting for frame data");
+                st->skipped++;
+            }
+        }
+
+        ret = lpReleaseFrame(ctx, &lease);
+        if (ret < 0)
+        {
+            break;
+        }
+        lpCaptureReport("Capture", st, false);
+    }
+
+    lpReleaseFrame(ctx, &lease);
+    if (ret < 0)
+    {
+        atomic_store_explicit(&cap->status, ret, memory_order_release);
+    }
+    lp__log_trace("Capture thread exited");
+    return NULL;
+}
+
+int lpCaptureStart(PLPContext ctx, PTRFContext cc, LPCapture * cap,
+                   size_t frameSize, uint32_t depth, LPScaler * scaler)
+{
+    if (!ctx || !cc || !cap || !frameSize || depth < 2 
+        || depth > LP_CAPTURE_DEPTH_MAX)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t count = 2;
+    while (count < depth)
+    {
+        count <<= 1;
+    }
+
+    memset(cap, 0, sizeof(*cap));
+    size_t psize = trf__GetPageSize();
+    size_t slotSize = (frameSize + psize - 1) / psize * psize;
+    cap->ctx        = ctx;
+    cap->frame_size = frameSize;
+    cap->scaler     = scaler;
+    cap->mem        = trfAllocAligned(slotSize * count, psize);
+    if (!cap->mem)
+    {
+        return -ENOMEM;
+    }
+
+    int ret = fi_mr_reg(cc->xfer.fabric->domain, cap->mem, slotSize * count,
+                        FI_WRITE, 0, 0, 0, &cap->mr, NULL);
+    if (ret < 0)
+    {
+        goto free_mem;
+    }
+
+    ret = lpRingInit(&cap->ring, sizeof(LPCaptureFrame), count);
+    if (ret < 0)
+    {
+        goto close_mr;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        LPCaptureFrame * f = lpRingElem(&cap->ring, i);
+        f->data = (uint8_t *) cap->mem + slotSize * i;
+    }
+
+    uint64_t now = lpGetTimeNs();
+    cap->cap_stats.last_report = now;
+    cap->net_stats.last_report = now;
+    atomic_init(&cap->stop, false);
+    atomic_init(&cap->status, 0);
+
+    ret = pthread_create(&cap->thread, NULL, lpCaptureThread, cap);
+    if (ret)
+    {
+        ret = -ret;
+        goto free_ring;
+    }
+    cap->started = true;
+    lp__log_debug("Capture queue: %u buffers of %lu bytes", count, slotSize);
+    return 0;
+
+free_ring:
+    lpRingFree(&cap->ring);
+close_mr:
+    fi_close(&cap->mr->fid);
+    cap->mr = NULL;
+free_mem:
+    free(cap->mem);
+    cap->mem = NULL;
+    return ret;
+}
+
+void lpCaptureStop(LPCapture * cap)
+{
+    if (!cap || !cap->started)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&cap->stop, true, memory_order_release);
+    pthread_join(cap->thread, NULL);
+    cap->started = false;
+
+    lpCaptureReport("Capture", &cap->cap_stats, true);
+    lpCaptureReport("Network", &cap->net_stats, true);
+
+    lpRingFree(&cap->ring);
+    fi_close(&cap->mr->fid);
+    cap->mr = NULL;
+    free(cap->mem);
+    cap->mem = NULL;
+}
+
+LPCaptureFrame * lpCaptureNext(LPCapture * cap, uint64_t serial)
+{
+    LPCaptureFrame * f;
+    while ((f = lpRingFront(&cap->ring)))
+    {
+        if (lpRingCount(&cap->ring) > 1)
+        {
+            // A newer frame has been captured
+            cap->net_stats.skipped++;
+            lpRingRelease(&cap->ring);
+            continue;
+        }
+        if (f->serial == serial)
+        {
+            // The sink already has this frame
+            lpRingRelease(&cap->ring);
+            return NULL;
+        }
+        return f;
+    }
+    return NULL;
+}
+
+void lpCaptureDone(LPCapture * cap, LPCaptureFrame * frame, uint64_t sendTime)
+{
+    LPCaptureStats * st = &cap->net_stats;
+    st->latency += lpGetTimeNs() - frame->time;
+    lpCaptureRecord(st, sendTime);
+    lpRingRelease(&cap->ring);
+    lpCaptureReport("Network", st, false);
+}
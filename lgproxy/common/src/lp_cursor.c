@@ -0,0 +1,587 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Update Queue
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_cursor.h"
+#include "lp_utils.h"
+#include <endian.h>
+
+int lpCursorQueueInit(LPCursorQueue * q)
+{
+    if (!q)
+    {
+        return -EINVAL;
+    }
+    
+    int ret = lpRingInit(&q->shapes, sizeof(LPCursorShape), 
+                         LP_CURSOR_SHAPE_RING_LEN);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    q->shape_buf = malloc((size_t) LP_CURSOR_SHAPE_RING_LEN * MAX_POINTER_SIZE);
+    if (!q->shape_buf)
+    {
+        lpRingFree(&q->shapes);
+        return -ENOMEM;
+    }
+
+    atomic_init(&q->pos_lock, 0);
+    atomic_init(&q->pos_x, 0);
+    atomic_init(&q->pos_y, 0);
+    atomic_init(&q->pos_flags, 0);
+    atomic_init(&q->pos_seq, 0);
+    atomic_init(&q->pos_time, 0);
+    q->seq      = 0;
+    q->sent_seq = 0;
+    return 0;
+}
+
+void lpCursorQueueFree(LPCursorQueue * q)
+{
+    if (!q)
+    {
+        return;
+    }
+
+    lpRingFree(&q->shapes);
+    free(q->shape_buf);
+    q->shape_buf = NULL;
+}
+
+static void lpCursorQueueSetPos(LPCursorQueue * q, int16_t x, int16_t y, 
+                                uint32_t flags, uint32_t seq, uint64_t time)
+{
+    uint32_t lock = atomic_load_explicit(&q->pos_lock, memory_order_relaxed);
+    atomic_store_explicit(&q->pos_lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&q->pos_x, x, memory_order_relaxed);
+    atomic_store_explicit(&q->pos_y, y, memory_order_relaxed);
+    atomic_store_explicit(&q->pos_flags, flags, memory_order_relaxed);
+    atomic_store_explicit(&q->pos_seq, seq, memory_order_relaxed);
+    atomic_store_explicit(&q->pos_time, time, memory_order_relaxed);
+
+    atomic_store_explicit(&q->pos_lock, lock + 2, memory_order_release);
+}
+
+KVMFRCursor * lpCursorQueueAcquireShape(LPCursorQueue * q)
+{
+    if (!lpRingAcquire(&q->shapes))
+    {
+        return NULL;
+    }
+    uint32_t head = atomic_load_explicit(&q->shapes.head, 
+                                         memory_order_relaxed);
+    return (KVMFRCursor *) (q->shape_buf 
+            + (size_t) (head & q->shapes.mask) * MAX_POINTER_SIZE);
+}
+
+int lpCursorQueuePush(LPCursorQueue * q, KVMFRCursor * cursor, uint32_t size,
+                      uint32_t flags)
+{
+    if (!q || !cursor)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t seq = q->seq + 1;
+    uint64_t now = lpGetTimeNs();
+    if ((flags & CURSOR_FLAG_SHAPE) && size > sizeof(KVMFRCursor))
+    {
+        LPCursorShape * shape = lpRingAcquire(&q->shapes);
+        if (!shape)
+        {
+            return -EAGAIN;
+        }
+        if (cursor != lpCursorQueueAcquireShape(q))
+        {
+            return -EINVAL;
+        }
+        shape->cursor   = cursor;
+        shape->size     = size;
+        shape->flags    = flags;
+        shape->seq      = seq;
+        shape->time     = now;
+        lpRingCommit(&q->shapes);
+        
+        // The shape update carries a position too; record it so that an
+        // older position-only update is never sent after this shape
+        lpCursorQueueSetPos(q, cursor->x, cursor->y, 
+                            flags & ~CURSOR_FLAG_SHAPE, seq, now);
+    }
+    else
+    {
+        lpCursorQueueSetPos(q, cursor->x, cursor->y, flags, seq, now);
+    }
+    q->seq = seq;
+    return 0;
+}
+
+bool lpCursorQueuePopShape(LPCursorQueue * q, LPCursorShape * out)
+{
+    LPCursorShape * shape = lpRingFront(&q->shapes);
+    if (!shape)
+    {
+        return false;
+    }
+    *out = *shape;
+    q->sent_seq = out->seq;
+    return true;
+}
+
+void lpCursorQueueReleaseShape(LPCursorQueue * q)
+{
+    lpRingRelease(&q->shapes);
+}
+
+bool lpCursorQueuePopPos(LPCursorQueue * q, LPCursorPos * out)
+{
+    uint32_t lock;
+    do
+    {
+        lock = atomic_load_explicit(&q->pos_lock, memory_order_acquire);
+        if (lock & 1)
+        {
+            continue;
+        }
+        out->x      = atomic_load_explicit(&q->pos_x, memory_order_relaxed);
+        out->y      = atomic_load_explicit(&q->pos_y, memory_order_relaxed);
+        out->flags  = atomic_load_explicit(&q->pos_flags, 
+                                           memory_order_relaxed);
+        out->seq    = atomic_load_explicit(&q->pos_seq, memory_order_relaxed);
+        out->time   = atomic_load_explicit(&q->pos_time, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    }
+    while ((lock & 1) || 
+           lock != atomic_load_explicit(&q->pos_lock, memory_order_relaxed));
+
+    if ((int32_t) (out->seq - q->sent_seq) <= 0)
+    {
+        return false;
+    }
+    q->sent_seq = out->seq;
+    return true;
+}
+
+uint64_t lpHashShape(const void * data, size_t len)
+{
+    const uint8_t * p   = data;
+    uint64_t h          = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t w;
+
+    for (; len >= sizeof(w); len -= sizeof(w), p += sizeof(w))
+    {
+        memcpy(&w, p, sizeof(w));
+        h ^= w;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+
+    w = 0;
+    memcpy(&w, p, len);
+    h ^= w;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static bool lpShapeHdrEqual(const KVMFRCursor * a, const KVMFRCursor * b)
+{
+    return a->type   == b->type   && a->hx     == b->hx     &&
+           a->hy     == b->hy     && a->width  == b->width  &&
+           a->height == b->height && a->pitch  == b->pitch;
+}
+
+uint32_t lpShapeCacheLookup(LPShapeCache * cache, const KVMFRCursor * cursor,
+                            uint32_t size, bool * hit)
+{
+    uint64_t hash = lpHashShape(cursor + 1, size);
+    int victim = 0;
+    cache->clock++;
+
+    for (int i = 0; i < LP_CURSOR_CACHE_LEN; i++)
+    {
+        LPShapeCacheEntry * e = &cache->entries[i];
+        if (e->valid && e->hash == hash && e->size == size 
+            && lpShapeHdrEqual(&e->hdr, cursor))
+        {
+            e->last_used = cache->clock;
+            *hit = true;
+            return i + 1;
+        }
+        LPShapeCacheEntry * v = &cache->entries[victim];
+        if (v->valid && (!e->valid || e->last_used < v->last_used))
+        {
+            victim = i;
+        }
+    }
+
+    LPShapeCacheEntry * e = &cache->entries[victim];
+    e->hash         = hash;
+    e->hdr          = *cursor;
+    e->size         = size;
+    e->last_used    = cache->clock;
+    e->valid        = true;
+    *hit = false;
+    return victim + 1;
+}
+
+int lpShapeStorePut(LPShapeStore * store, uint32_t id, 
+                    const KVMFRCursor * cursor, const void * data, 
+                    uint32_t size)
+{
+    if (!store || !id || id > LP_CURSOR_CACHE_LEN 
+        || size > MAX_POINTER_SIZE - sizeof(KVMFRCursor))
+    {
+        return -EINVAL;
+    }
+
+    LPShapeStoreEntry * e = &store->entries[id - 1];
+    uint32_t needed = sizeof(KVMFRCursor) + size;
+    if (e->alloc < needed)
+    {
+        KVMFRCursor * tmp = realloc(e->cursor, needed);
+        if (!tmp)
+        {
+            return -ENOMEM;
+        }
+        e->cursor   = tmp;
+        e->alloc    = needed;
+    }
+
+    memcpy(e->cursor, cursor, sizeof(KVMFRCursor));
+    memcpy(e->cursor + 1, data, size);
+    e->size = size;
+    return 0;
+}
+
+KVMFRCursor * lpShapeStoreGet(LPShapeStore * store, uint32_t id, 
+                              uint32_t * size)
+{
+    if (!store || !id || id > LP_CURSOR_CACHE_LEN)
+    {
+        return NULL;
+    }
+
+    LPShapeStoreEntry * e = &store->entries[id - 1];
+    if (!e->size)
+    {
+        return NULL;
+    }
+    *size = e->size;
+    return e->cursor;
+}
+
+void lpShapeStoreFree(LPShapeStore * store)
+{
+    if (!store)
+    {
+        return;
+    }
+    for (int i = 0; i < LP_CURSOR_CACHE_LEN; i++)
+    {
+        free(store->entries[i].cursor);
+        store->entries[i].cursor    = NULL;
+        store->entries[i].alloc     = 0;
+        store->entries[i].size      = 0;
+    }
+}
+
+/*  Output cursor for the shape encoder */
+typedef struct {
+    uint8_t *   p;
+    uint8_t *   end;
+} LPCodecOut;
+
+static inline bool lpCodecPutCount(LPCodecOut * o, uint8_t run, uint32_t n)
+{
+    if (n <= 127)
+    {
+        if (o->p >= o->end)
+            return false;
+        *o->p++ = run | (n - 1);
+        return true;
+    }
+    if (o->end - o->p < 3)
+        return false;
+    uint16_t ext = n - 128;
+    *o->p++ = run | 0x7F;
+    *o->p++ = ext & 0xFF;
+    *o->p++ = ext >> 8;
+    return true;
+}
+
+static inline bool lpCodecPutElems(LPCodecOut * o, const uint8_t * src, 
+                                   uint32_t n, uint32_t es, 
+                                   const uint8_t * idx)
+{
+    if (idx)
+    {
+        if ((size_t) (o->end - o->p) < n)
+            return false;
+        memcpy(o->p, idx, n);
+        o->p += n;
+        return true;
+    }
+    if ((size_t) (o->end - o->p) < (size_t) n * es)
+        return false;
+    memcpy(o->p, src, (size_t) n * es);
+    o->p += (size_t) n * es;
+    return true;
+}
+
+/**
+ * @brief Build a palette of 32-bit pixel values and map every pixel to its
+ * palette index
+ * 
+ * @param px        Pixels
+ * @param n         Number of pixels
+ * @param palette   Palette, LP_CURSOR_CODEC_PALETTE_LEN entries
+ * @param idx       Palette index of each pixel, n entries
+ * @return Number of palette entries, 0 if there are too many distinct values
+ */
+static int lpCodecPalette(const uint8_t * px, uint32_t n, uint32_t * palette, 
+                          uint8_t * idx)
+{
+    // Open addressing table mapping pixel values to palette entries + 1
+    uint8_t slots[512] = {0};
+    int count = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t v;
+        memcpy(&v, px + (size_t) i * 4, 4);
+        uint32_t h = (v * 0x9E3779B1u) >> 23;
+        while (slots[h] && palette[slots[h] - 1] != v)
+        {
+            h = (h + 1) & 511;
+        }
+        if (!slots[h])
+        {
+            if (count == LP_CURSOR_CODEC_PALETTE_LEN)
+            {
+                return 0;
+            }
+            palette[count++] = v;
+            slots[h] = count;
+        }
+        idx[i] = slots[h] - 1;
+    }
+    return count;
+}
+
+ssize_t lpEncodeCursorShape(uint32_t type, const void * data, uint32_t size,
+                            void * out, size_t outLen)
+{
+    if (!data || !out)
+    {
+        return -EINVAL;
+    }
+    if (outLen < LP_CURSOR_CODEC_HDR_LEN)
+    {
+        return -ENOSPC;
+    }
+
+    // Monochrome shapes are 1bpp masks, colour shapes 32bpp pixels
+    const uint8_t * src = data;
+    uint32_t es = (type != LG_CURSOR_MONOCHROME && size % 4 == 0) ? 4 : 1;
+    uint32_t n  = size / es;
+    LPCodecOut o = { .p = out, .end = (uint8_t *) out + outLen };
+
+    uint32_t rawSize = htole32(size);
+    memcpy(o.p, &rawSize, 4);
+    o.p[4] = es;
+    o.p[5] = 0;
+    o.p += LP_CURSOR_CODEC_HDR_LEN;
+
+    uint8_t * idx = NULL;
+    if (es == 4 && n)
+    {
+        uint32_t palette[LP_CURSOR_CODEC_PALETTE_LEN];
+        idx = malloc(n);
+        if (!idx)
+        {
+            return -ENOMEM;
+        }
+        int pl = lpCodecPalette(src, n, palette, idx);
+        if (pl && (size_t) (o.end - o.p) >= (size_t) pl * 4)
+        {
+            memcpy(o.p, palette, (size_t) pl * 4);
+            o.p += pl * 4;
+            ((uint8_t *) out)[5] = pl;
+        }
+        else
+        {
+            free(idx);
+            idx = NULL;
+        }
+    }
+
+    ssize_t ret = -ENOSPC;
+    uint32_t lit = 0;       // Start of pending literal elements
+    uint32_t i   = 0;
+    while (i < n)
+    {
+        // Measure the run starting at i
+        const uint8_t * e = src + (size_t) i * es;
+        uint32_t run = 1;
+        while (i + run < n && run < 128 + UINT16_MAX 
+               && memcmp(e, e + (size_t) run * es, es) == 0)
+        {
+            run++;
+        }
+        if (run < 3 && i + run < n)
+        {
+            i += run;
+            continue;
+        }
+        if (run < 3)
+        {
+            i += run;
+            run = 0;
+        }
+
+        // Flush literals before the run
+        while (lit < i)
+        {
+            uint32_t cnt = i - lit;
+            if (cnt > 128 + UINT16_MAX)
+                cnt = 128 + UINT16_MAX;
+            if (!lpCodecPutCount(&o, 0, cnt) 
+                || !lpCodecPutElems(&o, src + (size_t) lit * es, cnt, es, 
+                                    idx ? idx + lit : NULL))
+                goto out;
+            lit += cnt;
+        }
+        if (run)
+        {
+            if (!lpCodecPutCount(&o, 0x80, run) 
+                || !lpCodecPutElems(&o, e, 1, es, idx ? idx + i : NULL))
+                goto out;
+            i   += run;
+            lit  = i;
+        }
+    }
+    ret = o.p - (uint8_t *) out;
+
+out:
+    free(idx);
+    return ret;
+}
+
+ssize_t lpDecodeCursorShape(uint8_t codec, const void * data, uint32_t size,
+                            void * out, size_t outLen)
+{
+    if (!data || !out)
+    {
+        return -EINVAL;
+    }
+    if (codec == LP_CURSOR_CODEC_NONE)
+    {
+        if (size > outLen)
+        {
+            return -EMSGSIZE;
+        }
+        memcpy(out, data, size);
+        return size;
+    }
+    if (codec != LP_CURSOR_CODEC_RLE || size < LP_CURSOR_CODEC_HDR_LEN)
+    {
+        return -EBADMSG;
+    }
+
+    const uint8_t * p   = data;
+    const uint8_t * end = p + size;
+    uint32_t rawSize;
+    memcpy(&rawSize, p, 4);
+    rawSize     = le32toh(rawSize);
+    uint32_t es = p[4];
+    uint32_t pl = p[5];
+    p += LP_CURSOR_CODEC_HDR_LEN;
+
+    if (rawSize > outLen)
+    {
+        return -EMSGSIZE;
+    }
+    if ((es != 1 && es != 4) || rawSize % es || (pl && es != 4)
+        || (size_t) (end - p) < pl * 4)
+    {
+        return -EBADMSG;
+    }
+
+    const uint8_t * palette = p;
+    p += pl * 4;
+    uint8_t * dst       = out;
+    uint8_t * dstEnd    = dst + rawSize;
+    uint32_t ref        = pl ? 1 : es;
+
+    while (p < end)
+    {
+        uint8_t c = *p++;
+        uint32_t n = (c & 0x7F) + 1;
+        if ((c & 0x7F) == 0x7F)
+        {
+            if (end - p < 2)
+                return -EBADMSG;
+            n = 128 + (p[0] | (p[1] << 8));
+            p += 2;
+        }
+        if ((size_t) (dstEnd - dst) < (size_t) n * es)
+        {
+            return -EBADMSG;
+        }
+
+        uint32_t refs = (c & 0x80) ? 1 : n;
+        if ((size_t) (end - p) < (size_t) refs * ref)
+        {
+            return -EBADMSG;
+        }
+        for (uint32_t i = 0; i < refs; i++, p += ref)
+        {
+            const uint8_t * v = p;
+            if (pl)
+            {
+                if (*p >= pl)
+                    return -EBADMSG;
+                v = palette + *p * 4;
+            }
+            if (c & 0x80)
+            {
+                for (uint32_t j = 0; j < n; j++, dst += es)
+                    memcpy(dst, v, es);
+            }
+            else
+            {
+                memcpy(dst, v, es);
+                dst += es;
+            }
+        }
+    }
+
+    if (dst != dstEnd)
+    {
+        return -EBADMSG;
+    }
+    return rawSize;
+}
@@ -0,0 +1,205 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Client Consumption Feedback
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_demand.h"
+#include "lp_log.h"
+#include "lp_utils.h"
+
+static const char * lpDemandLevelName[] = {
+    "consuming frames, resuming capture",
+    "falling behind, throttling capture",
+    "not consuming frames, pausing capture"
+};
+
+static enum LPDemandLevel lpDemandLevel(const LPDemandReport * r)
+{
+    if (!r->subs)
+    {
+        return LP_DEMAND_PAUSED;
+    }
+    if (!r->backlog)
+    {
+        return LP_DEMAND_FULL;
+    }
+    return r->rate ? LP_DEMAND_THROTTLED : LP_DEMAND_PAUSED;
+}
+
+static uint64_t lpDemandPack(const LPDemandReport * r)
+{
+    return (uint64_t) r->rate 
+           | (uint64_t) r->pending << 32
+           | (uint64_t) (r->depth & 0xFF) << 48
+           | (uint64_t) r->subs << 56
+           | (uint64_t) r->backlog << 57;
+}
+
+static void lpDemandUnpack(uint64_t v, LPDemandReport * r)
+{
+    r->rate     = (uint32_t) v;
+    r->pending  = (uint16_t) (v >> 32);
+    r->depth    = (uint16_t) ((v >> 48) & 0xFF);
+    r->subs     = (v >> 56) & 1;
+    r->backlog  = (v >> 57) & 1;
+}
+
+void lpDemandMeterSample(LPDemandMeter * m, uint64_t consumed, 
+                         uint32_t pending, uint32_t depth, bool subs)
+{
+    uint64_t now = lpGetTimeNs();
+
+    // The counters start over when the LGMP host is reinitialized
+    if (!m->window_start || consumed < m->window_consumed)
+    {
+        m->window_start     = now;
+        m->window_consumed  = consumed;
+        m->drained          = false;
+    }
+    if (pending < depth)
+    {
+        m->drained = true;
+    }
+
+    uint64_t elapsed = now - m->window_start;
+    uint64_t n = consumed - m->window_consumed;
+    bool windowEnd = elapsed >= LP_DEMAND_WINDOW_MS * 1000000ULL;
+    if (windowEnd)
+    {
+        m->rate             = n * 1000000000000ULL / elapsed;
+        m->backlog          = !m->drained;
+        m->window_start     = now;
+        m->window_consumed  = consumed;
+        m->drained          = pending < depth;
+    }
+
+    LPDemandReport r = {
+        .pending    = pending,
+        .depth      = depth,
+        .subs       = subs,
+        .backlog    = m->backlog,
+        .rate       = m->rate
+    };
+
+    bool publish = !m->last_time 
+                   || now - m->last_time >= LP_DEMAND_REFRESH_MS * 1000000ULL
+                   || r.subs != m->last.subs;
+    if (!windowEnd && n && lpDemandLevel(&m->last) == LP_DEMAND_PAUSED)
+    {
+        // A stalled client has consumed a frame: report it right away
+        // instead of waiting for the window to end
+        r.backlog   = false;
+        r.rate      = n * 1000000000000ULL 
+                      / (elapsed > 1000000ULL ? elapsed : 1000000ULL);
+        publish     = true;
+    }
+    else if (windowEnd)
+    {
+        uint64_t diff = r.rate > m->last.rate ? r.rate - m->last.rate 
+                                              : m->last.rate - r.rate;
+        publish |= lpDemandLevel(&r) != lpDemandLevel(&m->last)
+                   || (lpDemandLevel(&r) == LP_DEMAND_THROTTLED 
+                       && diff * 100 > (uint64_t) m->last.rate 
+                                       * LP_DEMAND_RATE_CHANGE);
+    }
+    if (!publish)
+    {
+        return;
+    }
+
+    m->last      = r;
+    m->last_time = now;
+    atomic_store_explicit(&m->report, lpDemandPack(&r), memory_order_relaxed);
+    atomic_fetch_add_explicit(&m->seq, 1, memory_order_release);
+}
+
+bool lpDemandMeterPoll(LPDemandMeter * m, unsigned int * seq, 
+                       LPDemandReport * out)
+{
+    unsigned int cur = atomic_load_explicit(&m->seq, memory_order_acquire);
+    if (cur == *seq)
+    {
+        return false;
+    }
+    *seq = cur;
+    lpDemandUnpack(atomic_load_explicit(&m->report, memory_order_relaxed), 
+                   out);
+    return true;
+}
+
+void lpDemandInit(LPDemand * d)
+{
+    atomic_init(&d->level, LP_DEMAND_FULL);
+    atomic_init(&d->interval, 0);
+}
+
+void lpDemandUpdate(LPDemand * d, const LPDemandReport * r)
+{
+    enum LPDemandLevel level = lpDemandLevel(r);
+    uint64_t interval = 0;
+    if (level == LP_DEMAND_THROTTLED)
+    {
+        interval = 100000000000000ULL / ((uint64_t) r->rate 
+                                         * LP_DEMAND_HEADROOM);
+    }
+    atomic_store_explicit(&d->interval, interval, memory_order_relaxed);
+    int prev = atomic_exchange_explicit(&d->level, level, 
+                                        memory_order_release);
+    if (prev != (int) level)
+    {
+        lp__log_info("Looking Glass client %s (%.1f fps)", 
+                     lpDemandLevelName[level], r->rate / 1000.0);
+    }
+    else if (level == LP_DEMAND_THROTTLED)
+    {
+        lp__log_debug("Capture throttled to %.1f fps", 
+                      1000000000.0 / interval);
+    }
+}
+
+bool lpDemandReady(LPDemand * d, uint64_t last, uint64_t now)
+{
+    if (!d)
+    {
+        return true;
+    }
+
+    switch (atomic_load_explicit(&d->level, memory_order_acquire))
+    {
+        case LP_DEMAND_PAUSED:
+            return false;
+        case LP_DEMAND_THROTTLED:
+            return now - last >= atomic_load_explicit(&d->interval, 
+                                                      memory_order_relaxed);
+        default:
+            return true;
+    }
+}
+
+bool lpDemandAdmit(LPDemand * d, uint64_t * last, uint64_t now)
+{
+    if (!lpDemandReady(d, *last, now))
+    {
+        return false;
+    }
+    *last = now;
+    return true;
+}
@@ -0,0 +1,370 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Mailbox
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_mailbox.h"
+
+static uint32_t lpMailboxCheck(const void * rec, size_t len)
+{
+    return (uint32_t) lpHashShape(rec, len);
+}
+
+/**
+ * @brief Copy a record that may be modified by the NIC at any time
+ * 
+ */
+static void lpMailboxLoad(void * dst, const volatile void * src, size_t len)
+{
+    const volatile uint8_t * s = src;
+    uint8_t * d = dst;
+    atomic_thread_fence(memory_order_acquire);
+    for (size_t i = 0; i < len; i++)
+    {
+        d[i] = s[i];
+    }
+    atomic_thread_fence(memory_order_acquire);
+}
+
+/**
+ * @brief RDMA write a buffer and wait for the write to complete
+ * 
+ */
+static int lpMailboxWrite(PTRFContext ctx, struct TRFMem * mr, void * buf,
+                          size_t len, uint64_t addr, uint64_t key)
+{
+    ssize_t ret;
+    while ((ret = fi_write(ctx->xfer.fabric->ep, buf, len, 
+                           trfMemFabricDesc(mr), ctx->xfer.fabric->peer_addr,
+                           addr, key, NULL)) == -FI_EAGAIN)
+    {
+        // No other operations are outstanding, so this only drives progress
+        struct fi_cq_data_entry de;
+        struct fi_cq_err_entry err;
+        trfFabricPollSend(ctx, &de, &err, 0, 0, NULL, 1);
+    }
+    if (ret < 0)
+    {
+        return ret;
+    }
+    return lpWaitSends(ctx, 1);
+}
+
+int lpMailboxCreate(PTRFContext ctx, LPMailbox * mb)
+{
+    if (!ctx || !mb)
+    {
+        return -EINVAL;
+    }
+
+    size_t psize = trf__GetPageSize();
+    size_t size = (sizeof(LPCursorMailbox) + psize - 1) / psize * psize;
+    mb->mem = trfAllocAligned(size, psize);
+    if (!mb->mem)
+    {
+        return -ENOMEM;
+    }
+    memset(mb->mem, 0, size);
+
+    // Providers that let the application choose keys need one that no other
+    // registration uses. The offer carries the key read back with fi_mr_key,
+    // so providers that choose their own keys work the same.
+    int ret = fi_mr_reg(ctx->xfer.fabric->domain, mb->mem, size, 
+                        FI_REMOTE_READ | FI_REMOTE_WRITE, 0, 
+                        (uint64_t) (uintptr_t) mb->mem, 0, &mb->mr, NULL);
+    if (ret < 0)
+    {
+        free(mb->mem);
+        mb->mem = NULL;
+        mb->mr  = NULL;
+        return ret;
+    }
+    mb->consumed = 0;
+    mb->offered  = false;
+    return 0;
+}
+
+void lpMailboxDestroy(LPMailbox * mb)
+{
+    if (!mb)
+    {
+        return;
+    }
+    if (mb->mr)
+    {
+        fi_close(&mb->mr->fid);
+        mb->mr = NULL;
+    }
+    free(mb->mem);
+    mb->mem = NULL;
+}
+
+int lpMailboxOffer(PTRFContext ctx, struct TRFMem * mem, LPMailbox * mb)
+{
+    if (!ctx || !mem || !mb || !mb->mem)
+    {
+        return -EINVAL;
+    }
+
+    ssize_t ret = lpPackCursorMailbox(trfMemPtr(mem), trfMemSize(mem), 
+                                      LP_MAILBOX_VERSION, 
+                                      LP_MAILBOX_SHAPE_SLOTS,
+                                      (uintptr_t) mb->mem, 
+                                      fi_mr_key(mb->mr),
+                                      sizeof(LPCursorMailbox));
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = trfFabricSend(ctx, mem, trfMemPtr(mem), ret, 
+                        ctx->xfer.fabric->peer_addr, ctx->opts);
+    return ret < 0 ? ret : 0;
+}
+
+bool lpMailboxReadPos(LPMailbox * mb, LPMailboxPos * out)
+{
+    LPMailboxPos rec;
+    lpMailboxLoad(&rec, &mb->mem->pos, sizeof(rec));
+    if (!rec.seq || le32toh(rec.check) 
+            != lpMailboxCheck(&rec, offsetof(LPMailboxPos, check)))
+    {
+        return false;
+    }
+
+    out->seq    = le32toh(rec.seq);
+    out->x      = le16toh(rec.x);
+    out->y      = le16toh(rec.y);
+    out->flags  = le32toh(rec.flags);
+    out->check  = le32toh(rec.check);
+    return true;
+}
+
+const uint8_t * lpMailboxReadShape(LPMailbox * mb, LPMailboxShapeHdr * out)
+{
+    uint32_t index = mb->consumed + 1;
+    LPMailboxShapeSlot * slot = 
+        &mb->mem->shapes[(index - 1) % LP_MAILBOX_SHAPE_SLOTS];
+
+    LPMailboxShapeHdr rec;
+    lpMailboxLoad(&rec, &slot->hdr, sizeof(rec));
+    if (le32toh(rec.index) != index || le32toh(rec.check)
+            != lpMailboxCheck(&rec, offsetof(LPMailboxShapeHdr, check)))
+    {
+        return NULL;
+    }
+
+    out->index      = index;
+    out->seq        = le32toh(rec.seq);
+    out->x          = le16toh(rec.x);
+    out->y          = le16toh(rec.y);
+    out->hx         = rec.hx;
+    out->hy         = rec.hy;
+    out->type       = rec.type;
+    out->codec      = rec.codec;
+    out->width      = le32toh(rec.width);
+    out->height     = le32toh(rec.height);
+    out->pitch      = le32toh(rec.pitch);
+    out->flags      = le32toh(rec.flags);
+    out->shape_id   = le32toh(rec.shape_id);
+    out->total      = le32toh(rec.total);
+    out->check      = le32toh(rec.check);
+    if (out->total > LP_MAILBOX_SHAPE_SIZE)
+    {
+        return NULL;
+    }
+    return slot->data;
+}
+
+void lpMailboxReleaseShape(LPMailbox * mb)
+{
+    mb->consumed++;
+    __atomic_store_n(&mb->mem->consumed, htole32(mb->consumed), 
+                     __ATOMIC_RELEASE);
+}
+
+int lpMailboxAccept(LPMailboxRemote * rm, const LPBinCursorMailbox * offer)
+{
+    if (!rm || !offer)
+    {
+        return -EINVAL;
+    }
+    if (offer->version != LP_MAILBOX_VERSION 
+        || offer->slots != LP_MAILBOX_SHAPE_SLOTS
+        || offer->size != sizeof(LPCursorMailbox))
+    {
+        return -EPROTO;
+    }
+
+    rm->addr        = offer->addr;
+    rm->key         = offer->key;
+    rm->written     = 0;
+    rm->consumed    = 0;
+    rm->inject      = true;
+    rm->active      = true;
+    return 0;
+}
+
+int lpMailboxWritePos(PTRFContext ctx, struct TRFMem * mr, void * ctrl,
+                      LPMailboxRemote * rm, const LPCursorPos * pos)
+{
+    LPMailboxPos * rec = ctrl;
+    rec->seq    = htole32(pos->seq);
+    rec->x      = htole16(pos->x);
+    rec->y      = htole16(pos->y);
+    rec->flags  = htole32(pos->flags);
+    rec->check  = htole32(lpMailboxCheck(rec, offsetof(LPMailboxPos, check)));
+
+    uint64_t addr = rm->addr + offsetof(LPCursorMailbox, pos);
+    if (rm->inject)
+    {
+        ssize_t ret = fi_inject_write(ctx->xfer.fabric->ep, rec, sizeof(*rec),
+                                      ctx->xfer.fabric->peer_addr, addr, 
+                                      rm->key);
+        switch (ret)
+        {
+            case 0:
+                return 0;
+            case -FI_EAGAIN:
+                break;
+            case -FI_EINVAL:
+            case -FI_EMSGSIZE:
+            case -FI_ENOSYS:
+            case -FI_EOPNOTSUPP:
+                lp__log_debug("Inject writes unsupported (%s)", 
+                              fi_strerror(-ret));
+                rm->inject = false;
+                break;
+            default:
+                return ret;
+        }
+    }
+    return lpMailboxWrite(ctx, mr, rec, sizeof(*rec), addr, rm->key);
+}
+
+/**
+ * @brief Wait until the sink has consumed enough shapes for shape index to
+ * be written
+ * 
+ */
+static int lpMailboxWaitSlot(PTRFContext ctx, struct TRFMem * mr, 
+                             void * ctrl, LPMailboxRemote * rm, 
+                             uint32_t index)
+{
+    struct timespec dl;
+    ssize_t ret = trfGetDeadline(&dl, 1000);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    while (index - rm->consumed > LP_MAILBOX_SHAPE_SLOTS)
+    {
+        uint32_t * consumed = ctrl;
+        ret = fi_read(ctx->xfer.fabric->ep, consumed, sizeof(*consumed),
+                      trfMemFabricDesc(mr), ctx->xfer.fabric->peer_addr,
+                      rm->addr + offsetof(LPCursorMailbox, consumed), 
+                      rm->key, NULL);
+        if (ret == -FI_EAGAIN)
+        {
+            continue;
+        }
+        if (ret < 0 || (ret = lpWaitSends(ctx, 1)) < 0)
+        {
+            return ret;
+        }
+
+        rm->consumed = le32toh(*consumed);
+        if (index - rm->consumed > LP_MAILBOX_SHAPE_SLOTS)
+        {
+            if (trf__HasPassed(CLOCK_MONOTONIC, &dl))
+            {
+                return -ETIMEDOUT;
+            }
+            usleep(10);
+        }
+    }
+    return 0;
+}
+
+int lpMailboxWriteShape(PTRFContext ctx, struct TRFMem * mr, void * data,
+                        void * ctrl, LPMailboxRemote * rm, 
+                        const LPCursorShape * shape, uint32_t shapeId,
+                        const LPCursorShapeData * payload)
+{
+    const KVMFRCursor * cursor = shape->cursor;
+    uint32_t total = payload->size;
+    if (total > LP_MAILBOX_SHAPE_SIZE)
+    {
+        return -EMSGSIZE;
+    }
+
+    uint32_t index = rm->written + 1;
+    int ret = lpMailboxWaitSlot(ctx, mr, ctrl, rm, index);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    uint64_t addr = rm->addr + offsetof(LPCursorMailbox, shapes)
+                    + ((index - 1) % LP_MAILBOX_SHAPE_SLOTS) 
+                      * sizeof(LPMailboxShapeSlot);
+
+    // The data must have landed before the header is written
+    if (total)
+    {
+        memcpy(data, payload->data, total);
+        ret = lpMailboxWrite(ctx, mr, data, total, 
+                             addr + offsetof(LPMailboxShapeSlot, data), 
+                             rm->key);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+
+    LPMailboxShapeHdr * rec = ctrl;
+    rec->index      = htole32(index);
+    rec->seq        = htole32(shape->seq);
+    rec->x          = htole16(cursor->x);
+    rec->y          = htole16(cursor->y);
+    rec->hx         = cursor->hx;
+    rec->hy         = cursor->hy;
+    rec->type       = cursor->type;
+    rec->codec      = payload->codec;
+    rec->width      = htole32(cursor->width);
+    rec->height     = htole32(cursor->height);
+    rec->pitch      = htole32(cursor->pitch);
+    rec->flags      = htole32(shape->flags);
+    rec->shape_id   = htole32(shapeId);
+    rec->total      = htole32(total);
+    rec->check      = htole32(lpMailboxCheck(rec, 
+                                offsetof(LPMailboxShapeHdr, check)));
+
+    ret = lpMailboxWrite(ctx, mr, rec, sizeof(*rec), 
+                         addr + offsetof(LPMailboxShapeSlot, hdr), rm->key);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    rm->written = index;
+    return 0;
+}
@@ -52,4 +52,682 @@ int lpKeepAlive(PTRFContext ctx)
                     trfMemPtr(&ctx->xfer.fabric->msg_mem),
                     dsize, ctx->xfer.fabric->peer_addr, 
                     ctx->opts);
-}
\ No newline at end of file
+}
+
+/*  Protobuf wire format parsing
+
+    Only the subset of the wire format used by CursorData is decoded; unknown
+    fields are skipped so that newer senders remain compatible.
+*/
+
+enum LPWireType {
+    LP_WIRE_VARINT  = 0,
+    LP_WIRE_I64     = 1,
+    LP_WIRE_LEN     = 2,
+    LP_WIRE_I32     = 5
+};
+
+static int lpWireVarint(const uint8_t ** p, const uint8_t * end, 
+                        uint64_t * out)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (*p >= end)
+        {
+            return -EBADMSG;
+        }
+        uint8_t b = *(*p)++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *out = v;
+            return 0;
+        }
+    }
+    return -EBADMSG;
+}
+
+static int lpWireSkip(const uint8_t ** p, const uint8_t * end, int wtype)
+{
+    uint64_t v;
+    switch (wtype)
+    {
+        case LP_WIRE_VARINT:
+            return lpWireVarint(p, end, &v);
+        case LP_WIRE_I64:
+            v = 8;
+            break;
+        case LP_WIRE_LEN:
+            if (lpWireVarint(p, end, &v) < 0)
+            {
+                return -EBADMSG;
+            }
+            break;
+        case LP_WIRE_I32:
+            v = 4;
+            break;
+        default:
+            return -EBADMSG;
+    }
+    if (v > (uint64_t) (end - *p))
+    {
+        return -EBADMSG;
+    }
+    *p += v;
+    return 0;
+}
+
+static int lpParseCursorFields(const uint8_t * p, const uint8_t * end,
+                               LPCursorDataView * out)
+{
+    while (p < end)
+    {
+        uint64_t key, v;
+        if (lpWireVarint(&p, end, &key) < 0)
+        {
+            return -EBADMSG;
+        }
+        int wtype = key & 7;
+        uint64_t field = key >> 3;
+
+        if (field == 9 && wtype == LP_WIRE_LEN) // data
+        {
+            if (lpWireVarint(&p, end, &v) < 0 || v > (uint64_t) (end - p))
+            {
+                return -EBADMSG;
+            }
+            out->data       = v ? p : NULL;
+            out->data_len   = v;
+            p += v;
+            continue;
+        }
+        if (wtype != LP_WIRE_VARINT)
+        {
+            if (lpWireSkip(&p, end, wtype) < 0)
+            {
+                return -EBADMSG;
+            }
+            continue;
+        }
+
+        if (lpWireVarint(&p, end, &v) < 0)
+        {
+            return -EBADMSG;
+        }
+        switch (field)
+        {
+            case 2:  out->hdr.x         = (uint32_t) v; break;
+            case 3:  out->hdr.y         = (uint32_t) v; break;
+            case 4:  out->hdr.hx        = (uint32_t) v; break;
+            case 5:  out->hdr.hy        = (uint32_t) v; break;
+            case 6:  out->hdr.width     = v; break;
+            case 7:  out->hdr.height    = v; break;
+            case 8:  out->hdr.type      = v; break;
+            case 10: out->hdr.pitch     = v; break;
+            case 11: out->flags         = v; break;
+            case 12: out->shape_id      = v; break;
+            default: break;
+        }
+    }
+    return 0;
+}
+
+int lpParseCursorData(const void * buf, size_t len, LPCursorDataView * out)
+{
+    if (!buf || !out)
+    {
+        return -EINVAL;
+    }
+
+    const uint8_t * p   = buf;
+    const uint8_t * end = p + len;
+    int ret             = -ENOMSG;
+    memset(out, 0, sizeof(*out));
+
+    while (p < end)
+    {
+        uint64_t key, v;
+        if (lpWireVarint(&p, end, &key) < 0)
+        {
+            return -EBADMSG;
+        }
+        int wtype = key & 7;
+        if ((key >> 3) == LP_MSG__MESSAGE_WRAPPER__WDATA_CURSOR_DATA
+            && wtype == LP_WIRE_LEN)
+        {
+            if (lpWireVarint(&p, end, &v) < 0 || v > (uint64_t) (end - p))
+            {
+                return -EBADMSG;
+            }
+            ret = lpParseCursorFields(p, p + v, out);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            p += v;
+            continue;
+        }
+        if (lpWireSkip(&p, end, wtype) < 0)
+        {
+            return -EBADMSG;
+        }
+        // A later oneof member replaces any cursor data seen so far
+        ret = -ENOMSG;
+    }
+    return ret;
+}
+
+enum LPBinType lpBinMsgType(const void * buf, size_t len)
+{
+    const LPBinHdr * hdr = buf;
+    if (!buf || len < sizeof(*hdr) 
+        || memcmp(hdr->magic, LP_BIN_MAGIC, sizeof(hdr->magic)) != 0)
+    {
+        return LP_BIN_INVALID;
+    }
+    if (hdr->version != LP_BIN_VERSION)
+    {
+        lp__log_error("Unsupported binary message version %d", hdr->version);
+        return LP_BIN_INVALID;
+    }
+
+    uint16_t type = le16toh(hdr->type);
+    if (type == LP_BIN_INVALID || type >= LP_BIN_MAX 
+        || le16toh(hdr->size) > len)
+    {
+        return LP_BIN_INVALID;
+    }
+    return type;
+}
+
+static void lpPackBinHdr(LPBinHdr * hdr, enum LPBinType type, uint16_t size)
+{
+    memcpy(hdr->magic, LP_BIN_MAGIC, sizeof(hdr->magic));
+    hdr->version    = LP_BIN_VERSION;
+    hdr->type       = htole16(type);
+    hdr->size       = htole16(size);
+}
+
+ssize_t lpPackCursorPos(void * buf, size_t len, int16_t x, int16_t y,
+                        uint32_t flags, uint32_t seq)
+{
+    LPBinCursorPos * msg = buf;
+    if (!buf || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_CURSOR_POS, sizeof(*msg));
+    msg->x      = htole16(x);
+    msg->y      = htole16(y);
+    msg->flags  = htole32(flags);
+    msg->seq    = htole32(seq);
+    return sizeof(*msg);
+}
+
+int lpUnpackCursorPos(const void * buf, size_t len, LPBinCursorPos * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_CURSOR_POS)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinCursorPos * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_CURSOR_POS;
+    out->hdr.size   = sizeof(*msg);
+    out->x          = le16toh(msg->x);
+    out->y          = le16toh(msg->y);
+    out->flags      = le32toh(msg->flags);
+    out->seq        = le32toh(msg->seq);
+    return 0;
+}
+
+ssize_t lpPackCursorShape(void * buf, size_t len, const KVMFRCursor * cursor,
+                          uint32_t flags, uint32_t shapeId, uint32_t seq,
+                          uint8_t codec, const void * data, uint32_t total, uint32_t offset,
+                          uint32_t chunk)
+{
+    LPBinCursorShape * msg = buf;
+    if (!buf || !cursor || (chunk && !data) || offset + chunk > total)
+    {
+        return -EINVAL;
+    }
+    size_t size = sizeof(*msg) + chunk;
+    if (len < size || size > UINT16_MAX)
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_CURSOR_SHAPE, size);
+    msg->x          = htole16(cursor->x);
+    msg->y          = htole16(cursor->y);
+    msg->hx         = cursor->hx;
+    msg->hy         = cursor->hy;
+    msg->type       = cursor->type;
+    msg->codec      = codec;
+    msg->width      = htole32(cursor->width);
+    msg->height     = htole32(cursor->height);
+    msg->pitch      = htole32(cursor->pitch);
+    msg->flags      = htole32(flags);
+    msg->shape_id   = htole32(shapeId);
+    msg->seq        = htole32(seq);
+    msg->total      = htole32(total);
+    msg->offset     = htole32(offset);
+    if (chunk)
+    {
+        memcpy(msg + 1, (const uint8_t *) data + offset, chunk);
+    }
+    return size;
+}
+
+ssize_t lpUnpackCursorShape(const void * buf, size_t len, 
+                            LPBinCursorShape * out, const uint8_t ** data)
+{
+    if (!out || !data || lpBinMsgType(buf, len) != LP_BIN_CURSOR_SHAPE)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinCursorShape * msg = buf;
+    uint16_t size = le16toh(msg->hdr.size);
+    if (size < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_CURSOR_SHAPE;
+    out->hdr.size   = size;
+    out->x          = le16toh(msg->x);
+    out->y          = le16toh(msg->y);
+    out->hx         = msg->hx;
+    out->hy         = msg->hy;
+    out->type       = msg->type;
+    out->codec      = msg->codec;
+    out->width      = le32toh(msg->width);
+    out->height     = le32toh(msg->height);
+    out->pitch      = le32toh(msg->pitch);
+    out->flags      = le32toh(msg->flags);
+    out->shape_id   = le32toh(msg->shape_id);
+    out->seq        = le32toh(msg->seq);
+    out->total      = le32toh(msg->total);
+    out->offset     = le32toh(msg->offset);
+
+    uint32_t chunk = size - sizeof(*msg);
+    if (out->offset > out->total || chunk > out->total - out->offset)
+    {
+        return -EINVAL;
+    }
+    *data = (const uint8_t *) (msg + 1);
+    return chunk;
+}
+
+ssize_t lpPackCursorMailbox(void * buf, size_t len, uint32_t version, 
+                            uint32_t slots, uint64_t addr, uint64_t key, 
+                            uint64_t size)
+{
+    LPBinCursorMailbox * msg = buf;
+    if (!buf || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_CURSOR_MAILBOX, sizeof(*msg));
+    msg->version    = htole32(version);
+    msg->slots      = htole32(slots);
+    msg->addr       = htole64(addr);
+    msg->key        = htole64(key);
+    msg->size       = htole64(size);
+    return sizeof(*msg);
+}
+
+int lpUnpackCursorMailbox(const void * buf, size_t len, 
+                          LPBinCursorMailbox * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_CURSOR_MAILBOX)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinCursorMailbox * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_CURSOR_MAILBOX;
+    out->hdr.size   = sizeof(*msg);
+    out->version    = le32toh(msg->version);
+    out->slots      = le32toh(msg->slots);
+    out->addr       = le64toh(msg->addr);
+    out->key        = le64toh(msg->key);
+    out->size       = le64toh(msg->size);
+    return 0;
+}
+
+ssize_t lpPackConsumption(void * buf, size_t len, uint16_t pending, 
+                          uint16_t depth, uint32_t flags, uint32_t rate)
+{
+    LPBinConsumption * msg = buf;
+    if (!buf || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_CONSUMPTION, sizeof(*msg));
+    msg->pending    = htole16(pending);
+    msg->depth      = htole16(depth);
+    msg->flags      = htole32(flags);
+    msg->rate       = htole32(rate);
+    return sizeof(*msg);
+}
+
+int lpUnpackConsumption(const void * buf, size_t len, LPBinConsumption * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_CONSUMPTION)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinConsumption * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_CONSUMPTION;
+    out->hdr.size   = sizeof(*msg);
+    out->pending    = le16toh(msg->pending);
+    out->depth      = le16toh(msg->depth);
+    out->flags      = le32toh(msg->flags);
+    out->rate       = le32toh(msg->rate);
+    return 0;
+}
+
+ssize_t lpPackViewport(void * buf, size_t len, const LPViewport * vp)
+{
+    LPBinViewport * msg = buf;
+    if (!buf || !vp || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_VIEWPORT, sizeof(*msg));
+    msg->x          = htole16(vp->x);
+    msg->y          = htole16(vp->y);
+    msg->width      = htole16(vp->width);
+    msg->height     = htole16(vp->height);
+    return sizeof(*msg);
+}
+
+int lpUnpackViewport(const void * buf, size_t len, LPViewport * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_VIEWPORT)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinViewport * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->x          = le16toh(msg->x);
+    out->y          = le16toh(msg->y);
+    out->width      = le16toh(msg->width);
+    out->height     = le16toh(msg->height);
+    return 0;
+}
+
+ssize_t lpPackProgressive(void * buf, size_t len, uint16_t width, 
+                          uint16_t height)
+{
+    LPBinProgressive * msg = buf;
+    if (!buf || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_PROGRESSIVE, sizeof(*msg));
+    msg->width      = htole16(width);
+    msg->height     = htole16(height);
+    msg->reserved   = 0;
+    return sizeof(*msg);
+}
+
+int lpUnpackProgressive(const void * buf, size_t len, 
+                        LPBinProgressive * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_PROGRESSIVE)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinProgressive * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_PROGRESSIVE;
+    out->hdr.size   = sizeof(*msg);
+    out->width      = le16toh(msg->width);
+    out->height     = le16toh(msg->height);
+    out->reserved   = le32toh(msg->reserved);
+    return 0;
+}
+
+ssize_t lpPackFocus(void * buf, size_t len, uint32_t rows)
+{
+    LPBinFocus * msg = buf;
+    if (!buf || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_FOCUS, sizeof(*msg));
+    msg->rows       = htole32(rows);
+    msg->reserved   = 0;
+    return sizeof(*msg);
+}
+
+int lpUnpackFocus(const void * buf, size_t len, LPBinFocus * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_FOCUS)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinFocus * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_FOCUS;
+    out->hdr.size   = sizeof(*msg);
+    out->rows       = le32toh(msg->rows);
+    out->reserved   = le32toh(msg->reserved);
+    return 0;
+}
+
+ssize_t lpPackTileHashes(void * buf, size_t len, const LPBinTileHashes * info,
+                         const uint64_t * hashes)
+{
+    LPBinTileHashes * msg = buf;
+    if (!buf || !info || (info->count && !hashes) 
+        || info->count > LP_BIN_TILE_HASHES_MAX)
+    {
+        return -EINVAL;
+    }
+    size_t size = sizeof(*msg) + info->count * sizeof(uint64_t);
+    if (len < size)
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_TILE_HASHES, size);
+    msg->width      = htole16(info->width);
+    msg->height     = htole16(info->height);
+    msg->format     = htole16(info->format);
+    msg->tile       = htole16(info->tile);
+    msg->first      = htole16(info->first);
+    msg->count      = htole16(info->count);
+    msg->total      = htole16(info->total);
+    msg->reserved   = 0;
+    for (uint16_t i = 0; i < info->count; i++)
+    {
+        uint64_t h = htole64(hashes[i]);
+        memcpy((uint8_t *) (msg + 1) + i * sizeof(h), &h, sizeof(h));
+    }
+    return size;
+}
+
+int lpUnpackTileHashes(const void * buf, size_t len, LPBinTileHashes * out,
+                       const uint8_t ** hashes)
+{
+    if (!out || !hashes || lpBinMsgType(buf, len) != LP_BIN_TILE_HASHES)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinTileHashes * msg = buf;
+    uint16_t size = le16toh(msg->hdr.size);
+    if (size < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_TILE_HASHES;
+    out->hdr.size   = size;
+    out->width      = le16toh(msg->width);
+    out->height     = le16toh(msg->height);
+    out->format     = le16toh(msg->format);
+    out->tile       = le16toh(msg->tile);
+    out->first      = le16toh(msg->first);
+    out->count      = le16toh(msg->count);
+    out->total      = le16toh(msg->total);
+    out->reserved   = le16toh(msg->reserved);
+
+    if (size - sizeof(*msg) != out->count * sizeof(uint64_t)
+        || out->first > out->total || out->count > out->total - out->first)
+    {
+        return -EINVAL;
+    }
+    *hashes = (const uint8_t *) (msg + 1);
+    return 0;
+}
+
+ssize_t lpPackCompress(void * buf, size_t len, uint32_t format)
+{
+    LPBinCompress * msg = buf;
+    if (!buf || len < sizeof(*msg))
+    {
+        return -ENOBUFS;
+    }
+
+    lpPackBinHdr(&msg->hdr, LP_BIN_COMPRESS, sizeof(*msg));
+    msg->format     = htole32(format);
+    msg->reserved   = 0;
+    return sizeof(*msg);
+}
+
+int lpUnpackCompress(const void * buf, size_t len, LPBinCompress * out)
+{
+    if (!out || lpBinMsgType(buf, len) != LP_BIN_COMPRESS)
+    {
+        return -EINVAL;
+    }
+
+    const LPBinCompress * msg = buf;
+    if (le16toh(msg->hdr.size) < sizeof(*msg))
+    {
+        return -EINVAL;
+    }
+
+    out->hdr        = msg->hdr;
+    out->hdr.type   = LP_BIN_COMPRESS;
+    out->hdr.size   = sizeof(*msg);
+    out->format     = le32toh(msg->format);
+    out->reserved   = le32toh(msg->reserved);
+    return 0;
+}
+
+int lpWaitSends(PTRFContext ctx, size_t pending)
+{
+    struct fi_cq_data_entry de[16];
+    struct fi_cq_err_entry err;
+    struct timespec dl;
+    ssize_t ret = trfGetDeadline(&dl, 1000);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    while (pending)
+    {
+        size_t count = pending < 16 ? pending : 16;
+        ret = trfFabricPollSend(ctx, de, &err, ctx->opts->fab_cq_sync, 
+                                ctx->opts->fab_poll_rate, &dl, count);
+        if (ret == 0 || ret == -FI_EAGAIN)
+        {
+            continue;
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+        pending -= ret;
+    }
+    return 0;
+}
+
+ssize_t lpSendSmall(PTRFContext ctx, struct TRFMem * mem, void * buf, 
+                    size_t len, bool * inject)
+{
+    if (!ctx || !mem || !buf || !inject)
+    {
+        return -EINVAL;
+    }
+
+    if (*inject)
+    {
+        ssize_t ret = fi_inject(ctx->xfer.fabric->ep, buf, len, 
+                                ctx->xfer.fabric->peer_addr);
+        switch (ret)
+        {
+            case 0:
+                return 0;
+            case -FI_EAGAIN:
+                // Transmit queue full, a regular send will drive progress
+                break;
+            case -FI_EINVAL:
+            case -FI_EMSGSIZE:
+            case -FI_ENOSYS:
+            case -FI_EOPNOTSUPP:
+                lp__log_debug("Inject unsupported (%s), using regular sends", 
+                              fi_strerror(-ret));
+                *inject = false;
+                break;
+            default:
+                return ret;
+        }
+    }
+
+    ssize_t ret = trfFabricSend(ctx, mem, buf, len, 
+                                ctx->xfer.fabric->peer_addr, ctx->opts);
+    return ret < 0 ? ret : 0;
+}
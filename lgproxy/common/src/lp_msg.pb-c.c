@@ -283,7 +283,7 @@ const ProtobufCMessageDescriptor lp_msg__build_version__descriptor =
   (ProtobufCMessageInit) lp_msg__build_version__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor lp_msg__cursor_data__field_descriptors[11] =
+static const ProtobufCFieldDescriptor lp_msg__cursor_data__field_descriptors[12] =
 {
   {
     "dgid",
@@ -417,6 +417,18 @@ static const ProtobufCFieldDescriptor lp_msg__cursor_data__field_descriptors[11]
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "shape_id",
+    12,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(LpMsg__CursorData, shape_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned lp_msg__cursor_data__field_indices_by_name[] = {
   8,   /* field[8] = data */
@@ -426,6 +438,7 @@ static const unsigned lp_msg__cursor_data__field_indices_by_name[] = {
   3,   /* field[3] = hpx */
   4,   /* field[4] = hpy */
   9,   /* field[9] = pitch */
+  11,   /* field[11] = shape_id */
   7,   /* field[7] = tex_fmt */
   5,   /* field[5] = width */
   1,   /* field[1] = x */
@@ -434,7 +447,7 @@ static const unsigned lp_msg__cursor_data__field_indices_by_name[] = {
 static const ProtobufCIntRange lp_msg__cursor_data__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 11 }
+  { 0, 12 }
 };
 const ProtobufCMessageDescriptor lp_msg__cursor_data__descriptor =
 {
@@ -444,7 +457,7 @@ const ProtobufCMessageDescriptor lp_msg__cursor_data__descriptor =
   "LpMsg__CursorData",
   "lpMsg",
   sizeof(LpMsg__CursorData),
-  11,
+  12,
   lp_msg__cursor_data__field_descriptors,
   lp_msg__cursor_data__field_indices_by_name,
   1,  lp_msg__cursor_data__number_ranges,
@@ -0,0 +1,182 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Cursor Motion Predictor
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_predict.h"
+#include "lp_log.h"
+#include <math.h>
+
+int lpPredictInit(LPCursorPredictor * p, int rate)
+{
+    if (!p || rate <= 0)
+    {
+        return -EINVAL;
+    }
+
+    memset(p, 0, sizeof(*p));
+    p->interval = 1000000000ULL / rate;
+    return 0;
+}
+
+void lpPredictReset(LPCursorPredictor * p)
+{
+    p->vx                   = 0;
+    p->vy                   = 0;
+    p->valid                = false;
+    p->posted_prediction    = false;
+}
+
+void lpPredictSample(LPCursorPredictor * p, int16_t x, int16_t y, 
+                     uint64_t now)
+{
+    p->stats.samples++;
+
+    if (p->valid && p->posted_prediction)
+    {
+        double err = hypot(x - p->px, y - p->py);
+        p->stats.err_count++;
+        p->stats.err_sum    += err;
+        p->stats.err_sq_sum += err * err;
+        if (err > p->stats.err_max)
+        {
+            p->stats.err_max = err;
+        }
+    }
+
+    if (p->valid)
+    {
+        double dt = (now - p->last_time) / 1000000.0;
+        if (dt > LP_PREDICT_HORIZON_MS)
+        {
+            // The cursor was at rest, start again from zero velocity
+            p->vx = 0;
+            p->vy = 0;
+        }
+        else if (dt >= 0.25)
+        {
+            // Positions arriving in the same burst carry no timing
+            // information, so they only move the base position
+            const double a = LP_PREDICT_SMOOTHING;
+            p->vx = a * (x - p->x) / dt + (1 - a) * p->vx;
+            p->vy = a * (y - p->y) / dt + (1 - a) * p->vy;
+        }
+    }
+
+    p->x                    = x;
+    p->y                    = y;
+    p->px                   = x;
+    p->py                   = y;
+    p->last_time            = now;
+    p->post_time            = now;
+    p->valid                = true;
+    p->posted_prediction    = false;
+}
+
+static inline int16_t lpPredictAxis(int16_t base, double v, double dt)
+{
+    double d = v * dt;
+    if (d > LP_PREDICT_MAX_OVERSHOOT)
+    {
+        d = LP_PREDICT_MAX_OVERSHOOT;
+    }
+    else if (d < -LP_PREDICT_MAX_OVERSHOOT)
+    {
+        d = -LP_PREDICT_MAX_OVERSHOOT;
+    }
+
+    long r = lround(base + d);
+    if (r > INT16_MAX)
+    {
+        return INT16_MAX;
+    }
+    if (r < INT16_MIN)
+    {
+        return INT16_MIN;
+    }
+    return r;
+}
+
+bool lpPredictPosition(LPCursorPredictor * p, uint64_t now, int16_t * x, 
+                       int16_t * y)
+{
+    if (!p->valid || now < p->post_time + p->interval)
+    {
+        return false;
+    }
+
+    int16_t nx = p->x;
+    int16_t ny = p->y;
+    double dt = (now - p->last_time) / 1000000.0;
+    if (dt <= LP_PREDICT_HORIZON_MS)
+    {
+        nx = lpPredictAxis(p->x, p->vx, dt);
+        ny = lpPredictAxis(p->y, p->vy, dt);
+    }
+
+    p->post_time = now;
+    if (nx == p->px && ny == p->py)
+    {
+        return false;
+    }
+
+    p->px                   = nx;
+    p->py                   = ny;
+    p->posted_prediction    = nx != p->x || ny != p->y;
+    if (p->posted_prediction)
+    {
+        p->stats.predicted++;
+    }
+    *x = nx;
+    *y = ny;
+    return true;
+}
+
+uint64_t lpPredictNextTime(LPCursorPredictor * p)
+{
+    if (!p->valid)
+    {
+        return UINT64_MAX;
+    }
+
+    // Once the horizon has passed and the cursor is back at the received
+    // position, there is nothing left to predict until the next update
+    bool atRest = p->px == p->x && p->py == p->y 
+                  && (p->post_time - p->last_time > 
+                      LP_PREDICT_HORIZON_MS * 1000000ULL
+                      || (p->vx == 0 && p->vy == 0));
+    return atRest ? UINT64_MAX : p->post_time + p->interval;
+}
+
+void lpPredictLogStats(LPCursorPredictor * p)
+{
+    LPPredictStats * s = &p->stats;
+    if (!s->err_count)
+    {
+        lp__log_info("Cursor prediction: %lu positions, %lu predicted", 
+                     s->samples, s->predicted);
+        return;
+    }
+    lp__log_info("Cursor prediction: %lu positions, %lu predicted, error "
+                 "mean %.2f px, rms %.2f px, max %.2f px", 
+                 s->samples, s->predicted, s->err_sum / s->err_count, 
+                 sqrt(s->err_sq_sum / s->err_count), s->err_max);
+}
@@ -0,0 +1,204 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Tile hash resync
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_resync.h"
+#include "lp_cursor.h"
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int lpTileGridInit(LPTileGrid * g, uint32_t width, uint32_t height)
+{
+    if (!g || !width || !height)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t tile = LP_RESYNC_TILE_MIN;
+    uint32_t cols, rows;
+    while (1)
+    {
+        cols = (width + tile - 1) / tile;
+        rows = (height + tile - 1) / tile;
+        if ((uint64_t) cols * rows <= LP_RESYNC_TILES_MAX)
+        {
+            break;
+        }
+        tile *= 2;
+    }
+
+    g->width    = width;
+    g->height   = height;
+    g->tile     = tile;
+    g->cols     = cols;
+    g->rows     = rows;
+    g->count    = cols * rows;
+    return 0;
+}
+
+uint64_t lpHashTile(const LPTileGrid * g, const uint8_t * src, size_t pitch,
+                    size_t bpp, uint32_t index)
+{
+    uint32_t x  = (index % g->cols) * g->tile;
+    uint32_t y  = (index / g->cols) * g->tile;
+    uint32_t w  = g->width - x < g->tile ? g->width - x : g->tile;
+    uint32_t h  = g->height - y < g->tile ? g->height - y : g->tile;
+
+    // Rows are hashed separately with the cursor shape hash, then chained
+    const uint8_t * row = src + y * pitch + x * bpp;
+    uint64_t hash = index;
+    for (uint32_t i = 0; i < h; i++, row += pitch)
+    {
+        hash ^= lpHashShape(row, w * bpp);
+        hash *= 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+void lpHashTiles(const LPTileGrid * g, const uint8_t * src, size_t pitch,
+                 size_t bpp, uint64_t * out)
+{
+    for (uint32_t i = 0; i < g->count; i++)
+    {
+        out[i] = lpHashTile(g, src, pitch, bpp, i);
+    }
+}
+
+/*  Frame hash lanes, stripes and scrambling are laid out after XXH3: each
+    64-bit lane adds the product of the low and high halves of its word
+    mixed with a key, plus its neighbour's word, and the lanes are scrambled
+    every LP_HASH_STRIPES stripes so that no input bits are lost. */
+
+#define LP_HASH_LANES   8
+#define LP_HASH_STRIPE  (LP_HASH_LANES * sizeof(uint64_t))
+#define LP_HASH_STRIPES 16
+#define LP_HASH_PRIME32 0x9E3779B1U
+
+static const uint64_t lpHashKeys[LP_HASH_LANES] = {
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 
+    0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL, 
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 
+    0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+};
+
+#ifdef __SSE2__
+static void lpHashStripes(uint64_t * acc, const uint8_t * p, size_t stripes,
+                          bool scramble)
+{
+    __m128i a[LP_HASH_LANES / 2];
+    __m128i k[LP_HASH_LANES / 2];
+    for (int i = 0; i < LP_HASH_LANES / 2; i++)
+    {
+        a[i] = _mm_loadu_si128((const __m128i *) acc + i);
+        k[i] = _mm_loadu_si128((const __m128i *) lpHashKeys + i);
+    }
+    for (size_t s = 0; s < stripes; s++, p += LP_HASH_STRIPE)
+    {
+        for (int i = 0; i < LP_HASH_LANES / 2; i++)
+        {
+            __m128i d   = _mm_loadu_si128((const __m128i *) p + i);
+            __m128i dk  = _mm_xor_si128(d, k[i]);
+            __m128i hi  = _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1));
+            __m128i sw  = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(_mm_mul_epu32(dk, hi), 
+                                                     sw));
+        }
+    }
+    if (scramble)
+    {
+        const __m128i prime = _mm_set1_epi32(LP_HASH_PRIME32);
+        for (int i = 0; i < LP_HASH_LANES / 2; i++)
+        {
+            __m128i x = _mm_xor_si128(a[i], _mm_srli_epi64(a[i], 47));
+            x = _mm_xor_si128(x, k[i]);
+            __m128i lo = _mm_mul_epu32(x, prime);
+            __m128i hi = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+            a[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+        }
+    }
+    for (int i = 0; i < LP_HASH_LANES / 2; i++)
+    {
+        _mm_storeu_si128((__m128i *) acc + i, a[i]);
+    }
+}
+#else
+static void lpHashStripes(uint64_t * acc, const uint8_t * p, size_t stripes,
+                          bool scramble)
+{
+    for (size_t s = 0; s < stripes; s++, p += LP_HASH_STRIPE)
+    {
+        uint64_t d[LP_HASH_LANES];
+        memcpy(d, p, sizeof(d));
+        for (int i = 0; i < LP_HASH_LANES; i++)
+        {
+            d[i] = le64toh(d[i]);
+        }
+        for (int i = 0; i < LP_HASH_LANES; i++)
+        {
+            uint64_t dk = d[i] ^ lpHashKeys[i];
+            acc[i] += (dk & 0xFFFFFFFF) * (dk >> 32) + d[i ^ 1];
+        }
+    }
+    if (scramble)
+    {
+        for (int i = 0; i < LP_HASH_LANES; i++)
+        {
+            uint64_t x = acc[i] ^ (acc[i] >> 47) ^ lpHashKeys[i];
+            acc[i] = (x & 0xFFFFFFFF) * LP_HASH_PRIME32
+                     + (((x >> 32) * LP_HASH_PRIME32) << 32);
+        }
+    }
+}
+#endif
+
+uint64_t lpHashFrame(const void * data, size_t len)
+{
+    const uint8_t * p = data;
+    uint64_t acc[LP_HASH_LANES];
+    for (int i = 0; i < LP_HASH_LANES; i++)
+    {
+        acc[i] = lpHashKeys[i] ^ len;
+    }
+
+    size_t block = LP_HASH_STRIPE * LP_HASH_STRIPES;
+    size_t n = len;
+    for (; n >= block; n -= block, p += block)
+    {
+        lpHashStripes(acc, p, LP_HASH_STRIPES, true);
+    }
+    lpHashStripes(acc, p, n / LP_HASH_STRIPE, false);
+    p += n / LP_HASH_STRIPE * LP_HASH_STRIPE;
+    n %= LP_HASH_STRIPE;
+
+    for (int i = 0; i < LP_HASH_LANES; i++)
+    {
+        acc[i] = htole64(acc[i]);
+    }
+    return lpHashShape(acc, sizeof(acc)) 
+           ^ (lpHashShape(p, n) * 0x9E3779B97F4A7C15ULL);
+}
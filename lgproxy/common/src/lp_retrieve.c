@@ -37,12 +37,9 @@ int lpInitLgmpClient(PLPContext ctx)
         ret = -errno;
         goto out;
     }
-    ctx->ram = mmap(0, ctx->ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 
-                    0);
-    if (!ctx->ram)
+    ret = lpMapShm(ctx, fd);
+    if (ret < 0)
     {
-        lp__log_error("Unable to map shared memory: %s", strerror(errno));
-        ret = -errno;
         goto close_fd;
     }
     LGMP_STATUS status;
@@ -184,20 +181,23 @@ int lpClientInitSession(PLPContext ctx)
     return 0;
 }
 
-int lpGetFrame(PLPContext ctx, KVMFRFrame ** out, FrameBuffer ** fb)
+int lpLeaseFrame(PLPContext ctx, LPFrameLease * lease)
 {
-    if (!ctx || !out){
+    if (!ctx || !lease){
         return - EINVAL;
     }
+    if (lease->held)
+    {
+        return -EBUSY;
+    }
 
     LGMP_STATUS status;
 
-    uint32_t          frameSerial = 0;
     uint32_t          formatVer   = 0;
 
     if (ctx->state != LP_STATE_RUNNING)
     {
-        return 0;
+        return -ECANCELED;
     }
     
     LGMPMessage msg;
@@ -250,18 +250,8 @@ int lpGetFrame(PLPContext ctx, KVMFRFrame ** out, FrameBuffer ** fb)
 
     lp__log_trace("Frame offset: %lu", (uintptr_t) msg.mem - (uintptr_t) ctx->ram);
     KVMFRFrame * frame = (KVMFRFrame *)msg.mem;
-    if (frame->frameSerial == frameSerial && ctx->format_valid)
-    {
-        lp__log_error("Repeated Frame");
-        lgmpClientMessageDone(ctx->lp_host.client_q);
-    }
-    
-    if (frame)
-        lp__log_trace("Received frame size: %d x %d", 
-                      frame->frameWidth, frame->frameHeight);
-    
-    frameSerial = frame->frameSerial;
-    *out = frame;
+    lp__log_trace("Received frame size: %d x %d", 
+                  frame->frameWidth, frame->frameHeight);
     
     lp__log_trace("Frame Format: %d", lpLGToTrfFormat(frame->type));
     size_t ff = ((uint8_t *) frame - (uint8_t *) ctx->ram) + frame->offset;
@@ -279,17 +269,64 @@ int lpGetFrame(PLPContext ctx, KVMFRFrame ** out, FrameBuffer ** fb)
             lp__log_warn("Recommend increase size to %d MiB", size);
         }
     }
-    *fb = (FrameBuffer *)(((uint8_t*)frame) + frame->offset);
-    lgmpClientMessageDone(ctx->lp_host.client_q);
+
+    // The message is only marked as done when the lease is released
+    lease->frame    = frame;
+    lease->fb       = (FrameBuffer *)(((uint8_t*)frame) + frame->offset);
+    lease->time     = lpGetTimeNs();
+    lease->held     = true;
+    return 0;
+}
+
+int lpReleaseFrame(PLPContext ctx, LPFrameLease * lease)
+{
+    if (!ctx || !lease)
+    {
+        return -EINVAL;
+    }
+    if (!lease->held)
+    {
+        return 0;
+    }
+
+    lease->held = false;
+    lp__log_trace("Frame lease held for %.3f ms", 
+                  (lpGetTimeNs() - lease->time) / 1000000.0);
+    LGMP_STATUS status = lgmpClientMessageDone(ctx->lp_host.client_q);
+    if (status != LGMP_OK && status != LGMP_ERR_QUEUE_EMPTY)
+    {
+        lp__log_error("lgmpClientMessageDone: %s", lgmpStatusString(status));
+        return -EIO;
+    }
     return 0;
 }
 
-int lpgetCursor(PLPContext ctx, KVMFRCursor **out, uint32_t *size, uint32_t *flags)
+int lpResubscribeFrames(PLPContext ctx)
+{
+    if (!ctx)
+    {
+        return -EINVAL;
+    }
+
+    lgmpClientUnsubscribe(&ctx->lp_host.client_q);
+    LGMP_STATUS status = lgmpClientSubscribe(ctx->lp_host.lgmp_client, 
+                                             LGMP_Q_FRAME, 
+                                             &ctx->lp_host.client_q);
+    if (status != LGMP_OK)
+    {
+        lp__log_error("Unable to resubscribe to frame queue: %s", 
+                      lgmpStatusString(status));
+        ctx->state = LP_STATE_RESTART;
+        return -EIO;
+    }
+    return 0;
+}
+
+int lpgetCursor(PLPContext ctx, KVMFRCursor * out, uint32_t maxSize,
+                uint32_t * size, uint32_t * flags)
 {
     LGMP_STATUS status;
-    KVMFRCursor * cursor = NULL;
     LGMPMessage msg;
-    int cursorSize = 0;
 
     while (ctx->state == LP_STATE_RUNNING)
     {
@@ -300,7 +337,6 @@ int lpgetCursor(PLPContext ctx, KVMFRCursor **out, uint32_t *size, uint32_t *fla
         }
         if (status == LGMP_ERR_QUEUE_EMPTY) // No change in cursor position
         {
-            cursor = NULL;
             return 0;
         }
         if (status == LGMP_ERR_QUEUE_TIMEOUT)
@@ -326,33 +362,33 @@ int lpgetCursor(PLPContext ctx, KVMFRCursor **out, uint32_t *size, uint32_t *fla
             return -1;
         }
     }
+    if (ctx->state != LP_STATE_RUNNING)
+    {
+        return 0;
+    }
+
     KVMFRCursor *tmpCur = (KVMFRCursor *) msg.mem;
-    const int sizeNeeded = sizeof(*tmpCur) + 
+    const uint32_t sizeNeeded = sizeof(*tmpCur) + 
         (msg.udata & CURSOR_FLAG_SHAPE ? 
             tmpCur->height * tmpCur->pitch : 0);
-    
-    *flags = msg.udata; 
 
-    if (cursor && sizeNeeded > cursorSize)
+    if (sizeNeeded > MAX_POINTER_SIZE)
     {
-        free(cursor);
-        cursor = NULL;
+        lp__log_warn("Dropping oversized cursor shape (%u bytes)", 
+                     sizeNeeded);
+        lgmpClientMessageDone(ctx->lp_host.pointer_q);
+        return 0;
     }
-    if (!cursor)
+    if (sizeNeeded > maxSize)
     {
-        cursor = malloc(sizeNeeded);
-        if (!cursor)
-        {
-            lp__log_error("Unable to allocate memory for pointer data");
-            return -ENOMEM;
-        }
-        cursorSize = sizeNeeded;
+        // Leave the message in the queue until there is space for it
+        return -ENOBUFS;
     }
     
-    memcpy(cursor, msg.mem, sizeNeeded);
+    memcpy(out, msg.mem, sizeNeeded);
+    *flags = msg.udata;
+    *size = sizeNeeded;
 
     lgmpClientMessageDone(ctx->lp_host.pointer_q);
-    *out = cursor;
-    *size = cursorSize;
-    return 0;
+    return 1;
 }
\ No newline at end of file
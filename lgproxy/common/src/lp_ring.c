@@ -0,0 +1,77 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Lock-free Ring Buffer
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_ring.h"
+#include <stdlib.h>
+
+int lpRingInitBuf(LPRing * ring, void * buf, size_t elem_size, uint32_t count)
+{
+    if (!ring || !buf || !elem_size || !count || (count & (count - 1)))
+    {
+        return -EINVAL;
+    }
+
+    ring->data      = buf;
+    ring->elem_size = elem_size;
+    ring->mask      = count - 1;
+    ring->owned     = false;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+int lpRingInit(LPRing * ring, size_t elem_size, uint32_t count)
+{
+    if (!ring || !elem_size || !count)
+    {
+        return -EINVAL;
+    }
+
+    void * buf = calloc(count, elem_size);
+    if (!buf)
+    {
+        return -ENOMEM;
+    }
+
+    int ret = lpRingInitBuf(ring, buf, elem_size, count);
+    if (ret < 0)
+    {
+        free(buf);
+        return ret;
+    }
+    ring->owned = true;
+    return 0;
+}
+
+void lpRingFree(LPRing * ring)
+{
+    if (!ring)
+    {
+        return;
+    }
+    if (ring->owned)
+    {
+        free(ring->data);
+    }
+    ring->data = NULL;
+}
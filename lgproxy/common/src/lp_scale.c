@@ -0,0 +1,697 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Frame Downscaling
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_scale.h"
+#include "lp_log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int lpParseScale(const char * data, LPScaleOpts * out)
+{
+    unsigned int a, b;
+    int n = 0;
+    if (!data || !out)
+    {
+        return -EINVAL;
+    }
+    if (sscanf(data, "%ux%u%n", &a, &b, &n) == 2 && !data[n] && a && b)
+    {
+        out->factor = 0;
+        out->width  = a;
+        out->height = b;
+        return 0;
+    }
+    if (sscanf(data, "%u%n", &a, &n) == 1 && !data[n] && a >= 2)
+    {
+        out->factor = a;
+        out->width  = 0;
+        out->height = 0;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+int lpParseScaleFilter(const char * data)
+{
+    if (!data)
+    {
+        return -EINVAL;
+    }
+    if (strcasecmp(data, "box") == 0)
+    {
+        return LP_SCALE_BOX;
+    }
+    if (strcasecmp(data, "bilinear") == 0)
+    {
+        return LP_SCALE_BILINEAR;
+    }
+    return -EINVAL;
+}
+
+int lpScaleSize(const LPScaleOpts * opts, uint32_t * width, 
+                uint32_t * height)
+{
+    uint32_t w, h;
+    if (opts->factor)
+    {
+        if (opts->filter == LP_SCALE_BOX && opts->factor > LP_SCALE_BOX_MAX)
+        {
+            return -EINVAL;
+        }
+        w = *width / opts->factor;
+        h = *height / opts->factor;
+    }
+    else
+    {
+        w = opts->width;
+        h = opts->height;
+        if (opts->filter == LP_SCALE_BOX)
+        {
+            // Only whole blocks of pixels are averaged
+            uint32_t k = w ? *width / w : 0;
+            if (k < 2 || k > LP_SCALE_BOX_MAX || *width % w 
+                || *height != h * k)
+            {
+                return -EINVAL;
+            }
+        }
+    }
+    if (!w || !h || w > *width || h > *height)
+    {
+        return -EINVAL;
+    }
+    *width  = w;
+    *height = h;
+    return 0;
+}
+
+bool lpScaleFormatSupported(int format)
+{
+    switch (format)
+    {
+        case TRF_TEX_BGRA_8888:
+        case TRF_TEX_RGBA_8888:
+        case TRF_TEX_BGR_32:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Average 2x2 blocks of pixels from two source rows
+ * 
+ * @param dst       Destination row
+ * @param r0        First source row
+ * @param r1        Second source row
+ * @param dstW      Destination width in pixels
+ */
+static void lpBox2Row(uint8_t * restrict dst, const uint8_t * restrict r0, 
+                      const uint8_t * restrict r1, uint32_t dstW)
+{
+    uint32_t x = 0;
+#ifdef __SSE2__
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    for (; x + 2 <= dstW; x += 2)
+    {
+        // Four source pixels from each row make two destination pixels
+        __m128i a   = _mm_loadu_si128((const __m128i *) (r0 + x * 8));
+        __m128i b   = _mm_loadu_si128((const __m128i *) (r1 + x * 8));
+        __m128i lo  = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), 
+                                    _mm_unpacklo_epi8(b, zero));
+        __m128i hi  = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), 
+                                    _mm_unpackhi_epi8(b, zero));
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), 
+                                    _mm_unpackhi_epi64(lo, hi));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64((__m128i *) (dst + x * 4), 
+                         _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; x < dstW; x++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            dst[x * 4 + c] = (r0[x * 8 + c] + r0[x * 8 + 4 + c] 
+                              + r1[x * 8 + c] + r1[x * 8 + 4 + c] + 2) >> 2;
+        }
+    }
+}
+
+/**
+ * @brief Average k x k blocks of pixels
+ * 
+ * @param dst       Destination row
+ * @param src       First source row
+ * @param pitch     Size of a source row in bytes
+ * @param dstW      Destination width in pixels
+ * @param k         Box size
+ */
+static void lpBoxRow(uint8_t * restrict dst, const uint8_t * restrict src,
+                     size_t pitch, uint32_t dstW, uint32_t k)
+{
+    const uint32_t area = k * k;
+    for (uint32_t x = 0; x < dstW; x++)
+    {
+        uint32_t acc[4] = {0};
+        for (uint32_t dy = 0; dy < k; dy++)
+        {
+            const uint8_t * p = src + dy * pitch + x * k * 4;
+            for (uint32_t i = 0; i < k * 4; i += 4)
+            {
+                acc[0] += p[i];
+                acc[1] += p[i + 1];
+                acc[2] += p[i + 2];
+                acc[3] += p[i + 3];
+            }
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            dst[x * 4 + c] = (acc[c] + area / 2) / area;
+        }
+    }
+}
+
+/**
+ * @brief Interpolate between two source rows
+ * 
+ * @param tmp       Output, with LP_SCALE_FRAC_BITS fractional bits
+ * @param r0        Upper source row
+ * @param r1        Lower source row
+ * @param n         Number of bytes in a row
+ * @param w         Weight of the lower row
+ */
+static void lpLerpRows(uint16_t * restrict tmp, const uint8_t * restrict r0,
+                       const uint8_t * restrict r1, size_t n, uint16_t w)
+{
+    const uint16_t iw = (1 << LP_SCALE_FRAC_BITS) - w;
+    size_t i = 0;
+#ifdef __SSE2__
+    // The weights add up to 256, so the sum of the products fits in 16 bits
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i vw    = _mm_set1_epi16(w);
+    const __m128i viw   = _mm_set1_epi16(iw);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (r0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (r1 + i));
+        __m128i lo = _mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), viw),
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), vw));
+        __m128i hi = _mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), viw),
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), vw));
+        _mm_storeu_si128((__m128i *) (tmp + i), lo);
+        _mm_storeu_si128((__m128i *) (tmp + i + 8), hi);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        tmp[i] = r0[i] * iw + r1[i] * w;
+    }
+}
+
+/**
+ * @brief Interpolate between columns of a vertically interpolated row
+ * 
+ * @param dst       Destination row
+ * @param tmp       Vertically interpolated row
+ * @param s         Scaler
+ */
+static void lpLerpCols(uint8_t * restrict dst, const uint16_t * restrict tmp,
+                       const LPScaler * s)
+{
+    const uint32_t one   = 1 << LP_SCALE_FRAC_BITS;
+    const uint32_t round = 1 << (2 * LP_SCALE_FRAC_BITS - 1);
+    for (uint32_t x = 0; x < s->dst_w; x++)
+    {
+        const uint16_t * p = tmp + s->x_idx[x] * 4;
+        uint32_t w  = s->x_wt[x];
+        uint32_t iw = one - w;
+        for (int c = 0; c < 4; c++)
+        {
+            dst[x * 4 + c] = (p[c] * iw + p[c + 4] * w + round) 
+                             >> (2 * LP_SCALE_FRAC_BITS);
+        }
+    }
+}
+
+/**
+ * @brief Wait for the guest to write part of the source frame
+ * 
+ * @param s         Scaler
+ * @param size      Number of bytes needed from the start of the frame
+ * @return true once they are written, false on timeout
+ */
+static inline bool lpScaleWait(LPScaler * s, size_t size)
+{
+    return !s->fb || framebuffer_wait(s->fb, size);
+}
+
+/**
+ * @brief Scale one band of destination rows
+ * 
+ * @param b         Band
+ * @return true on success, false if the guest did not write the source rows
+ * in time
+ */
+static bool lpScaleBand(LPScaleBand * b)
+{
+    LPScaler * s        = b->s;
+    const uint8_t * src = s->src;
+    size_t dstPitch     = (size_t) s->dst_w * 4;
+    size_t srcLimit     = s->src_h * s->src_pitch;
+
+    for (uint32_t y = b->y0; y < b->y1; y++)
+    {
+        uint8_t * dst = s->dst + y * dstPitch;
+        if (s->filter == LP_SCALE_BOX)
+        {
+            const uint8_t * row = src + (size_t) y * s->factor * s->src_pitch;
+            if (!lpScaleWait(s, ((size_t) y + 1) * s->factor * s->src_pitch))
+            {
+                return false;
+            }
+            if (s->factor == 2)
+            {
+                lpBox2Row(dst, row, row + s->src_pitch, s->dst_w);
+            }
+            else
+            {
+                lpBoxRow(dst, row, s->src_pitch, s->dst_w, s->factor);
+            }
+        }
+        else
+        {
+            size_t need = ((size_t) s->y_idx[y] + 2) * s->src_pitch;
+            if (!lpScaleWait(s, need < srcLimit ? need : srcLimit))
+            {
+                return false;
+            }
+            const uint8_t * r0 = src + s->y_idx[y] * s->src_pitch;
+            const uint8_t * r1 = s->y_idx[y] + 1 < s->src_h ? 
+                                 r0 + s->src_pitch : r0;
+            lpLerpRows(b->tmp, r0, r1, (size_t) s->src_w * 4, s->y_wt[y]);
+            lpLerpCols(dst, b->tmp, s);
+        }
+    }
+    return true;
+}
+
+static void * lpScaleWorker(void * arg)
+{
+    LPScaleBand * b = (LPScaleBand *) arg;
+    LPScaler * s    = b->s;
+
+    // Wait for the other workers to be created
+    pthread_mutex_lock(&s->lock);
+    pthread_mutex_unlock(&s->lock);
+    if (atomic_load_explicit(&s->stop, memory_order_acquire))
+    {
+        return NULL;
+    }
+    while (1)
+    {
+        pthread_barrier_wait(&s->start);
+        if (atomic_load_explicit(&s->stop, memory_order_acquire))
+        {
+            break;
+        }
+        b->ok = lpScaleBand(b);
+        pthread_barrier_wait(&s->end);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Work out the source position and weight for each destination
+ * column or row of the bilinear filter
+ * 
+ * @param idx       Left or upper source index for each destination index
+ * @param wt        Weight of the right or lower source index
+ * @param src       Source size
+ * @param dst       Destination size
+ */
+static void lpScaleTable(uint32_t * idx, uint16_t * wt, uint32_t src, 
+                         uint32_t dst)
+{
+    const uint32_t one = 1 << LP_SCALE_FRAC_BITS;
+    for (uint32_t i = 0; i < dst; i++)
+    {
+        // Pixel centres are aligned between the source and destination
+        double pos = ((double) i + 0.5) * src / dst - 0.5;
+        if (pos < 0)
+        {
+            pos = 0;
+        }
+        uint32_t p = (uint32_t) pos;
+        uint32_t w = (uint32_t) ((pos - p) * one + 0.5);
+        if (w >= one)
+        {
+            p++;
+            w = 0;
+        }
+        if (p + 1 >= src)
+        {
+            p = src > 1 ? src - 2 : 0;
+            w = src > 1 ? one : 0;
+        }
+        idx[i]  = p;
+        wt[i]   = w;
+    }
+}
+
+int lpScalerInit(LPScaler * s, const LPScaleOpts * opts, uint32_t srcW, 
+                 uint32_t srcH, int threads)
+{
+    if (!s || !opts || threads < 1)
+    {
+        return -EINVAL;
+    }
+
+    memset(s, 0, sizeof(*s));
+    uint32_t w = srcW, h = srcH;
+    int ret = lpScaleSize(opts, &w, &h);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    s->src_w    = srcW;
+    s->src_h    = srcH;
+    s->dst_w    = w;
+    s->dst_h    = h;
+    s->filter   = opts->filter;
+    s->factor   = srcW / w;
+    s->threads  = threads > LP_SCALE_THREADS_MAX ? 
+                  LP_SCALE_THREADS_MAX : threads;
+    if ((uint32_t) s->threads > h)
+    {
+        s->threads = h;
+    }
+
+    if (s->filter == LP_SCALE_BILINEAR)
+    {
+        s->x_idx    = calloc(w, sizeof(*s->x_idx));
+        s->x_wt     = calloc(w, sizeof(*s->x_wt));
+        s->y_idx    = calloc(h, sizeof(*s->y_idx));
+        s->y_wt     = calloc(h, sizeof(*s->y_wt));
+        if (!s->x_idx || !s->x_wt || !s->y_idx || !s->y_wt)
+        {
+            ret = -ENOMEM;
+            goto free_tables;
+        }
+        lpScaleTable(s->x_idx, s->x_wt, srcW, w);
+        lpScaleTable(s->y_idx, s->y_wt, srcH, h);
+    }
+
+    for (int i = 0; i < s->threads; i++)
+    {
+        LPScaleBand * b = &s->bands[i];
+        b->s    = s;
+        b->y0   = (uint64_t) h * i / s->threads;
+        b->y1   = (uint64_t) h * (i + 1) / s->threads;
+        if (s->filter == LP_SCALE_BILINEAR)
+        {
+            b->tmp = malloc((size_t) srcW * 4 * sizeof(*b->tmp));
+            if (!b->tmp)
+            {
+                ret = -ENOMEM;
+                goto free_tables;
+            }
+        }
+    }
+
+    atomic_init(&s->stop, false);
+    if (s->threads > 1)
+    {
+        pthread_barrier_init(&s->start, NULL, s->threads);
+        pthread_barrier_init(&s->end, NULL, s->threads);
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_mutex_lock(&s->lock);
+        int i;
+        for (i = 1; i < s->threads; i++)
+        {
+            ret = pthread_create(&s->bands[i].thread, NULL, lpScaleWorker, 
+                                 &s->bands[i]);
+            if (ret)
+            {
+                lp__log_error("Unable to start scaling thread: %s", 
+                              strerror(ret));
+                ret = -ret;
+                break;
+            }
+        }
+        if (i < s->threads)
+        {
+            // The workers that did start exit before reaching the barriers
+            atomic_store_explicit(&s->stop, true, memory_order_release);
+            pthread_mutex_unlock(&s->lock);
+            for (int j = 1; j < i; j++)
+            {
+                pthread_join(s->bands[j].thread, NULL);
+            }
+            pthread_barrier_destroy(&s->start);
+            pthread_barrier_destroy(&s->end);
+            pthread_mutex_destroy(&s->lock);
+            goto free_tables;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    s->started = true;
+    lp__log_info("Downscaling %ux%u to %ux%u (%s) with %d threads", srcW, 
+                 srcH, w, h, s->filter == LP_SCALE_BOX ? "box" : "bilinear",
+                 s->threads);
+    return 0;
+
+free_tables:
+    for (int i = 0; i < LP_SCALE_THREADS_MAX; i++)
+    {
+        free(s->bands[i].tmp);
+        s->bands[i].tmp = NULL;
+    }
+    free(s->x_idx);
+    free(s->x_wt);
+    free(s->y_idx);
+    free(s->y_wt);
+    s->x_idx = NULL;
+    s->x_wt  = NULL;
+    s->y_idx = NULL;
+    s->y_wt  = NULL;
+    return ret;
+}
+
+void lpScalerDestroy(LPScaler * s)
+{
+    if (!s || !s->started)
+    {
+        return;
+    }
+
+    if (s->threads > 1)
+    {
+        atomic_store_explicit(&s->stop, true, memory_order_release);
+        pthread_barrier_wait(&s->start);
+        for (int i = 1; i < s->threads; i++)
+        {
+            pthread_join(s->bands[i].thread, NULL);
+        }
+        pthread_barrier_destroy(&s->start);
+        pthread_barrier_destroy(&s->end);
+        pthread_mutex_destroy(&s->lock);
+    }
+    for (int i = 0; i < LP_SCALE_THREADS_MAX; i++)
+    {
+        free(s->bands[i].tmp);
+        s->bands[i].tmp = NULL;
+    }
+    free(s->x_idx);
+    free(s->x_wt);
+    free(s->y_idx);
+    free(s->y_wt);
+    s->started = false;
+}
+
+/**
+ * @brief Scale the frame set in the scaler, with every thread
+ * 
+ * @param s         Scaler
+ * @return true on success, false if the guest did not finish writing the
+ * frame in time
+ */
+static bool lpScaleRun(LPScaler * s)
+{
+    if (s->threads > 1)
+    {
+        pthread_barrier_wait(&s->start);
+    }
+    bool ok = lpScaleBand(&s->bands[0]);
+    if (s->threads > 1)
+    {
+        pthread_barrier_wait(&s->end);
+        for (int i = 1; i < s->threads; i++)
+        {
+            ok = ok && s->bands[i].ok;
+        }
+    }
+    return ok;
+}
+
+bool lpScaleFrame(LPScaler * s, uint8_t * dst, FrameBuffer * fb, 
+                  size_t srcPitch)
+{
+    s->dst          = dst;
+    s->src          = framebuffer_get_data(fb);
+    s->fb           = fb;
+    s->src_pitch    = srcPitch;
+    return lpScaleRun(s);
+}
+
+void lpScaleBuffer(LPScaler * s, uint8_t * dst, const uint8_t * src, 
+                   size_t srcPitch)
+{
+    s->dst          = dst;
+    s->src          = src;
+    s->fb           = NULL;
+    s->src_pitch    = srcPitch;
+    lpScaleRun(s);
+}
+
+/**
+ * @brief Produce one row of a 2x bilinear upscale. Each output pixel is 9/16
+ * of the nearest input pixel, 3/16 of each of the next nearest ones along
+ * either axis and 1/16 of the one diagonally next to it.
+ * 
+ * @param out       Output row
+ * @param tmp       Scratch space for one vertically filtered input row
+ * @param near      Nearest input row
+ * @param far       Next nearest input row
+ * @param inW       Input width in pixels
+ * @param outW      Output width in pixels
+ */
+static void lpUpscaleRow(uint8_t * restrict out, uint16_t * restrict tmp,
+                         const uint8_t * near, const uint8_t * far, 
+                         uint32_t inW, uint32_t outW)
+{
+    size_t n = (size_t) inW * 4;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i three = _mm_set1_epi16(3);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a  = _mm_loadu_si128((const __m128i *) (near + i));
+        __m128i b  = _mm_loadu_si128((const __m128i *) (far + i));
+        __m128i lo = _mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), three),
+                        _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), three),
+                        _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i *) (tmp + i), lo);
+        _mm_storeu_si128((__m128i *) (tmp + i + 8), hi);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        tmp[i] = near[i] * 3 + far[i];
+    }
+
+    for (uint32_t x = 0; x < outW; x++)
+    {
+        uint32_t j = x / 2, k;
+        if (j >= inW)
+        {
+            j = k = inW - 1;
+        }
+        else if (x & 1)
+        {
+            k = j + 1 < inW ? j + 1 : j;
+        }
+        else
+        {
+            k = j ? j - 1 : 0;
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            out[x * 4 + c] = (tmp[j * 4 + c] * 3 + tmp[k * 4 + c] + 8) >> 4;
+        }
+    }
+}
+
+int lpUpscalePreview(uint8_t * buf, uint32_t width, uint32_t height)
+{
+    if (!buf || width < 2 || height < 2)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t inW        = width / 2;
+    uint32_t inH        = height / 2;
+    size_t inPitch      = (size_t) inW * 4;
+    size_t outPitch     = (size_t) width * 4;
+    uint16_t * tmp      = malloc(inPitch * sizeof(*tmp));
+    uint8_t * row       = malloc(outPitch);
+    if (!tmp || !row)
+    {
+        free(tmp);
+        free(row);
+        return -ENOMEM;
+    }
+
+    // Working from the bottom up, an output row only ever overwrites input
+    // rows that no remaining output row reads. Each row is produced in
+    // scratch space first, since the top rows overlap their own input.
+    for (uint32_t y = height; y-- > 0;)
+    {
+        uint32_t i = y / 2, k;
+        if (i >= inH)
+        {
+            i = k = inH - 1;
+        }
+        else if (y & 1)
+        {
+            k = i + 1 < inH ? i + 1 : i;
+        }
+        else
+        {
+            k = i ? i - 1 : 0;
+        }
+        lpUpscaleRow(row, tmp, buf + i * inPitch, buf + k * inPitch, inW, 
+                     width);
+        memcpy(buf + y * outPitch, row, outPitch);
+    }
+
+    free(tmp);
+    free(row);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    Telescope Project  
+    Looking Glass Proxy   
+    Transfer Priority Scheduling
+    
+    Copyright (c) 2022 Telescope Project Developers
+
+    This program is free software; you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by the Free
+    Software Foundation; either version 2 of the License, or (at your option)
+    any later version.
+
+    This program is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+    more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program; if not, write to the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
+*/
+#include "lp_sched.h"
+#include "lp_log.h"
+#include "lp_utils.h"
+#include <sched.h>
+
+static const char * lpSchedClassName[LP_SCHED_CLASS_MAX] = {
+    "Cursor",
+    "Frame",
+    "Frame hash"
+};
+
+void lpSchedInit(LPSched * s)
+{
+    atomic_init(&s->urgent, 0);
+    uint64_t now = lpGetTimeNs();
+    for (int i = 0; i < LP_SCHED_CLASS_MAX; i++)
+    {
+        s->stats[i] = (LPSchedStats) { .last_report = now };
+    }
+}
+
+uint64_t lpSchedWait(LPSched * s)
+{
+    if (!atomic_load_explicit(&s->urgent, memory_order_acquire))
+    {
+        return 0;
+    }
+
+    uint64_t start = lpGetTimeNs();
+    uint64_t now = start;
+    while (atomic_load_explicit(&s->urgent, memory_order_acquire)
+           && now - start < LP_SCHED_MAX_DEFER_US * 1000ULL)
+    {
+        sched_yield();
+        now = lpGetTimeNs();
+    }
+    return now - start;
+}
+
+void lpSchedRecord(LPSched * s, int cls, uint64_t delay)
+{
+    LPSchedStats * st = &s->stats[cls];
+    st->count++;
+    st->total += delay;
+    if (delay > st->max)
+    {
+        st->max = delay;
+    }
+}
+
+void lpSchedReport(LPSched * s, int cls, bool force)
+{
+    LPSchedStats * st = &s->stats[cls];
+    uint64_t now = lpGetTimeNs();
+    if (!force && now - st->last_report < LP_SCHED_REPORT_MS * 1000000ULL)
+    {
+        return;
+    }
+
+    if (st->count && force)
+    {
+        lp__log_info("%s queueing delay: %lu transfers, mean %.1f us, "
+                     "max %.1f us", lpSchedClassName[cls], st->count, 
+                     st->total / 1000.0 / st->count, st->max / 1000.0);
+    }
+    else if (st->count)
+    {
+        lp__log_debug("%s queueing delay: %lu transfers, mean %.1f us, "
+                      "max %.1f us", lpSchedClassName[cls], st->count, 
+                      st->total / 1000.0 / st->count, st->max / 1000.0);
+    }
+    *st = (LPSchedStats) { .last_report = now };
+}
@@ -22,6 +22,8 @@
     Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA. 
 */
 #include "lp_types.h"
+#include "lp_cursor.h"
+#include "lp_mailbox.h"
 
 PLPContext lpAllocContext(){
     PLPContext ctx = calloc(1, sizeof(* ctx));
@@ -40,6 +42,12 @@ void lpDestroyContext(PLPContext ctx){
     {
         lgmpClientFree(&ctx->lp_host.lgmp_client);
     }
+    if (ctx->lp_client.mailbox)
+    {
+        // Deregistered before the subchannel's domain is closed
+        lpMailboxDestroy(ctx->lp_client.mailbox);
+        free(ctx->lp_client.mailbox);
+    }
     if (ctx->lp_client.client_ctx)
     {
         trfDestroyContext(ctx->lp_client.client_ctx);
@@ -52,6 +60,12 @@ void lpDestroyContext(PLPContext ctx){
     {
         trfDestroyContext(ctx->lp_host.client_ctx);
     }
+    if (ctx->lp_client.shape_store)
+    {
+        lpShapeStoreFree(ctx->lp_client.shape_store);
+        free(ctx->lp_client.shape_store);
+    }
+    free(ctx->lp_client.resync_hashes);
     if (ctx->ram)
     {
         munmap(ctx->ram, ctx->ram_size);
@@ -23,6 +23,7 @@
 */
 #include "lp_utils.h"
 #include "version.h"
+#include "lp_sched.h"
 
 int lpPollMsg(PLPContext ctx, TrfMsg__MessageWrapper ** msg, int timeoutMs)
 {
@@ -132,6 +133,42 @@ int64_t lpParsePollString(char * data)
     }
 }
 
+int lpParseViewport(const char * data, LPViewport * out)
+{
+    unsigned int w, h, x, y;
+    int n = 0;
+    if (!data || !out 
+        || sscanf(data, "%ux%u+%u+%u%n", &w, &h, &x, &y, &n) != 4 
+        || data[n] || !w || !h || w > UINT16_MAX || h > UINT16_MAX 
+        || x > UINT16_MAX || y > UINT16_MAX)
+    {
+        return -EINVAL;
+    }
+
+    out->x      = x;
+    out->y      = y;
+    out->width  = w;
+    out->height = h;
+    return 0;
+}
+
+bool lpClipViewport(LPViewport * vp, uint32_t width, uint32_t height)
+{
+    if (!vp->width || !vp->height || vp->x >= width || vp->y >= height)
+    {
+        return false;
+    }
+    if (vp->x + vp->width > width)
+    {
+        vp->width = width - vp->x;
+    }
+    if (vp->y + vp->height > height)
+    {
+        vp->height = height - vp->y;
+    }
+    return true;
+}
+
 bool lpShouldTruncate(PLPContext ctx)
 {
     struct stat filestat;
@@ -153,9 +190,181 @@ bool lpShouldTruncate(PLPContext ctx)
 }
 
 
+ssize_t lpShmHugePageSize(const char * path)
+{
+    struct statfs fs;
+    if (statfs(path, &fs) < 0)
+    {
+        return -errno;
+    }
+    if (fs.f_type == HUGETLBFS_MAGIC)
+    {
+        return fs.f_bsize;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint8_t *   addr;
+    size_t      len;
+} LPPrefaultRange;
+
+static void * lpPrefaultThread(void * arg)
+{
+    LPPrefaultRange * r = (LPPrefaultRange *) arg;
+    size_t psize = trf__GetPageSize();
+
+#ifdef MADV_POPULATE_WRITE
+    // Populates writable page table entries without touching the data, so
+    // this is safe on memory that already contains a live LGMP session
+    if (madvise(r->addr, r->len, MADV_POPULATE_WRITE) == 0)
+    {
+        return NULL;
+    }
+#endif
+
+    // Older kernels - read one byte per page, which faults the page in
+    // without altering the contents
+    volatile uint8_t sink = 0;
+    for (size_t off = 0; off < r->len; off += psize)
+    {
+        sink += r->addr[off];
+    }
+    (void) sink;
+    return NULL;
+}
+
+int lpPrefaultMem(void * addr, size_t len, int threads)
+{
+    if (!addr || !len || threads < 1)
+    {
+        return -EINVAL;
+    }
+
+    size_t psize    = trf__GetPageSize();
+    size_t pages    = (len + psize - 1) / psize;
+    if ((size_t) threads > pages)
+    {
+        threads = pages;
+    }
+
+    pthread_t *         tids    = calloc(threads, sizeof(*tids));
+    LPPrefaultRange *   ranges  = calloc(threads, sizeof(*ranges));
+    if (!tids || !ranges)
+    {
+        free(tids);
+        free(ranges);
+        return -ENOMEM;
+    }
+
+    struct timespec ts, te;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    int ret = 0;
+    int started = 0;
+    size_t per_thread = pages / threads;
+    for (int i = 0; i < threads; i++)
+    {
+        size_t first = per_thread * i;
+        size_t count = (i == threads - 1) ? pages - first : per_thread;
+        ranges[i].addr  = (uint8_t *) addr + first * psize;
+        ranges[i].len   = count * psize;
+        if (ranges[i].addr + ranges[i].len > (uint8_t *) addr + len)
+        {
+            ranges[i].len = (uint8_t *) addr + len - ranges[i].addr;
+        }
+        ret = pthread_create(&tids[i], NULL, lpPrefaultThread, &ranges[i]);
+        if (ret)
+        {
+            lp__log_error("Unable to create prefault thread: %s", 
+                          strerror(ret));
+            ret = -ret;
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &te);
+    lp__log_debug("Prefaulted %lu MiB using %d threads in %.2f ms",
+                  len / 1048576, started,
+                  (te.tv_sec - ts.tv_sec) * 1000.0 
+                  + (te.tv_nsec - ts.tv_nsec) / 1000000.0);
+
+    free(tids);
+    free(ranges);
+    return ret;
+}
+
+int lpWorkerThreads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 3 ? cpus / 2 : 1;
+}
+
+int lpMapShm(PLPContext ctx, int fd)
+{
+    if (!ctx || fd < 0)
+    {
+        return -EINVAL;
+    }
+
+    int mflags = MAP_SHARED;
+    if (ctx->opts.prefault_threads == 1)
+    {
+        mflags |= MAP_POPULATE;
+    }
+
+    ctx->ram = mmap(0, ctx->ram_size, PROT_READ | PROT_WRITE, mflags, fd, 0);
+    if (ctx->ram == MAP_FAILED)
+    {
+        int err = errno;
+        ctx->ram = NULL;
+        lp__log_error("Unable to map shared memory: %s", strerror(err));
+        return -err;
+    }
+
+    // Files on hugetlbfs are always backed by huge pages. For regular shm
+    // files, request transparent huge pages; this is only honoured if shmem
+    // THP is enabled on the system, so failure here is not an error.
+    ssize_t hpsize = lpShmHugePageSize(ctx->shm);
+    if (hpsize > 0)
+    {
+        lp__log_info("Shared memory backed by %ld KiB huge pages", 
+                     hpsize / 1024);
+    }
+    else if (!ctx->dma_buf)
+    {
+        if (madvise(ctx->ram, ctx->ram_size, MADV_HUGEPAGE) < 0)
+        {
+            lp__log_debug("Transparent huge pages unavailable: %s", 
+                          strerror(errno));
+        }
+    }
+
+    if (ctx->opts.prefault_threads > 1)
+    {
+        int ret = lpPrefaultMem(ctx->ram, ctx->ram_size, 
+                                ctx->opts.prefault_threads);
+        if (ret < 0)
+        {
+            lp__log_warn("Unable to prefault shared memory: %s", 
+                         strerror(-ret));
+        }
+    }
+
+    return 0;
+}
+
 int lpSetDefaultOpts(PLPContext ctx)
 {
     ctx->opts.poll_int = 0;
+    ctx->opts.frame_chunk = LP_SCHED_DEFAULT_CHUNK;
+    ctx->opts.frame_slots = LP_FRAME_SLOTS_DEFAULT;
     ctx->shm = "/dev/shm/looking-glass";
     return 0;
 }
@@ -165,10 +374,12 @@ int lpRoundUpFrameSize(int size)
     return (int) powf(2.0f, ceilf(logf(size) / logf(2.0f)));
 }
 
-int lpCalcFrameSizeNeeded(PTRFDisplay display)
+int lpCalcFrameSizeNeeded(PTRFDisplay display, int slots)
 {
-    int needed = trfGetDisplayBytes(display) * 2 + \
-        (sizeof(KVMFRCursor) + 1048576) * 2;
+    // Each frame slot holds a page of headers followed by the frame data
+    int needed = (trfGetDisplayBytes(display) + trf__GetPageSize()) * slots + \
+        (sizeof(KVMFRCursor) + 1048576) * 2 + \
+        slots * LP_HUGE_PAGE_SIZE;
     return lpRoundUpFrameSize(needed);
 }
 
@@ -170,13 +170,13 @@ int lpInitHost(PLPContext ctx, PTRFDisplay display, bool initShm)
     struct LGMPQueueConfig frameQueueConfig = {
         .queueID        = LGMP_Q_FRAME,
         .numMessages    = LGMP_Q_FRAME_LEN,
-        .subTimeout     = 1000,
+        .subTimeout     = LP_LGMP_SUB_TIMEOUT_MS,
     };
 
     struct LGMPQueueConfig pointerQueueConfig = {
         .queueID        = LGMP_Q_POINTER,
         .numMessages    = LGMP_Q_POINTER_LEN,
-        .subTimeout     = 1000,
+        .subTimeout     = LP_LGMP_SUB_TIMEOUT_MS,
     };
     
     if ((status = lgmpHostQueueNew(ctx->lp_client.lgmp_host, frameQueueConfig, 
@@ -226,11 +226,50 @@ int lpInitHost(PLPContext ctx, PTRFDisplay display, bool initShm)
     ctx->lp_client.pointer_index = 0;
     ctx->lp_client.cursor_shape_index = 0;
 
-    ssize_t dispsize = trfGetDisplayBytes(display);
-    for (int i = 0; i < LGMP_Q_FRAME_LEN; ++i )
+    // Each slot holds the frame header and FrameBuffer in the first page,
+    // followed by the frame data
+    ssize_t dispsize = trfGetDisplayBytes(display) + trf__GetPageSize();
+    unsigned int slots = ctx->opts.frame_slots;
+    if (slots < 2 || slots > LP_FRAME_SLOTS_MAX)
+    {
+        slots = LP_FRAME_SLOTS_DEFAULT;
+    }
+
+    // Align frame slots to huge page boundaries so each frame is covered by
+    // as few TLB and IOMMU entries as possible, if there is room to do so
+    uint32_t align = LP_HUGE_PAGE_SIZE;
+    if (lgmpHostMemAvail(ctx->lp_client.lgmp_host) < 
+        (uint64_t) slots * (dispsize + LP_HUGE_PAGE_SIZE))
+    {
+        lp__log_warn("Shared memory too small for huge page aligned frames");
+        align = trf__GetPageSize();
+    }
+    if (lgmpHostMemAvail(ctx->lp_client.lgmp_host) < 
+        (uint64_t) slots * (dispsize + align))
+    {
+        lp__log_warn("Shared memory too small for %u frame slots, using %d",
+                     slots, LGMP_Q_FRAME_LEN);
+        slots = LGMP_Q_FRAME_LEN;
+    }
+
+    ctx->lp_client.frame_slots      = slots;
+    ctx->lp_client.frame_index      = 0;
+    ctx->lp_client.frame_post_head  = 0;
+    ctx->lp_client.frame_post_count = 0;
+    ctx->lp_client.display          = display;
+    atomic_store(&ctx->lp_client.frame_last, -1);
+
+    // A slot being received into stays owned by the receive thread
+    for (unsigned int i = 0; i < LP_FRAME_SLOTS_MAX; ++i)
+    {
+        int posted = LP_FRAME_SLOT_POSTED;
+        atomic_compare_exchange_strong(&ctx->lp_client.frame_state[i], 
+                                       &posted, LP_FRAME_SLOT_FREE);
+    }
+    for (unsigned int i = 0; i < slots; ++i)
     {
         if ((status = lgmpHostMemAllocAligned(ctx->lp_client.lgmp_host, dispsize,
-                trf__GetPageSize(), &ctx->lp_client.frame_memory[i])) != LGMP_OK)
+                align, &ctx->lp_client.frame_memory[i])) != LGMP_OK)
         {
             lp__log_error("lgmpHostMemAllocAligned Failed: %s", 
                 lgmpStatusString(status));
@@ -257,6 +296,11 @@ LGMP_STATUS lpKeepLGMPSessionAlive(PLPContext ctx, PTRFDisplay display)
         lpShutdown(ctx);
         // Reinit Host
         status = lpInitHost(ctx, display, false);
+        atomic_fetch_add(&ctx->lp_client.lgmp_gen, 1);
+        if (status == LGMP_OK && ctx->state == LP_STATE_RESTART)
+        {
+            ctx->state = LP_STATE_RUNNING;
+        }
         // Reinitialize Thread
         int ret = lpReinitCursorThread(ctx);
         if (ret < 0)
@@ -277,6 +321,80 @@ LGMP_STATUS lpKeepLGMPSessionAlive(PLPContext ctx, PTRFDisplay display)
     return status;
 }
 
+/**
+ * @brief Wait until the LGMP frame queue has room for another post. If the
+ * client is not consuming frames, back off gradually instead of spinning.
+ * 
+ * @param ctx       Context to use
+ * @return 0 with lgmp_lock held, -EAGAIN if the context is stopping
+ */
+static int lpWaitFrameQueue(PLPContext ctx)
+{
+    useconds_t backoff = 1;
+    pthread_mutex_lock(&ctx->lp_client.lgmp_lock);
+    while (lgmpHostQueuePending(ctx->lp_client.host_q) == LGMP_Q_FRAME_LEN)
+    {
+        pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+        if (ctx->state == LP_STATE_STOP)
+        {
+            return -EAGAIN;
+        }
+        usleep(backoff);
+        if (backoff < LP_LGMP_MAINT_INTERVAL_US)
+        {
+            backoff *= 2;
+        }
+        pthread_mutex_lock(&ctx->lp_client.lgmp_lock);
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the frame header of a slot. The LGMP maintenance thread frees
+ * and reallocates the slots when it reinitializes the host, so lgmp_lock must
+ * be held for as long as the header is used.
+ * 
+ * @param ctx   Context to use
+ * @param slot  Frame slot index
+ * @return Frame header, NULL if the host failed to reinitialize
+ */
+static KVMFRFrame * lpFrameHeader(PLPContext ctx, unsigned int slot)
+{
+    if (slot >= ctx->lp_client.frame_slots 
+        || !ctx->lp_client.frame_memory[slot])
+    {
+        return NULL;
+    }
+    return lgmpHostMemPtr(ctx->lp_client.frame_memory[slot]);
+}
+
+/**
+ * @brief Hand the frame slot being received into over to the LGMP
+ * maintenance thread. If the host was reinitialized while receiving, the
+ * frame was never posted to the current queue and the slot can be reused
+ * right away. Must be called with lgmp_lock held.
+ * 
+ * @param ctx       Context to use
+ * @param complete  The slot holds a complete frame, which may be posted
+ *                  again in place of an unchanged one
+ */
+static void lpHandOverFrameSlot(PLPContext ctx, bool complete)
+{
+    int slot = ctx->lp_client.frame_index;
+    if (ctx->lp_client.frame_gen == atomic_load(&ctx->lp_client.lgmp_gen))
+    {
+        atomic_store(&ctx->lp_client.frame_state[slot], LP_FRAME_SLOT_POSTED);
+        if (complete)
+        {
+            atomic_store(&ctx->lp_client.frame_last, slot);
+        }
+    }
+    else
+    {
+        atomic_store(&ctx->lp_client.frame_state[slot], LP_FRAME_SLOT_FREE);
+    }
+}
+
 int lpSignalFrameDone(PLPContext ctx, PTRFDisplay disp)
 {
     if (!ctx || !disp)
@@ -284,58 +402,330 @@ int lpSignalFrameDone(PLPContext ctx, PTRFDisplay disp)
 
     FrameBuffer * fb = trfGetFBPtr(disp) - sizeof(struct stFrameBuffer);
     framebuffer_set_write_ptr(fb, trfGetDisplayBytes(disp));
+    pthread_mutex_lock(&ctx->lp_client.lgmp_lock);
+    lpHandOverFrameSlot(ctx, true);
+    pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
     return 0;
 }
 
-int lpRequestFrame(PLPContext ctx, PTRFDisplay disp)
+int lpSignalFrameUnchanged(PLPContext ctx, PTRFDisplay disp)
 {
-    ctx->lp_client.frame_index = 0; 
-    bool repeatFrame = false;
-    while (ctx->state == LP_STATE_RUNNING && 
-        lgmpHostQueuePending(ctx->lp_client.host_q) == LGMP_Q_FRAME_LEN)
+    if (!ctx || !disp)
+        return -EINVAL;
+
+    // The slot was never posted, so it is released and the last complete
+    // frame is posted again in its place. If the host was reinitialized in
+    // the meantime there is no last frame, and the source sends a full frame
+    // in reply to the next request.
+    atomic_store(&ctx->lp_client.frame_state[ctx->lp_client.frame_index],
+                 LP_FRAME_SLOT_FREE);
+
+    LGMP_STATUS status = LGMP_OK;
+    pthread_mutex_lock(&ctx->lp_client.lgmp_lock);
+    int last = atomic_load(&ctx->lp_client.frame_last);
+    if (last >= 0 
+        && lgmpHostQueuePending(ctx->lp_client.host_q) < LGMP_Q_FRAME_LEN)
     {
-        usleep(1);
-        continue;
+        status = lpPostFrameSlot(ctx, last);
+    }
+    pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+    if (status != LGMP_OK)
+    {
+        // The slot is still handed over once received, and reclaimed later
+        lp__log_error("Unable to post queue: %s", lgmpStatusString(status));
     }
+    return 0;
+}
+
+int lpSignalFrameBand(PLPContext ctx, PTRFDisplay disp, uint32_t y, 
+                      uint32_t rows)
+{
+    if (!ctx || !disp || !rows || y + rows > disp->height)
+        return -EINVAL;
 
-    if (ctx->state != LP_STATE_RUNNING)
+    FrameBuffer * fb = trfGetFBPtr(disp) - sizeof(struct stFrameBuffer);
+    size_t pitch = trfGetTextureBytes(disp->width, 1, disp->format);
+    framebuffer_set_write_ptr(fb, (y + rows) * pitch);
+
+    // The slot is only posted now that the band is in place, so a client
+    // never reads the header before its damage is set
+    int slot = ctx->lp_client.frame_index;
+    if (lpWaitFrameQueue(ctx) < 0)
     {
+        atomic_store(&ctx->lp_client.frame_state[slot], LP_FRAME_SLOT_FREE);
         return -EAGAIN;
     }
+    LGMP_STATUS status = LGMP_OK;
+    KVMFRFrame * fi = lpFrameHeader(ctx, slot);
+    if (fi && ctx->lp_client.frame_gen == atomic_load(&ctx->lp_client.lgmp_gen))
+    {
+        fi->damageRects[0] = (FrameDamageRect) {
+            .x      = 0,
+            .y      = y,
+            .width  = disp->width,
+            .height = rows
+        };
+        fi->damageRectsCount = 1;
+        status = lpPostFrameSlot(ctx, slot);
+    }
+    lpHandOverFrameSlot(ctx, false);
+    pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+    if (status != LGMP_OK)
+    {
+        lp__log_error("Unable to post queue: %s", lgmpStatusString(status));
+    }
+    return 0;
+}
 
-    LGMP_STATUS status;
-    status = lgmpHostProcess(ctx->lp_client.lgmp_host);
+int lpFindResyncBase(PLPContext ctx, PTRFDisplay disp)
+{
+    if (!ctx || !disp)
+    {
+        return -EINVAL;
+    }
+    ctx->lp_client.resync_slot = -1;
+    if (trfTextureIsCompressed(disp->format))
+    {
+        return -ENOTSUP;
+    }
+
+    // Slots are allocated at the same offsets as long as the shared memory
+    // and display size are unchanged, and only a frame that was signalled
+    // as done in full has a write pointer covering the whole frame
+    size_t bytes        = trfGetDisplayBytes(disp);
+    size_t pitch        = trfGetTextureBytes(disp->width, 1, disp->format);
+    KVMFRFrame * base   = NULL;
+    for (unsigned int i = 0; i < ctx->lp_client.frame_slots; i++)
+    {
+        KVMFRFrame * fi = lgmpHostMemPtr(ctx->lp_client.frame_memory[i]);
+        if (fi->offset != trf__GetPageSize() - sizeof(struct stFrameBuffer)
+            || fi->type != lpTrftoLGFormat(disp->format)
+            || fi->frameWidth != disp->width 
+            || fi->frameHeight != disp->height
+            || fi->pitch != pitch || fi->damageRectsCount != 0)
+        {
+            continue;
+        }
+        FrameBuffer * fb = (FrameBuffer *) ((uint8_t *) fi + fi->offset);
+        if (fb->wp < bytes)
+        {
+            continue;
+        }
+        if (!base || (int32_t) (fi->frameSerial - base->frameSerial) > 0)
+        {
+            base = fi;
+            ctx->lp_client.resync_slot = i;
+        }
+    }
+    if (!base)
+    {
+        return -ENOENT;
+    }
+
+    LPTileGrid * g = &ctx->lp_client.resync_grid;
+    int ret = lpTileGridInit(g, disp->width, disp->height);
+    if (ret < 0)
+    {
+        goto no_base;
+    }
+    free(ctx->lp_client.resync_hashes);
+    ctx->lp_client.resync_hashes = calloc(g->count, sizeof(uint64_t));
+    if (!ctx->lp_client.resync_hashes)
+    {
+        ret = -ENOMEM;
+        goto no_base;
+    }
+
+    FrameBuffer * fb = (FrameBuffer *) ((uint8_t *) base + base->offset);
+    lpHashTiles(g, framebuffer_get_data(fb), pitch, pitch / disp->width,
+                ctx->lp_client.resync_hashes);
+    lp__log_info("Found frame %u of a previous session in slot %d, offering "
+                 "%u tile hashes", base->frameSerial, 
+                 ctx->lp_client.resync_slot, g->count);
+    return 0;
+
+no_base:
+    ctx->lp_client.resync_slot = -1;
+    return ret;
+}
+
+int lpRestoreResyncBase(PLPContext ctx, PTRFDisplay disp)
+{
+    if (!ctx || !disp || ctx->lp_client.resync_slot < 0)
+    {
+        return -EINVAL;
+    }
+    if (ctx->lp_client.resync_slot == (int) ctx->lp_client.frame_index)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->lp_client.lgmp_lock);
+    KVMFRFrame * fi = lpFrameHeader(ctx, ctx->lp_client.resync_slot);
+    if (!fi)
+    {
+        pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+        return -EAGAIN;
+    }
+    FrameBuffer * fb = (FrameBuffer *) ((uint8_t *) fi + fi->offset);
+    memcpy(trfGetFBPtr(disp), framebuffer_get_data(fb), 
+           trfGetDisplayBytes(disp));
+    pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+    return 0;
+}
+
+LGMP_STATUS lpPostFrameSlot(PLPContext ctx, unsigned int slot)
+{
+    LGMP_STATUS status = lgmpHostQueuePost(ctx->lp_client.host_q, 0,
+                                           ctx->lp_client.frame_memory[slot]);
     if (status != LGMP_OK)
     {
-        lp__log_error("lgmpHostProcess failed: %s", lgmpStatusString(status));
-        return -1;
+        return status;
     }
 
-    if (repeatFrame)
+    unsigned int * head     = &ctx->lp_client.frame_post_head;
+    unsigned int * count    = &ctx->lp_client.frame_post_count;
+    ctx->lp_client.frame_posted[(*head + *count) % LGMP_Q_FRAME_LEN] = slot;
+    if (*count < LGMP_Q_FRAME_LEN)
     {
-        status = lgmpHostQueuePost(
-            ctx->lp_client.host_q, 0,
-            ctx->lp_client.frame_memory[ctx->lp_client.frame_index]);
-        if (status != LGMP_OK)
+        (*count)++;
+    }
+    else
+    {
+        *head = (*head + 1) % LGMP_Q_FRAME_LEN;
+    }
+    ctx->lp_client.frame_post_time = lpGetTimeNs();
+    ctx->lp_client.frame_post_total++;
+    return LGMP_OK;
+}
+
+/**
+ * @brief Return posted frame slots that no client can still be reading to the
+ * receive thread. Frame queue messages are consumed in order, so the slots of
+ * the last lgmpHostQueuePending() posts are held and all others are free. The
+ * last complete frame is kept for reposting. Must be called with lgmp_lock
+ * held.
+ * 
+ * @param ctx       Context to use
+ */
+static void lpReclaimFrameSlots(PLPContext ctx)
+{
+    bool held[LP_FRAME_SLOTS_MAX] = {0};
+    unsigned int pending = lgmpHostQueuePending(ctx->lp_client.host_q);
+    unsigned int count = ctx->lp_client.frame_post_count;
+    if (pending > count)
+    {
+        pending = count;
+    }
+    for (unsigned int i = count - pending; i < count; i++)
+    {
+        held[ctx->lp_client.frame_posted[(ctx->lp_client.frame_post_head + i)
+                                         % LGMP_Q_FRAME_LEN]] = true;
+    }
+
+    int last = atomic_load(&ctx->lp_client.frame_last);
+    for (unsigned int i = 0; i < ctx->lp_client.frame_slots; i++)
+    {
+        if (held[i] || (int) i == last)
         {
-            lp__log_error("Failed lgmpHostQueuePost: %s", 
-                lgmpStatusString(status));
-            return -ENOBUFS;
+            continue;
+        }
+        int posted = LP_FRAME_SLOT_POSTED;
+        atomic_compare_exchange_strong(&ctx->lp_client.frame_state[i], 
+                                       &posted, LP_FRAME_SLOT_FREE);
+    }
+}
+
+/**
+ * @brief Take ownership of the next free frame slot
+ * 
+ * @param ctx       Context to use
+ * @return Slot index, -EBUSY if all slots are held
+ */
+static int lpClaimFrameSlot(PLPContext ctx)
+{
+    // Rotate through the slots, so that a client which has just released a
+    // slot does not race with it being overwritten
+    unsigned int slots = ctx->lp_client.frame_slots;
+    for (unsigned int i = 1; i <= slots; i++)
+    {
+        unsigned int slot = (ctx->lp_client.frame_index + i) % slots;
+        int free = LP_FRAME_SLOT_FREE;
+        if (atomic_compare_exchange_strong(&ctx->lp_client.frame_state[slot],
+                                           &free, LP_FRAME_SLOT_RECV))
+        {
+            return slot;
+        }
+    }
+    return -EBUSY;
+}
+
+int lpPostFrame(PLPContext ctx)
+{
+    int slot = ctx->lp_client.frame_index;
+    if (lpWaitFrameQueue(ctx) < 0)
+    {
+        atomic_store(&ctx->lp_client.frame_state[slot], LP_FRAME_SLOT_FREE);
+        return -EAGAIN;
+    }
+    // If the host was reinitialized since the header was written, the slot
+    // has no header in the new host, and is freed once handed over
+    LGMP_STATUS status = LGMP_OK;
+    if (ctx->lp_client.frame_gen == atomic_load(&ctx->lp_client.lgmp_gen))
+    {
+        status = lpPostFrameSlot(ctx, slot);
+    }
+    pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+    if (status != LGMP_OK)
+    {
+        // The slot is still handed over once received, and reclaimed later
+        lp__log_error("Unable to post queue: %s", lgmpStatusString(status));
+    }
+    return 0;
+}
+
+int lpRequestFrame(PLPContext ctx, PTRFDisplay disp, bool post)
+{
+    // Slots are returned by the LGMP maintenance thread
+    int slot;
+    while ((slot = lpClaimFrameSlot(ctx)) < 0)
+    {
+        if (ctx->state == LP_STATE_STOP)
+        {
+            return -EAGAIN;
         }
+        usleep(1);
     }
 
-    if (++ctx->lp_client.frame_index == LGMP_Q_FRAME_LEN)
+    ctx->lp_client.frame_index = slot;
+    lp__log_trace("Using frame slot %d", slot);
+
+    // The frame is posted before it is received, so that the client is
+    // already waiting on the frame buffer when the data arrives. Either way,
+    // the header is written under lgmp_lock, as the LGMP maintenance thread
+    // may reinitialize the host at any time.
+    if (!post)
     {
-        ctx->lp_client.frame_index = 0;
+        pthread_mutex_lock(&ctx->lp_client.lgmp_lock);
+    }
+    else if (lpWaitFrameQueue(ctx) < 0)
+    {
+        atomic_store(&ctx->lp_client.frame_state[slot], LP_FRAME_SLOT_FREE);
+        return -EAGAIN;
     }
 
-    lgmpHostQueueNewSubs(ctx->lp_client.host_q);
-    KVMFRFrame *fi = lgmpHostMemPtr(ctx->lp_client.frame_memory[ctx->lp_client.frame_index]);
+    KVMFRFrame *fi = lpFrameHeader(ctx, slot);
+    if (!fi)
+    {
+        pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+        atomic_store(&ctx->lp_client.frame_state[slot], LP_FRAME_SLOT_FREE);
+        return -EAGAIN;
+    }
 
     uint8_t comp = trfTextureIsCompressed(disp->format);
     
     fi->rotation         = FRAME_ROT_0;
-    fi->frameSerial      = disp->frame_cntr;
+    fi->frameSerial      = disp->frame_cntr & LP_FRAME_CNTR_SERIAL_MASK;
     fi->formatVer        = 1;
     fi->damageRectsCount = 0;
     fi->type             = lpTrftoLGFormat(disp->format);
@@ -375,29 +765,171 @@ int lpRequestFrame(PLPContext ctx, PTRFDisplay disp)
         lp__log_error("Address mismatch! Looking Glass: %p, LibTRF: %p",
                       framebuffer_get_data(fb), trfGetFBPtr(disp));
     }
+    lp__log_debug("Display offset: %lu", disp->fb_offset);
 
-    if ((status = lgmpHostQueuePost(ctx->lp_client.host_q, 0, 
-            ctx->lp_client.frame_memory[ctx->lp_client.frame_index])) != LGMP_OK)
+    ctx->lp_client.frame_gen = atomic_load(&ctx->lp_client.lgmp_gen);
+    LGMP_STATUS status = post ? lpPostFrameSlot(ctx, slot) : LGMP_OK;
+    pthread_mutex_unlock(&ctx->lp_client.lgmp_lock);
+    if (status != LGMP_OK)
     {
+        // The slot is still handed over once received, and reclaimed later
         lp__log_error("Unable to post queue: %s", lgmpStatusString(status));
-        return true;
     }
-    lp__log_debug("Display offset: %lu", disp->fb_offset);
     return 0;
-} 
+}
 
-int lpUpdateCursorPos(PLPContext ctx, KVMFRCursor * cur, uint32_t curShapeSize, 
-                uint32_t flags)
+/**
+ * @brief Post the last complete frame again, but only if a subscriber needs
+ * it: when a new subscriber has joined and has nothing to display yet, or
+ * when subscribers have read every posted frame and nothing has been posted
+ * for half the subscriber timeout. While a post is still pending, every
+ * subscriber has a frame left to read and nothing is reposted. Must be called
+ * with lgmp_lock held.
+ * 
+ * @param ctx       Context to use
+ */
+static void lpRepostFrame(PLPContext ctx)
 {
-    if (!ctx || !cur)
+    LPClient * c = &ctx->lp_client;
+
+    // Read the new subscriber count even without a frame, so that an old
+    // join does not trigger a repost later
+    uint32_t newSubs = lgmpHostQueueNewSubs(c->host_q);
+    int last = atomic_load(&c->frame_last);
+    if (last < 0 || !atomic_load(&c->has_subs))
     {
-        return -EINVAL;
+        return;
     }
 
-    lp__log_trace("Updating cursor position... %d, %d", cur->x, cur->y);
-    
+    uint32_t pending = lgmpHostQueuePending(c->host_q);
+    uint64_t * counter;
+    if (newSubs && pending < LGMP_Q_FRAME_LEN)
+    {
+        // New subscribers only receive messages posted after they joined
+        counter = &c->repost_new;
+    }
+    else if (!pending && lpGetTimeNs() - c->frame_post_time 
+                         > LP_LGMP_SUB_TIMEOUT_MS * 1000000ULL / 2)
+    {
+        counter = &c->repost_idle;
+    }
+    else
+    {
+        return;
+    }
+
+    LGMP_STATUS status = lpPostFrameSlot(ctx, last);
+    if (status != LGMP_OK)
+    {
+        lp__log_error("Failed lgmpHostQueuePost: %s", 
+                      lgmpStatusString(status));
+        return;
+    }
+    (*counter)++;
+    lp__log_debug("Reposted frame slot %d for %s subscriber", last, 
+                  counter == &c->repost_new ? "new" : "idle");
+}
+
+/**
+ * @brief Keep the LGMP session alive and return frame slots to the receive
+ * thread on a fixed interval, independently of network waits.
+ * 
+ * @param arg       PLPContext
+ */
+static void * lpLGMPThread(void * arg)
+{
+    PLPContext ctx = (PLPContext) arg;
+    LPClient * c = &ctx->lp_client;
+    lp__log_trace("Started LGMP maintenance thread");
+
+    while (ctx->state != LP_STATE_STOP)
+    {
+        pthread_mutex_lock(&c->lgmp_lock);
+        LGMP_STATUS status = lpKeepLGMPSessionAlive(ctx, c->display);
+        if (status != LGMP_OK)
+        {
+            pthread_mutex_unlock(&c->lgmp_lock);
+            ctx->state = LP_STATE_STOP;
+            break;
+        }
+        atomic_store(&c->has_subs, lgmpHostQueueHasSubs(c->host_q));
+        lpReclaimFrameSlots(ctx);
+
+        uint32_t pending = lgmpHostQueuePending(c->host_q);
+        lpDemandMeterSample(&c->demand, c->frame_post_total - pending, pending,
+                            LGMP_Q_FRAME_LEN, atomic_load(&c->has_subs));
+
+        lpRepostFrame(ctx);
+        pthread_mutex_unlock(&c->lgmp_lock);
+
+        if (c->thread_flags == T_STOP && ctx->state == LP_STATE_RUNNING)
+        {
+            if (c->sub_started)
+            {
+                pthread_join(c->cursor_thread, NULL);
+                c->sub_started = false;
+            }
+            int ret = lpReinitCursorThread(ctx);
+            if (ret < 0)
+            {
+                lp__log_error("Unable to reinitialize cursor thread: %s", 
+                              strerror(ret));
+                ctx->state = LP_STATE_STOP;
+                break;
+            }
+            lp__log_debug("Cursor thread Reinitialized");
+        }
+
+        usleep(LP_LGMP_MAINT_INTERVAL_US);
+    }
+
+    lp__log_info("Frames reposted: %lu for new subscribers, %lu for idle "
+                 "subscribers", c->repost_new, c->repost_idle);
+    lp__log_trace("LGMP maintenance thread exited");
+    return NULL;
+}
+
+int lpStartLGMPThread(PLPContext ctx)
+{
+    int ret = pthread_mutex_init(&ctx->lp_client.lgmp_lock, NULL);
+    if (ret)
+    {
+        return -ret;
+    }
+    ret = pthread_create(&ctx->lp_client.lgmp_thread, NULL, lpLGMPThread, 
+                         ctx);
+    if (ret)
+    {
+        pthread_mutex_destroy(&ctx->lp_client.lgmp_lock);
+        return -ret;
+    }
+    ctx->lp_client.lgmp_started = true;
+    return 0;
+}
+
+void lpStopLGMPThread(PLPContext ctx)
+{
+    if (!ctx->lp_client.lgmp_started)
+    {
+        return;
+    }
+    ctx->state = LP_STATE_STOP;
+    pthread_join(ctx->lp_client.lgmp_thread, NULL);
+    pthread_mutex_destroy(&ctx->lp_client.lgmp_lock);
+    ctx->lp_client.lgmp_started = false;
+} 
+
+/**
+ * @brief Get the next LGMP buffer to write a cursor update into
+ * 
+ * @param ctx       Context to use
+ * @param shape     Whether the update contains shape data
+ * @return LGMP memory to use
+ */
+static PLGMPMemory lpNextCursorMem(PLPContext ctx, bool shape)
+{
     PLGMPMemory mem;
-    if (!curShapeSize)
+    if (!shape)
     {
         mem = ctx->lp_client.pointer_memory[ctx->lp_client.pointer_index];
         if (++ctx->lp_client.pointer_index == LGMP_Q_POINTER_LEN)
@@ -411,18 +943,54 @@ int lpUpdateCursorPos(PLPContext ctx, KVMFRCursor * cur, uint32_t curShapeSize,
             ctx->lp_client.cursor_shape_index = 0;
         lp__log_trace("Using cursor-shape");
     }
+    return mem;
+}
+
+int lpUpdateCursor(PLPContext ctx, const KVMFRCursor * cur, 
+                   const void * shape, uint32_t shapeSize, uint32_t flags)
+{
+    if (!ctx || !cur || (shapeSize && !shape))
+    {
+        return -EINVAL;
+    }
+    if (shapeSize > MAX_POINTER_SIZE - sizeof(KVMFRCursor))
+    {
+        return -EMSGSIZE;
+    }
 
+    lp__log_trace("Updating cursor position... %d, %d", cur->x, cur->y);
+    
+    PLGMPMemory mem = lpNextCursorMem(ctx, shapeSize > 0);
     KVMFRCursor *tmpCur = lgmpHostMemPtr(mem);
-    memcpy((void *) tmpCur, (void *) cur, curShapeSize + sizeof(KVMFRCursor));
+    memcpy((void *) tmpCur, (void *) cur, sizeof(KVMFRCursor));
+    if (atomic_load_explicit(&ctx->lp_client.viewport_state, 
+                             memory_order_acquire) == LP_OFFER_ACTIVE)
+    {
+        // Positions are relative to the received part of the display
+        tmpCur->x -= ctx->lp_client.viewport.x;
+        tmpCur->y -= ctx->lp_client.viewport.y;
+    }
+    atomic_store_explicit(&ctx->lp_client.cursor_y, tmpCur->y, 
+                          memory_order_relaxed);
+    if (shapeSize)
+    {
+        memcpy((void *) (tmpCur + 1), shape, shapeSize);
+    }
     
     int ret = lpPostCursor(ctx,flags,mem);
     if (ret < 0)
         return ret;
 
-    ctx->lp_client.pointer_shape_valid = curShapeSize ? true : false;
+    ctx->lp_client.pointer_shape_valid = shapeSize ? true : false;
     return 0;
 }
 
+int lpUpdateCursorPos(PLPContext ctx, KVMFRCursor * cur, uint32_t curShapeSize, 
+                uint32_t flags)
+{
+    return lpUpdateCursor(ctx, cur, cur + 1, curShapeSize, flags);
+}
+
 int lpPostCursor(PLPContext ctx, uint32_t flags, PLGMPMemory mem)
 {
     LGMP_STATUS status;
@@ -451,6 +1019,15 @@ int lpInitShmFile(PLPContext ctx)
         goto out;
     }
     
+    // Files on hugetlbfs can only be sized in multiples of the huge page size
+    ssize_t hpsize = lpShmHugePageSize(ctx->shm);
+    if (hpsize > 0 && ctx->ram_size % hpsize)
+    {
+        ctx->ram_size = (ctx->ram_size / hpsize + 1) * hpsize;
+        lp__log_debug("Rounded shm size up to %u bytes for hugetlbfs",
+                      ctx->ram_size);
+    }
+
     bool truncFile = lpShouldTruncate(ctx);
     if (truncFile)
     {
@@ -462,12 +1039,9 @@ int lpInitShmFile(PLPContext ctx)
         }
     }
 
-    ctx->ram = mmap(0, ctx->ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, 
-                fd, 0);
-    if (!ctx->ram)
+    ret = lpMapShm(ctx, fd);
+    if (ret < 0)
     {
-        lp__log_error("Unable to map shared memory: %s", strerror(errno));
-        ret = -errno;
         goto close_fd;
     }
     ctx->shmFile = fd;
@@ -491,7 +1065,7 @@ void lpShutdown(PLPContext ctx)
         ctx->lp_client.sub_started = false;
     }
 
-    for(int i = 0; i < LGMP_Q_FRAME_LEN; ++i)
+    for(unsigned int i = 0; i < ctx->lp_client.frame_slots; ++i)
         lgmpHostMemFree(&ctx->lp_client.frame_memory[i]);
     for(int i = 0; i < LGMP_Q_POINTER_LEN; ++i)
         lgmpHostMemFree(&ctx->lp_client.pointer_memory[i]);
@@ -504,7 +1078,9 @@ void lpShutdown(PLPContext ctx)
 
 int lpReinitCursorThread(PLPContext ctx)
 {
-    // Create new thread to use
+    // Mark the thread as running up front, so that it is not restarted again
+    // before it has started
+    ctx->lp_client.thread_flags = T_RUNNING;
     int ret = pthread_create(&ctx->lp_client.cursor_thread, NULL, lpCursorThread ,ctx);
     if (ret < 0)
     {
@@ -517,41 +1093,1117 @@ int lpReinitCursorThread(PLPContext ctx)
     return ret;
 }
 
-void * lpCursorThread(void * arg)
+/**
+ * @brief Post a cursor update parsed from a CursorData message, using the
+ * shape store for shapes the source has already sent.
+ * 
+ * @param ctx       Context to use
+ * @param cursor    Last cursor header, updated on return
+ * @param cv        Parsed cursor update
+ * @param flags     LGMP cursor flags posted, updated on return
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleCursorData(PLPContext ctx, KVMFRCursor * cursor,
+                              const LPCursorDataView * cv, uint32_t * flags)
 {
-    lp__log_trace("Started Cursor thread");
+    *cursor                 = cv->hdr;
+    *flags                  = cv->flags;
+    const void * shape      = NULL;
+    uint32_t shapeLen       = 0;
+    uint32_t shapeId        = cv->shape_id;
+
+    if (cv->data_len && cv->codec != LP_CURSOR_CODEC_NONE)
+    {
+        // Decode straight into LGMP cursor memory
+        PLGMPMemory mem = lpNextCursorMem(ctx, true);
+        KVMFRCursor * dst = lgmpHostMemPtr(mem);
+        ssize_t len = lpDecodeCursorShape(cv->codec, cv->data, cv->data_len,
+                                          dst + 1, MAX_POINTER_SIZE 
+                                          - sizeof(KVMFRCursor));
+        if (len < 0)
+        {
+            lp__log_error("Invalid encoded cursor shape");
+            return len;
+        }
+        lp__log_trace("Data: %u bytes, decoded %zd", cv->data_len, len);
+
+        *dst    = *cursor;
+        *flags  |= CURSOR_FLAG_SHAPE;
+        if (shapeId && lpShapeStorePut(ctx->lp_client.shape_store,
+                shapeId, cursor, dst + 1, len) < 0)
+        {
+            lp__log_warn("Unable to cache cursor shape %u", shapeId);
+        }
+
+        int ret = lpPostCursor(ctx, *flags, mem);
+        if (ret == 0)
+        {
+            ctx->lp_client.pointer_shape_valid = true;
+        }
+        return ret;
+    }
+    else if (cv->data_len)
+    {
+        shape       = cv->data;
+        shapeLen    = cv->data_len;
+        *flags      |= CURSOR_FLAG_SHAPE;
+        lp__log_trace("Data: %u bytes", shapeLen);
+
+        if (shapeId && lpShapeStorePut(ctx->lp_client.shape_store,
+                shapeId, cursor, shape, shapeLen) < 0)
+        {
+            lp__log_warn("Unable to cache cursor shape %u", shapeId);
+        }
+    }
+    else if (shapeId && (*flags & CURSOR_FLAG_SHAPE))
+    {
+        // Shape previously sent by the source
+        KVMFRCursor * cached = lpShapeStoreGet(ctx->lp_client.shape_store, 
+                                               shapeId, &shapeLen);
+        if (cached)
+        {
+            cached->x   = cursor->x;
+            cached->y   = cursor->y;
+            *cursor     = *cached;
+            shape       = cached + 1;
+            lp__log_trace("Cached shape %u: %u bytes", shapeId, shapeLen);
+        }
+        else
+        {
+            lp__log_warn("Cursor shape %u not in cache", shapeId);
+            shapeLen    = 0;
+            *flags      &= ~CURSOR_FLAG_SHAPE;
+        }
+    }
+    else
+    {
+        *flags &= ~CURSOR_FLAG_SHAPE;
+    }
+
+    return lpUpdateCursor(ctx, cursor, shape, shapeLen, *flags);
+}
+
+/**
+ * @brief Sink cursor subchannel receive state
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Receive slots, LP_CURSOR_RECV_SLOTS buffers of
+     * LP_BIN_MAX_MSG_SIZE bytes following a reserved send area
+     * 
+     */
+    struct TRFMem *         mr;
+    /**
+     * @brief Fabric contexts of the posted receives, one per slot
+     * 
+     */
+    struct fi_context       rctx[LP_CURSOR_RECV_SLOTS];
+    /**
+     * @brief Bitmask of slots that do not have a receive posted
+     * 
+     */
+    uint64_t                idle;
+    /**
+     * @brief Last cursor header posted to LGMP
+     * 
+     */
+    KVMFRCursor             cursor;
+    /**
+     * @brief Last cursor flags posted to LGMP
+     * 
+     */
+    uint32_t                flags;
+    /**
+     * @brief Sequence number of the last update posted to LGMP
+     * 
+     */
+    uint32_t                seq;
+    /**
+     * @brief Shape being reassembled from fragments
+     * 
+     */
+    struct {
+        PLGMPMemory         mem;
+        /**
+         * @brief Staging buffer for encoded shapes, which are decoded into
+         * LGMP memory once complete
+         * 
+         */
+        uint8_t *           enc;
+        uint8_t             codec;
+        uint32_t            seq;
+        uint32_t            total;
+        uint32_t            received;
+        bool                active;
+    } shape;
+    /**
+     * @brief Cursor motion predictor, NULL if prediction is disabled
+     * 
+     */
+    LPCursorPredictor *     pred;
+} LPCursorRecv;
+
+_Static_assert(LP_CURSOR_RECV_SLOTS <= 64, "Receive slot mask too small");
+
+#define LP_CURSOR_RECV_ALL (LP_CURSOR_RECV_SLOTS == 64 ? \
+                            UINT64_MAX : (1ULL << LP_CURSOR_RECV_SLOTS) - 1)
+
+static inline bool lpSeqNewer(uint32_t a, uint32_t b)
+{
+    return (int32_t) (a - b) > 0;
+}
+
+static inline uint8_t * lpCursorRecvSlot(LPCursorRecv * rs, int slot)
+{
+    return (uint8_t *) trfMemPtr(rs->mr) 
+           + (size_t) (slot + 1) * LP_BIN_MAX_MSG_SIZE;
+}
+
+/**
+ * @brief Find the receive slot a completion belongs to
+ * 
+ * @param rs        Receive state
+ * @param opCtx     Operation context of the completion
+ * @return Slot index, or -1 if the completion is not for a receive currently
+ * posted by this thread
+ */
+static int lpCursorRecvIndex(LPCursorRecv * rs, void * opCtx)
+{
+    uintptr_t base  = (uintptr_t) rs->rctx;
+    uintptr_t p     = (uintptr_t) opCtx;
+    if (p < base || p >= base + sizeof(rs->rctx) 
+        || (p - base) % sizeof(rs->rctx[0]))
+    {
+        return -1;
+    }
+    int slot = (p - base) / sizeof(rs->rctx[0]);
+    return rs->idle & (1ULL << slot) ? -1 : slot;
+}
+
+/**
+ * @brief Cancel all posted receives and wait for their completions, so that
+ * no completion refers to this thread's receive state once it has exited
+ * 
+ * @param sc        Subchannel context
+ * @param rs        Receive state
+ */
+static void lpCancelCursorRecvs(PTRFContext sc, LPCursorRecv * rs)
+{
+    uint64_t posted = ~rs->idle & LP_CURSOR_RECV_ALL;
+    while (posted)
+    {
+        int slot = __builtin_ctzll(posted);
+        posted &= posted - 1;
+        fi_cancel(&sc->xfer.fabric->ep->fid, &rs->rctx[slot]);
+    }
+
+    struct timespec dl;
+    if (trfGetDeadline(&dl, LP_CURSOR_DRAIN_MS) < 0)
+    {
+        return;
+    }
+    while (rs->idle != LP_CURSOR_RECV_ALL)
+    {
+        struct fi_cq_data_entry de[LP_CURSOR_RECV_BATCH];
+        struct fi_cq_err_entry err = {0};
+        ssize_t ret = trfFabricPollRecv(sc, de, &err, 0, 0, &dl, 
+                                        LP_CURSOR_RECV_BATCH);
+        for (ssize_t i = 0; i < ret; i++)
+        {
+            int slot = lpCursorRecvIndex(rs, de[i].op_context);
+            if (slot >= 0)
+            {
+                rs->idle |= 1ULL << slot;
+            }
+        }
+        if (ret < 0 && ret != -FI_EAGAIN && ret != -FI_ETIMEDOUT)
+        {
+            // Cancelled receives complete with an error
+            int slot = lpCursorRecvIndex(rs, err.op_context);
+            if (slot >= 0)
+            {
+                rs->idle |= 1ULL << slot;
+            }
+        }
+        if (trf__HasPassed(CLOCK_MONOTONIC, &dl))
+        {
+            break;
+        }
+    }
+    if (rs->idle != LP_CURSOR_RECV_ALL)
+    {
+        lp__log_warn("%d cursor receives still posted after cancelling",
+                     __builtin_popcountll(~rs->idle & LP_CURSOR_RECV_ALL));
+    }
+}
+
+/**
+ * @brief Feed the position last posted to LGMP to the cursor predictor
+ * 
+ * @param rs        Receive state
+ */
+static void lpCursorRecvSample(LPCursorRecv * rs)
+{
+    if (!(rs->flags & CURSOR_FLAG_VISIBLE))
+    {
+        lpPredictReset(rs->pred);
+        return;
+    }
+    lpPredictSample(rs->pred, rs->cursor.x, rs->cursor.y, lpGetTimeNs());
+}
+
+/**
+ * @brief Post a predicted cursor position to LGMP, if one is due
+ * 
+ * @param ctx       Context to use
+ * @param rs        Receive state
+ * @return 0 on success, negative error code on failure
+ */
+static int lpPostPredictedCursor(PLPContext ctx, LPCursorRecv * rs)
+{
+    KVMFRCursor cursor = rs->cursor;
+    if (!lpPredictPosition(rs->pred, lpGetTimeNs(), &cursor.x, &cursor.y))
+    {
+        return 0;
+    }
+    int ret = lpUpdateCursorPos(ctx, &cursor, 0, rs->flags & ~CURSOR_FLAG_SHAPE);
+    return ret == -EAGAIN ? 0 : ret;
+}
+
+/**
+ * @brief Send a viewport request to the source
+ * 
+ * @param sc        Subchannel context
+ * @param mem       Registered message buffer, the first slot-sized area of
+ *                  which is used for the message
+ * @param vp        Viewport to request
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendViewport(PTRFContext sc, struct TRFMem * mem, 
+                          const LPViewport * vp)
+{
+    ssize_t ret = lpPackViewport(trfMemPtr(mem), LP_BIN_MAX_MSG_SIZE, vp);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = trfFabricSend(sc, mem, trfMemPtr(mem), ret, 
+                        sc->xfer.fabric->peer_addr, sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Ask the source for a preview of each frame
+ * 
+ * @param sc        Subchannel context
+ * @param mem       Registered message buffer, the first slot-sized area of
+ *                  which is used for the message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendProgressive(PTRFContext sc, struct TRFMem * mem)
+{
+    ssize_t ret = lpPackProgressive(trfMemPtr(mem), LP_BIN_MAX_MSG_SIZE, 0, 
+                                    0);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = trfFabricSend(sc, mem, trfMemPtr(mem), ret, 
+                        sc->xfer.fabric->peer_addr, sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Send the tile hashes of the frame left over from a previous session
+ * to the source, in as many messages as needed
+ * 
+ * @param ctx       Context to use
+ * @param sc        Subchannel context
+ * @param mem       Registered message buffer, the first slot-sized area of
+ *                  which is used for the messages
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendTileHashes(PLPContext ctx, PTRFContext sc, 
+                            struct TRFMem * mem)
+{
+    const LPTileGrid * g = &ctx->lp_client.resync_grid;
+    PTRFDisplay disp = ctx->lp_client.display;
+    LPBinTileHashes info = {
+        .width  = g->width,
+        .height = g->height,
+        .format = disp->format,
+        .tile   = g->tile,
+        .total  = g->count
+    };
+    for (uint32_t first = 0; first < g->count; first += info.count)
+    {
+        info.first = first;
+        info.count = g->count - first < LP_BIN_TILE_HASHES_MAX ? 
+                     g->count - first : LP_BIN_TILE_HASHES_MAX;
+        ssize_t ret = lpPackTileHashes(trfMemPtr(mem), LP_BIN_MAX_MSG_SIZE,
+                                       &info, 
+                                       ctx->lp_client.resync_hashes + first);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        ret = trfFabricSend(sc, mem, trfMemPtr(mem), ret, 
+                            sc->xfer.fabric->peer_addr, sc->opts);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Ask the source to send the rows around the cursor first
+ * 
+ * @param sc        Subchannel context
+ * @param mem       Registered message buffer, the first slot-sized area of
+ *                  which is used for the message
+ * @param rows      Band height
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendFocus(PTRFContext sc, struct TRFMem * mem, uint32_t rows)
+{
+    ssize_t ret = lpPackFocus(trfMemPtr(mem), LP_BIN_MAX_MSG_SIZE, rows);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = trfFabricSend(sc, mem, trfMemPtr(mem), ret, 
+                        sc->xfer.fabric->peer_addr, sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Ask the source to send block compressed frames
+ * 
+ * @param sc        Subchannel context
+ * @param mem       Registered message buffer, the first slot-sized area of
+ *                  which is used for the message
+ * @param format    Compression format (enum LPBlockFormat)
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendCompress(PTRFContext sc, struct TRFMem * mem, 
+                          uint32_t format)
+{
+    ssize_t ret = lpPackCompress(trfMemPtr(mem), LP_BIN_MAX_MSG_SIZE, format);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = trfFabricSend(sc, mem, trfMemPtr(mem), ret, 
+                        sc->xfer.fabric->peer_addr, sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Send a consumption report to the source
+ * 
+ * @param sc        Subchannel context
+ * @param mem       Registered message buffer, the first slot-sized area of
+ *                  which is used for the message
+ * @param r         Report to send
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendConsumption(PTRFContext sc, struct TRFMem * mem, 
+                             const LPDemandReport * r)
+{
+    uint32_t flags = (r->subs ? LP_BIN_CONSUMPTION_SUBS : 0)
+                   | (r->backlog ? LP_BIN_CONSUMPTION_BACKLOG : 0);
+    ssize_t ret = lpPackConsumption(trfMemPtr(mem), LP_BIN_MAX_MSG_SIZE, 
+                                    r->pending, r->depth, flags, r->rate);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    ret = trfFabricSend(sc, mem, trfMemPtr(mem), ret, 
+                        sc->xfer.fabric->peer_addr, sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Post receives on all idle slots
+ * 
+ * @param sc        Subchannel context
+ * @param rs        Receive state
+ * @return 0 on success, negative error code on failure. If the receive queue
+ * is full, the remaining slots stay idle and are posted on the next call.
+ */
+static int lpPostCursorRecvs(PTRFContext sc, LPCursorRecv * rs)
+{
+    while (rs->idle)
+    {
+        int slot = __builtin_ctzll(rs->idle);
+        ssize_t ret = fi_recv(sc->xfer.fabric->ep, lpCursorRecvSlot(rs, slot),
+                              LP_BIN_MAX_MSG_SIZE, trfMemFabricDesc(rs->mr),
+                              sc->xfer.fabric->peer_addr, &rs->rctx[slot]);
+        if (ret == -FI_EAGAIN)
+        {
+            return 0;
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+        rs->idle &= ~(1ULL << slot);
+    }
+    return 0;
+}
+
+/**
+ * @brief Handle a cursor shape fragment, reassembling the shape directly into
+ * LGMP cursor memory. The shape is posted once all fragments have arrived.
+ * 
+ * @param ctx       Context to use
+ * @param rs        Receive state
+ * @param buf       Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleCursorFrag(PLPContext ctx, LPCursorRecv * rs, 
+                              const uint8_t * buf)
+{
+    LPBinCursorShape frag;
+    const uint8_t * data;
+    ssize_t chunk = lpUnpackCursorShape(buf, LP_BIN_MAX_MSG_SIZE, &frag, 
+                                        &data);
+    if (chunk < 0)
+    {
+        return chunk;
+    }
+    if (frag.total > MAX_POINTER_SIZE - sizeof(KVMFRCursor))
+    {
+        return -EMSGSIZE;
+    }
+
+    KVMFRCursor hdr = {
+        .x      = frag.x,
+        .y      = frag.y,
+        .type   = frag.type,
+        .hx     = frag.hx,
+        .hy     = frag.hy,
+        .width  = frag.width,
+        .height = frag.height,
+        .pitch  = frag.pitch
+    };
+    int ret;
+
+    if (!frag.total)
+    {
+        // Shape previously cached by the sink
+        LPCursorDataView cv = {
+            .hdr        = hdr,
+            .flags      = frag.flags | CURSOR_FLAG_SHAPE,
+            .shape_id   = frag.shape_id
+        };
+        rs->seq = frag.seq;
+        ret = lpHandleCursorData(ctx, &rs->cursor, &cv, &rs->flags);
+        return ret == -EAGAIN ? 0 : ret;
+    }
+
+    if (frag.codec >= LP_CURSOR_CODEC_MAX)
+    {
+        return -EBADMSG;
+    }
+
+    if (!rs->shape.active || rs->shape.seq != frag.seq 
+        || rs->shape.total != frag.total || rs->shape.codec != frag.codec)
+    {
+        if (rs->shape.active)
+        {
+            lp__log_warn("Dropping incomplete cursor shape");
+        }
+        if (frag.codec != LP_CURSOR_CODEC_NONE && !rs->shape.enc)
+        {
+            rs->shape.enc = malloc(MAX_POINTER_SIZE - sizeof(KVMFRCursor));
+            if (!rs->shape.enc)
+            {
+                return -ENOMEM;
+            }
+        }
+        rs->shape.mem       = frag.codec == LP_CURSOR_CODEC_NONE ?
+                              lpNextCursorMem(ctx, true) : NULL;
+        rs->shape.codec     = frag.codec;
+        rs->shape.seq       = frag.seq;
+        rs->shape.total     = frag.total;
+        rs->shape.received  = 0;
+        rs->shape.active    = true;
+    }
+
+    // Raw shapes are reassembled in LGMP memory, encoded ones are staged
+    KVMFRCursor * dst = NULL;
+    uint8_t * base;
+    if (rs->shape.mem)
+    {
+        dst  = lgmpHostMemPtr(rs->shape.mem);
+        base = (uint8_t *) (dst + 1);
+    }
+    else
+    {
+        base = rs->shape.enc;
+    }
+    memcpy(base + frag.offset, data, chunk);
+    rs->shape.received += chunk;
+    if (rs->shape.received < rs->shape.total)
+    {
+        return 0;
+    }
+
+    lp__log_trace("Shape: %u bytes", rs->shape.total);
+    rs->shape.active    = false;
+    if (!dst)
+    {
+        LPCursorDataView cv = {
+            .hdr        = hdr,
+            .flags      = frag.flags | CURSOR_FLAG_SHAPE,
+            .shape_id   = frag.shape_id,
+            .data       = rs->shape.enc,
+            .data_len   = rs->shape.total,
+            .codec      = rs->shape.codec
+        };
+        rs->seq = frag.seq;
+        ret = lpHandleCursorData(ctx, &rs->cursor, &cv, &rs->flags);
+        return ret == -EAGAIN ? 0 : ret;
+    }
+
+    *dst                = hdr;
+    rs->cursor          = hdr;
+    rs->flags           = frag.flags | CURSOR_FLAG_SHAPE;
+    rs->seq             = frag.seq;
+
+    if (frag.shape_id && lpShapeStorePut(ctx->lp_client.shape_store,
+            frag.shape_id, dst, dst + 1, frag.total) < 0)
+    {
+        lp__log_warn("Unable to cache cursor shape %u", frag.shape_id);
+    }
+
+    ret = lpPostCursor(ctx, rs->flags, rs->shape.mem);
+    if (ret == 0)
+    {
+        ctx->lp_client.pointer_shape_valid = true;
+    }
+    return ret == -EAGAIN ? 0 : ret;
+}
+
+/**
+ * @brief Handle the source's reply to a viewport request
+ * 
+ * @param ctx       Context to use
+ * @param buf       Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleViewportReply(PLPContext ctx, const uint8_t * buf)
+{
+    LPViewport vp;
+    int ret = lpUnpackViewport(buf, LP_BIN_MAX_MSG_SIZE, &vp);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int state = LP_OFFER_PENDING;
+    if (vp.width && vp.height)
+    {
+        ctx->lp_client.viewport = vp;
+        if (atomic_compare_exchange_strong(&ctx->lp_client.viewport_state, 
+                                           &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_info("Receiving viewport %ux%u+%u+%u", vp.width, 
+                         vp.height, vp.x, vp.y);
+            return 0;
+        }
+    }
+    else if (atomic_compare_exchange_strong(&ctx->lp_client.viewport_state, 
+                                            &state, LP_OFFER_REJECTED))
+    {
+        lp__log_warn("Viewport rejected by the source, receiving whole "
+                     "frames");
+        return 0;
+    }
+    lp__log_debug("Ignoring late viewport reply");
+    return 0;
+}
+
+/**
+ * @brief Handle the source's reply to a progressive delivery request
+ * 
+ * @param ctx       Context to use
+ * @param buf       Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleProgressiveReply(PLPContext ctx, const uint8_t * buf)
+{
+    LPBinProgressive msg;
+    int ret = lpUnpackProgressive(buf, LP_BIN_MAX_MSG_SIZE, &msg);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int state = LP_OFFER_PENDING;
+    if (msg.width && msg.height)
+    {
+        if (atomic_compare_exchange_strong(&ctx->lp_client.progressive_state,
+                                           &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_info("Receiving %ux%u previews", msg.width, msg.height);
+            return 0;
+        }
+    }
+    else if (atomic_compare_exchange_strong(
+                &ctx->lp_client.progressive_state, &state, LP_OFFER_REJECTED))
+    {
+        lp__log_warn("Previews rejected by the source");
+        return 0;
+    }
+    lp__log_debug("Ignoring late progressive delivery reply");
+    return 0;
+}
+
+/**
+ * @brief Handle the source's reply to a focus band request
+ * 
+ * @param ctx       Context to use
+ * @param buf       Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleFocusReply(PLPContext ctx, const uint8_t * buf)
+{
+    LPBinFocus msg;
+    int ret = lpUnpackFocus(buf, LP_BIN_MAX_MSG_SIZE, &msg);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int state = LP_OFFER_PENDING;
+    if (msg.rows && msg.rows <= LP_FOCUS_ROWS_MAX)
+    {
+        ctx->lp_client.focus_rows = msg.rows;
+        if (atomic_compare_exchange_strong(&ctx->lp_client.focus_state,
+                                           &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_info("Receiving %u rows around the cursor first", 
+                         msg.rows);
+            return 0;
+        }
+    }
+    else if (atomic_compare_exchange_strong(&ctx->lp_client.focus_state, 
+                                            &state, LP_OFFER_REJECTED))
+    {
+        lp__log_warn("Focus bands rejected by the source");
+        return 0;
+    }
+    lp__log_debug("Ignoring late focus band reply");
+    return 0;
+}
+
+/**
+ * @brief Handle the source's reply to the tile hashes
+ * 
+ * @param ctx       Context to use
+ * @param buf       Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleTileHashesReply(PLPContext ctx, const uint8_t * buf)
+{
+    LPBinTileHashes msg;
+    const uint8_t * hashes;
+    int ret = lpUnpackTileHashes(buf, LP_BIN_MAX_MSG_SIZE, &msg, &hashes);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int state = LP_OFFER_PENDING;
+    if (msg.total && msg.total == ctx->lp_client.resync_grid.count)
+    {
+        if (atomic_compare_exchange_strong(&ctx->lp_client.resync_state,
+                                           &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_info("Receiving only changed tiles of the first frame");
+            return 0;
+        }
+    }
+    else if (atomic_compare_exchange_strong(&ctx->lp_client.resync_state, 
+                                            &state, LP_OFFER_REJECTED))
+    {
+        lp__log_info("Tile hashes rejected by the source, receiving the "
+                     "first frame in full");
+        return 0;
+    }
+    lp__log_debug("Ignoring late tile hash reply");
+    return 0;
+}
+
+/**
+ * @brief Handle the source's reply to a block compression request
+ * 
+ * @param ctx       Context to use
+ * @param buf       Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleCompressReply(PLPContext ctx, const uint8_t * buf)
+{
+    LPBinCompress msg;
+    int ret = lpUnpackCompress(buf, LP_BIN_MAX_MSG_SIZE, &msg);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int state = LP_OFFER_PENDING;
+    if (msg.format == LP_BLOCK_BC1)
+    {
+        if (atomic_compare_exchange_strong(&ctx->lp_client.compress_state,
+                                           &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_info("Receiving BC1 compressed frames");
+            return 0;
+        }
+    }
+    else if (atomic_compare_exchange_strong(&ctx->lp_client.compress_state, 
+                                            &state, LP_OFFER_REJECTED))
+    {
+        lp__log_warn("Block compression rejected by the source");
+        return 0;
+    }
+    lp__log_debug("Ignoring late block compression reply");
+    return 0;
+}
+
+/**
+ * @brief Handle a message received on the cursor subchannel
+ * 
+ * @param ctx       Context to use
+ * @param rs        Receive state
+ * @param buf       Received message
+ * @param latestPos Sequence number of the newest position update in the
+ *                  current batch; older position updates are skipped
+ * @return 0 on success, 1 if the source requested a disconnect, negative
+ * error code on failure
+ */
+static int lpHandleCursorMsg(PLPContext ctx, LPCursorRecv * rs, 
+                             uint8_t * buf, uint32_t latestPos)
+{
+    int ret;
+    LPBinCursorPos pos;
+    switch (lpBinMsgType(buf, LP_BIN_MAX_MSG_SIZE))
+    {
+        case LP_BIN_CURSOR_POS:
+            ret = lpUnpackCursorPos(buf, LP_BIN_MAX_MSG_SIZE, &pos);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            if (pos.seq != latestPos || !lpSeqNewer(pos.seq, rs->seq))
+            {
+                lp__log_trace("Skipping stale cursor position %u", pos.seq);
+                return 0;
+            }
+            rs->cursor.x    = pos.x;
+            rs->cursor.y    = pos.y;
+            rs->flags       = pos.flags & ~CURSOR_FLAG_SHAPE;
+            rs->seq         = pos.seq;
+            lp__log_trace("Cursor position %d, %d", pos.x, pos.y);
+            ret = lpUpdateCursorPos(ctx, &rs->cursor, 0, rs->flags);
+            return ret == -EAGAIN ? 0 : ret;
+        case LP_BIN_CURSOR_SHAPE:
+            return lpHandleCursorFrag(ctx, rs, buf);
+        case LP_BIN_VIEWPORT:
+            return lpHandleViewportReply(ctx, buf);
+        case LP_BIN_PROGRESSIVE:
+            return lpHandleProgressiveReply(ctx, buf);
+        case LP_BIN_FOCUS:
+            return lpHandleFocusReply(ctx, buf);
+        case LP_BIN_TILE_HASHES:
+            return lpHandleTileHashesReply(ctx, buf);
+        case LP_BIN_COMPRESS:
+            return lpHandleCompressReply(ctx, buf);
+        default:
+            break;
+    }
+
+    int s = trfMsgGetPackedLength(buf);
+    lp__log_trace("Packed Length: %d", s);
+    if (s < 0 || s > LP_BIN_MAX_MSG_SIZE)
+    {
+        lp__log_error("Invalid message length: %d", s);
+        return -EBADMSG;
+    }
+
+    // Cursor updates are parsed in place, so the shape data is only copied
+    // once, directly into LGMP memory
+    LPCursorDataView cv;
+    ret = lpParseCursorData(trfMsgGetPayload(buf), s, &cv);
+    if (ret == 0)
+    {
+        ret = lpHandleCursorData(ctx, &rs->cursor, &cv, &rs->flags);
+        return ret == -EAGAIN ? 0 : ret;
+    }
+    else if (ret != -ENOMSG)
+    {
+        return ret;
+    }
+
+    LpMsg__MessageWrapper * wrapper = NULL;
+    ret = trfMsgUnpackProtobuf((ProtobufCMessage **) &wrapper, 
+                               (const ProtobufCMessageDescriptor *) 
+                               &lp_msg__message_wrapper__descriptor, s, 
+                               trfMsgGetPayload(buf));
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    switch (wrapper->wdata_case)
+    {
+        case LP_MSG__MESSAGE_WRAPPER__WDATA_KA:
+            lp__log_debug("Waiting for new data...");
+            ret = 0;
+            break;
+        case LP_MSG__MESSAGE_WRAPPER__WDATA_DISCONNECT:
+            lp__log_trace("Host sent disconnect message");
+            ret = 1;
+            break;
+        default:
+            lp__log_error("Server sent garbage data: %d", wrapper->wdata_case);
+            ret = -EBADMSG;
+            break;
+    }
+    lp_msg__message_wrapper__free_unpacked(wrapper, NULL);
+    return ret;
+}
+
+/**
+ * @brief Handle the updates written into the cursor mailbox since the last
+ * call
+ * 
+ * @param ctx       Context to use
+ * @param rs        Receive state
+ * @param mb        Mailbox to poll
+ * @return Number of updates handled, negative error code on failure
+ */
+static int lpPollCursorMailbox(PLPContext ctx, LPCursorRecv * rs, 
+                               LPMailbox * mb)
+{
+    int handled = 0;
+    int ret;
+    LPMailboxShapeHdr hdr;
+    const uint8_t * data;
+
+    // Shapes are handled in order, before the latest position
+    while ((data = lpMailboxReadShape(mb, &hdr)))
+    {
+        LPCursorDataView cv = {
+            .hdr = {
+                .x      = hdr.x,
+                .y      = hdr.y,
+                .type   = hdr.type,
+                .hx     = hdr.hx,
+                .hy     = hdr.hy,
+                .width  = hdr.width,
+                .height = hdr.height,
+                .pitch  = hdr.pitch
+            },
+            .flags      = hdr.flags | CURSOR_FLAG_SHAPE,
+            .shape_id   = hdr.shape_id,
+            .data       = hdr.total ? data : NULL,
+            .data_len   = hdr.total,
+            .codec      = hdr.codec
+        };
+        if (lpSeqNewer(hdr.seq, rs->seq))
+        {
+            rs->seq = hdr.seq;
+        }
+        else
+        {
+            // A newer position has already been posted
+            cv.hdr.x = rs->cursor.x;
+            cv.hdr.y = rs->cursor.y;
+        }
+
+        ret = lpHandleCursorData(ctx, &rs->cursor, &cv, &rs->flags);
+        lpMailboxReleaseShape(mb);
+        if (ret < 0 && ret != -EAGAIN)
+        {
+            return ret;
+        }
+        handled++;
+    }
+
+    LPMailboxPos pos;
+    if (lpMailboxReadPos(mb, &pos) && lpSeqNewer(pos.seq, rs->seq))
+    {
+        rs->cursor.x    = pos.x;
+        rs->cursor.y    = pos.y;
+        rs->flags       = pos.flags & ~CURSOR_FLAG_SHAPE;
+        rs->seq         = pos.seq;
+        lp__log_trace("Cursor position %d, %d", pos.x, pos.y);
+        ret = lpUpdateCursorPos(ctx, &rs->cursor, 0, rs->flags);
+        if (ret < 0 && ret != -EAGAIN)
+        {
+            return ret;
+        }
+        handled++;
+    }
+    return handled;
+}
+
+void * lpCursorThread(void * arg)
+{
+    lp__log_trace("Started Cursor thread");
     PLPContext ctx = (PLPContext) arg;
     intptr_t ret = 0;
     size_t psize = trf__GetPageSize();
     PTRFContext sc = ctx->lp_client.sub_channel;
     ctx->lp_client.thread_flags = T_RUNNING;
-    KVMFRCursor * cursor = malloc(MAX_POINTER_SIZE);
-    if (!cursor)
+    LPCursorRecv rs = {0};
+    LPMailbox * mb = ctx->lp_client.mailbox;
+
+    // The first slot-sized area is left for messages sent by libtrf itself
+    size_t memSize = (LP_CURSOR_RECV_SLOTS + 1) * LP_BIN_MAX_MSG_SIZE;
+    void * mem = trfAllocAligned(memSize, psize);
+    if (!mem)
     {
         lp__log_error("Unable to allocate memory");
+        ret = -ENOMEM;
         goto destroy_ctx;
     }
-    void * mem = trfAllocAligned(MAX_POINTER_SIZE, psize);
-    if (!mem)
+
+    ret = trfRegInternalMsgBuf(sc, mem, memSize);
+    if (ret < 0)
     {
-        lp__log_error("Unable to allocate memory");
-        ret = -ENOMEM;
+        lp__log_error("Unable to register internal buffer");
         goto destroy_ctx;
     }
 
-    LpMsg__MessageWrapper * wrapper = NULL;
+    rs.mr   = &sc->xfer.fabric->msg_mem;
+    rs.idle = LP_CURSOR_RECV_ALL;
 
-    ret = trfRegInternalMsgBuf(sc, mem, MAX_POINTER_SIZE);
+    // Receives stay posted in mailbox mode, for control messages and in case
+    // the source does not support the mailbox
+    ret = lpPostCursorRecvs(sc, &rs);
     if (ret < 0)
     {
-        lp__log_error("Unable to register internal buffer");
+        lp__log_error("Unable to post receive: %s", fi_strerror(-ret));
         goto destroy_ctx;
     }
 
-    struct TRFMem *mr = &sc->xfer.fabric->msg_mem;
-    uint32_t flags = 0;
-    bool posted = 0;
+    // The mailbox lives as long as the subchannel, as the source keeps
+    // writing to it across cursor thread restarts. It is only offered once.
+    if (mb && mb->mem && !mb->offered)
+    {
+        ret = lpMailboxOffer(sc, rs.mr, mb);
+        if (ret < 0)
+        {
+            lp__log_warn("Unable to offer cursor mailbox: %s, using "
+                         "messages", fi_strerror(-ret));
+            lpMailboxDestroy(mb);
+        }
+        else
+        {
+            mb->offered = true;
+            lp__log_info("Cursor mailbox enabled");
+        }
+    }
+
+    // The viewport is only requested once, before the first frame
+    int vpState = LP_OFFER_NONE;
+    if (ctx->opts.viewport.width 
+        && atomic_compare_exchange_strong(&ctx->lp_client.viewport_state, 
+                                          &vpState, LP_OFFER_PENDING))
+    {
+        ret = lpSendViewport(sc, rs.mr, &ctx->opts.viewport);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to request viewport: %s", 
+                          fi_strerror(-ret));
+            goto destroy_ctx;
+        }
+    }
+    int pgState = LP_OFFER_NONE;
+    if (ctx->opts.progressive
+        && atomic_compare_exchange_strong(&ctx->lp_client.progressive_state,
+                                          &pgState, LP_OFFER_PENDING))
+    {
+        ret = lpSendProgressive(sc, rs.mr);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to request previews: %s", 
+                          fi_strerror(-ret));
+            goto destroy_ctx;
+        }
+    }
+    int rsState = LP_OFFER_NONE;
+    if (ctx->lp_client.resync_slot >= 0
+        && atomic_compare_exchange_strong(&ctx->lp_client.resync_state,
+                                          &rsState, LP_OFFER_PENDING))
+    {
+        ret = lpSendTileHashes(ctx, sc, rs.mr);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to send tile hashes: %s", 
+                          fi_strerror(-ret));
+            goto destroy_ctx;
+        }
+    }
+    int fcState = LP_OFFER_NONE;
+    if (ctx->opts.focus_rows
+        && atomic_compare_exchange_strong(&ctx->lp_client.focus_state,
+                                          &fcState, LP_OFFER_PENDING))
+    {
+        ret = lpSendFocus(sc, rs.mr, ctx->opts.focus_rows);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to request focus bands: %s", 
+                          fi_strerror(-ret));
+            goto destroy_ctx;
+        }
+    }
+    int bcState = LP_OFFER_NONE;
+    if (ctx->opts.compress
+        && atomic_compare_exchange_strong(&ctx->lp_client.compress_state,
+                                          &bcState, LP_OFFER_PENDING))
+    {
+        ret = lpSendCompress(sc, rs.mr, LP_BLOCK_BC1);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to request block compression: %s", 
+                          fi_strerror(-ret));
+            goto destroy_ctx;
+        }
+    }
+
+    LPCursorPredictor pred;
+    if (ctx->opts.cursor_predict > 0)
+    {
+        ret = lpPredictInit(&pred, ctx->opts.cursor_predict);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to initialize cursor predictor");
+            goto destroy_ctx;
+        }
+        rs.pred = &pred;
+        lp__log_info("Cursor prediction enabled at %d Hz", 
+                     ctx->opts.cursor_predict);
+    }
+    uint32_t lastSeq    = rs.seq;
+    int16_t lastX       = rs.cursor.x;
+    int16_t lastY       = rs.cursor.y;
+    unsigned int demandSeq = 0;
 
+    struct timespec dl;
+    bool setDeadline = false;
     while (1)
     {
         if (ctx->state == LP_STATE_RESTART || ctx->state == LP_STATE_STOP)
@@ -560,34 +2212,96 @@ void * lpCursorThread(void * arg)
             break;
         }
 
-        if (!posted)
+        ret = lpPostCursorRecvs(sc, &rs);
+        if (ret < 0)
         {
-            ret = trfFabricRecvUnchecked(
-                    sc, mr, trfMemPtr(mr),
-                    MAX_POINTER_SIZE, 
-                    sc->xfer.fabric->peer_addr);
+            lp__log_error("Unable to post receive: %s", fi_strerror(-ret));
+            goto destroy_ctx;
+        }
+
+        LPDemandReport report;
+        if (lpDemandMeterPoll(&ctx->lp_client.demand, &demandSeq, &report))
+        {
+            ret = lpSendConsumption(sc, rs.mr, &report);
             if (ret < 0)
             {
-                lp__log_error("Unable to post receive: %s", fi_strerror(-ret));
+                lp__log_error("Unable to send consumption report: %s", 
+                              fi_strerror(-ret));
                 goto destroy_ctx;
             }
-            posted = true;
-            lp__log_trace("Receive buffer posted!");
         }
 
-        struct timespec dl;
-        ret = trfGetDeadline(&dl, 100);
-        if (ret < 0)
+        if (rs.pred)
         {
-            lp__log_error("System clock error");
-            goto destroy_ctx;
+            // Snap to positions received since the last iteration
+            if (rs.seq != lastSeq || rs.cursor.x != lastX 
+                || rs.cursor.y != lastY)
+            {
+                lpCursorRecvSample(&rs);
+                lastSeq = rs.seq;
+                lastX   = rs.cursor.x;
+                lastY   = rs.cursor.y;
+            }
+            ret = lpPostPredictedCursor(ctx, &rs);
+            if (ret < 0)
+            {
+                lp__log_error("Unable to post predicted cursor: %s", 
+                              strerror(-ret));
+                goto destroy_ctx;
+            }
+        }
+
+        if (!setDeadline || !mb || !mb->mem)
+        {
+            ret = trfGetDeadline(&dl, 100);
+            if (ret < 0)
+            {
+                lp__log_error("System clock error");
+                goto destroy_ctx;
+            }
+            setDeadline = true;
+        }
+
+        // Wake up in time for the next predicted position
+        struct timespec pdl = dl;
+        if (rs.pred)
+        {
+            uint64_t next = lpPredictNextTime(rs.pred);
+            uint64_t dlNs = (uint64_t) dl.tv_sec * 1000000000ULL + dl.tv_nsec;
+            if (next < dlNs)
+            {
+                pdl.tv_sec  = next / 1000000000ULL;
+                pdl.tv_nsec = next % 1000000000ULL;
+            }
         }
 
-        struct fi_cq_data_entry de;
+        struct fi_cq_data_entry de[LP_CURSOR_RECV_BATCH];
         struct fi_cq_err_entry err;
 
-        ret = trfFabricPollRecv(sc, &de, &err, sc->opts->fab_cq_sync, 
-                                sc->opts->fab_poll_rate, &dl, 1);
+        if (mb && mb->mem)
+        {
+            // Poll mailbox memory, and the completion queue for control
+            // messages without blocking
+            ret = lpPollCursorMailbox(ctx, &rs, mb);
+            if (ret < 0)
+            {
+                lp__log_error("Unable to handle cursor mailbox: %s", 
+                              strerror(-ret));
+                goto destroy_ctx;
+            }
+            if (ret > 0)
+            {
+                setDeadline = false;
+            }
+            ret = trfFabricPollRecv(sc, de, &err, 0, 0, NULL, 
+                                    LP_CURSOR_RECV_BATCH);
+        }
+        else
+        {
+            ret = trfFabricPollRecv(sc, de, &err, sc->opts->fab_cq_sync, 
+                                    sc->opts->fab_poll_rate, &pdl, 
+                                    LP_CURSOR_RECV_BATCH);
+        }
         switch (ret)
         {
             case -FI_ETIMEDOUT:
@@ -598,112 +2312,81 @@ void * lpCursorThread(void * arg)
                 if (trf__HasPassed(CLOCK_MONOTONIC, &dl))
                 {
                     ret = -ETIMEDOUT;
-                    uint32_t tmp_flags = flags & ~CURSOR_FLAG_SHAPE;
-                    lpUpdateCursorPos(ctx, cursor, 0, tmp_flags);
-                    continue;
+                    uint32_t tmp_flags = rs.flags & ~CURSOR_FLAG_SHAPE;
+                    lpUpdateCursorPos(ctx, &rs.cursor, 0, tmp_flags);
+                    setDeadline = false;
                 }
-                break;
-            case 1:
-                posted = 0;
-                break;
+                continue;
             default:
-                lp__log_error("Poll failed: %s", fi_strerror(-ret));
-                goto destroy_ctx;
-        }
-
-        if (ret != 1)
-        {
-            continue;
-        }
-
-        int s = trfMsgGetPackedLength(trfMemPtr(mr));
-        lp__log_trace("Packed Length: %d", s);
-        ret = trfMsgUnpackProtobuf((ProtobufCMessage **) &wrapper, 
-                                   (const ProtobufCMessageDescriptor *) 
-                                   &lp_msg__message_wrapper__descriptor, s, 
-                                   trfMsgGetPayload(trfMemPtr(mr)));
-        if (ret < 0)
-        {
-            lp__log_error("Unable to decode message");
-            goto destroy_ctx;
+                if (ret < 0)
+                {
+                    lp__log_error("Poll failed: %s", fi_strerror(-ret));
+                    goto destroy_ctx;
+                }
+                break;
         }
 
-        if (wrapper->wdata_case == LP_MSG__MESSAGE_WRAPPER__WDATA_KA)
-        {
-            lp__log_debug("Waiting for new data...");
-            lp_msg__message_wrapper__free_unpacked(wrapper, NULL);
-            wrapper = NULL;
-            continue;
-        }
-        else if (wrapper->wdata_case == 
-                LP_MSG__MESSAGE_WRAPPER__WDATA_CURSOR_DATA)
+        // Handle the whole batch at once. Position updates only carry the
+        // latest position, so all but the newest one in the batch are
+        // skipped.
+        int n = ret;
+        uint32_t latestPos = rs.seq;
+        for (int i = 0; i < n; i++)
         {
-            cursor->y       = wrapper->cursor_data->y;
-            cursor->x       = wrapper->cursor_data->x;
-            cursor->width   = wrapper->cursor_data->width;
-            cursor->height  = wrapper->cursor_data->height;
-            cursor->hx      = wrapper->cursor_data->hpx;
-            cursor->hy      = wrapper->cursor_data->hpy;
-            cursor->type    = wrapper->cursor_data->tex_fmt;
-            cursor->pitch   = wrapper->cursor_data->pitch;
-            flags           = wrapper->cursor_data->flags;
-
-            if (wrapper->cursor_data->data.len)
+            int slot = lpCursorRecvIndex(&rs, de[i].op_context);
+            if (slot < 0)
             {
-                memcpy((uint8_t *)(cursor + 1), 
-                    wrapper->cursor_data->data.data, 
-                    wrapper->cursor_data->data.len);
-
-                flags |= CURSOR_FLAG_SHAPE;
-                lp__log_trace("Data: %lu bytes", wrapper->cursor_data->data.len);
-                
+                continue;
             }
-            else
+            LPBinCursorPos pos;
+            if (lpUnpackCursorPos(lpCursorRecvSlot(&rs, slot), 
+                                  LP_BIN_MAX_MSG_SIZE, &pos) == 0
+                && lpSeqNewer(pos.seq, latestPos))
             {
-                flags &= ~CURSOR_FLAG_SHAPE;   
+                latestPos = pos.seq;
             }
+        }
 
-            lp_msg__message_wrapper__free_unpacked(wrapper, NULL);
-
-            ret = lpUpdateCursorPos(ctx,cursor, wrapper->cursor_data->data.len, 
-                                    flags);
-            if (ret == -EAGAIN)
+        for (int i = 0; i < n; i++)
+        {
+            int slot = lpCursorRecvIndex(&rs, de[i].op_context);
+            if (slot < 0)
             {
+                lp__log_debug("Ignoring completion for an unknown receive");
                 continue;
             }
-            else if (ret < 0)
+            ret = lpHandleCursorMsg(ctx, &rs, lpCursorRecvSlot(&rs, slot),
+                                    latestPos);
+            rs.idle |= 1ULL << slot;
+            if (ret == 1)
+            {
+                ctx->state = LP_STATE_STOP;
+                sc->disconnected = 1;
+                lpMailboxDestroy(mb);
+                trfDestroyContext(sc);
+                rs.mr = NULL; // Receives went with the endpoint
+                goto destroy_ctx; // Server requested disconnect
+            }
+            if (ret < 0)
             {
-                lp__log_error("Unable to send cursor position to Looking Glass");
+                lp__log_error("Unable to handle cursor message: %s",
+                              strerror(-ret));
                 goto destroy_ctx;
             }
-            wrapper = NULL;
-        }
-        else if (wrapper->wdata_case == LP_MSG__MESSAGE_WRAPPER__WDATA_DISCONNECT)
-        {   
-            lp__log_trace("Host sent disconnect message");
-            lp_msg__message_wrapper__free_unpacked(wrapper, NULL);
-            wrapper = NULL;
-            ctx->state = LP_STATE_STOP;
-            sc->disconnected = 1;
-            ret = 1; // Server requested disconnect
-            trfDestroyContext(sc);
-            goto destroy_ctx;
-        }
-        else
-        {
-            lp__log_error("Server sent garbage data: %d", wrapper->wdata_case);
-            lp_msg__message_wrapper__free_unpacked(wrapper, NULL);
-            wrapper = NULL;
-            goto destroy_ctx;
         }
     }
 
 destroy_ctx:
-    if (cursor)
+    if (rs.mr)
     {
-        free(cursor);
+        lpCancelCursorRecvs(sc, &rs);
+    }
+    free(rs.shape.enc);
+    if (rs.pred)
+    {
+        lpPredictLogStats(rs.pred);
     }
     ctx->lp_client.thread_flags = T_STOP;
     lp__log_debug("Thread exited");
     return (void *) ret;
-}
\ No newline at end of file
+}
@@ -52,6 +52,29 @@ static const char * LP_USAGE_GUIDE_STR =                                \
 "   -r  Polling interval (default unit: ms, default value: 0)\n"        \
 "       [Experimental] use -1 for sync mode\n"                          \
 "       [Experimental] use n/u/m/s for nano/micro/milli/whole seconds, respectively\n" \
+"\n"                                                                    \
+"   -w  Number of threads used to prefault the shared memory at startup\n" \
+"       (default: 0, fault pages in on first access)\n"                   \
+"\n"                                                                    \
+"   -m  Receive cursor updates through an RDMA mailbox instead of\n"    \
+"       messages\n"                                                     \
+"\n"                                                                    \
+"   -e  Predict cursor motion between updates, posting positions at\n"  \
+"       the given rate in Hz (default: 0, disabled)\n"                   \
+"\n"                                                                    \
+"   -b  Number of frame buffers to rotate through (default: 3, max: 8)\n" \
+"\n"                                                                    \
+"   -v  Only receive part of the display, given as WxH+X+Y\n"          \
+"       (e.g. 1920x1080+1920+0, default: whole display)\n"             \
+"\n"                                                                    \
+"   -g  Show a quarter resolution preview of each frame while the\n"   \
+"       frame itself is received\n"                                    \
+"\n"                                                                    \
+"   -o  Receive the given number of rows around the cursor ahead of\n"  \
+"       the rest of each frame (default: 0, disabled)\n"                \
+"\n"                                                                    \
+"   -z  Receive frames compressed to BC1, an eighth of their size,\n"   \
+"       at the cost of some image quality\n"                            \
 ;
 
 volatile int8_t flag = 0;
@@ -66,6 +89,71 @@ void exitHandler(int dummy)
     flag = 1;
 }
 
+/**
+ * @brief Wait for the source to reply to an option requested by the cursor
+ * thread
+ * 
+ * @param ctx       Context to use
+ * @param state     Negotiation state of the option (enum LP_OFFER_STATE)
+ * @param name      Name of the option, for logging
+ * @return LP_OFFER_ACTIVE or LP_OFFER_REJECTED on success, negative error
+ * code on failure
+ */
+static int lpWaitOffer(PLPContext ctx, atomic_int * state, const char * name)
+{
+    uint64_t deadline = lpGetTimeNs() + LP_OFFER_TIMEOUT_MS * 1000000ULL;
+    int s;
+    while ((s = atomic_load(state)) <= LP_OFFER_PENDING)
+    {
+        if (flag || ctx->state == LP_STATE_STOP 
+            || ctx->lp_client.thread_flags == T_ERR)
+        {
+            return -ECANCELED;
+        }
+        if (lpGetTimeNs() > deadline)
+        {
+            // Replies arriving after this are ignored
+            int pending = LP_OFFER_PENDING;
+            if (atomic_compare_exchange_strong(state, &pending, 
+                                               LP_OFFER_REJECTED) 
+                || pending == LP_OFFER_NONE)
+            {
+                atomic_store(state, LP_OFFER_REJECTED);
+                lp__log_warn("No %s reply from the source, continuing "
+                             "without it", name);
+                return LP_OFFER_REJECTED;
+            }
+            continue;
+        }
+        trfSleep(1);
+    }
+    return s;
+}
+
+/**
+ * @brief Wait for the source to reply to the viewport request, and shrink the
+ * display to the viewport if it was accepted
+ * 
+ * @param ctx       Context to use
+ * @param disp      Display to receive
+ * @return 0 on success, negative error code on failure
+ */
+static int lpWaitViewport(PLPContext ctx, PTRFDisplay disp)
+{
+    int state = lpWaitOffer(ctx, &ctx->lp_client.viewport_state, "viewport");
+    if (state < 0)
+    {
+        return state;
+    }
+
+    if (state == LP_OFFER_ACTIVE)
+    {
+        disp->width     = ctx->lp_client.viewport.width;
+        disp->height    = ctx->lp_client.viewport.height;
+    }
+    return 0;
+}
+
 int main(int argc, char ** argv)
 {
     signal(SIGINT, exitHandler);    
@@ -78,6 +166,8 @@ int main(int argc, char ** argv)
     char * port = NULL;
 
     TrfMsg__MessageWrapper * msg = NULL;
+    LPBlockCoder blockDec;
+    memset(&blockDec, 0, sizeof(blockDec));
 
     if (lpSetDefaultOpts(ctx))
     {
@@ -86,7 +176,7 @@ int main(int argc, char ** argv)
     }
     
     int o;
-    while ((o = getopt(argc, argv, "h:p:f:s:d:r:")) != -1)
+    while ((o = getopt(argc, argv, "h:p:f:s:d:r:w:me:b:v:go:z")) != -1)
     {
         switch (o)
         {
@@ -109,6 +199,49 @@ int main(int argc, char ** argv)
                 lp__log_info("Requested polling interval: %s", optarg);
                 ctx->opts.poll_int = lpParsePollString(optarg);
                 break;
+            case 'w':
+                ctx->opts.prefault_threads = atoi(optarg);
+                break;
+            case 'm':
+                ctx->opts.cursor_mailbox = true;
+                break;
+            case 'e':
+                ctx->opts.cursor_predict = atoi(optarg);
+                break;
+            case 'b':
+                ctx->opts.frame_slots = atoi(optarg);
+                if (ctx->opts.frame_slots < 2 
+                    || ctx->opts.frame_slots > LP_FRAME_SLOTS_MAX)
+                {
+                    lp__log_fatal("Number of frame slots must be between 2 "
+                                  "and %d", LP_FRAME_SLOTS_MAX);
+                    return EINVAL;
+                }
+                break;
+            case 'v':
+                if (lpParseViewport(optarg, &ctx->opts.viewport) < 0)
+                {
+                    lp__log_fatal("Invalid viewport %s, expected WxH+X+Y", 
+                                  optarg);
+                    return EINVAL;
+                }
+                break;
+            case 'g':
+                ctx->opts.progressive = true;
+                break;
+            case 'o':
+                ctx->opts.focus_rows = atoi(optarg);
+                if (ctx->opts.focus_rows < 1 
+                    || ctx->opts.focus_rows > LP_FOCUS_ROWS_MAX)
+                {
+                    lp__log_fatal("Focus band must be between 1 and %d rows",
+                                  LP_FOCUS_ROWS_MAX);
+                    return EINVAL;
+                }
+                break;
+            case 'z':
+                ctx->opts.compress = true;
+                break;
             default:
             case '?':
                 lp__log_fatal("Invalid argument -%c", optopt);
@@ -128,6 +261,28 @@ int main(int argc, char ** argv)
     lpSetLPLogLevel();  // Set lgproxy log level
     lpSetTRFLogLevel(); // Set libtrf log level
 
+    if (ctx->opts.progressive && ctx->opts.viewport.width)
+    {
+        lp__log_warn("Previews are not supported with a viewport, "
+                     "disabling them");
+        ctx->opts.progressive = false;
+    }
+    if (ctx->opts.focus_rows 
+        && (ctx->opts.viewport.width || ctx->opts.progressive))
+    {
+        lp__log_warn("Focus bands are not supported with a viewport or "
+                     "previews, disabling them");
+        ctx->opts.focus_rows = 0;
+    }
+    if (ctx->opts.compress 
+        && (ctx->opts.viewport.width || ctx->opts.progressive 
+            || ctx->opts.focus_rows))
+    {
+        lp__log_warn("Block compression is not supported with a viewport, "
+                     "previews or focus bands, disabling it");
+        ctx->opts.compress = false;
+    }
+
     lp__log_info("Connecting to %s:%s", host,port);
     if ((ret = lpTrfClientInit(ctx, host, port)) < 0)
     {
@@ -188,7 +343,7 @@ int main(int argc, char ** argv)
     // If user did not specify ramsize
     if (!ctx->ram_size)
     {
-        ctx->ram_size = lpCalcFrameSizeNeeded(displays);
+        ctx->ram_size = lpCalcFrameSizeNeeded(displays, ctx->opts.frame_slots);
         lp__log_trace("Size needed for display: %d", ctx->ram_size);
     }
 
@@ -210,6 +365,19 @@ int main(int argc, char ** argv)
         goto destroy_ctx;
     }
 
+    // If the shared memory still holds a frame from before a reconnect, only
+    // the tiles that changed since need to be sent
+    ctx->lp_client.resync_slot = -1;
+    if (!ctx->opts.viewport.width)
+    {
+        ret = lpFindResyncBase(ctx, displays);
+        if (ret < 0 && ret != -ENOENT && ret != -ENOTSUP)
+        {
+            lp__log_warn("Unable to hash the previous frame: %s", 
+                         strerror(-ret));
+        }
+    }
+
     if ((ret = trfSendClientReq(ctx->lp_client.client_ctx, displays)) < 0)
     {
         lp__log_error("Unable to send display request");
@@ -227,7 +395,34 @@ int main(int argc, char ** argv)
         goto destroy_ctx;
     }
 
+    ctx->lp_client.shape_store = calloc(1, sizeof(LPShapeStore));
+    if (!ctx->lp_client.shape_store)
+    {
+        lp__log_error("Unable to allocate cursor shape store");
+        ret = -ENOMEM;
+        goto destroy_ctx;
+    }
+
+    if (ctx->opts.cursor_mailbox)
+    {
+        ctx->lp_client.mailbox = calloc(1, sizeof(LPMailbox));
+        if (!ctx->lp_client.mailbox)
+        {
+            lp__log_error("Unable to allocate cursor mailbox");
+            ret = -ENOMEM;
+            goto destroy_ctx;
+        }
+        ret = lpMailboxCreate(ctx->lp_client.sub_channel, 
+                              ctx->lp_client.mailbox);
+        if (ret < 0)
+        {
+            lp__log_warn("Unable to set up cursor mailbox: %s, using "
+                         "messages", fi_strerror(-ret));
+        }
+    }
+
     // Create new thread for cursor
+    atomic_init(&ctx->lp_client.cursor_y, -1);
     ret = pthread_create(&ctx->lp_client.cursor_thread, NULL, lpCursorThread ,ctx);
     if (ret < 0)
     {
@@ -280,36 +475,111 @@ int main(int argc, char ** argv)
         return -1;
     }
 
-    while (1)
+    // From here on, this thread only receives frames. LGMP host processing
+    // and the cursor thread are looked after by the maintenance thread.
+    ret = lpStartLGMPThread(ctx);
+    if (ret < 0)
     {
-        if (flag)
+        lp__log_error("Unable to start LGMP maintenance thread: %s", 
+                      strerror(-ret));
+        goto destroy_ctx;
+    }
+
+    // The frame header describes the viewport once the source has agreed to
+    // send it
+    if (ctx->opts.viewport.width)
+    {
+        ret = lpWaitViewport(ctx, displays);
+        if (ret < 0)
+        {
+            goto destroy_ctx;
+        }
+    }
+    if (ctx->opts.progressive)
+    {
+        ret = lpWaitOffer(ctx, &ctx->lp_client.progressive_state, 
+                          "preview");
+        if (ret < 0)
+        {
+            goto destroy_ctx;
+        }
+    }
+    if (ctx->opts.focus_rows)
+    {
+        ret = lpWaitOffer(ctx, &ctx->lp_client.focus_state, "focus band");
+        if (ret < 0)
+        {
             goto destroy_ctx;
+        }
+    }
 
-        if (ctx->state == LP_STATE_STOP)
+    // Compressed frames are written to the end of the frame buffer and
+    // decompressed in place
+    bool compressed = false;
+    if (ctx->opts.compress)
+    {
+        ret = lpWaitOffer(ctx, &ctx->lp_client.compress_state, 
+                          "block compression");
+        if (ret < 0)
         {
-            lp__log_info("Shutting down");
             goto destroy_ctx;
         }
+        compressed = ret == LP_OFFER_ACTIVE;
+    }
+    if (compressed)
+    {
+        ret = lpBC1DecoderInit(&blockDec, displays->width, displays->height,
+                               lpWorkerThreads());
+        if (ret < 0)
+        {
+            lp__log_error("Unable to set up block decompression: %s",
+                          strerror(-ret));
+            goto destroy_ctx;
+        }
+    }
 
-        if (ctx->lp_client.thread_flags == T_STOP)
+    // The first frame is written on top of the previous session's frame
+    bool delta = false;
+    if (ctx->lp_client.resync_slot >= 0)
+    {
+        ret = lpWaitOffer(ctx, &ctx->lp_client.resync_state, "tile hash");
+        if (ret < 0)
         {
-            ret = lpReinitCursorThread(ctx);
-            if (ret < 0)
-            {
-                lp__log_error("Unable to reinitialize cursor thread: %s", strerror(ret));
-                goto destroy_ctx;
-            }
-            lp__log_debug("Cursor thread Reinitialized");
+            goto destroy_ctx;
         }
-        LGMP_STATUS status;
-        status = lgmpHostProcess(ctx->lp_client.lgmp_host);
-        if (status != LGMP_OK && status != LGMP_ERR_QUEUE_EMPTY)
+        delta = ret == LP_OFFER_ACTIVE;
+    }
+
+    // In progressive mode, each frame is preceded by a preview
+    bool preview = false;
+
+    // With focus bands, each frame is received in two passes: the band
+    // around the cursor, posted on its own, then the remaining rows, merged
+    // with the band in the next slot
+    bool focus = false;
+    bool rest  = false;
+    uint32_t bandY    = 0;
+    uint32_t bandRows = 0;
+    uint8_t * focusBuf = NULL;
+
+    // Whole frames identical to the last one are acknowledged by the source
+    // without advancing its frame counter, and not sent
+    bool same     = false;
+    bool acked    = false;
+    uint64_t ackCntr = 0;
+
+    while (1)
+    {
+        if (flag)
+            goto destroy_ctx;
+
+        if (ctx->state == LP_STATE_STOP)
         {
-            lp__log_error("lgmpHostProcess failed: %s", lgmpStatusString(status));
-            return -1;
+            lp__log_info("Shutting down");
+            goto destroy_ctx;
         }
 
-        if (!lgmpHostQueueHasSubs(ctx->lp_client.host_q))
+        if (!atomic_load(&ctx->lp_client.has_subs))
         {
             retries > 100 ? trfSleep(100) : trfSleep(1);   
             retries++;
@@ -333,17 +603,92 @@ int main(int argc, char ** argv)
         retries = 0;
         displays->mem.ptr = ctx->ram;
 
-        // Update the offset where LGMP has stored the actual framebuffer data
-        ret = lpRequestFrame(ctx, displays);
+        preview = !delta && !preview 
+                  && atomic_load(&ctx->lp_client.progressive_state)
+                     == LP_OFFER_ACTIVE;
+        if (preview)
+        {
+            displays->frame_cntr |= LP_FRAME_CNTR_PREVIEW;
+        }
+
+        rest  = focus;
+        focus = !delta && !focus 
+                && atomic_load(&ctx->lp_client.focus_state) 
+                   == LP_OFFER_ACTIVE;
+        if (focus)
+        {
+            // Centre the band on the last cursor position posted to Looking
+            // Glass, or on the middle of the display if there is none yet
+            int cy   = atomic_load_explicit(&ctx->lp_client.cursor_y,
+                                            memory_order_relaxed);
+            bandRows = ctx->lp_client.focus_rows < displays->height ?
+                       ctx->lp_client.focus_rows : displays->height;
+            if (cy < 0 || cy >= (int) displays->height)
+            {
+                cy = displays->height / 2;
+            }
+            bandY = cy > (int) (bandRows / 2) ? cy - bandRows / 2 : 0;
+            if (bandY + bandRows > displays->height)
+            {
+                bandY = displays->height - bandRows;
+            }
+            if (bandY > LP_FOCUS_Y_MAX)
+            {
+                bandY = LP_FOCUS_Y_MAX;
+            }
+            displays->frame_cntr |= LP_FRAME_CNTR_FOCUS
+                                    | LP_FRAME_CNTR_BAND(bandY, bandRows);
+        }
+        else if (rest)
+        {
+            displays->frame_cntr |= LP_FRAME_CNTR_REST
+                                    | LP_FRAME_CNTR_BAND(bandY, bandRows);
+        }
+        
+        same = !delta && !preview && !focus && !rest && acked
+               && atomic_load(&ctx->lp_client.frame_last) >= 0;
+        if (same)
+        {
+            displays->frame_cntr |= LP_FRAME_CNTR_SAME;
+        }
+
+        // Update the offset where LGMP has stored the actual framebuffer
+        // data. A frame that may turn out unchanged is only posted once the
+        // source has replied, and a focus band once it has arrived.
+        ret = lpRequestFrame(ctx, displays, !same && !focus);
         if (ret < 0)
         {
             lp__log_error("Unable to request frame: %d", ret);
             ret = -1;
             goto destroy_ctx;
         }
+
+        if (delta)
+        {
+            ret = lpRestoreResyncBase(ctx, displays);
+            if (ret < 0)
+            {
+                lp__log_error("Unable to restore the previous frame: %s",
+                              strerror(-ret));
+                goto destroy_ctx;
+            }
+            displays->frame_cntr |= LP_FRAME_CNTR_DELTA;
+        }
+
+        // The resync frame is sent uncompressed, as only some of its tiles
+        // are written
+        size_t blockOffset = 0;
+        if (compressed && !delta)
+        {
+            blockOffset = trfGetDisplayBytes(displays) 
+                          - lpBC1Size(displays->width, displays->height);
+        }
         
         clock_gettime(CLOCK_MONOTONIC, &tstart);
+        displays->fb_offset += blockOffset;
         ret = trfRecvFrame(ctx->lp_client.client_ctx, displays);
+        displays->fb_offset -= blockOffset;
+        displays->frame_cntr &= LP_FRAME_CNTR_SERIAL_MASK;
         if (ret < 0)
         {
             lp__log_error("Unable to receive frame: error %s\n", strerror(-ret));
@@ -352,44 +697,19 @@ int main(int argc, char ** argv)
         clock_gettime(CLOCK_MONOTONIC, &tend);
         double tsd1 = timespecdiff(tstart, tend) / 1000000.0;
 
-        bool repeatframe = false;
         while (1)
         {
             if (flag)
                 goto destroy_ctx;
 
-            if (ctx->lp_client.thread_flags == T_ERR)
+            if (ctx->lp_client.thread_flags == T_ERR 
+                || ctx->state == LP_STATE_STOP)
             {
                 goto destroy_ctx;
             }
 
-            if (repeatframe)
-            {
-                status = lgmpHostQueuePost(
-                    ctx->lp_client.host_q, 0,
-                    ctx->lp_client.frame_memory[ctx->lp_client.frame_index]);
-                if (status != LGMP_OK && status != LGMP_ERR_QUEUE_FULL)
-                {
-                    lp__log_error("Failed lgmpHostQueuePost: %s", 
-                        lgmpStatusString(status));
-                    goto destroy_ctx;
-                }
-                ret = lpSignalFrameDone(ctx, displays);
-                if (ret < 0)
-                {
-                    lp__log_error("Unable to signal frame done: %s", 
-                            strerror(ret));
-                }
-            }
-
-            status = lpKeepLGMPSessionAlive(ctx, displays);
-            if (status != LGMP_OK)
-            {
-                return -1;
-            }
-        
-            // We cannot use an infinite timeout, since we need to keep the LGMP
-            // session alive
+            // A finite timeout is used so that the exit conditions above are
+            // still checked
             if (cc->opts->fab_cq_sync)
                 ret = lpPollMsg(ctx, &msg, 100);
             else
@@ -398,7 +718,6 @@ int main(int argc, char ** argv)
             if (ret == -EAGAIN)
             {
                 trfNanoSleep(cc->opts->fab_poll_rate);
-                repeatframe = true;
                 continue;
             }
             if (ret < 0)
@@ -428,6 +747,69 @@ int main(int argc, char ** argv)
             else if (ifmt == TRFM_SERVER_ACK_F_REQ)
             {
                 lp__log_debug("Acknowledgement received...");
+                uint64_t cntr = msg->server_ack_f_req->frame_cntr;
+                bool unchanged = same && cntr == ackCntr;
+                ackCntr = cntr;
+                acked   = true;
+                if (unchanged)
+                {
+                    lp__log_debug("Frame unchanged, reusing the last one");
+                    ret = lpSignalFrameUnchanged(ctx, displays);
+                    if (ret < 0)
+                    {
+                        lp__log_error("Could not signal unchanged frame: %s",
+                                      strerror(-ret));
+                        goto destroy_ctx;
+                    }
+                    trf__ProtoFree(msg);
+                    break;
+                }
+                if (same)
+                {
+                    ret = lpPostFrame(ctx);
+                    if (ret < 0)
+                    {
+                        goto destroy_ctx;
+                    }
+                }
+                if (blockOffset)
+                {
+                    lpBC1Decode(&blockDec, trfGetFBPtr(displays), 
+                                trfGetFBPtr(displays) + blockOffset);
+                }
+                if (preview)
+                {
+                    ret = lpUpscalePreview(trfGetFBPtr(displays), 
+                                           displays->width, displays->height);
+                    if (ret < 0)
+                    {
+                        lp__log_error("Unable to expand preview: %s",
+                                      strerror(-ret));
+                        goto destroy_ctx;
+                    }
+                }
+                if (focus)
+                {
+                    focusBuf = trfGetFBPtr(displays);
+                    ret = lpSignalFrameBand(ctx, displays, bandY, bandRows);
+                    if (ret < 0)
+                    {
+                        lp__log_error("Could not signal focus band: %s",
+                                      strerror(-ret));
+                        goto destroy_ctx;
+                    }
+                    trf__ProtoFree(msg);
+                    break;
+                }
+                if (rest && focusBuf && focusBuf != trfGetFBPtr(displays))
+                {
+                    // The band is in the previous slot, which Looking Glass
+                    // clients only read from
+                    size_t pitch = trfGetTextureBytes(displays->width, 1, 
+                                                      displays->format);
+                    memcpy(trfGetFBPtr(displays) + bandY * pitch,
+                           focusBuf + bandY * pitch, bandRows * pitch);
+                }
                 ret = lpSignalFrameDone(ctx, displays);
                 if (ret < 0)
                 {
@@ -435,7 +817,6 @@ int main(int argc, char ** argv)
                                   strerror(-ret));
                     goto destroy_ctx;
                 }
-                repeatframe = false;
                 trf__ProtoFree(msg);
                 break;
             }
@@ -454,11 +835,13 @@ int main(int argc, char ** argv)
                ((double) trfGetDisplayBytes(displays)) / tsd2 / 1e5,
                1000.0 / tsd2);
         displays->frame_cntr++;
+        delta = false;
     }
 
 
 destroy_ctx:
     ctx->state = LP_STATE_STOP; // Shutdown all threads
+    lpStopLGMPThread(ctx);
 
     void * tret = NULL;
     if (ctx->lp_client.sub_started)
@@ -477,6 +860,7 @@ destroy_ctx:
             }
         }
     }
+    lpBC1CoderDestroy(&blockDec);
     lpDestroyContext(ctx);
     if (msg)
     {
@@ -41,6 +41,7 @@
 #include "lp_write.h"
 #include "lp_msg.pb-c.h"
 #include "lp_utils.h"
+#include "lp_bcn.h"
 
 
 
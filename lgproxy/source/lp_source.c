@@ -50,6 +50,26 @@ static const char * LP_USAGE_GUIDE_STR =                                \
 "   -r  Polling interval (default unit: ms, default value: 0)\n"        \
 "       [Experimental] use -1 for sync mode\n"                          \
 "       [Experimental] use n/u/m/s for nano/micro/milli/whole seconds, respectively\n" \
+"\n"                                                                    \
+"   -w  Number of threads used to prefault the shared memory at startup\n" \
+"       (default: 0, fault pages in on first access)\n"                   \
+"\n"                                                                    \
+"   -c  Frame chunk size (e.g. 512k, default: 1m, 0 to send whole frames)\n" \
+"       Cursor updates wait for at most one chunk of frame data\n"       \
+"\n"                                                                    \
+"   -q  Number of capture buffers (2 - 8, default: 0, disabled)\n"      \
+"       Frames are copied out of shared memory by a separate thread\n"  \
+"\n"                                                                    \
+"   -t  Target frame transfer time in ms (default: 0, disabled)\n"      \
+"       The frame rate is capped to what the link sustains\n"          \
+"\n"                                                                    \
+"   -a  File to append frame rate decisions to as CSV\n"               \
+"\n"                                                                    \
+"   -x  Downscale frames by a factor (e.g. 2) or to a size (e.g. 1280x720)\n" \
+"       Enables the capture buffers if -q is not set\n"                 \
+"\n"                                                                    \
+"   -X  Downscaling filter, box or bilinear\n"                          \
+"       (default: box for factors, bilinear for sizes)\n"               \
 ;
 
 volatile int8_t flag = 0;
@@ -73,6 +93,7 @@ int main(int argc, char ** argv)
 
     char * host = NULL;
     char * port = NULL;
+    int scaleFilter = -1;
 
     if (lpSetDefaultOpts(ctx))
     {
@@ -81,7 +102,7 @@ int main(int argc, char ** argv)
     }
 
     int o;
-    while ((o = getopt(argc, argv, "h:p:f:s:r:")) != -1)
+    while ((o = getopt(argc, argv, "h:p:f:s:r:w:c:q:t:a:x:X:")) != -1)
     {
         switch (o)
         {
@@ -101,6 +122,45 @@ int main(int argc, char ** argv)
                 lp__log_info("Requested polling interval: %s", optarg);
                 ctx->opts.poll_int = lpParsePollString(optarg);
                 break;
+            case 'w':
+                ctx->opts.prefault_threads = atoi(optarg);
+                break;
+            case 'c':
+                ctx->opts.frame_chunk = lpParseMemString(optarg);
+                break;
+            case 'q':
+                ctx->opts.capture_depth = atoi(optarg);
+                if (ctx->opts.capture_depth != 0 
+                    && (ctx->opts.capture_depth < 2 
+                        || ctx->opts.capture_depth > LP_CAPTURE_DEPTH_MAX))
+                {
+                    lp__log_fatal("Capture buffers must be between 2 and %d",
+                                  LP_CAPTURE_DEPTH_MAX);
+                    return EINVAL;
+                }
+                break;
+            case 't':
+                ctx->opts.adapt_target = (uint32_t) (atof(optarg) * 1000);
+                break;
+            case 'a':
+                ctx->opts.adapt_log = optarg;
+                break;
+            case 'x':
+                if (lpParseScale(optarg, &ctx->opts.scale) < 0)
+                {
+                    lp__log_fatal("Invalid scaling factor or size: %s", 
+                                  optarg);
+                    return EINVAL;
+                }
+                break;
+            case 'X':
+                scaleFilter = lpParseScaleFilter(optarg);
+                if (scaleFilter < 0)
+                {
+                    lp__log_fatal("Invalid scaling filter: %s", optarg);
+                    return EINVAL;
+                }
+                break;
             default:
             case '?':
                 lp__log_fatal("Invalid argument -%c", optopt);
@@ -118,6 +178,22 @@ int main(int argc, char ** argv)
     lpSetLPLogLevel();  // Set lgproxy log level
     lpSetTRFLogLevel(); // Set libtrf log level
 
+    if (ctx->opts.scale.factor || ctx->opts.scale.width)
+    {
+        if (scaleFilter < 0)
+        {
+            scaleFilter = ctx->opts.scale.factor ? LP_SCALE_BOX 
+                                                 : LP_SCALE_BILINEAR;
+        }
+        ctx->opts.scale.filter = scaleFilter;
+        if (!ctx->opts.capture_depth)
+        {
+            // Frames are scaled while being copied out of shared memory
+            lp__log_info("Downscaling enabled, using 2 capture buffers");
+            ctx->opts.capture_depth = 2;
+        }
+    }
+
 
     if (!host || !port)
     {
@@ -170,13 +246,901 @@ destroy_ctx:
 
 }
 
+/**
+ * @brief Write a frame to the sink in chunks of at most chunk bytes. Each
+ * chunk is split into up to LP_SCHED_FRAME_WINDOW writes kept in flight
+ * together, so at most one chunk is outstanding at any time. While a cursor
+ * update is in flight on the subchannel, the outstanding writes are drained
+ * and the next one is held back.
+ * 
+ * @param cc        Client context
+ * @param src       Frame data
+ * @param len       Size of the frame data in bytes
+ * @param desc      Fabric descriptor of the frame data
+ * @param addr      Remote address of the sink's frame buffer
+ * @param rkey      Remote key of the sink's frame buffer
+ * @param chunk     Chunk size in bytes
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendFrameChunked(PTRFContext cc, uint8_t * src, size_t len, 
+                              void * desc, uint64_t addr, uint64_t rkey, 
+                              size_t chunk, LPSched * s, LPAdapt * a)
+{
+    uint64_t held       = 0;
+    size_t inflight     = 0;
+    size_t sampled      = 0;
+    uint64_t start      = lpGetTimeNs();
+    size_t write        = chunk;
+    size_t window       = 1;
+    if (chunk < len)
+    {
+        write = chunk / LP_SCHED_FRAME_WINDOW;
+        if (write < LP_SCHED_MIN_WRITE)
+        {
+            write = chunk < LP_SCHED_MIN_WRITE ? chunk : LP_SCHED_MIN_WRITE;
+        }
+        window = chunk / write;
+    }
+    ssize_t ret;
+    for (size_t off = 0; off < len; off += write)
+    {
+        size_t n = len - off < write ? len - off : write;
+        if (lpSchedUrgent(s))
+        {
+            // Only the chunks already in flight are ahead of the cursor
+            ret = lpWaitSends(cc, inflight);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            inflight = 0;
+            lpAdaptSample(a, off - sampled, lpGetTimeNs() - start);
+            held    += lpSchedWait(s);
+            sampled = off;
+            start   = lpGetTimeNs();
+        }
+        else if (inflight == window)
+        {
+            ret = lpWaitSends(cc, 1);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            inflight--;
+        }
+
+        while ((ret = fi_write(cc->xfer.fabric->ep, src + off, n, desc, 
+                               cc->xfer.fabric->peer_addr, addr + off, rkey,
+                               NULL)) == -FI_EAGAIN)
+        {
+            struct fi_cq_data_entry de[LP_SCHED_FRAME_WINDOW];
+            struct fi_cq_err_entry err;
+            ret = trfFabricPollSend(cc, de, &err, 0, 0, NULL, 
+                                    inflight ? inflight : 1);
+            if (ret > 0)
+            {
+                inflight -= (size_t) ret < inflight ? (size_t) ret : inflight;
+            }
+            else if (ret < 0 && ret != -FI_EAGAIN)
+            {
+                return ret;
+            }
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+        inflight++;
+    }
+
+    ret = lpWaitSends(cc, inflight);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    lpAdaptSample(a, len - sampled, lpGetTimeNs() - start);
+    lpSchedRecord(s, LP_SCHED_FRAME, held);
+    lpSchedReport(s, LP_SCHED_FRAME, false);
+    return 0;
+}
+
+/**
+ * @brief Write the part of a frame inside a rectangle to the sink. Rows are
+ * written in batches of about chunk bytes, with all writes in a batch in
+ * flight at once.
+ * 
+ * @param cc        Client context
+ * @param src       Frame data
+ * @param disp      Display the frame data belongs to
+ * @param vp        Rectangle, within the display
+ * @param desc      Fabric descriptor of the frame data
+ * @param addr      Remote address of the first pixel of the rectangle
+ * @param dstPitch  Size of a row in the sink's frame buffer in bytes. The
+ *                  rectangle's own row size packs it tightly, as a frame of
+ *                  its size.
+ * @param rkey      Remote key of the sink's frame buffer
+ * @param chunk     Batch size in bytes, 0 to send the viewport in one batch
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendFrameRect(PTRFContext cc, uint8_t * src, PTRFDisplay disp,
+                           const LPViewport * vp, void * desc, uint64_t addr,
+                           size_t dstPitch, uint64_t rkey, size_t chunk, 
+                           LPSched * s, LPAdapt * a)
+{
+    size_t pitch    = trfGetTextureBytes(disp->width, 1, disp->format);
+    size_t bpp      = pitch / disp->width;
+    size_t rowLen   = vp->width * bpp;
+    uint8_t * first = src + vp->y * pitch + vp->x * bpp;
+
+    // Full-width rectangles are contiguous
+    if (rowLen == pitch && dstPitch == pitch)
+    {
+        size_t len = vp->height * pitch;
+        return lpSendFrameChunked(cc, first, len, desc, addr, rkey, 
+                                  chunk ? chunk : len, s, a);
+    }
+
+    size_t batch = chunk ? chunk / rowLen : vp->height;
+    batch = batch < 1 ? 1 : batch;
+    batch = batch > LP_VIEWPORT_BATCH_MAX ? LP_VIEWPORT_BATCH_MAX : batch;
+
+    uint64_t held = 0;
+    for (size_t row = 0; row < vp->height; row += batch)
+    {
+        size_t n = vp->height - row < batch ? vp->height - row : batch;
+        held += lpSchedWait(s);
+
+        uint64_t start  = lpGetTimeNs();
+        size_t done     = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            ssize_t ret;
+            while ((ret = fi_write(cc->xfer.fabric->ep, 
+                                   first + (row + i) * pitch, rowLen, desc, 
+                                   cc->xfer.fabric->peer_addr, 
+                                   addr + (row + i) * dstPitch, rkey, 
+                                   NULL)) == -FI_EAGAIN)
+            {
+                // Completions of this batch's earlier writes are counted
+                struct fi_cq_data_entry de;
+                struct fi_cq_err_entry err;
+                ret = trfFabricPollSend(cc, &de, &err, 0, 0, NULL, 1);
+                if (ret > 0)
+                {
+                    done += ret;
+                }
+                else if (ret < 0 && ret != -FI_EAGAIN)
+                {
+                    return ret;
+                }
+            }
+            if (ret < 0)
+            {
+                return ret;
+            }
+        }
+        ssize_t ret = lpWaitSends(cc, n - done);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        lpAdaptSample(a, n * rowLen, lpGetTimeNs() - start);
+    }
+
+    lpSchedRecord(s, LP_SCHED_FRAME, held);
+    lpSchedReport(s, LP_SCHED_FRAME, false);
+    return 0;
+}
+
+/**
+ * @brief Write a band of full rows of a frame to the sink, at the same
+ * position in the sink's frame buffer. Nothing is written for an empty band.
+ * 
+ * @param cc        Client context
+ * @param src       Frame data
+ * @param desc      Fabric descriptor of the frame data
+ * @param pitch     Size of a frame row in bytes
+ * @param y         First row of the band
+ * @param rows      Number of rows in the band
+ * @param addr      Remote address of the sink's frame buffer
+ * @param rkey      Remote key of the sink's frame buffer
+ * @param chunk     Chunk size in bytes, 0 to send the band in a single write
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendFrameRows(PTRFContext cc, uint8_t * src, void * desc, 
+                           size_t pitch, uint32_t y, uint32_t rows, 
+                           uint64_t addr, uint64_t rkey, size_t chunk, 
+                           LPSched * s, LPAdapt * a)
+{
+    if (!rows)
+    {
+        return 0;
+    }
+    size_t off = (size_t) y * pitch;
+    size_t len = (size_t) rows * pitch;
+    return lpSendFrameChunked(cc, src + off, len, desc, addr + off, rkey, 
+                              chunk ? chunk : len, s, a);
+}
+
+/**
+ * @brief Write the tiles of a frame whose hashes differ from the sink's, each
+ * at its place in the sink's frame buffer, which holds the frame the hashes
+ * were made from. Changed tiles next to each other in a row are written as
+ * one rectangle, and consecutive rows that changed completely as one band.
+ * 
+ * @param cc        Client context
+ * @param g         Tile grid of the frame
+ * @param hashes    Sink's tile hashes
+ * @param src       Frame data
+ * @param disp      Display the frame data belongs to
+ * @param desc      Fabric descriptor of the frame data
+ * @param addr      Remote address of the sink's frame buffer
+ * @param rkey      Remote key of the sink's frame buffer
+ * @param chunk     Batch size in bytes, 0 to send each rectangle in one batch
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @param bytes     Set to the number of bytes written
+ * @return Number of tiles written on success, negative error code on failure
+ */
+static ssize_t lpSendFrameDelta(PTRFContext cc, const LPTileGrid * g, 
+                                const uint64_t * hashes, uint8_t * src, 
+                                PTRFDisplay disp, void * desc, uint64_t addr,
+                                uint64_t rkey, size_t chunk, LPSched * s, 
+                                LPAdapt * a, size_t * bytes)
+{
+    size_t pitch    = trfGetTextureBytes(disp->width, 1, disp->format);
+    size_t bpp      = pitch / disp->width;
+    LPViewport band = {0};
+    ssize_t sent    = 0;
+    int ret;
+
+    *bytes = 0;
+    for (uint32_t r = 0; r < g->rows; r++)
+    {
+        uint32_t y  = r * g->tile;
+        uint32_t h  = g->height - y < g->tile ? g->height - y : g->tile;
+        uint32_t c  = 0;
+        while (c < g->cols)
+        {
+            uint32_t i = r * g->cols + c;
+            if (lpHashTile(g, src, pitch, bpp, i) == hashes[i])
+            {
+                c++;
+                continue;
+            }
+            uint32_t end = c + 1;
+            while (end < g->cols 
+                   && lpHashTile(g, src, pitch, bpp, i + end - c) 
+                      != hashes[i + end - c])
+            {
+                end++;
+            }
+            sent += end - c;
+
+            uint32_t x      = c * g->tile;
+            uint32_t right  = end * g->tile < g->width ? end * g->tile 
+                                                       : g->width;
+            *bytes += (size_t) (right - x) * h * bpp;
+            LPViewport rect = {
+                .x      = x,
+                .y      = y,
+                .width  = right - x,
+                .height = h
+            };
+            c = end;
+
+            // Whole rows are merged with the rows changed above them
+            if (rect.width == g->width && band.height 
+                && band.y + band.height == y)
+            {
+                band.height += h;
+                continue;
+            }
+            if (band.height)
+            {
+                ret = lpSendFrameRect(cc, src, disp, &band, desc,
+                                      addr + band.y * pitch, pitch, rkey, 
+                                      chunk, s, a);
+                if (ret < 0)
+                {
+                    return ret;
+                }
+                band = (LPViewport) {0};
+            }
+            if (rect.width == g->width)
+            {
+                band = rect;
+                continue;
+            }
+            ret = lpSendFrameRect(cc, src, disp, &rect, desc, 
+                                  addr + y * pitch + x * bpp, pitch, rkey, 
+                                  chunk, s, a);
+            if (ret < 0)
+            {
+                return ret;
+            }
+        }
+    }
+    if (band.height)
+    {
+        ret = lpSendFrameRect(cc, src, disp, &band, desc, 
+                              addr + band.y * pitch, pitch, rkey, chunk, s, 
+                              a);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    return sent;
+}
+
+/**
+ * @brief Quarter resolution previews, sent ahead of frames in progressive
+ * delivery
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Half width and height box filter
+     * 
+     */
+    LPScaler                scaler;
+    /**
+     * @brief Staging buffer for the preview, and its fabric registration
+     * 
+     */
+    uint8_t *               mem;
+    struct fid_mr *         mr;
+    size_t                  size;
+} LPPreview;
+
+/**
+ * @brief Set up preview scaling and the preview staging buffer
+ * 
+ * @param cc        Client context the previews will be sent on
+ * @param p         Previews to set up
+ * @param disp      Display the frames belong to
+ * @return 0 on success, negative error code on failure
+ */
+static int lpPreviewInit(PTRFContext cc, LPPreview * p, PTRFDisplay disp)
+{
+    memset(p, 0, sizeof(*p));
+    LPScaleOpts opts = {
+        .factor = 2,
+        .filter = LP_SCALE_BOX
+    };
+    int ret = lpScalerInit(&p->scaler, &opts, disp->width, disp->height,
+                           lpWorkerThreads());
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    size_t psize = trf__GetPageSize();
+    p->size = (size_t) p->scaler.dst_w * p->scaler.dst_h * 4;
+    p->mem  = trfAllocAligned((p->size + psize - 1) / psize * psize, psize);
+    if (!p->mem)
+    {
+        ret = -ENOMEM;
+        goto destroy_scaler;
+    }
+    ret = fi_mr_reg(cc->xfer.fabric->domain, p->mem, p->size, FI_WRITE, 0, 0, 
+                    0, &p->mr, NULL);
+    if (ret < 0)
+    {
+        goto free_mem;
+    }
+    return 0;
+
+free_mem:
+    free(p->mem);
+    p->mem = NULL;
+destroy_scaler:
+    lpScalerDestroy(&p->scaler);
+    return ret;
+}
+
+/**
+ * @brief Free the resources of the previews. Does nothing if they were not
+ * set up.
+ * 
+ * @param p         Previews
+ */
+static void lpPreviewDestroy(LPPreview * p)
+{
+    if (p->mr)
+    {
+        fi_close(&p->mr->fid);
+        p->mr = NULL;
+    }
+    free(p->mem);
+    p->mem = NULL;
+    lpScalerDestroy(&p->scaler);
+}
+
+/**
+ * @brief Write a preview of a frame to the sink, as a tightly packed frame of
+ * half the display's width and height
+ * 
+ * @param cc        Client context
+ * @param p         Previews
+ * @param src       Complete frame data
+ * @param pitch     Size of a frame row in bytes
+ * @param addr      Remote address of the sink's frame buffer
+ * @param rkey      Remote key of the sink's frame buffer
+ * @param chunk     Maximum write size in bytes, 0 to send the preview in a
+ *                  single write
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendPreview(PTRFContext cc, LPPreview * p, const uint8_t * src,
+                         size_t pitch, uint64_t addr, uint64_t rkey, 
+                         size_t chunk, LPSched * s, LPAdapt * a)
+{
+    lpScaleBuffer(&p->scaler, p->mem, src, pitch);
+    return lpSendFrameChunked(cc, p->mem, p->size, fi_mr_desc(p->mr), addr,
+                              rkey, chunk ? chunk : p->size, s, a);
+}
+
+/**
+ * @brief Block compression state for the frames sent to a sink that asked
+ * for them
+ * 
+ */
+typedef struct {
+    /**
+     * @brief BC1 encoder
+     * 
+     */
+    LPBlockCoder            enc;
+    /**
+     * @brief Staging buffer for compressed frames, and its fabric
+     * registration
+     * 
+     */
+    uint8_t *               mem;
+    struct fid_mr *         mr;
+    size_t                  size;
+} LPBlockStage;
+
+/**
+ * @brief Set up the encoder and the staging buffer for compressed frames
+ * 
+ * @param cc        Client context the frames will be sent on
+ * @param b         Block compression state to set up
+ * @param disp      Display the frames belong to
+ * @return 0 on success, negative error code on failure
+ */
+static int lpBlockStageInit(PTRFContext cc, LPBlockStage * b, 
+                            PTRFDisplay disp)
+{
+    memset(b, 0, sizeof(*b));
+    int ret = lpBC1EncoderInit(&b->enc, disp->width, disp->height, 
+                               lpWorkerThreads());
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    size_t psize = trf__GetPageSize();
+    b->size = lpBC1Size(disp->width, disp->height);
+    b->mem  = trfAllocAligned((b->size + psize - 1) / psize * psize, psize);
+    if (!b->mem)
+    {
+        ret = -ENOMEM;
+        goto destroy_enc;
+    }
+    ret = fi_mr_reg(cc->xfer.fabric->domain, b->mem, b->size, FI_WRITE, 0, 0, 
+                    0, &b->mr, NULL);
+    if (ret < 0)
+    {
+        goto free_mem;
+    }
+    return 0;
+
+free_mem:
+    free(b->mem);
+    b->mem = NULL;
+destroy_enc:
+    lpBC1CoderDestroy(&b->enc);
+    return ret;
+}
+
+/**
+ * @brief Free the resources of block compression. Does nothing if it was not
+ * set up.
+ * 
+ * @param b         Block compression state
+ */
+static void lpBlockStageDestroy(LPBlockStage * b)
+{
+    if (b->mr)
+    {
+        fi_close(&b->mr->fid);
+        b->mr = NULL;
+    }
+    free(b->mem);
+    b->mem = NULL;
+    lpBC1CoderDestroy(&b->enc);
+}
+
+/**
+ * @brief Compress a frame to BC1 and write it to the sink. The sink has the
+ * compressed frame written to the end of its frame buffer, and decompresses
+ * it in place.
+ * 
+ * @param cc        Client context
+ * @param b         Block compression state
+ * @param src       Complete frame data
+ * @param pitch     Size of a frame row in bytes
+ * @param addr      Remote address the compressed frame is written to
+ * @param rkey      Remote key of the sink's frame buffer
+ * @param chunk     Maximum write size in bytes, 0 to send the frame in a
+ *                  single write
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendBlocks(PTRFContext cc, LPBlockStage * b, const uint8_t * src,
+                        size_t pitch, uint64_t addr, uint64_t rkey, 
+                        size_t chunk, LPSched * s, LPAdapt * a)
+{
+    lpBC1Encode(&b->enc, b->mem, src, pitch);
+    return lpSendFrameChunked(cc, b->mem, b->size, fi_mr_desc(b->mr), addr,
+                              rkey, chunk ? chunk : b->size, s, a);
+}
+
+/**
+ * @brief Features the sink offered before its first frame request, latched
+ * at that request
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Set once the offers have been latched
+     * 
+     */
+    bool                    latched;
+    /**
+     * @brief Only the viewport is sent, instead of the whole display
+     * 
+     */
+    bool                    crop;
+    LPViewport              vp;
+    /**
+     * @brief Each frame may be preceded by a preview
+     * 
+     */
+    bool                    progressive;
+    /**
+     * @brief Each frame may be sent in two passes, a band around the cursor
+     * and the remaining rows
+     * 
+     */
+    bool                    focused;
+    /**
+     * @brief The first frame may be sent as the tiles that changed since the
+     * sink's old frame. Cleared once it has been sent.
+     * 
+     */
+    bool                    resync;
+    /**
+     * @brief Frames are sent compressed to BC1
+     * 
+     */
+    bool                    compressed;
+} LPOffers;
+
+/**
+ * @brief Latch one offer. An offer the sink has not made by now is
+ * rejected, so that it can no longer be accepted.
+ * 
+ * @param state     Offer state (enum LP_OFFER_STATE)
+ * @return true if the offer was accepted
+ */
+static inline bool lpLatchOffer(atomic_int * state)
+{
+    int none = LP_OFFER_NONE;
+    return !atomic_compare_exchange_strong(state, &none, LP_OFFER_REJECTED);
+}
+
+/**
+ * @brief Latch the offers made by the sink at its first frame request, and
+ * set up previews and block compression if they were accepted
+ * 
+ * @param ctx       Context to use
+ * @param o         Offers to latch
+ * @param disp      Display the frames are sent from
+ * @param preview   Previews to set up
+ * @param blocks    Block compression state to set up
+ * @return 0 on success, negative error code on failure
+ */
+static int lpLatchOffers(PLPContext ctx, LPOffers * o, PTRFDisplay disp, 
+                         LPPreview * preview, LPBlockStage * blocks)
+{
+    PTRFContext cc = ctx->lp_host.client_ctx;
+    int ret;
+    o->crop = lpLatchOffer(&ctx->lp_host.viewport_state);
+    if (o->crop)
+    {
+        o->vp = ctx->lp_host.viewport;
+    }
+    o->progressive = lpLatchOffer(&ctx->lp_host.progressive_state);
+    if (o->progressive)
+    {
+        // The sink expects previews from now on
+        ret = lpPreviewInit(cc, preview, disp);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to set up previews: %s", fi_strerror(-ret));
+            return ret;
+        }
+    }
+    o->focused      = lpLatchOffer(&ctx->lp_host.focus_state);
+    o->resync       = lpLatchOffer(&ctx->lp_host.resync_state);
+    o->compressed   = lpLatchOffer(&ctx->lp_host.compress_state);
+    if (o->compressed)
+    {
+        // The sink expects compressed frames from now on
+        ret = lpBlockStageInit(cc, blocks, disp);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to set up block compression: %s", 
+                          fi_strerror(-ret));
+            return ret;
+        }
+    }
+    o->latched = true;
+    return 0;
+}
+
+/**
+ * @brief Frame request from the sink, with the frame it is answered with
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Frame data, its fabric descriptor and size in bytes
+     * 
+     */
+    uint8_t *               src;
+    void *                  desc;
+    size_t                  size;
+    /**
+     * @brief The frame was staged by the capture thread, outside the
+     * display's registered memory
+     * 
+     */
+    bool                    staged;
+    /**
+     * @brief Sink's frame buffer
+     * 
+     */
+    uint64_t                addr;
+    uint64_t                rkey;
+    /**
+     * @brief Pass requested, at most one of which is set
+     * 
+     */
+    bool                    delta;
+    bool                    preview;
+    bool                    focus;
+    bool                    rest;
+    /**
+     * @brief Focus band, valid for focus and rest passes
+     * 
+     */
+    uint32_t                band_y;
+    uint32_t                band_rows;
+} LPFrameReq;
+
+/**
+ * @brief Send the part of a frame a request asks for, in the form the sink
+ * agreed to
+ * 
+ * @param ctx       Context to use
+ * @param disp      Display the frame belongs to
+ * @param o         Latched offers
+ * @param r         Frame request
+ * @param preview   Previews
+ * @param blocks    Block compression state
+ * @param s         Priority gate shared with the cursor thread
+ * @param a         Frame rate controller to record write times in, may be
+ *                  NULL
+ * @return Number of bytes sent on success, negative error code on failure
+ */
+static ssize_t lpSendFrameReq(PLPContext ctx, PTRFDisplay disp, 
+                              const LPOffers * o, const LPFrameReq * r,
+                              LPPreview * preview, LPBlockStage * blocks,
+                              LPSched * s, LPAdapt * a)
+{
+    PTRFContext cc  = ctx->lp_host.client_ctx;
+    size_t chunk    = ctx->opts.frame_chunk;
+    size_t pitch    = trfGetTextureBytes(disp->width, 1, disp->format);
+    ssize_t ret;
+
+    if (r->delta)
+    {
+        size_t bytes;
+        ret = lpSendFrameDelta(cc, &ctx->lp_host.resync_grid,
+                               ctx->lp_host.resync_hashes, r->src, disp, 
+                               r->desc, r->addr, r->rkey, chunk, s, a, 
+                               &bytes);
+        if (ret < 0)
+        {
+            lp__log_error("unable to send changed tiles: %s", 
+                          fi_strerror(-ret));
+            return ret;
+        }
+        lp__log_info("Resynced %zd of %u tiles", ret, 
+                     ctx->lp_host.resync_grid.count);
+        return bytes;
+    }
+    if (o->compressed)
+    {
+        ret = lpSendBlocks(cc, blocks, r->src, pitch, r->addr, r->rkey, 
+                           chunk, s, a);
+        if (ret < 0)
+        {
+            lp__log_error("unable to send compressed frame: %s", 
+                          fi_strerror(-ret));
+            return ret;
+        }
+        return blocks->size;
+    }
+    if (r->preview)
+    {
+        ret = lpSendPreview(cc, preview, r->src, pitch, r->addr, r->rkey, 
+                            chunk, s, a);
+        if (ret < 0)
+        {
+            lp__log_error("unable to send preview: %s", fi_strerror(-ret));
+            return ret;
+        }
+        return preview->size;
+    }
+    if (r->focus || r->rest)
+    {
+        uint32_t after  = r->band_y + r->band_rows;
+        size_t rows     = r->focus ? r->band_rows 
+                                   : disp->height - r->band_rows;
+        if (r->focus)
+        {
+            ret = lpSendFrameRows(cc, r->src, r->desc, pitch, r->band_y, 
+                                  r->band_rows, r->addr, r->rkey, chunk, s,
+                                  a);
+        }
+        else
+        {
+            ret = lpSendFrameRows(cc, r->src, r->desc, pitch, 0, r->band_y,
+                                  r->addr, r->rkey, chunk, s, a);
+            if (ret == 0)
+            {
+                ret = lpSendFrameRows(cc, r->src, r->desc, pitch, after, 
+                                      disp->height - after, r->addr, 
+                                      r->rkey, chunk, s, a);
+            }
+        }
+        if (ret < 0)
+        {
+            lp__log_error("unable to send frame rows: %s", 
+                          fi_strerror(-ret));
+            return ret;
+        }
+        return rows * pitch;
+    }
+    if (o->crop)
+    {
+        size_t bpp = pitch / disp->width;
+        ret = lpSendFrameRect(cc, r->src, disp, &o->vp, r->desc, r->addr, 
+                              o->vp.width * bpp, r->rkey, chunk, s, a);
+        if (ret < 0)
+        {
+            lp__log_error("unable to send frame: %s", fi_strerror(-ret));
+            return ret;
+        }
+        return (size_t) o->vp.width * o->vp.height * bpp;
+    }
+    if (r->staged || chunk)
+    {
+        // Staged frames are always written with RMA writes, as they are not
+        // in the display's registered memory
+        ret = lpSendFrameChunked(cc, r->src, r->size, r->desc, r->addr, 
+                                 r->rkey, chunk ? chunk : r->size, s, a);
+        if (ret < 0)
+        {
+            lp__log_error("unable to send frame: %s", fi_strerror(-ret));
+            return ret;
+        }
+        return r->size;
+    }
+
+    uint64_t start = lpGetTimeNs();
+    ret = trfSendFrame(cc, disp, r->addr, r->rkey);
+    if (ret < 0)
+    {
+        lp__log_error("unable to send frame: %d\n", ret);
+        return ret;
+    }
+
+    struct fi_cq_data_entry de;
+    struct fi_cq_err_entry err = {0};
+    ret = trfGetSendProgress(cc, &de, &err, 1, cc->opts);
+    if (ret <= 0)
+    {
+        lp__log_error("Error: %s", fi_strerror(err.err));
+        return ret < 0 ? ret : -EIO;
+    }
+    lpAdaptSample(a, r->size, lpGetTimeNs() - start);
+    return r->size;
+}
+
 int lpHandleClientReq(PLPContext ctx)
 {
     pthread_t sub_channel = 0; // Not necessary, but it shuts up CodeQL.
     bool sub_started = 0;
     int ret = 0;
+    LPSched sched;
+    LPDemand demand;
+    LPAdapt adaptState;
+    LPAdapt * adapt = NULL;
+    LPFrameLease lease = {0};
+    LPCapture cap = {0};
+    LPScaler scaler = {0};
+    uint32_t srcWidth = 0, srcHeight = 0;
+    lpSchedInit(&sched);
+    lpDemandInit(&demand);
+    ctx->lp_host.sched = &sched;
+    ctx->lp_host.demand = &demand;
+    ctx->lp_host.display = NULL;
+    atomic_store(&ctx->lp_host.viewport_state, LP_OFFER_NONE);
+    atomic_store(&ctx->lp_host.progressive_state, LP_OFFER_NONE);
+    atomic_store(&ctx->lp_host.focus_state, LP_OFFER_NONE);
+    atomic_store(&ctx->lp_host.resync_state, LP_OFFER_NONE);
+    atomic_store(&ctx->lp_host.compress_state, LP_OFFER_NONE);
+    ctx->lp_host.resync_hashes      = NULL;
+    ctx->lp_host.resync_filled      = NULL;
+    ctx->lp_host.resync_received    = 0;
+    LPOffers offers = {0};
+    LPPreview preview = {0};
+    LPBlockStage blocks = {0};
+    // Set once a preview or focus band has been sent. The frame it came from
+    // is held until the rest of it has been sent on the next request.
+    bool held = false;
+    // Captured frame being held, NULL if it was leased from LGMP
+    LPCaptureFrame * heldFrame = NULL;
+    // Hash of the last whole frame sent, valid if the sink was able to
+    // accept an unchanged acknowledgement instead of it
+    uint64_t sentHash = 0;
+    bool sentValid = false;
+    uint64_t unchangedCount = 0;
     lp__log_trace("Accepted Connection");
 
+    if (ctx->opts.adapt_target)
+    {
+        ret = lpAdaptInit(&adaptState, ctx->opts.adapt_target, 
+                          ctx->opts.adapt_log);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to initialize frame rate controller");
+            goto destroy_ctx;
+        }
+        adapt = &adaptState;
+    }
+
     // Send server build version
     ret = lpSendVersion(ctx->lp_host.client_ctx);
     if (ret < 0)
@@ -235,7 +1199,7 @@ int lpHandleClientReq(PLPContext ctx)
         if (flag)
             goto destroy_ctx;
         
-        ret = lpGetFrame(ctx, &metadata, &fb);
+        ret = lpLeaseFrame(ctx, &lease);
         if (ret == -EAGAIN)
         {
             continue;
@@ -248,6 +1212,8 @@ int lpHandleClientReq(PLPContext ctx)
         }
         break;
     }
+    metadata = lease.frame;
+    fb = lease.fb;
     displays->id        =   0;
     displays->name      =   "Looking Glass Display";
     displays->height    =   metadata->frameHeight ? \
@@ -255,6 +1221,29 @@ int lpHandleClientReq(PLPContext ctx)
     displays->width     =   metadata->frameWidth;
     displays->format    =  lpLGToTrfFormat(metadata->type);
     displays->rate      =   0;
+
+    if (ctx->opts.scale.factor || ctx->opts.scale.width)
+    {
+        // The sink only ever sees the scaled display
+        srcWidth    = displays->width;
+        srcHeight   = displays->height;
+        if (!lpScaleFormatSupported(displays->format))
+        {
+            lp__log_warn("Downscaling is not supported for this frame "
+                         "format, sending frames at full size");
+            srcWidth = 0;
+        }
+        else if (lpScaleSize(&ctx->opts.scale, &displays->width, 
+                             &displays->height) < 0)
+        {
+            lp__log_warn("Cannot scale %ux%u frames as requested, sending "
+                         "frames at full size", srcWidth, srcHeight);
+            srcWidth = 0;
+        }
+    }
+
+    // Only the metadata was needed
+    lpReleaseFrame(ctx, &lease);
     
     ret = trfBindDisplayList(ctx->lp_host.client_ctx, displays); //Bind display list to client context
     if (ret < 0)
@@ -317,6 +1306,7 @@ int lpHandleClientReq(PLPContext ctx)
     }
 
     req_disp->mem.ptr = ctx->ram;
+    ctx->lp_host.display = req_disp;
 
     ret = trfRegDisplayCustom(ctx->lp_host.client_ctx, req_disp, 
                               ctx->ram_size, 
@@ -350,13 +1340,40 @@ int lpHandleClientReq(PLPContext ctx)
         return -1;
     }
 
-    // Set Polling Interval
-    struct TRFContext * cc  = ctx->lp_host.client_ctx;
-    if (ctx->opts.poll_int < 0)
+    if (srcWidth)
     {
-        cc->opts->fab_cq_sync   = 1;
-        cc->opts->fab_poll_rate = 0;
-    }
+        ret = lpScalerInit(&scaler, &ctx->opts.scale, srcWidth, srcHeight, 
+                           lpWorkerThreads());
+        if (ret < 0)
+        {
+            lp__log_error("Unable to initialize scaler: %s", 
+                          strerror(-ret));
+            ret = -1;
+            goto destroy_ctx;
+        }
+    }
+
+    if (ctx->opts.capture_depth)
+    {
+        ret = lpCaptureStart(ctx, ctx->lp_host.client_ctx, &cap, dispBytes, 
+                             ctx->opts.capture_depth, 
+                             srcWidth ? &scaler : NULL);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to start capture thread: %s", 
+                          fi_strerror(-ret));
+            ret = -1;
+            goto destroy_ctx;
+        }
+    }
+
+    // Set Polling Interval
+    struct TRFContext * cc  = ctx->lp_host.client_ctx;
+    if (ctx->opts.poll_int < 0)
+    {
+        cc->opts->fab_cq_sync   = 1;
+        cc->opts->fab_poll_rate = 0;
+    }
     else
     {
         cc->opts->fab_cq_sync   = 0;
@@ -419,26 +1436,58 @@ int lpHandleClientReq(PLPContext ctx)
         }
         if (processed == TRFM_CLIENT_F_REQ)
         {
-            // Check if address of fb has changed
-            if (framebuffer_get_data(fb) != req_disp->mem.ptr)
-            {
-                req_disp->fb_offset = framebuffer_get_data(fb) 
-                                      - (uint8_t *) req_disp->mem.ptr;
-            }
-
             struct timespec ts, te;
             ret = clock_gettime(CLOCK_MONOTONIC, &ts);
             if (ret < 0)
             {
                 trf__log_error("System clock error: %s", strerror(errno));
-                return -errno;
+                ret = -errno;
+                goto destroy_ctx;
             }
             trf__GetDelay(&ts, &te, 1000);
 
+            // Offers can only be made before the first frame
+            if (!offers.latched)
+            {
+                ret = lpLatchOffers(ctx, &offers, req_disp, &preview, 
+                                    &blocks);
+                if (ret < 0)
+                {
+                    ret = -1;
+                    goto destroy_ctx;
+                }
+            }
+
+            // The counter carries the pass flags and focus band on top of
+            // the serial
+            uint64_t cntr       = msg->client_f_req->frame_cntr;
+            uint64_t reqCntr    = cntr & LP_FRAME_CNTR_SERIAL_MASK;
+            bool previewReq     = offers.progressive 
+                                  && (cntr & LP_FRAME_CNTR_PREVIEW);
+            bool deltaReq       = offers.resync 
+                                  && (cntr & LP_FRAME_CNTR_DELTA);
+            uint32_t bandY      = LP_FRAME_CNTR_BAND_Y(cntr);
+            uint32_t bandRows   = LP_FRAME_CNTR_BAND_ROWS(cntr);
+            bool bandValid      = offers.focused && bandRows 
+                                  && bandY + bandRows <= req_disp->height;
+            bool focusReq       = bandValid && (cntr & LP_FRAME_CNTR_FOCUS);
+            bool restReq        = bandValid && held 
+                                  && (cntr & LP_FRAME_CNTR_REST);
+
+            // Hold the request back if frames would exceed the rate cap. A
+            // frame that was previewed, or had its focus band sent, follows
+            // without delay.
+            if (!held)
+            {
+                lpAdaptPace(adapt);
+            }
+
             trf__log_debug("Waiting for new frame data...");
 
-            // Get new frame from Looking Glass
-            while (1)
+            // Get new frame from Looking Glass, or from the capture thread,
+            // unless the rest of the held frame is still to be sent
+            LPCaptureFrame * frame = heldFrame;
+            while (!held)
             {
                 if (flag)
                     goto destroy_ctx;
@@ -448,7 +1497,23 @@ int lpHandleClientReq(PLPContext ctx)
                     goto destroy_ctx;
                 }
 
-                ret = lpGetFrame(ctx, &metadata, &fb);
+                if (ctx->opts.capture_depth)
+                {
+                    ret = lpCaptureStatus(&cap);
+                    if (ret == 0)
+                    {
+                        frame = lpCaptureNext(&cap, reqCntr);
+                        ret = frame ? 0 : -EAGAIN;
+                    }
+                    if (ret == -EAGAIN && cc->opts->fab_poll_rate > 0)
+                    {
+                        trfNanoSleep(cc->opts->fab_poll_rate);
+                    }
+                }
+                else
+                {
+                    ret = lpLeaseFrame(ctx, &lease);
+                }
                 if (ret == -EAGAIN)
                 {
                     if (trf__HasPassed(CLOCK_MONOTONIC, &te))
@@ -463,14 +1528,15 @@ int lpHandleClientReq(PLPContext ctx)
                         {
                             lp__log_debug("Error sending keep alive: %s", 
                                     fi_strerror(abs(ret)));
-                            return ret;
+                            goto destroy_ctx;
                         }
                         ret = clock_gettime(CLOCK_MONOTONIC, &ts);
                         if (ret < 0)
                         {
                             trf__log_error("System clock error: %s", 
                                     strerror(errno));
-                            return -errno;
+                            ret = -errno;
+                            goto destroy_ctx;
                         }
                         trf__GetDelay(&ts, &te, 1000);
                         lp__log_debug("Sent keep alive");
@@ -483,51 +1549,121 @@ int lpHandleClientReq(PLPContext ctx)
                     ret = -1;
                     goto destroy_ctx;
                 }
+                if (frame)
+                {
+                    lp__log_debug("Got frame from capture thread");
+                    break;
+                }
+                metadata = lease.frame;
+                fb = lease.fb;
                 framebuffer_wait(fb, trfGetDisplayBytes(displays));
-                if (msg->client_f_req->frame_cntr == metadata->frameSerial)
+                if (reqCntr == metadata->frameSerial)
                 {
-                    ret = lgmpClientMessageDone(ctx->lp_host.client_q);
-                    if (ret != LGMP_OK)
-                    {
-                        lp__log_error("lgmpClientMessageDone: %s", 
-                            lgmpStatusString(ret));
-                    }
+                    lpReleaseFrame(ctx, &lease);
                     lp__log_debug("Repeated frame");
                     continue;
                 }
                 lp__log_debug("Got frame from LookingGlass");
                 break;
             }
-        
+
+            // The frame buffer may have moved since the last frame
+            if (!frame && framebuffer_get_data(fb) != req_disp->mem.ptr)
+            {
+                req_disp->fb_offset = framebuffer_get_data(fb) 
+                                      - (uint8_t *) req_disp->mem.ptr;
+            }
+            LPFrameReq req = {
+                .src        = frame ? frame->data : trfGetFBPtr(req_disp),
+                .desc       = frame ? lpCaptureDesc(&cap)
+                                    : trfMemFabricDesc(&req_disp->mem),
+                .size       = frame ? frame->size : (size_t) dispBytes,
+                .staged     = frame != NULL,
+                .addr       = msg->client_f_req->addr,
+                .rkey       = msg->client_f_req->rkey,
+                .delta      = deltaReq,
+                .preview    = !deltaReq && previewReq,
+                .focus      = !deltaReq && !previewReq && focusReq,
+                .rest       = !deltaReq && !previewReq && !focusReq 
+                              && restReq,
+                .band_y     = bandY,
+                .band_rows  = bandRows
+            };
+
             // Handle the frame request
-            ret = trfSendFrame(ctx->lp_host.client_ctx, displays, 
-                               msg->client_f_req->addr, 
-                               msg->client_f_req->rkey);
-            if (ret < 0)
+            uint64_t sendStart = lpGetTimeNs();
+
+            // A whole frame identical to the last one sent is not sent
+            // again, if the sink still holds that one. Hashing holds the
+            // frame back like higher priority traffic does, and counts
+            // towards the frame's send time.
+            bool sameReq    = !deltaReq && !previewReq && !focusReq 
+                              && !restReq && (cntr & LP_FRAME_CNTR_SAME);
+            uint64_t hash   = 0;
+            if (sameReq)
             {
-                lp__log_error("unable to send frame: %d\n", ret);
-                ret = -1;
-                goto destroy_ctx;
+                hash = lpHashFrame(req.src, req.size);
+                lpSchedRecord(&sched, LP_SCHED_HASH, 
+                              lpGetTimeNs() - sendStart);
+                lpSchedReport(&sched, LP_SCHED_HASH, false);
             }
+            bool unchanged  = sameReq && sentValid && hash == sentHash;
+            sentHash        = hash;
+            sentValid       = sameReq;
 
-            struct fi_cq_data_entry de;
-            struct fi_cq_err_entry err = {0};
-            ret = trfGetSendProgress(ctx->lp_host.client_ctx, &de, &err, 1, 
-                    ctx->lp_host.client_ctx->opts);
-            if (ret <= 0)
+            ssize_t sent = 0;
+            if (unchanged)
             {
-                lp__log_error("Error: %s", fi_strerror(err.err));
-                break;
+                unchangedCount++;
+                lp__log_debug("Frame unchanged, %lu skipped so far", 
+                              unchangedCount);
+            }
+            else
+            {
+                sent = lpSendFrameReq(ctx, req_disp, &offers, &req, &preview,
+                                      &blocks, &sched, adapt);
+                if (sent < 0)
+                {
+                    ret = -1;
+                    goto destroy_ctx;
+                }
+                lp__log_debug("Sent %zd bytes", sent);
+            }
+            if (deltaReq)
+            {
+                // Only the first frame is sent as a delta
+                offers.resync = false;
+            }
+            if (frame && !previewReq && !focusReq)
+            {
+                lpCaptureDone(&cap, frame, lpGetTimeNs() - sendStart);
             }
 
-            //Post receive message to LGMP
-            ret = lgmpClientMessageDone(ctx->lp_host.client_q);
-            if (ret != LGMP_OK && ret != LGMP_ERR_QUEUE_EMPTY)
+            if (previewReq || focusReq)
             {
-                lp__log_debug("lgmpClientMessageDone: %s", lgmpStatusString(ret));
+                // The frame is held for the next request
+                held        = true;
+                heldFrame   = frame;
+            }
+            else
+            {
+                if (!unchanged)
+                {
+                    lpAdaptFrameDone(adapt, lpGetTimeNs() - sendStart);
+                }
+
+                // The fabric writes have completed, the frame can be released
+                lpReleaseFrame(ctx, &lease);
+                held        = false;
+                heldFrame   = NULL;
             }
 
-            req_disp->frame_cntr++;
+            // An acknowledgement with the counter of the previous one tells
+            // the sink that the frame is unchanged
+            if (!unchanged)
+            {
+                req_disp->frame_cntr++;
+            }
             ret = trfAckFrameReq(ctx->lp_host.client_ctx, req_disp);
             if (ret < 0)
             {
@@ -547,6 +1683,12 @@ int lpHandleClientReq(PLPContext ctx)
     }
 
 destroy_ctx:
+    lpCaptureStop(&cap);
+    lpPreviewDestroy(&preview);
+    lpBlockStageDestroy(&blocks);
+    lpScalerDestroy(&scaler);
+    lpAdaptDestroy(adapt);
+    lpReleaseFrame(ctx, &lease);
     ctx->lp_host.thread_flags = T_STOP;
     void *tret = NULL;
     if (sub_started)
@@ -558,33 +1700,689 @@ destroy_ctx:
                 strerror((uint64_t)tret));
         }
     }
+    free(ctx->lp_host.resync_hashes);
+    free(ctx->lp_host.resync_filled);
+    ctx->lp_host.resync_hashes = NULL;
+    ctx->lp_host.resync_filled = NULL;
+    lpSchedReport(&sched, LP_SCHED_FRAME, true);
+    lpSchedReport(&sched, LP_SCHED_HASH, true);
+    ctx->lp_host.sched = NULL;
+    ctx->lp_host.demand = NULL;
+    ctx->lp_host.display = NULL;
     trfDestroyContext(ctx->lp_host.client_ctx);
     ctx->lp_host.client_ctx = NULL;
     return ret;
 }
 
+void * lpReadCursorPos(void * arg)
+{
+    lp__log_trace("Cursor reader thread started");
+    PLPContext ctx = (PLPContext) arg;
+    LPCursorQueue * q = ctx->lp_host.cursor_q;
+    intptr_t ret = 0;
+    KVMFRCursor posCursor;
+    uint32_t cursorSize = 0;
+    uint32_t flags = 0;
+
+    while (ctx->lp_host.thread_flags == T_RUNNING)
+    {
+        // Updates are copied straight from LGMP message memory into queue
+        // storage. Position-only updates need just the header, so they can
+        // still be read while all shape slots are in use.
+        KVMFRCursor * cursor = lpCursorQueueAcquireShape(q);
+        uint32_t maxSize = MAX_POINTER_SIZE;
+        if (!cursor)
+        {
+            cursor  = &posCursor;
+            maxSize = sizeof(posCursor);
+        }
+
+        ret = lpgetCursor(ctx, cursor, maxSize, &cursorSize, &flags);
+        if (ret == 0 || ret == -ENOBUFS)
+        {
+            // No update, or a shape update waiting for the sender to free a
+            // slot
+            usleep(10);
+            continue;
+        }
+        if (ret < 0)
+        {
+            lp__log_error("Unable to get cursor position");
+            ctx->lp_host.thread_flags = T_ERR;
+            break;
+        }
+
+        ret = lpCursorQueuePush(q, cursor, cursorSize, flags);
+        if (ret < 0)
+        {
+            lp__log_error("Unable to queue cursor update");
+            ctx->lp_host.thread_flags = T_ERR;
+            break;
+        }
+    }
+
+    lp__log_debug("Exited cursor reader");
+    return (void *) ret;
+}
+
+/**
+ * @brief Send a cursor shape as a series of fragments, each of which fits in
+ * one of the sink's receive slots. Up to LP_CURSOR_SEND_BATCH fragments are
+ * in flight at a time.
+ * 
+ * @param sc        Subchannel context
+ * @param mr        Registered send buffer
+ * @param shape     Shape update to send
+ * @param shapeId   Shape cache slot + 1
+ * @param payload   Shape data to send, empty if the sink already holds it
+ * @return 0 on success, negative error code on failure
+ */
+static int lpSendCursorShape(PTRFContext sc, struct TRFMem * mr, 
+                             const LPCursorShape * shape, uint32_t shapeId,
+                             const LPCursorShapeData * payload)
+{
+    uint8_t * buf               = trfMemPtr(mr);
+    const KVMFRCursor * cursor  = shape->cursor;
+    uint32_t total  = payload->size;
+    uint32_t offset = 0;
+    size_t pending  = 0;
+    ssize_t ret;
+
+    while (1)
+    {
+        uint32_t chunk = total - offset;
+        if (chunk > LP_BIN_FRAG_DATA)
+            chunk = LP_BIN_FRAG_DATA;
+
+        uint8_t * slot = buf + pending * LP_BIN_MAX_MSG_SIZE;
+        ret = lpPackCursorShape(slot, LP_BIN_MAX_MSG_SIZE, cursor, 
+                                shape->flags, shapeId, shape->seq, 
+                                payload->codec, payload->data, total, offset,
+                                chunk);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        ret = trfFabricSendUnchecked(sc, mr, slot, ret, 
+                                     sc->xfer.fabric->peer_addr);
+        if (ret == -FI_EAGAIN && pending)
+        {
+            // Transmit queue full, drain it and retry this fragment
+            ret = lpWaitSends(sc, pending);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            pending = 0;
+            continue;
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        pending++;
+        offset += chunk;
+        if (pending == LP_CURSOR_SEND_BATCH || offset == total)
+        {
+            ret = lpWaitSends(sc, pending);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            pending = 0;
+        }
+        if (offset == total)
+        {
+            return 0;
+        }
+    }
+}
+
+/*  Cursor subchannel buffer layout: shape data or fragments, followed by a
+    scratch area for mailbox records and LP_CURSOR_SRC_RECV_SLOTS receive
+    slots for messages from the sink */
+#define LP_CURSOR_BUF_CTRL      MAX_POINTER_SIZE
+#define LP_CURSOR_BUF_RECV      (MAX_POINTER_SIZE + LP_BIN_MAX_MSG_SIZE)
+#define LP_CURSOR_BUF_SIZE      (LP_CURSOR_BUF_RECV \
+                                 + LP_CURSOR_SRC_RECV_SLOTS \
+                                   * LP_BIN_MAX_MSG_SIZE)
+
+/**
+ * @brief Source cursor subchannel receive state. The sink sends several
+ * requests back to back when it connects, so more than one receive is kept
+ * posted.
+ * 
+ */
+typedef struct {
+    /**
+     * @brief Registered subchannel buffer holding the receive slots
+     * 
+     */
+    struct TRFMem *         mr;
+    /**
+     * @brief Fabric contexts of the posted receives, one per slot
+     * 
+     */
+    struct fi_context       rctx[LP_CURSOR_SRC_RECV_SLOTS];
+    /**
+     * @brief Bitmask of slots that do not have a receive posted
+     * 
+     */
+    uint32_t                idle;
+} LPSourceRecv;
+
+_Static_assert(LP_CURSOR_SRC_RECV_SLOTS < 32, "Receive slot mask too small");
+
+#define LP_SOURCE_RECV_ALL ((1U << LP_CURSOR_SRC_RECV_SLOTS) - 1)
+
+static inline uint8_t * lpSourceRecvSlot(LPSourceRecv * rs, int slot)
+{
+    return (uint8_t *) trfMemPtr(rs->mr) + LP_CURSOR_BUF_RECV
+           + (size_t) slot * LP_BIN_MAX_MSG_SIZE;
+}
+
+/**
+ * @brief Post receives on all idle slots
+ * 
+ * @param sc        Subchannel context
+ * @param rs        Receive state
+ * @return 0 on success, negative error code on failure. If the receive queue
+ * is full, the remaining slots stay idle and are posted on the next call.
+ */
+static int lpPostSourceRecvs(PTRFContext sc, LPSourceRecv * rs)
+{
+    while (rs->idle)
+    {
+        int slot = __builtin_ctz(rs->idle);
+        ssize_t ret = fi_recv(sc->xfer.fabric->ep, lpSourceRecvSlot(rs, slot),
+                              LP_BIN_MAX_MSG_SIZE, trfMemFabricDesc(rs->mr),
+                              sc->xfer.fabric->peer_addr, &rs->rctx[slot]);
+        if (ret == -FI_EAGAIN)
+        {
+            return 0;
+        }
+        if (ret < 0)
+        {
+            return ret;
+        }
+        rs->idle &= ~(1U << slot);
+    }
+    return 0;
+}
+
+/**
+ * @brief Accept or reject a viewport requested by the sink, and reply with
+ * the viewport that will be sent
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @param vp        Requested viewport
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleViewportReq(PLPContext ctx, struct TRFMem * mr, 
+                               void * ctrl, LPViewport * vp)
+{
+    PTRFContext sc = ctx->lp_host.sub_channel;
+    PTRFDisplay disp = ctx->lp_host.display;
+    int state = LP_OFFER_NONE;
+    if (!disp || trfTextureIsCompressed(disp->format)
+        || atomic_load(&ctx->lp_host.progressive_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.focus_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.compress_state) == LP_OFFER_ACTIVE
+        || !lpClipViewport(vp, disp->width, disp->height))
+    {
+        lp__log_warn("Unable to send viewport %ux%u+%u+%u, sending whole "
+                     "frames", vp->width, vp->height, vp->x, vp->y);
+        *vp = (LPViewport) {0};
+    }
+    else
+    {
+        ctx->lp_host.viewport = *vp;
+        if (!atomic_compare_exchange_strong(&ctx->lp_host.viewport_state, 
+                                            &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_warn("Viewport requested after the first frame, sending "
+                         "whole frames");
+            *vp = (LPViewport) {0};
+        }
+        else
+        {
+            lp__log_info("Sending viewport %ux%u+%u+%u", vp->width, 
+                         vp->height, vp->x, vp->y);
+        }
+    }
+
+    ssize_t ret = lpPackViewport(ctrl, LP_BIN_MAX_MSG_SIZE, vp);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = trfFabricSend(sc, mr, ctrl, ret, sc->xfer.fabric->peer_addr, 
+                        sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Accept or reject progressive delivery requested by the sink, and
+ * reply with the size of the previews that will be sent
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleProgressiveReq(PLPContext ctx, struct TRFMem * mr, 
+                                  void * ctrl)
+{
+    PTRFContext sc = ctx->lp_host.sub_channel;
+    PTRFDisplay disp = ctx->lp_host.display;
+    uint16_t width = 0, height = 0;
+    int state = LP_OFFER_NONE;
+    if (!disp || !lpScaleFormatSupported(disp->format) 
+        || disp->width < 2 || disp->height < 2
+        || atomic_load(&ctx->lp_host.viewport_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.focus_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.compress_state) == LP_OFFER_ACTIVE)
+    {
+        lp__log_warn("Unable to send previews of this display");
+    }
+    else if (!atomic_compare_exchange_strong(&ctx->lp_host.progressive_state,
+                                             &state, LP_OFFER_ACTIVE))
+    {
+        lp__log_warn("Previews requested after the first frame, sending "
+                     "frames only");
+    }
+    else
+    {
+        width   = disp->width / 2;
+        height  = disp->height / 2;
+        lp__log_info("Sending %ux%u previews", width, height);
+    }
+
+    ssize_t ret = lpPackProgressive(ctrl, LP_BIN_MAX_MSG_SIZE, width, height);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = trfFabricSend(sc, mr, ctrl, ret, sc->xfer.fabric->peer_addr, 
+                        sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Accept or reject focus bands requested by the sink, and reply with
+ * the maximum band height that will be sent
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @param rows      Requested band height
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleFocusReq(PLPContext ctx, struct TRFMem * mr, void * ctrl,
+                            uint32_t rows)
+{
+    PTRFContext sc = ctx->lp_host.sub_channel;
+    PTRFDisplay disp = ctx->lp_host.display;
+    int state = LP_OFFER_NONE;
+    if (!disp || !rows || trfTextureIsCompressed(disp->format)
+        || atomic_load(&ctx->lp_host.viewport_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.progressive_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.compress_state) == LP_OFFER_ACTIVE)
+    {
+        lp__log_warn("Unable to send focus bands of this display");
+        rows = 0;
+    }
+    else
+    {
+        rows = rows < disp->height ? rows : disp->height;
+        rows = rows < LP_FOCUS_ROWS_MAX ? rows : LP_FOCUS_ROWS_MAX;
+        if (!atomic_compare_exchange_strong(&ctx->lp_host.focus_state, 
+                                            &state, LP_OFFER_ACTIVE))
+        {
+            lp__log_warn("Focus bands requested after the first frame, "
+                         "sending whole frames");
+            rows = 0;
+        }
+        else
+        {
+            lp__log_info("Sending %u rows around the cursor first", rows);
+        }
+    }
+
+    ssize_t ret = lpPackFocus(ctrl, LP_BIN_MAX_MSG_SIZE, rows);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = trfFabricSend(sc, mr, ctrl, ret, sc->xfer.fabric->peer_addr, 
+                        sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Accept or reject block compression requested by the sink, and reply
+ * with the format frames will be sent in
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @param format    Requested format
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleCompressReq(PLPContext ctx, struct TRFMem * mr, 
+                               void * ctrl, uint32_t format)
+{
+    PTRFContext sc = ctx->lp_host.sub_channel;
+    PTRFDisplay disp = ctx->lp_host.display;
+    int state = LP_OFFER_NONE;
+    if (!disp || format != LP_BLOCK_BC1
+        || !lpBC1Supported(disp->format, disp->width, disp->height)
+        || atomic_load(&ctx->lp_host.viewport_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.progressive_state) == LP_OFFER_ACTIVE
+        || atomic_load(&ctx->lp_host.focus_state) == LP_OFFER_ACTIVE)
+    {
+        lp__log_warn("Unable to compress frames of this display");
+        format = LP_BLOCK_NONE;
+    }
+    else if (!atomic_compare_exchange_strong(&ctx->lp_host.compress_state,
+                                             &state, LP_OFFER_ACTIVE))
+    {
+        lp__log_warn("Block compression requested after the first frame, "
+                     "sending frames uncompressed");
+        format = LP_BLOCK_NONE;
+    }
+    else
+    {
+        lp__log_info("Sending BC1 compressed frames");
+    }
+
+    ssize_t ret = lpPackCompress(ctrl, LP_BIN_MAX_MSG_SIZE, format);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = trfFabricSend(sc, mr, ctrl, ret, sc->xfer.fabric->peer_addr, 
+                        sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Collect the tile hashes of the frame the sink still holds, and
+ * reply once all of them have arrived, or as soon as they turn out not to
+ * match the display
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @param msg       Unpacked message header
+ * @param hashes    Little-endian hashes in the message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleTileHashes(PLPContext ctx, struct TRFMem * mr, void * ctrl,
+                              const LPBinTileHashes * msg, 
+                              const uint8_t * hashes)
+{
+    PTRFContext sc = ctx->lp_host.sub_channel;
+    PTRFDisplay disp = ctx->lp_host.display;
+    LPTileGrid * g = &ctx->lp_host.resync_grid;
+    LPBinTileHashes reply = {0};
+
+    if (msg->first == 0)
+    {
+        free(ctx->lp_host.resync_hashes);
+        free(ctx->lp_host.resync_filled);
+        ctx->lp_host.resync_hashes      = NULL;
+        ctx->lp_host.resync_filled      = NULL;
+        ctx->lp_host.resync_received    = 0;
+        if (!disp || trfTextureIsCompressed(disp->format) 
+            || msg->format != disp->format
+            || lpTileGridInit(g, disp->width, disp->height) < 0
+            || g->width != msg->width || g->height != msg->height
+            || g->tile != msg->tile || g->count != msg->total)
+        {
+            lp__log_info("Tile hashes do not match the display, sending the "
+                         "first frame in full");
+            goto send_reply;
+        }
+        ctx->lp_host.resync_hashes = calloc(g->count, sizeof(uint64_t));
+        ctx->lp_host.resync_filled = calloc((g->count + 63) / 64, 
+                                            sizeof(uint64_t));
+        if (!ctx->lp_host.resync_hashes || !ctx->lp_host.resync_filled)
+        {
+            free(ctx->lp_host.resync_hashes);
+            free(ctx->lp_host.resync_filled);
+            ctx->lp_host.resync_hashes = NULL;
+            ctx->lp_host.resync_filled = NULL;
+            return -ENOMEM;
+        }
+    }
+    if (!ctx->lp_host.resync_hashes || msg->total != g->count)
+    {
+        // Already rejected
+        return 0;
+    }
+
+    // Only tiles not covered before count, so that repeated or overlapping
+    // ranges do not complete the set early
+    for (uint16_t i = 0; i < msg->count; i++)
+    {
+        uint32_t t = msg->first + i;
+        uint64_t h;
+        memcpy(&h, hashes + i * sizeof(h), sizeof(h));
+        ctx->lp_host.resync_hashes[t] = le64toh(h);
+        uint64_t bit = 1ULL << (t % 64);
+        if (!(ctx->lp_host.resync_filled[t / 64] & bit))
+        {
+            ctx->lp_host.resync_filled[t / 64] |= bit;
+            ctx->lp_host.resync_received++;
+        }
+    }
+    if (ctx->lp_host.resync_received < g->count)
+    {
+        return 0;
+    }
+
+    int state = LP_OFFER_NONE;
+    if (!atomic_compare_exchange_strong(&ctx->lp_host.resync_state, &state,
+                                        LP_OFFER_ACTIVE))
+    {
+        lp__log_info("Tile hashes received after the first frame, sending "
+                     "it in full");
+        goto send_reply;
+    }
+    reply.total = g->count;
+
+send_reply: ;
+    ssize_t ret = lpPackTileHashes(ctrl, LP_BIN_MAX_MSG_SIZE, &reply, NULL);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = trfFabricSend(sc, mr, ctrl, ret, sc->xfer.fabric->peer_addr, 
+                        sc->opts);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Handle a message from the sink, switching to the cursor mailbox if
+ * the sink has offered one
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @param rm        Remote mailbox
+ * @param recv      Received message
+ * @return 0 on success, negative error code on failure
+ */
+static int lpHandleSinkMsg(PLPContext ctx, struct TRFMem * mr, void * ctrl,
+                           LPMailboxRemote * rm, const uint8_t * recv)
+{
+    LPDemand * demand = ctx->lp_host.demand;
+    ssize_t ret;
+
+    LPBinCursorMailbox offer;
+    LPBinConsumption cons;
+    LPBinProgressive prog;
+    LPBinFocus focus;
+    LPBinTileHashes tiles;
+    LPBinCompress comp;
+    const uint8_t * hashes;
+    LPViewport vp;
+    if (lpUnpackViewport(recv, LP_BIN_MAX_MSG_SIZE, &vp) == 0)
+    {
+        ret = lpHandleViewportReq(ctx, mr, ctrl, &vp);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    else if (lpUnpackProgressive(recv, LP_BIN_MAX_MSG_SIZE, &prog) == 0)
+    {
+        ret = lpHandleProgressiveReq(ctx, mr, ctrl);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    else if (lpUnpackFocus(recv, LP_BIN_MAX_MSG_SIZE, &focus) == 0)
+    {
+        ret = lpHandleFocusReq(ctx, mr, ctrl, focus.rows);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    else if (lpUnpackTileHashes(recv, LP_BIN_MAX_MSG_SIZE, &tiles, 
+                                &hashes) == 0)
+    {
+        ret = lpHandleTileHashes(ctx, mr, ctrl, &tiles, hashes);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    else if (lpUnpackCompress(recv, LP_BIN_MAX_MSG_SIZE, &comp) == 0)
+    {
+        ret = lpHandleCompressReq(ctx, mr, ctrl, comp.format);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    else if (lpUnpackConsumption(recv, LP_BIN_MAX_MSG_SIZE, &cons) == 0)
+    {
+        LPDemandReport r = {
+            .pending    = cons.pending,
+            .depth      = cons.depth,
+            .subs       = cons.flags & LP_BIN_CONSUMPTION_SUBS,
+            .backlog    = cons.flags & LP_BIN_CONSUMPTION_BACKLOG,
+            .rate       = cons.rate
+        };
+        if (demand)
+        {
+            lpDemandUpdate(demand, &r);
+        }
+    }
+    else if (lpUnpackCursorMailbox(recv, LP_BIN_MAX_MSG_SIZE, &offer) == 0)
+    {
+        if (lpMailboxAccept(rm, &offer) < 0)
+        {
+            lp__log_warn("Incompatible cursor mailbox (version %u), using "
+                         "messages", offer.version);
+        }
+        else
+        {
+            lp__log_info("Using cursor mailbox");
+        }
+    }
+    else
+    {
+        lp__log_debug("Ignoring message on cursor subchannel");
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check for messages from the sink, and post their receive slots
+ * again once handled
+ * 
+ * @param ctx       Context to use
+ * @param mr        Registered subchannel buffer
+ * @param ctrl      Registered scratch buffer in mr
+ * @param rs        Receive state
+ * @param rm        Remote mailbox
+ * @return 0 on success, negative error code on failure
+ */
+static int lpCheckCursorMsg(PLPContext ctx, struct TRFMem * mr, void * ctrl,
+                            LPSourceRecv * rs, LPMailboxRemote * rm)
+{
+    PTRFContext sc = ctx->lp_host.sub_channel;
+    struct fi_cq_data_entry de[LP_CURSOR_SRC_RECV_SLOTS];
+    struct fi_cq_err_entry err;
+
+    ssize_t ret = trfFabricPollRecv(sc, de, &err, 0, 0, NULL, 
+                                    LP_CURSOR_SRC_RECV_SLOTS);
+    if (ret == 0 || ret == -EAGAIN || ret == -FI_EAGAIN)
+    {
+        return 0;
+    }
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    for (ssize_t i = 0; i < ret; i++)
+    {
+        uintptr_t base  = (uintptr_t) rs->rctx;
+        uintptr_t p     = (uintptr_t) de[i].op_context;
+        if (p < base || p >= base + sizeof(rs->rctx) 
+            || (p - base) % sizeof(rs->rctx[0]))
+        {
+            lp__log_debug("Ignoring completion on cursor subchannel");
+            continue;
+        }
+        int slot = (p - base) / sizeof(rs->rctx[0]);
+        int hret = lpHandleSinkMsg(ctx, mr, ctrl, rm, 
+                                   lpSourceRecvSlot(rs, slot));
+        rs->idle |= 1U << slot;
+        if (hret < 0)
+        {
+            return hret;
+        }
+    }
+    return lpPostSourceRecvs(sc, rs);
+}
+
 void * lpHandleCursorPos(void * arg)
 {
     lp__log_trace("Subchannel thread started");
     PLPContext ctx = (PLPContext) arg;
     ctx->lp_host.thread_flags = T_RUNNING;
     intptr_t ret = 0;
-    uint32_t cursorSize = 0;
     size_t psize = trf__GetPageSize();
-    uint32_t flags = 0;
-    void * cursorData = trfAllocAligned(MAX_POINTER_SIZE, psize);
-    if (!cursorData)
+    bool reader_started = false;
+    LPCursorQueue cursor_q = {0};
+    LPShapeCache shape_cache = {0};
+    LPMailboxRemote mailbox = {0};
+    LPSourceRecv recvState = {0};
+    LPSched * sched = ctx->lp_host.sched;
+    uint8_t * encBuf = malloc(MAX_POINTER_SIZE);
+    void * cursorData = trfAllocAligned(LP_CURSOR_BUF_SIZE, psize);
+    if (!cursorData || !encBuf)
     {
         lp__log_error("Unable to allocate memory for subchannel");
         ctx->lp_host.thread_flags = T_ERR;
         ret = -EINVAL;
         goto destroy_ctx;
     }
-    KVMFRCursor *cursor = (KVMFRCursor *) cursorData;
-    cursor = NULL;
 
     ret = trfRegInternalMsgBuf(ctx->lp_host.sub_channel, cursorData,
-            MAX_POINTER_SIZE);
+            LP_CURSOR_BUF_SIZE);
     if (ret)
     {
         lp__log_error("Unable to register buffer");
@@ -594,17 +2392,46 @@ void * lpHandleCursorPos(void * arg)
     }
     struct TRFMem *mr   = &ctx->lp_host.sub_channel->xfer.fabric->msg_mem;
     void * buf          = trfMemPtr(mr);
-    
-    LpMsg__MessageWrapper wrapper   = LP_MSG__MESSAGE_WRAPPER__INIT;
-    LpMsg__CursorData curData       = LP_MSG__CURSOR_DATA__INIT;
-    wrapper.cursor_data             = &curData;
-    wrapper.wdata_case              = LP_MSG__MESSAGE_WRAPPER__WDATA_CURSOR_DATA;
+    void * ctrl         = (uint8_t *) buf + LP_CURSOR_BUF_CTRL;
+
+    // The sink may offer a cursor mailbox. The receives are cancelled when
+    // the subchannel is destroyed below.
+    recvState.mr    = mr;
+    recvState.idle  = LP_SOURCE_RECV_ALL;
+    ret = lpPostSourceRecvs(ctx->lp_host.sub_channel, &recvState);
+    if (ret < 0)
+    {
+        lp__log_error("Unable to post receive: %s", fi_strerror(-ret));
+        ctx->lp_host.thread_flags = T_ERR;
+        goto destroy_ctx;
+    }
+
+    ret = lpCursorQueueInit(&cursor_q);
+    if (ret < 0)
+    {
+        lp__log_error("Unable to initialize cursor queue");
+        ctx->lp_host.thread_flags = T_ERR;
+        goto destroy_ctx;
+    }
+    ctx->lp_host.cursor_q = &cursor_q;
+
+    ret = pthread_create(&ctx->lp_host.cursor_reader, NULL, lpReadCursorPos,
+                         ctx);
+    if (ret)
+    {
+        lp__log_error("Unable to create cursor reader thread");
+        ctx->lp_host.thread_flags = T_ERR;
+        ret = -ret;
+        goto destroy_ctx;
+    }
+    reader_started = true;
 
     struct timespec te;
     bool setDeadline = false;
+    bool inject = true;
     while (1)
     {
-        if (ctx->lp_host.thread_flags == T_STOP)
+        if (ctx->lp_host.thread_flags != T_RUNNING)
         {
             ret = 0;
             break;
@@ -615,79 +2442,139 @@ void * lpHandleCursorPos(void * arg)
             setDeadline = true;
         }
 
-        if ((ret = lpgetCursor(ctx, &cursor, &cursorSize, &flags)) < 0)
+        ret = lpCheckCursorMsg(ctx, mr, ctrl, &recvState, &mailbox);
+        if (ret < 0)
         {
-            lp__log_error("Unable to get cursor position");
+            lp__log_error("Unable to receive message: %s", 
+                          fi_strerror(abs((int)ret)));
             ctx->lp_host.thread_flags = T_ERR;
             goto destroy_ctx;
         }
 
-        if (trf__HasPassed(CLOCK_MONOTONIC, &te) && !cursor)
+        // Shapes are always sent in order; position updates that arrived
+        // while we were busy sending are coalesced into the latest one
+        LPCursorShape shape;
+        LPCursorPos pos;
+        if (lpCursorQueuePopShape(&cursor_q, &shape))
         {
-            lp__log_debug("Sending cursor keep alive...");
-            ret = lpKeepAlive(ctx->lp_host.sub_channel);
+            // Only send the shape data if the sink does not already hold it
+            bool hit;
+            uint32_t rawLen = shape.size - sizeof(KVMFRCursor);
+            uint32_t shapeId = lpShapeCacheLookup(&shape_cache, shape.cursor,
+                                                  rawLen, &hit);
+            LPCursorShapeData payload = {
+                .data   = shape.cursor + 1,
+                .size   = hit ? 0 : rawLen,
+                .codec  = LP_CURSOR_CODEC_NONE
+            };
+
+            // Most cursor shapes are largely transparent or have only a few
+            // colours; send them run-length encoded if that is smaller
+            if (payload.size > LP_CURSOR_CODEC_HDR_LEN)
+            {
+                ssize_t encLen = lpEncodeCursorShape(shape.cursor->type, 
+                                                     payload.data, rawLen,
+                                                     encBuf, rawLen - 1);
+                if (encLen > 0)
+                {
+                    lp__log_trace("Cursor shape encoded: %u -> %zd bytes",
+                                  rawLen, encLen);
+                    payload.data    = encBuf;
+                    payload.size    = encLen;
+                    payload.codec   = LP_CURSOR_CODEC_RLE;
+                }
+            }
+
+            // Hold back frame chunks until the shape is out
+            lpSchedUrgentBegin(sched);
+            lpSchedRecord(sched, LP_SCHED_CURSOR, lpGetTimeNs() - shape.time);
+            if (mailbox.active)
+                ret = lpMailboxWriteShape(ctx->lp_host.sub_channel, mr, buf,
+                                          ctrl, &mailbox, &shape, shapeId, 
+                                          &payload);
+            else
+                ret = lpSendCursorShape(ctx->lp_host.sub_channel, mr, &shape,
+                                        shapeId, &payload);
+            lpSchedUrgentEnd(sched);
+            lpCursorQueueReleaseShape(&cursor_q);
             if (ret < 0)
             {
-                lp__log_error("Error sending keep alive: %s", 
-                                fi_strerror(abs((int)ret)));
-                return (void *) ret;
+                lp__log_error("Unable to send cursor shape: %s", 
+                              fi_strerror(abs((int)ret)));
+                ctx->lp_host.thread_flags = T_ERR;
+                goto destroy_ctx;
             }
+            lp__log_trace("Cursor shape %u: %s", shapeId, 
+                          hit ? "cached" : "sent");
             setDeadline = false;
-            lp__log_debug("Sent keep alive");
-            continue;
         }
-        
-        if (cursor)
+        else if (lpCursorQueuePopPos(&cursor_q, &pos))
         {
-            curData.y       = cursor->y;
-            curData.x       = cursor->x;
-            curData.width   = cursor->width;
-            curData.height  = cursor->height;
-            curData.hpx     = cursor->hx;
-            curData.hpy     = cursor->hy;
-            curData.tex_fmt = cursor->type;
-            curData.pitch   = cursor->pitch;
-            curData.flags   = flags;
-
-            if (cursorSize > sizeof(KVMFRCursor)) // Send cursor shape data
+            lpSchedUrgentBegin(sched);
+            lpSchedRecord(sched, LP_SCHED_CURSOR, lpGetTimeNs() - pos.time);
+            if (mailbox.active)
             {
-                curData.data.len = cursorSize - sizeof(KVMFRCursor);
-                curData.data.data = (uint8_t *)(cursor + 1);
+                ret = lpMailboxWritePos(ctx->lp_host.sub_channel, mr, ctrl, 
+                                        &mailbox, &pos);
             }
-            else // Only cursor position has changed
+            else
             {
-                curData.data.len = 0;
-                curData.data.data = NULL;
+                // Position updates use the fixed-layout binary encoding
+                ret = lpPackCursorPos(buf, MAX_POINTER_SIZE, pos.x, pos.y, 
+                                      pos.flags, pos.seq);
+                if (ret >= 0)
+                    ret = lpSendSmall(ctx->lp_host.sub_channel, mr, buf, ret, 
+                                      &inject);
             }
-
-            ret = trfMsgPackProtobuf((ProtobufCMessage *) &wrapper, 
-                                     MAX_POINTER_SIZE, buf);
+            lpSchedUrgentEnd(sched);
             if (ret < 0)
             {
-                lp__log_error("Unable to pack message");
+                lp__log_error("Unable to send cursor position %s", 
+                              fi_strerror(abs((int)ret)));
                 ctx->lp_host.thread_flags = T_ERR;
                 goto destroy_ctx;
             }
-
-            free(cursor);
-
-            ret = trfFabricSend(ctx->lp_host.sub_channel, mr, trfMemPtr(mr), ret, 
-                    ctx->lp_host.sub_channel->xfer.fabric->peer_addr,
-                    ctx->lp_host.sub_channel->opts);
-            if (ret < 0)
+            setDeadline = false;
+        }
+        else
+        {
+            if (trf__HasPassed(CLOCK_MONOTONIC, &te))
             {
-                lp__log_error("Unable to send cursor data %s", fi_strerror(ret));
-                ctx->lp_host.thread_flags = T_ERR;
-                goto destroy_ctx;
+                lp__log_debug("Sending cursor keep alive...");
+                lpSchedUrgentBegin(sched);
+                ret = lpKeepAlive(ctx->lp_host.sub_channel);
+                lpSchedUrgentEnd(sched);
+                if (ret < 0)
+                {
+                    lp__log_error("Error sending keep alive: %s", 
+                                    fi_strerror(abs((int)ret)));
+                    ctx->lp_host.thread_flags = T_ERR;
+                    goto destroy_ctx;
+                }
+                setDeadline = false;
+                lp__log_debug("Sent keep alive");
+                lpSchedReport(sched, LP_SCHED_CURSOR, false);
+                continue;
             }
-            cursor = NULL;
-            setDeadline = false;
+            usleep(10);
+            continue;
         }
     }
     
     ret = 0;
 
 destroy_ctx:
+    if (reader_started)
+    {
+        if (ctx->lp_host.thread_flags == T_RUNNING)
+            ctx->lp_host.thread_flags = T_STOP;
+        pthread_join(ctx->lp_host.cursor_reader, NULL);
+    }
+    ctx->lp_host.cursor_q = NULL;
+    lpCursorQueueFree(&cursor_q);
+    free(encBuf);
+    lpSchedReport(sched, LP_SCHED_CURSOR, true);
+
     ret = lpSendDisconnect(ctx->lp_host.sub_channel);
     if (ret < 0)
         lp__log_error("Unable to send disconnect message on subchannel");
@@ -699,4 +2586,4 @@ destroy_ctx:
         ctx->lp_host.thread_flags = T_STOP;
 
     return (void *) ret;
-}
\ No newline at end of file
+}
@@ -35,6 +35,13 @@
 #include "lp_convert.h"
 #include "lp_msg.h"
 #include "lp_utils.h"
+#include "lp_cursor.h"
+#include "lp_mailbox.h"
+#include "lp_sched.h"
+#include "lp_capture.h"
+#include "lp_demand.h"
+#include "lp_adapt.h"
+#include "lp_bcn.h"
 
 #include <getopt.h>
 #include <errno.h>
@@ -52,10 +59,18 @@
 int lpHandleClientReq(PLPContext ctx);
 
 /**
- * @brief  Get the current cursor position and update the client side
- * @param  arg      PTRFContext containing connection details
+ * @brief  Send queued cursor updates to the client side. Starts the cursor
+ * reader thread, which feeds the queue from LGMP.
+ * @param  arg      PLPContext containing connection details
  * 
  */
 void * lpHandleCursorPos(void * arg);
 
+/**
+ * @brief  Read cursor updates from LGMP into the cursor queue
+ * @param  arg      PLPContext containing the cursor queue
+ * 
+ */
+void * lpReadCursorPos(void * arg);
+
 #endif
\ No newline at end of file